@@ -1,4 +1,5 @@
 varying float color_intensity;
+varying float sunlight;             // 0 in the shadow of the terrain
 
 varying vec3 fN;
 varying vec3 fE;
@@ -49,10 +50,10 @@ main()
         vec4 ambient = ambient_product;
 
         float Kd = max(dot(L,N),0.0);
-        vec4 diffuse = attenuation * Kd * diffuse_product;
+        vec4 diffuse = sunlight * attenuation * Kd * diffuse_product;
 
         float Ks = pow(max(dot(N,H),0.0),shininess);
-        vec4 specular = attenuation * Ks * specular_product;
+        vec4 specular = sunlight * attenuation * Ks * specular_product;
 
         if(dot(L,N) < 0.0) {
             specular = vec4(0.0,0.0,0.0,1.0);
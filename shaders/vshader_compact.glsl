@@ -0,0 +1,58 @@
+attribute vec3 vGrid;
+attribute vec2 vOctNormal;
+
+uniform mat4 model_view;
+uniform mat4 projection;
+
+uniform vec4 light_position;
+uniform float max_elevation;
+
+// World position = (grid_scale * x - grid_offset.x,
+//                   height_scale * h + height_offset,
+//                   grid_scale * z - grid_offset.y)
+uniform float grid_scale;
+uniform vec2 grid_offset;
+uniform float height_scale;
+uniform float height_offset;
+
+varying float color_intensity;
+varying float sunlight;
+
+varying vec3 fN;
+varying vec3 fE;
+varying vec3 fL;
+
+// Unfold an octahedral normal around the y axis, see compact.c
+vec3
+decode_normal(vec2 code)
+{
+    // Codes 0 to 254, 127 standing for 0
+    vec2 f = min((code * 255.0 - 127.0) / 127.0, 1.0);
+    vec3 n = vec3(f.x, 1.0 - abs(f.x) - abs(f.y), f.y);
+    if(n.y < 0.0) {
+        vec2 s = step(vec2(0.0), f) * 2.0 - 1.0;
+        n.xz = (1.0 - abs(f.yx)) * s;
+    }
+    return normalize(n);
+}
+
+void
+main()
+{
+    vec4 position = vec4(grid_scale * vGrid.x - grid_offset.x,
+                         height_scale * vGrid.z + height_offset,
+                         grid_scale * vGrid.y - grid_offset.y,
+                         1.0);
+    vec3 normal = decode_normal(vOctNormal);
+
+    color_intensity = position.y / max_elevation;
+    sunlight = 1.0;
+
+    vec3 pos = (model_view * position).xyz;
+
+    fN = (model_view * vec4(normal,0.0)).xyz;
+    fE = -pos;
+    fL = light_position.xyz - pos;
+
+    gl_Position = projection * model_view * position;
+}
@@ -1,23 +1,60 @@
 attribute vec4 vPosition;
 attribute vec3 vNormal;
 
+// Horizon angles towards azimuths 0-3 and 4-7, see horizon.c
+attribute vec4 vHorizon0;
+attribute vec4 vHorizon1;
+
 uniform mat4 model_view;
 uniform mat4 projection;
 
 uniform vec4 light_position;
 uniform float max_elevation;
 
+uniform float shadows;
+uniform vec3 sun_direction;     // World coordinates
+
 varying float color_intensity;
+varying float sunlight;
 
 varying vec3 fN;
 varying vec3 fE;
 varying vec3 fL;
 
+float PI = 3.14159265;
+float SOFTNESS = 0.02;
+
+// Blend the horizons of the two azimuths either side of the sun
+float
+horizon_angle()
+{
+    float azimuth = 0.0;
+    if(abs(sun_direction.x) + abs(sun_direction.z) > 1e-6) {
+        azimuth = mod(atan(sun_direction.z, sun_direction.x) / (PI / 4.0),
+                      8.0);
+    }
+    vec4 d0 = abs(vec4(azimuth) - vec4(0.0, 1.0, 2.0, 3.0));
+    vec4 d1 = abs(vec4(azimuth) - vec4(4.0, 5.0, 6.0, 7.0));
+    d0 = min(d0, vec4(8.0) - d0);
+    d1 = min(d1, vec4(8.0) - d1);
+    vec4 w0 = max(vec4(1.0) - d0, vec4(0.0));
+    vec4 w1 = max(vec4(1.0) - d1, vec4(0.0));
+    return (dot(vHorizon0, w0) + dot(vHorizon1, w1)) * (PI / 2.0);
+}
+
 void
 main()
 {
     color_intensity = vPosition.y / max_elevation;
 
+    sunlight = 1.0;
+    if(shadows > 0.5) {
+        float elevation = asin(clamp(sun_direction.y, -1.0, 1.0));
+        float horizon = horizon_angle();
+        sunlight = smoothstep(horizon - SOFTNESS, horizon + SOFTNESS,
+                              elevation);
+    }
+
     vec3 pos = (model_view * vPosition).xyz;
 
     fN = (model_view * vec4(vNormal,0.0)).xyz;
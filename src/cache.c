@@ -0,0 +1,290 @@
+/**
+ * cache.c
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "horizon.h"
+
+static char const cache_magic[4] = { 'T', 'V', 'C', '\0' };
+
+// Sections start on cache line boundaries
+#define SECTION_ALIGN 64
+
+/**
+ *  Hash the contents of a buffer 8 bytes at a time
+ */
+static uint64_t
+hash_bytes(char const * const data, size_t size) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ size;
+    size_t i;
+    for(i = 0; i + 8 <= size; i += 8) {
+        uint64_t k;
+        memcpy( &k, data + i, sizeof(k) );
+        k *= 0x87C37B91114253D5ULL;
+        k ^= k >> 31;
+        h = (h ^ k) * 0x4CF5AD432745937FULL;
+    }
+
+    uint64_t tail = 0;
+    memcpy( &tail, data + i, size - i );
+    h = (h ^ tail) * 0x4CF5AD432745937FULL;
+
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ *  Hash the contents of a file
+ *  @param[out] hash  The hash of the file contents
+ *  @param[in] path  The file to hash
+ *  @return 1 on success, 0 if the file could not be read
+ */
+static int
+hash_file(uint64_t * const hash, char const * const path) {
+    int const fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return 0;
+    }
+
+    mappedFile file;
+    int const ok = (map_file( &file, fd ) == 0);
+    close( fd );
+    if(!ok) {
+        return 0;
+    }
+
+    *hash = hash_bytes(file.data, file.size);
+    unmap_file( &file );
+    return 1;
+}
+
+/**
+ *  The name of the cache belonging to a source file
+ *  @return A newly allocated string
+ */
+static char*
+cache_path(char const * const source) {
+    size_t const length = strlen(source);
+    char* const path = malloc(length + sizeof(CACHE_EXTENSION));
+    memcpy( path, source, length );
+    memcpy( path + length, CACHE_EXTENSION, sizeof(CACHE_EXTENSION) );
+    return path;
+}
+
+static uint64_t
+align_offset(uint64_t offset) {
+    return (offset + SECTION_ALIGN - 1) & ~(uint64_t) (SECTION_ALIGN - 1);
+}
+
+/**
+ *  Map the cache for a source file if it exists and is still valid. The
+ *  size and modification time of the source must match those recorded in
+ *  the cache, and so must the hash of its contents.
+ *  @param[out] c  The mapped cache
+ *  @param[in] source  The path of the source elevation file
+ *  @return 1 if a valid cache was mapped, 0 otherwise
+ */
+int
+cache_open(terrainCache * const c, char const * const source) {
+    struct stat st;
+    if(stat(source, &st) != 0) {
+        return 0;
+    }
+
+    char* const path = cache_path(source);
+    int const fd = open(path, O_RDONLY);
+    free( path );
+    if(fd < 0) {
+        return 0;
+    }
+
+    int const mapped = (map_file( &c->file, fd ) == 0);
+    close( fd );
+    if(!mapped) {
+        return 0;
+    }
+
+    cacheHeader const * const h = (cacheHeader const *) c->file.data;
+    size_t const size = c->file.size;
+    if(size < sizeof(*h)
+       || memcmp(h->magic, cache_magic, sizeof(cache_magic)) != 0
+       || h->version != CACHE_VERSION
+       || h->sourceSize != (uint64_t) st.st_size
+       || h->sourceMtimeSec != (int64_t) st.st_mtim.tv_sec
+       || h->sourceMtimeNsec != (int64_t) st.st_mtim.tv_nsec) {
+        cache_close( c );
+        return 0;
+    }
+
+    uint64_t const samples = (uint64_t) h->mapWidth * h->mapHeight;
+    if(h->heightsOffset + samples * sizeof(GLfloat) > size) {
+        cache_close( c );
+        return 0;
+    }
+    if((h->flags & CACHE_HAS_MESH)
+       && (h->verticesOffset + h->numVertices * sizeof(vec4) > size
+           || h->normalsOffset + h->numVertices * sizeof(vec3) > size)) {
+        cache_close( c );
+        return 0;
+    }
+    if((h->flags & CACHE_HAS_HORIZONS)
+       && h->horizonsOffset + samples * HORIZON_AZIMUTHS > size) {
+        cache_close( c );
+        return 0;
+    }
+
+    uint64_t hash;
+    if(!hash_file( &hash, source ) || hash != h->sourceHash) {
+        cache_close( c );
+        return 0;
+    }
+
+    c->header = h;
+    c->heights = (GLfloat const *) (c->file.data + h->heightsOffset);
+    if(h->flags & CACHE_HAS_MESH) {
+        c->vertices = (vec4 const *) (c->file.data + h->verticesOffset);
+        c->normals = (vec3 const *) (c->file.data + h->normalsOffset);
+    }else {
+        c->vertices = NULL;
+        c->normals = NULL;
+    }
+    c->horizons = (h->flags & CACHE_HAS_HORIZONS)
+                  ? (GLubyte const *) (c->file.data + h->horizonsOffset)
+                  : NULL;
+    return 1;
+}
+
+/**
+ *  Unmap a cache opened by cache_open()
+ */
+void
+cache_close(terrainCache * const c) {
+    unmap_file( &c->file );
+    c->header = NULL;
+    c->heights = NULL;
+    c->vertices = NULL;
+    c->normals = NULL;
+    c->horizons = NULL;
+}
+
+/**
+ *  Pad a file with zeros up to an offset
+ */
+static int
+pad_to(FILE* const f, uint64_t offset) {
+    static char const zeros[SECTION_ALIGN];
+    long const position = ftell(f);
+    if(position < 0 || (uint64_t) position > offset) {
+        return 0;
+    }
+    return fwrite(zeros, 1, offset - position, f) == offset - position;
+}
+
+/**
+ *  Write the cache for a source file. The cache is written to a temporary
+ *  file first and renamed into place so readers never see a partial cache.
+ *  @param[in] source  The path of the source elevation file
+ *  @param[in] mData  The map loaded from the source file
+ *  @param[in] mesh  The layout of the vertices
+ *  @param[in] normal_mode  How the normals were computed
+ *  @param[in] vertices  The mesh vertices, or NULL to store only heights
+ *  @param[in] normals  The mesh normals, or NULL to store only heights
+ *  @param[in] num_vertices  The number of mesh vertices
+ *  @param[in] horizons  The horizons of every sample, or NULL
+ *  @return 1 if the cache was written, 0 otherwise
+ */
+int
+cache_write(char const * const source, mapData const * const mData,
+            meshMode mesh, normalMode normal_mode,
+            vec4 const * const vertices, vec3 const * const normals,
+            GLuint num_vertices, GLubyte const * const horizons) {
+    struct stat st;
+    cacheHeader h;
+    memset( &h, 0, sizeof(h) );
+    if(stat(source, &st) != 0 || !hash_file( &h.sourceHash, source )) {
+        return 0;
+    }
+
+    memcpy( h.magic, cache_magic, sizeof(cache_magic) );
+    h.version = CACHE_VERSION;
+    h.mapWidth = mData->mapWidth;
+    h.mapHeight = mData->mapHeight;
+    h.resolution = mData->resolution;
+    h.minElevation = mData->minElevation;
+    h.maxElevation = mData->maxElevation;
+    h.sourceSize = st.st_size;
+    h.sourceMtimeSec = st.st_mtim.tv_sec;
+    h.sourceMtimeNsec = st.st_mtim.tv_nsec;
+
+    uint64_t const samples = (uint64_t) h.mapWidth * h.mapHeight;
+    h.heightsOffset = align_offset(sizeof(h));
+    if(vertices != NULL && normals != NULL) {
+        h.flags |= CACHE_HAS_MESH;
+        h.numVertices = num_vertices;
+        h.meshLayout = mesh;
+        h.normalMode = normal_mode;
+        h.verticesOffset = align_offset(h.heightsOffset
+                                        + samples * sizeof(GLfloat));
+        h.normalsOffset = align_offset(h.verticesOffset
+                                       + (uint64_t) num_vertices * sizeof(vec4));
+    }
+    if(horizons != NULL) {
+        uint64_t const end = (h.flags & CACHE_HAS_MESH)
+                             ? h.normalsOffset + (uint64_t) num_vertices
+                                                 * sizeof(vec3)
+                             : h.heightsOffset + samples * sizeof(GLfloat);
+        h.flags |= CACHE_HAS_HORIZONS;
+        h.horizonsOffset = align_offset(end);
+    }
+
+    char* const path = cache_path(source);
+    char* const temp = malloc(strlen(path) + 32);
+    sprintf( temp, "%s.%ld", path, (long) getpid() );
+
+    FILE* const f = fopen(temp, "wb");
+    int ok = (f != NULL);
+    if(ok) {
+        ok = fwrite(&h, sizeof(h), 1, f) == 1 && pad_to(f, h.heightsOffset);
+
+        // Heights are always stored row-major, whatever the grid layout
+        GLfloat* const row_buffer = malloc(mData->mapWidth * sizeof(GLfloat));
+        unsigned int row;
+        for(row = 0; ok && row < mData->mapHeight; row++) {
+            grid_read_row( &mData->elevation, row, 0, mData->mapWidth,
+                           row_buffer );
+            ok = fwrite(row_buffer, sizeof(GLfloat),
+                        mData->mapWidth, f) == mData->mapWidth;
+        }
+        free( row_buffer );
+
+        if(ok && (h.flags & CACHE_HAS_MESH)) {
+            ok = pad_to(f, h.verticesOffset)
+                 && fwrite(vertices, sizeof(vec4), num_vertices, f) == num_vertices
+                 && pad_to(f, h.normalsOffset)
+                 && fwrite(normals, sizeof(vec3), num_vertices, f) == num_vertices;
+        }
+        if(ok && (h.flags & CACHE_HAS_HORIZONS)) {
+            ok = pad_to(f, h.horizonsOffset)
+                 && fwrite(horizons, HORIZON_AZIMUTHS, samples, f) == samples;
+        }
+        ok = (fclose( f ) == 0) && ok;
+    }
+
+    if(ok) {
+        ok = (rename( temp, path ) == 0);
+    }
+    if(!ok) {
+        unlink( temp );
+    }
+
+    free( temp );
+    free( path );
+    return ok;
+}
@@ -0,0 +1,61 @@
+/**
+ * cache.h
+ */
+#ifndef CACHE_H
+#define CACHE_H
+#include <stdint.h>
+#include "terrain.h"
+#include "mapfile.h"
+
+#define CACHE_EXTENSION ".tvc"
+#define CACHE_VERSION   4
+
+// Header flags
+#define CACHE_HAS_MESH      0x1
+#define CACHE_HAS_HORIZONS  0x2
+
+/**
+ *  On-disk header of a .tvc file, stored in native byte order. The heights
+ *  follow in row-major order, then optionally the mesh vertices and
+ *  normals exactly as they are uploaded to the vertex buffer, then
+ *  optionally the horizon angles of every sample (see horizon.h). Index
+ *  buffers are cheap to rebuild and aren't stored.
+ */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t mapWidth;
+    uint32_t mapHeight;
+    float resolution;
+    float minElevation;
+    float maxElevation;
+    uint64_t sourceSize;
+    int64_t sourceMtimeSec;
+    int64_t sourceMtimeNsec;
+    uint64_t sourceHash;
+    uint64_t heightsOffset;
+    uint64_t verticesOffset;
+    uint64_t normalsOffset;
+    uint64_t horizonsOffset;
+    uint32_t numVertices;
+    uint32_t meshLayout;        // Layout of the stored vertices
+    uint32_t normalMode;        // How the stored normals were computed
+} cacheHeader;
+
+typedef struct {
+    mappedFile file;
+    cacheHeader const * header;
+    GLfloat const * heights;
+    vec4 const * vertices;      // NULL if the cache holds no mesh
+    vec3 const * normals;
+    GLubyte const * horizons;   // NULL if the cache holds no horizons
+} terrainCache;
+
+int cache_open(terrainCache * const c, char const * const source);
+void cache_close(terrainCache * const c);
+int cache_write(char const * const source, mapData const * const mData,
+                meshMode mesh, normalMode normal_mode,
+                vec4 const * const vertices, vec3 const * const normals,
+                GLuint num_vertices, GLubyte const * const horizons);
+#endif
@@ -0,0 +1,72 @@
+/**
+ * camera.c
+ */
+#include <math.h>
+#include "camera.h"
+
+/**
+ *  The model view matrix of a camera: a translation to its position, then
+ *  its rotations around z, y and x
+ *  @param[out] r  The matrix
+ *  @param[in] c  The camera
+ */
+void
+camera_model_view(mat4 r, cameraData const * const c) {
+    mat4 ROTATE_Z;
+    mat4_rotate_z(ROTATE_Z, c->theta[2]);
+
+    mat4 ROTATE_Y;
+    mat4_rotate_y(ROTATE_Y, c->theta[1]);
+
+    mat4 ROTATE_X;
+    mat4_rotate_x(ROTATE_X, c->theta[0]);
+
+    mat4 result1;
+    mat4 result2;
+
+    mat4_translate(result1, -c->viewer[0], -c->viewer[1], -c->viewer[2]);
+    mat4_mult(result2, ROTATE_Z, result1);
+    mat4_mult(result1, ROTATE_Y, result2);
+    mat4_mult(r, ROTATE_X, result1);
+}
+
+/**
+ *  The direction the w key moves a camera in
+ *  @param[out] heading  A unit vector, world coordinates
+ *  @param[in] c  The camera
+ */
+void
+camera_heading(vec3 * const heading, cameraData const * const c) {
+    GLfloat const DegreesToRadians = M_PI / 180.0;
+    GLfloat const pitch = c->theta[0] * DegreesToRadians;
+    GLfloat const yaw = c->theta[1] * DegreesToRadians;
+    vec3_init( heading, sin(yaw) * cos(pitch), -sin(pitch),
+               -cos(yaw) * cos(pitch) );
+}
+
+/**
+ *  Unproject a point of the window into the ray from the eye through it
+ *  @param[out] origin  The eye, world coordinates
+ *  @param[out] direction  Through the point, world coordinates
+ *  @param[in] mv  The model view matrix, a rotation and a translation
+ *  @param[in] projection  A symmetric perspective projection
+ *  @param[in] x,y  Normalized device coordinates of the point
+ */
+void
+camera_ray(vec3 * const origin, vec3 * const direction, mat4 mv,
+           mat4 projection, GLfloat x, GLfloat y) {
+    // The point on the plane at z = -1 in eye coordinates
+    GLfloat const eye[3] = { x / projection[0][0], y / projection[1][1],
+                             -1.0f };
+
+    // The inverse of the rotation is its transpose
+    GLfloat out[3], eye_origin[3];
+    unsigned int i;
+    for(i = 0; i < 3; i++) {
+        out[i] = mv[0][i] * eye[0] + mv[1][i] * eye[1] + mv[2][i] * eye[2];
+        eye_origin[i] = -(mv[0][i] * mv[0][3] + mv[1][i] * mv[1][3]
+                          + mv[2][i] * mv[2][3]);
+    }
+    vec3_init( origin, eye_origin[0], eye_origin[1], eye_origin[2] );
+    vec3_init( direction, out[0], out[1], out[2] );
+}
@@ -0,0 +1,13 @@
+/**
+ * camera.h
+ */
+#ifndef CAMERA_H
+#define CAMERA_H
+#include "terrain.h"
+#include "mat.h"
+
+void camera_model_view(mat4 r, cameraData const * const c);
+void camera_heading(vec3 * const heading, cameraData const * const c);
+void camera_ray(vec3 * const origin, vec3 * const direction, mat4 mv,
+                mat4 projection, GLfloat x, GLfloat y);
+#endif
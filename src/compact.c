@@ -0,0 +1,126 @@
+/**
+ * compact.c
+ *
+ * Encoders for the compact vertex format. Normals are projected onto the
+ * octahedron |x| + |y| + |z| = 1, which is unfolded around the y axis so
+ * the upward facing normals of a height field keep the full resolution.
+ * Coordinates are coded 0 to 254 with 127 standing for 0, so the axes are
+ * stored exactly; 255 decodes as 254.
+ */
+#include <math.h>
+#include "compact.h"
+
+#define HEIGHT_CODES 65535.0f
+#define NORMAL_CODES 254.0f
+#define NORMAL_ZERO  127.0f
+
+static GLfloat
+sign_not_zero(GLfloat v) {
+    return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+/**
+ *  Set up a quantizer covering a range of elevations
+ *  @param[out] q  The quantizer
+ *  @param[in] low  The lowest elevation
+ *  @param[in] high  The highest elevation
+ */
+void
+compact_init_quantizer(heightQuantizer * const q, GLfloat low, GLfloat high) {
+    q->low = low;
+    q->step = high > low ? (high - low) / HEIGHT_CODES : 1.0f;
+}
+
+/**
+ *  The 16 bit code closest to an elevation, clamped to the range
+ */
+GLushort
+compact_quantize(heightQuantizer const * const q, GLfloat h) {
+    GLfloat const code = (h - q->low) / q->step + 0.5f;
+    if(code <= 0.0f) {
+        return 0;
+    }
+    if(code >= HEIGHT_CODES) {
+        return (GLushort) HEIGHT_CODES;
+    }
+    return (GLushort) code;
+}
+
+GLfloat
+compact_dequantize(heightQuantizer const * const q, GLushort code) {
+    return q->low + code * q->step;
+}
+
+/**
+ *  The point of the octahedron a code stands for, before normalization.
+ *  Written with selects rather than branches since the encoder calls it
+ *  four times per normal.
+ */
+static void
+unfold(vec3 * const n, GLubyte u_code, GLubyte v_code) {
+    GLfloat const u = fminf((u_code - NORMAL_ZERO) / NORMAL_ZERO, 1.0f);
+    GLfloat const v = fminf((v_code - NORMAL_ZERO) / NORMAL_ZERO, 1.0f);
+    GLfloat const y = 1.0f - fabsf(u) - fabsf(v);
+
+    n->x = y < 0.0f ? (1.0f - fabsf(v)) * sign_not_zero(u) : u;
+    n->y = y;
+    n->z = y < 0.0f ? (1.0f - fabsf(u)) * sign_not_zero(v) : v;
+}
+
+/**
+ *  Decode an octahedral normal the same way vshader_compact.glsl does
+ *  @param[out] n  The unit normal
+ *  @param[in] code  The two 8 bit coordinates
+ */
+void
+compact_decode_normal(vec3 * const n, GLubyte const code[2]) {
+    vec3 folded;
+    unfold( &folded, code[0], code[1] );
+    vec3_norm( n, &folded );
+}
+
+/**
+ *  Encode a unit normal in two bytes. Of the four codes around the exact
+ *  projection, the one that decodes closest to the normal is kept.
+ *  @param[out] code  The two 8 bit coordinates
+ *  @param[in] n  The unit normal
+ */
+void
+compact_encode_normal(GLubyte code[2], vec3 const * const n) {
+    GLfloat const sum = fabsf(n->x) + fabsf(n->y) + fabsf(n->z);
+    GLfloat u = n->x / sum;
+    GLfloat v = n->z / sum;
+    if(n->y < 0.0f) {
+        GLfloat const fu = (1.0f - fabsf(v)) * sign_not_zero(u);
+        GLfloat const fv = (1.0f - fabsf(u)) * sign_not_zero(v);
+        u = fu;
+        v = fv;
+    }
+
+    GLfloat const cu = floorf((u + 1.0f) * NORMAL_ZERO);
+    GLfloat const cv = floorf((v + 1.0f) * NORMAL_ZERO);
+
+    // Compare the signed squared cosines of the candidates by cross
+    // multiplying, so no candidate needs a square root or a division
+    GLfloat best_dot = -1.0f;
+    GLfloat best_length = 1.0f;
+    GLubyte best_u = 0, best_v = 0;
+    int k;
+    for(k = 0; k < 4; k++) {
+        GLfloat const eu = fminf(cu + (k & 1), NORMAL_CODES);
+        GLfloat const ev = fminf(cv + (k >> 1), NORMAL_CODES);
+
+        vec3 c;
+        unfold( &c, (GLubyte) eu, (GLubyte) ev );
+        GLfloat const d = c.x * n->x + c.y * n->y + c.z * n->z;
+        GLfloat const dot = d * fabsf(d);
+        GLfloat const length = c.x * c.x + c.y * c.y + c.z * c.z;
+        int const better = dot * best_length > best_dot * length;
+        best_dot = better ? dot : best_dot;
+        best_length = better ? length : best_length;
+        best_u = better ? (GLubyte) eu : best_u;
+        best_v = better ? (GLubyte) ev : best_v;
+    }
+    code[0] = best_u;
+    code[1] = best_v;
+}
@@ -0,0 +1,35 @@
+/**
+ * compact.h
+ */
+#ifndef COMPACT_H
+#define COMPACT_H
+#include "vec.h"
+
+/**
+ *  An 8 byte vertex. The position is rebuilt in the vertex shader from the
+ *  grid coordinates and the quantized height, the normal is stored in
+ *  octahedral form.
+ */
+// Grid coordinates are stored in 16 bits
+#define COMPACT_MAX_SIZE 65536
+
+typedef struct {
+    GLushort x;
+    GLushort z;
+    GLushort height;
+    GLubyte normal[2];
+} compactVertex;
+
+// Maps elevations in [low, low + 65535 * step] to 16 bit codes
+typedef struct {
+    GLfloat low;
+    GLfloat step;
+} heightQuantizer;
+
+void compact_init_quantizer(heightQuantizer * const q,
+                            GLfloat low, GLfloat high);
+GLushort compact_quantize(heightQuantizer const * const q, GLfloat h);
+GLfloat compact_dequantize(heightQuantizer const * const q, GLushort code);
+void compact_encode_normal(GLubyte code[2], vec3 const * const n);
+void compact_decode_normal(vec3 * const n, GLubyte const code[2]);
+#endif
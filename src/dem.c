@@ -0,0 +1,464 @@
+/**
+ * dem.c
+ *
+ * Binary elevation grids read straight from a mapped file: SRTM .hgt
+ * tiles, and .bil and .flt grids described by a .hdr file next to them.
+ *
+ * An .hgt file is a square of big-endian int16 samples, 1201 or 3601 a
+ * side, with -32768 marking voids; its size gives its shape. A .hdr file
+ * holds "KEY value" lines, as written by ESRI tools and GDAL. For .bil
+ * grids NROWS, NCOLS, NBITS, PIXELTYPE, BYTEORDER, NBANDS, SKIPBYTES,
+ * BANDROWBYTES, TOTALROWBYTES, NODATA and XDIM are read, for .flt grids
+ * nrows, ncols, byteorder, NODATA_value and cellsize. Only the first band
+ * is loaded. The corner of the grid, ULXMAP and ULYMAP or xllcorner and
+ * yllcorner (or xllcenter and yllcenter), and the name of an .hgt tile,
+ * such as N37W122.hgt, place tiles next to each other in a mosaic.
+ *
+ * Samples are byte-swapped and converted a vector at a time. Samples
+ * without data are set to the lowest elevation with data once it is known,
+ * so voids don't draw as pits.
+ */
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <libgen.h>
+#include "dem.h"
+#include "trace.h"
+
+typedef uint16_t v8u16 __attribute__ ((vector_size (16)));
+typedef int16_t v8s16 __attribute__ ((vector_size (16)));
+typedef uint32_t v4u32 __attribute__ ((vector_size (16)));
+typedef float v8f32 __attribute__ ((vector_size (32)));
+
+typedef struct {
+    elevationGrid* grid;
+    demHeader const * h;
+    char const * data;
+    GLfloat fill;           // For the second pass
+    demResult* bands;       // One per band
+} demConvert;
+
+/**
+ *  Guess the format of an elevation file from its extension
+ */
+demFormat
+dem_detect(char const * const path) {
+    char const * const dot = strrchr(path, '.');
+    if(dot == NULL || strchr(dot, '/') != NULL) {
+        return DEM_TEXT;
+    }
+    if(strcasecmp(dot, ".hgt") == 0) {
+        return DEM_HGT;
+    }else if(strcasecmp(dot, ".bil") == 0) {
+        return DEM_BIL;
+    }else if(strcasecmp(dot, ".flt") == 0) {
+        return DEM_FLT;
+    }
+    return DEM_TEXT;
+}
+
+char const *
+dem_format_name(demFormat format) {
+    static char const * const names[] = { "text", "hgt", "bil", "flt" };
+    return names[format];
+}
+
+static size_t
+sample_size(demSampleType type) {
+    return type == DEM_FLOAT32 ? 4 : 2;
+}
+
+/**
+ *  Read the .hdr file of a .bil or .flt grid
+ *  @return 0 if it can't be read or describes a grid we can't load, with
+ *          a message
+ */
+static int
+read_sidecar(demHeader * const h, char const * const path,
+             demFormat format) {
+    char const * const dot = strrchr(path, '.');
+    size_t const stem = dot - path;
+    char* const name = malloc(stem + sizeof(DEM_HEADER_EXTENSION));
+    if(name == NULL) {
+        fprintf(stderr, "Unable to allocate the header path\n");
+        exit(1);
+    }
+    memcpy( name, path, stem );
+    strcpy( name + stem, DEM_HEADER_EXTENSION );
+    FILE* const file = fopen(name, "r");
+    if(file == NULL) {
+        fprintf(stderr, "Unable to open the header of %s: %s\n", path, name);
+        free( name );
+        return 0;
+    }
+
+    long width = -1, height = -1, bits = format == DEM_FLT ? 32 : 16;
+    long bands = 1, skip = 0, band_row_bytes = 0, total_row_bytes = 0;
+    int is_signed = 0, is_float = format == DEM_FLT;
+    double resolution = 0.0;
+    double ulx = NAN, uly = NAN, xll = NAN, yll = NAN;
+    int centered = 0;
+    h->big_endian = 0;
+    h->has_nodata = 0;
+
+    char line[256];
+    while(fgets(line, sizeof(line), file) != NULL) {
+        char key[64], value[64];
+        if(sscanf(line, "%63s %63s", key, value) != 2) {
+            continue;
+        }
+        if(strcasecmp(key, "ncols") == 0) {
+            width = strtol(value, NULL, 10);
+        }else if(strcasecmp(key, "nrows") == 0) {
+            height = strtol(value, NULL, 10);
+        }else if(strcasecmp(key, "nbits") == 0) {
+            bits = strtol(value, NULL, 10);
+        }else if(strcasecmp(key, "nbands") == 0) {
+            bands = strtol(value, NULL, 10);
+        }else if(strcasecmp(key, "skipbytes") == 0) {
+            skip = strtol(value, NULL, 10);
+        }else if(strcasecmp(key, "bandrowbytes") == 0) {
+            band_row_bytes = strtol(value, NULL, 10);
+        }else if(strcasecmp(key, "totalrowbytes") == 0) {
+            total_row_bytes = strtol(value, NULL, 10);
+        }else if(strcasecmp(key, "pixeltype") == 0) {
+            is_signed = strcasecmp(value, "signedint") == 0;
+            is_float = strcasecmp(value, "float") == 0;
+        }else if(strcasecmp(key, "byteorder") == 0) {
+            h->big_endian = toupper((unsigned char) value[0]) == 'M';
+        }else if(strcasecmp(key, "nodata") == 0
+                 || strcasecmp(key, "nodata_value") == 0) {
+            h->has_nodata = 1;
+            h->nodata = strtof(value, NULL);
+        }else if(strcasecmp(key, "xdim") == 0
+                 || strcasecmp(key, "cellsize") == 0) {
+            resolution = strtod(value, NULL);
+        }else if(strcasecmp(key, "ulxmap") == 0) {
+            ulx = strtod(value, NULL);
+        }else if(strcasecmp(key, "ulymap") == 0) {
+            uly = strtod(value, NULL);
+        }else if(strcasecmp(key, "xllcorner") == 0
+                 || strcasecmp(key, "xllcenter") == 0) {
+            xll = strtod(value, NULL);
+            centered = strcasecmp(key, "xllcenter") == 0;
+        }else if(strcasecmp(key, "yllcorner") == 0
+                 || strcasecmp(key, "yllcenter") == 0) {
+            yll = strtod(value, NULL);
+        }
+    }
+    fclose( file );
+
+    int ok = 1;
+    if(width < 2 || height < 2 || bands < 1 || skip < 0) {
+        fprintf(stderr, "%s: expected ncols and nrows of at least 2\n", name);
+        ok = 0;
+    }else if(bits == 16 && !is_float) {
+        h->type = is_signed ? DEM_INT16 : DEM_UINT16;
+    }else if(bits == 32 && (is_float || format == DEM_FLT)) {
+        h->type = DEM_FLOAT32;
+    }else {
+        fprintf(stderr, "%s: only 16 bit integer and 32 bit float samples "
+                        "are supported\n", name);
+        ok = 0;
+    }
+    free( name );
+    if(!ok) {
+        return 0;
+    }
+
+    h->width = width;
+    h->height = height;
+    h->skip = skip;
+    size_t const band_bytes = band_row_bytes > 0
+                              ? (size_t) band_row_bytes
+                              : h->width * sample_size(h->type);
+    h->row_bytes = total_row_bytes > 0 ? (size_t) total_row_bytes
+                                       : bands * band_bytes;
+
+    // The center of the first sample, whichever corner was given
+    h->has_origin = resolution > 0.0 && ((!isnan(ulx) && !isnan(uly))
+                                         || (!isnan(xll) && !isnan(yll)));
+    h->cell = resolution;
+    if(!isnan(ulx) && !isnan(uly)) {
+        h->left = ulx;
+        h->top = uly;
+    }else if(centered) {
+        h->left = xll;
+        h->top = yll + (height - 1) * resolution;
+    }else {
+        h->left = xll + resolution / 2.0;
+        h->top = yll + (height - 0.5) * resolution;
+    }
+
+    // Grids in degrees are far finer than a meter apart
+    if(resolution <= 0.0) {
+        resolution = 1.0;
+    }else if(resolution < 0.01) {
+        resolution *= 3600.0 * DEM_METERS_PER_ARCSECOND;
+    }
+    h->resolution = resolution;
+    return 1;
+}
+
+/**
+ *  Place an SRTM tile from its name, which gives the latitude and
+ *  longitude of its lower left corner
+ */
+static void
+hgt_origin(demHeader * const h, char const * const path) {
+    char* const copy = strdup(path);
+    if(copy == NULL) {
+        fprintf(stderr, "Unable to allocate the tile name\n");
+        exit(1);
+    }
+    char ns, ew;
+    int lat, lon;
+    h->has_origin = sscanf(basename(copy), "%c%d%c%d", &ns, &lat, &ew,
+                           &lon) == 4
+                    && (toupper(ns) == 'N' || toupper(ns) == 'S')
+                    && (toupper(ew) == 'E' || toupper(ew) == 'W');
+    free( copy );
+    if(h->has_origin) {
+        lat = toupper(ns) == 'S' ? -lat : lat;
+        lon = toupper(ew) == 'W' ? -lon : lon;
+        h->cell = 1.0 / (h->width - 1);
+        h->left = lon;
+        h->top = lat + 1.0;
+    }
+}
+
+/**
+ *  Find where the samples of a binary elevation file are
+ *  @param[out] h  The layout of the samples
+ *  @param[in] path  The elevation file
+ *  @param[in] format  Its format, not DEM_TEXT
+ *  @param[in] file_size  Its size in bytes
+ *  @return 0 if the file can't be loaded, with a message
+ */
+int
+dem_read_header(demHeader * const h, char const * const path,
+                demFormat format, size_t file_size) {
+    if(format == DEM_HGT) {
+        size_t const side = (size_t) sqrt(file_size / 2.0 + 0.5);
+        if(side < 2 || 2 * side * side != file_size) {
+            fprintf(stderr, "%s: %zu bytes isn't a square of 16 bit "
+                            "samples\n", path, file_size);
+            return 0;
+        }
+        h->width = h->height = side;
+        h->resolution = DEM_METERS_PER_ARCSECOND * 3600.0f / (side - 1);
+        h->type = DEM_INT16;
+        h->big_endian = 1;
+        h->skip = 0;
+        h->row_bytes = 2 * side;
+        h->has_nodata = 1;
+        h->nodata = DEM_HGT_NODATA;
+        hgt_origin( h, path );
+    }else if(!read_sidecar( h, path, format )) {
+        return 0;
+    }
+
+    size_t const needed = h->skip + h->row_bytes * (h->height - 1)
+                          + h->width * sample_size(h->type);
+    if(file_size < needed) {
+        fprintf(stderr, "%s: expected at least %zu bytes for %u x %u "
+                        "samples, found %zu\n", path, needed, h->width,
+                h->height, file_size);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ *  Convert one row of samples to floats, eight at a time
+ */
+static void
+convert_row(GLfloat * const out, char const * const in,
+            demHeader const * const h) {
+    int const swap = h->big_endian != (__BYTE_ORDER__
+                                       == __ORDER_BIG_ENDIAN__);
+    GLuint const width = h->width;
+    GLuint x = 0;
+    if(h->type == DEM_FLOAT32) {
+        for(; x + 4 <= width; x += 4) {
+            v4u32 v;
+            memcpy( &v, in + 4 * x, sizeof(v) );
+            if(swap) {
+                v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000)
+                    | (v << 24);
+            }
+            memcpy( out + x, &v, sizeof(v) );
+        }
+        for(; x < width; x++) {
+            uint32_t v;
+            memcpy( &v, in + 4 * x, sizeof(v) );
+            if(swap) {
+                v = __builtin_bswap32(v);
+            }
+            memcpy( out + x, &v, sizeof(v) );
+        }
+        return;
+    }
+
+    for(; x + 8 <= width; x += 8) {
+        v8u16 v;
+        memcpy( &v, in + 2 * x, sizeof(v) );
+        if(swap) {
+            v = (v << 8) | (v >> 8);
+        }
+        v8f32 const f = h->type == DEM_INT16
+                        ? __builtin_convertvector((v8s16) v, v8f32)
+                        : __builtin_convertvector(v, v8f32);
+        memcpy( out + x, &f, sizeof(f) );
+    }
+    for(; x < width; x++) {
+        uint16_t v;
+        memcpy( &v, in + 2 * x, sizeof(v) );
+        if(swap) {
+            v = __builtin_bswap16(v);
+        }
+        out[x] = h->type == DEM_INT16 ? (GLfloat) (int16_t) v : (GLfloat) v;
+    }
+}
+
+/**
+ *  Convert one row of a file, marking samples without data as NaN
+ *  @param[out] out  The h->width samples
+ *  @param[in] h  The layout of the samples
+ *  @param[in] data  The whole file
+ *  @param[in] z  The row
+ *  @return The number of samples without data
+ */
+size_t
+dem_read_row(GLfloat * const out, demHeader const * const h,
+             char const * const data, GLuint z) {
+    convert_row( out, data + h->skip + z * h->row_bytes, h );
+    size_t nodata = 0;
+    GLuint x;
+    for(x = 0; x < h->width; x++) {
+        if(isnan(out[x]) || (h->has_nodata && out[x] == h->nodata)) {
+            out[x] = NAN;
+            nodata++;
+        }
+    }
+    return nodata;
+}
+
+/**
+ *  Convert a band of rows into the grid, marking samples without data as
+ *  NaN for fill_band()
+ */
+static void
+convert_band(void * const arg, unsigned int band) {
+    demConvert const * const c = arg;
+    demHeader const * const h = c->h;
+    GLfloat* const row = malloc(h->width * sizeof(*row));
+    if(row == NULL) {
+        fprintf(stderr, "Unable to allocate a row of %u samples\n",
+                h->width);
+        exit(1);
+    }
+
+    demResult r;
+    r.minElevation = INFINITY;
+    r.maxElevation = -INFINITY;
+    r.nodata = 0;
+    GLuint const first = band * DEM_BAND_ROWS;
+    GLuint const last = first + DEM_BAND_ROWS < h->height
+                        ? first + DEM_BAND_ROWS : h->height;
+    GLuint x, z;
+    for(z = first; z < last; z++) {
+        r.nodata += dem_read_row( row, h, c->data, z );
+        for(x = 0; x < h->width; x++) {
+            GLfloat const v = row[x];
+            if(!isnan(v)) {
+                r.minElevation = v < r.minElevation ? v : r.minElevation;
+                r.maxElevation = v > r.maxElevation ? v : r.maxElevation;
+            }
+        }
+        grid_write_row( c->grid, z, 0, h->width, row );
+    }
+    c->bands[band] = r;
+    free( row );
+}
+
+/**
+ *  Give the samples without data of a band of rows the fill elevation
+ */
+static void
+fill_band(void * const arg, unsigned int band) {
+    demConvert const * const c = arg;
+    if(c->bands[band].nodata == 0) {
+        return;
+    }
+    GLuint const width = c->grid->width;
+    GLfloat* const row = malloc(width * sizeof(*row));
+    if(row == NULL) {
+        fprintf(stderr, "Unable to allocate a row of %u samples\n", width);
+        exit(1);
+    }
+    GLuint const first = band * DEM_BAND_ROWS;
+    GLuint const last = first + DEM_BAND_ROWS < c->grid->height
+                        ? first + DEM_BAND_ROWS : c->grid->height;
+    GLuint x, z;
+    for(z = first; z < last; z++) {
+        grid_read_row( c->grid, z, 0, width, row );
+        for(x = 0; x < width; x++) {
+            if(isnan(row[x])) {
+                row[x] = c->fill;
+            }
+        }
+        grid_write_row( c->grid, z, 0, width, row );
+    }
+    free( row );
+}
+
+/**
+ *  Convert the samples of a binary elevation file into a grid
+ *  @param[out] r  The range of the samples with data and how many have none
+ *  @param[out] grid  The grid, h->width x h->height
+ *  @param[in] h  The layout of the samples
+ *  @param[in] data  The whole file
+ *  @param[in] pool  The workers to convert with
+ */
+void
+dem_convert(demResult * const r, elevationGrid * const grid,
+            demHeader const * const h, char const * const data,
+            threadPool * const pool) {
+    TRACE_SPAN("convert dem");
+    unsigned int const bands = (h->height + DEM_BAND_ROWS - 1)
+                               / DEM_BAND_ROWS;
+    demConvert c;
+    c.grid = grid;
+    c.h = h;
+    c.data = data;
+    c.bands = malloc(bands * sizeof(*c.bands));
+    if(c.bands == NULL) {
+        fprintf(stderr, "Unable to allocate %u bands\n", bands);
+        exit(1);
+    }
+    pool_run( pool, bands, convert_band, &c );
+
+    r->minElevation = INFINITY;
+    r->maxElevation = -INFINITY;
+    r->nodata = 0;
+    unsigned int i;
+    for(i = 0; i < bands; i++) {
+        r->minElevation = fminf(r->minElevation, c.bands[i].minElevation);
+        r->maxElevation = fmaxf(r->maxElevation, c.bands[i].maxElevation);
+        r->nodata += c.bands[i].nodata;
+    }
+    if(r->minElevation > r->maxElevation) {
+        // No data at all
+        r->minElevation = r->maxElevation = 0.0f;
+    }
+    if(r->nodata > 0) {
+        c.fill = r->minElevation;
+        pool_run( pool, bands, fill_band, &c );
+    }
+    free( c.bands );
+}
@@ -0,0 +1,68 @@
+/**
+ * dem.h
+ */
+#ifndef DEM_H
+#define DEM_H
+#include <stddef.h>
+#include "terrain.h"
+#include "grid.h"
+#include "pool.h"
+
+// Extension of the header next to .bil and .flt grids
+#define DEM_HEADER_EXTENSION ".hdr"
+
+// Marks voids in SRTM tiles
+#define DEM_HGT_NODATA  -32768
+
+// Meters per arc second of latitude, for grids spaced in degrees
+#define DEM_METERS_PER_ARCSECOND 30.87f
+
+// Rows of samples converted by one task
+#define DEM_BAND_ROWS   64
+
+typedef enum {
+    DEM_TEXT,           // The viewer's own text format
+    DEM_HGT,            // SRTM tile, square big-endian int16
+    DEM_BIL,            // Band interleaved by line, described by a .hdr
+    DEM_FLT             // ESRI GridFloat, described by a .hdr
+} demFormat;
+
+typedef enum {
+    DEM_INT16,
+    DEM_UINT16,
+    DEM_FLOAT32
+} demSampleType;
+
+// Where the samples are in a binary file and how to read them
+typedef struct {
+    GLuint width;
+    GLuint height;
+    GLfloat resolution;     // Distance between samples, elevation units
+    demSampleType type;
+    int big_endian;
+    size_t skip;            // Bytes before the first row
+    size_t row_bytes;       // From one row to the next, all bands
+    int has_nodata;
+    GLfloat nodata;
+    int has_origin;         // Whether the next three are known
+    double left;            // Georeferenced center of the first sample
+    double top;
+    double cell;            // Georeferenced distance between samples
+} demHeader;
+
+typedef struct {
+    GLfloat minElevation;   // Of the samples with data
+    GLfloat maxElevation;
+    size_t nodata;          // Samples without data, set to minElevation
+} demResult;
+
+demFormat dem_detect(char const * const path);
+char const * dem_format_name(demFormat format);
+int dem_read_header(demHeader * const h, char const * const path,
+                    demFormat format, size_t file_size);
+size_t dem_read_row(GLfloat * const out, demHeader const * const h,
+                    char const * const data, GLuint z);
+void dem_convert(demResult * const r, elevationGrid * const grid,
+                 demHeader const * const h, char const * const data,
+                 threadPool * const pool);
+#endif
@@ -2,17 +2,40 @@
  * display.c
  */
 #include <stdio.h>
+#include <time.h>
+#include <unistd.h>
 #include "terrain.h"
 #include "mat.h"
 #include "vec.h"
 #include "display.h"
+#include "camera.h"
+#include "frustum.h"
+#include "lod.h"
+#include "stream.h"
+#include "progressive.h"
+#include "replay.h"
+#include "watch.h"
+#include "playback.h"
+#include "trace.h"
+#include "horizon.h"
 
 /* Global variables defined in init.c */
 extern worldData world;
 extern cameraData camera;
 
-static void get_model_view(mat4 r, cameraData const * const c);
-static void get_sun_position(vec4* r, mat4 mv, worldData const * const w);
+static void select_levels(worldData * const w, cameraData const * const c,
+                          mat4 mv);
+static void report_lod(lodStats const * const stats);
+static void select_tiles(worldData * const w, cameraData const * const c,
+                         mat4 mv);
+static void report_stream(streamStats const * const stats);
+static void report_level(progressiveLoader * const l);
+static void draw_terrain(worldData const * const w);
+static size_t frame_triangles(worldData const * const w);
+static void finish_replay(pathReplay * const r);
+#ifdef TRACE
+static size_t draw_list_indices(lodDrawList const * const d);
+#endif
 
 /**
  * Call back function called by OpenGL when a frame
@@ -21,21 +44,34 @@ static void get_sun_position(vec4* r, mat4 mv, worldData const * const w);
 void 
 display()
 {
+    TRACE_SPAN("frame");
+
     // Clear the window
     glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
     
     // Update model view based on camera location/rotation
     mat4 mv;
-    get_model_view(mv, &camera);
+    camera_model_view(mv, &camera);
     glUniformMatrix4fv(camera.model_view_pos, 1, GL_TRUE, (GLfloat*) mv);
 
     // Update sun position using rotation angle and translate into eye coordinates
     vec4 sp;
     get_sun_position(&sp, mv, &world);
     glUniform4fv(world.light_pos, 1, (GLfloat*) &sp);
+    if(world.shadows) {
+        vec3 sun_direction;
+        horizon_sun_direction(&sun_direction, &world);
+        glUniform3fv(world.sun_direction_pos, 1, (GLfloat*) &sun_direction);
+    }
 
     glUniform1f(world.shininess_pos, world.ground_material.shininess);
 
+    if(world.stream != NULL) {
+        select_tiles(&world, &camera, mv);
+    }else if(world.mesh == MESH_CHUNKED) {
+        select_levels(&world, &camera, mv);
+    }
+
     // Draw landscape
     if(world.fill_mode > 0) {
         glUniform1f(world.wireframe_pos, 0.0);
@@ -49,7 +85,7 @@ display()
             glPolygonMode(GL_FRONT_AND_BACK, GL_POINT);
         }
 
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, world.num_vertices);
+        draw_terrain(&world);
         glDisable(GL_POLYGON_OFFSET_FILL);
     }
 
@@ -57,60 +93,349 @@ display()
     if(world.wireframe_mode > 0) {
         glUniform1f(world.wireframe_pos, 1.0);
         glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, world.num_vertices);
+        draw_terrain(&world);
     }
 
     // Update background (sky) based on light (sun) position
-    vec4 night_color = {0.0, 0.0, 0.05, 1.0};
-    vec4 day_color = {0.6, 0.85, 1.0, 1.0};
-
-    GLfloat const sun_angle = world.sun_theta * M_PI / 180.0;
-    GLfloat const day_percentage = (cos(sun_angle) + 1.0) / 2.0;
-    GLfloat const night_percentage = 1.0 - day_percentage;
-
-    vec4_mult_s(&night_color, &night_color, night_percentage);
-    vec4_mult_s(&day_color, &day_color, day_percentage);
-
     vec4 sky_color;
-    vec4_add(&sky_color, &night_color, &day_color);
+    get_sky_color(&sky_color, &world);
     glClearColor( sky_color.x, sky_color.y, sky_color.z, 1.0 );
 
     // Double buffer
     glutSwapBuffers();
+
+    if(world.loader != NULL
+       && world.loader->step != world.loader->reported_step) {
+        report_level(world.loader);
+    }
+
+    if(world.recorder != NULL) {
+        path_record(world.recorder, &camera, &world);
+    }
+    TRACE_FRAME_COUNTERS();
 }
 
 void
 reshape(int width, int height) {
-    mat4 p;
     GLfloat const w = width;
     GLfloat const aspect = w / height;
 
     glViewport(0, 0, width, height);
-    mat4_perspective(p, 45.0, aspect, 0.01, world.cube_size * 2.0);
+    mat4_perspective(world.projection, world.fovy, aspect, 0.01, 
+                     world.cube_size * 2.0);
+    world.viewport_width = width;
+    world.viewport_height = height;
     
-    glUniformMatrix4fv(world.projection_pos, 1, GL_TRUE, (GLfloat*) p); 
+    glUniformMatrix4fv(world.projection_pos, 1, GL_TRUE, 
+                       (GLfloat*) world.projection); 
 }
 
-static void get_model_view(mat4 r, cameraData const * const c) {
-    mat4 ROTATE_Z;
-    mat4_rotate_z(ROTATE_Z, c->theta[2]);
+/**
+ * Pick the level of detail of every chunk for the current camera, skipping
+ * the chunks outside the view frustum
+ */
+static void select_levels(worldData * const w, cameraData const * const c,
+                          mat4 mv) {
+    mat4 pmv;
+    mat4_mult(pmv, w->projection, mv);
+    frustum f;
+    frustum_extract(&f, pmv);
 
-    mat4 ROTATE_Y;
-    mat4_rotate_y(ROTATE_Y, c->theta[1]);
+    lodView view;
+    vec3_init(&view.eye, c->viewer[0], c->viewer[1], c->viewer[2]);
+    view.fovy = w->fovy;
+    view.viewport_height = w->viewport_height;
+    view.threshold = w->lod->threshold;
+    view.frustum = w->cull ? &f : NULL;
 
-    mat4 ROTATE_X;
-    mat4_rotate_x(ROTATE_X, c->theta[0]);
+    lodStats stats;
+    lod_select(&w->lod->terrain, &view, w->lod->levels, &stats);
+    lod_draw_list_build(&w->lod->draws, &w->lod->terrain, w->lod->levels);
+
+    if(stats.chunks != w->lod->stats.chunks
+       || stats.culled_chunks != w->lod->stats.culled_chunks
+       || stats.triangles != w->lod->stats.triangles
+       || stats.culled_triangles != w->lod->stats.culled_triangles) {
+        report_lod(&stats);
+    }
+    w->lod->stats = stats;
+}
 
-    mat4 result1;
-    mat4 result2;
+/**
+ * Show what the last frame drew and culled in the window title
+ */
+static void report_lod(lodStats const * const stats) {
+    char title[192];
+    snprintf(title, sizeof(title), 
+             "Terrain Viewer - %u/%u chunks, %zu triangles"
+             " (culled %u chunks, %zu triangles)%s%s",
+             stats->chunks - stats->culled_chunks, stats->chunks,
+             stats->triangles, stats->culled_chunks, 
+             stats->culled_triangles, world.cursor[0] != '\0' ? " - " : "",
+             world.cursor);
+    glutSetWindowTitle(title);
+}
 
-    mat4_translate(result1, -c->viewer[0], -c->viewer[1], -c->viewer[2]);
-    mat4_mult(result2, ROTATE_Z, result1);
-    mat4_mult(result1, ROTATE_Y, result2);
-    mat4_mult(r, ROTATE_X, result1);
+/**
+ * Show what is under the mouse in the window title, after the chunks
+ * drawn when the mesh is chunked
+ */
+void report_cursor() {
+    if(world.lod != NULL) {
+        report_lod(&world.lod->stats);
+        return;
+    }
+    char title[128];
+    snprintf(title, sizeof(title), "Terrain Viewer%s%s",
+             world.cursor[0] != '\0' ? " - " : "", world.cursor);
+    glutSetWindowTitle(title);
 }
 
-static void get_sun_position(vec4* r, mat4 mv, worldData const * const w) {
+/**
+ * Pick and upload the tiles of a streamed pyramid for the current camera
+ */
+static void select_tiles(worldData * const w, cameraData const * const c,
+                         mat4 mv) {
+    mat4 pmv;
+    mat4_mult(pmv, w->projection, mv);
+    frustum f;
+    frustum_extract(&f, pmv);
+
+    streamView view;
+    vec3_init(&view.eye, c->viewer[0], c->viewer[1], c->viewer[2]);
+    camera_heading(&view.heading, c);
+    view.lookahead = STREAM_LOOKAHEAD * w->cube_size;
+    view.frustum = w->cull ? &f : NULL;
+
+    streamStats const last = w->stream->stats;
+    stream_update(w->stream, &view);
+
+    streamStats const * const stats = &w->stream->stats;
+    if(stats->tiles != last.tiles || stats->culled_tiles != last.culled_tiles
+       || stats->finest_level != last.finest_level
+       || stats->cache.resident_tiles != last.cache.resident_tiles
+       || stats->cache.queued != last.cache.queued) {
+        report_stream(stats);
+    }
+}
+
+/**
+ * Show what the last frame drew and what the tile cache holds in the
+ * window title
+ */
+static void report_stream(streamStats const * const stats) {
+    size_t const lookups = stats->cache.hits + stats->cache.misses;
+    char title[160];
+    snprintf(title, sizeof(title),
+             "Terrain Viewer - %u tiles (levels %u-%u), %zu triangles,"
+             " cache %.0f/%.0f MB, %.1f%% hits, %zu queued",
+             stats->tiles, stats->finest_level, stats->coarsest_level,
+             stats->triangles, stats->cache.resident_bytes / 1048576.0,
+             stats->cache.budget_bytes / 1048576.0,
+             lookups > 0 ? 100.0 * stats->cache.hits / lookups : 100.0,
+             stats->cache.queued);
+    glutSetWindowTitle(title);
+}
+
+/**
+ * Timer callback that redraws while a streamed pyramid is still loading
+ * the tiles the camera needs
+ */
+void poll_tiles(int value) {
+    if(world.stream == NULL) {
+        return;
+    }
+    if(!stream_settled(world.stream)) {
+        glutPostRedisplay();
+    }
+    glutTimerFunc(STREAM_POLL_MS, poll_tiles, 0);
+}
+
+/**
+ * Idle callback that swaps in the levels of a map loading in the
+ * background as they are finished
+ */
+void poll_levels() {
+    if(world.loader == NULL) {
+        glutIdleFunc(NULL);
+        return;
+    }
+    progressiveMesh* const m = progressive_take(world.loader);
+    if(m == NULL) {
+        // Leave the CPU to the loader
+        usleep(PROGRESSIVE_POLL_US);
+        return;
+    }
+    progressive_upload(world.loader, m, &world);
+    if(m->step == 1) {
+        glutIdleFunc(NULL);
+    }
+    progressive_mesh_free(m);
+    glutPostRedisplay();
+}
+
+/**
+ * Idle callback that shows the next frame of a sequence of grids once it
+ * is due and decoded
+ */
+void play_frames() {
+    if(world.player == NULL) {
+        glutIdleFunc(NULL);
+        return;
+    }
+    if(playback_poll(world.player, &world)) {
+        glutPostRedisplay();
+    }else {
+        // Leave the CPU to the decoder
+        usleep(PLAYBACK_POLL_US);
+    }
+}
+
+/**
+ * Timer callback that patches in the heights that changed in the
+ * elevation file
+ */
+void poll_watch(int value) {
+    if(world.watch == NULL) {
+        return;
+    }
+    watchChange* c = watch_take(world.watch);
+    if(c != NULL) {
+        while(c != NULL) {
+            watchChange* const next = c->next;
+            watch_apply(c, &world);
+            watch_change_free(c);
+            c = next;
+        }
+        glutPostRedisplay();
+    }
+    glutTimerFunc(WATCH_POLL_MS, poll_watch, 0);
+}
+
+/**
+ * Idle callback that draws the next frame of a replayed camera path as
+ * soon as the last one is finished, and exits after the last frame
+ */
+void play_path() {
+    pathReplay* const r = world.replay;
+    size_t const frame = r->next < REPLAY_WARMUP ? 0 : r->next - REPLAY_WARMUP;
+    if(frame == r->frames) {
+        finish_replay(r);
+    }
+
+    pathKey key;
+    path_sample(&key, &r->path, (double) frame / REPLAY_RATE);
+    path_apply(&key, &camera, &world);
+
+    // Wait for the GPU so the time covers drawing, not just queuing
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    display();
+    glFinish();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if(r->next >= REPLAY_WARMUP) {
+        double const seconds = (end.tv_sec - start.tv_sec)
+                               + (end.tv_nsec - start.tv_nsec) / 1e9;
+        frame_log_add(&r->log, seconds, frame_triangles(&world));
+    }
+    r->next++;
+}
+
+/**
+ * Report the frames of a replay and exit
+ */
+static void finish_replay(pathReplay * const r) {
+    if(!frame_log_summary(&r->log, r->map, r->mesh, r->stats_path)) {
+        fprintf(stderr, "Unable to write %s\n", r->stats_path);
+        exit(1);
+    }
+    if(r->times_path != NULL && !frame_log_write(&r->log, r->times_path)) {
+        fprintf(stderr, "Unable to write %s\n", r->times_path);
+        exit(1);
+    }
+    replay_free(r);
+    exit(0);
+}
+
+/**
+ * Triangles the last frame drew in one pass
+ */
+static size_t frame_triangles(worldData const * const w) {
+    if(w->stream != NULL) {
+        return w->stream->stats.triangles;
+    }else if(w->mesh == MESH_CHUNKED) {
+        return w->lod->stats.triangles;
+    }
+    return w->num_triangles;
+}
+
+/**
+ * Log when the first level and the full map were first drawn
+ */
+static void report_level(progressiveLoader * const l) {
+    double const seconds = progressive_seconds(l);
+    if(l->reported_step == 0) {
+        printf("First frame after %.3f s\n", seconds);
+    }
+    if(l->step == 1) {
+        printf("Full resolution after %.3f s\n", seconds);
+    }else {
+        printf("Drawing every %uth sample after %.3f s\n", l->step, seconds);
+    }
+    l->reported_step = l->step;
+}
+
+static void draw_terrain(worldData const * const w) {
+    TRACE_SPAN("draw");
+    if(w->stream != NULL) {
+        lodDrawList const * const d = &w->stream->draws;
+        TRACE_TALLY(TRACE_DRAW_CALLS, d->draws);
+        TRACE_TALLY(TRACE_VERTICES, draw_list_indices(d));
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, d->counts,
+                                      GL_UNSIGNED_SHORT,
+                                      (GLvoid const * const *) d->offsets,
+                                      d->draws, d->base_vertices);
+    }else if(w->mesh == MESH_STRIP) {
+        TRACE_TALLY(TRACE_DRAW_CALLS, 1);
+        TRACE_TALLY(TRACE_VERTICES, w->num_vertices);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, w->num_vertices);
+    }else if(w->mesh == MESH_CHUNKED) {
+        lodDrawList const * const d = &w->lod->draws;
+        TRACE_TALLY(TRACE_DRAW_CALLS, d->draws);
+        TRACE_TALLY(TRACE_VERTICES, draw_list_indices(d));
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, d->counts, 
+                                      GL_UNSIGNED_SHORT, 
+                                      (GLvoid const * const *) d->offsets,
+                                      d->draws, d->base_vertices);
+    }else {
+        GLenum const mode = (w->mesh == MESH_INDEXED) ? GL_TRIANGLE_STRIP 
+                                                      : GL_TRIANGLES;
+        TRACE_TALLY(TRACE_DRAW_CALLS, 1);
+        TRACE_TALLY(TRACE_VERTICES, w->num_indices);
+        glDrawElements(mode, w->num_indices, GL_UNSIGNED_INT, 
+                       BUFFER_OFFSET(0));
+    }
+}
+
+#ifdef TRACE
+/**
+ * Indices a multi-draw sends, each of its draws counted as a draw call
+ */
+static size_t draw_list_indices(lodDrawList const * const d) {
+    size_t total = 0;
+    GLsizei i;
+    for(i = 0; i < d->draws; i++) {
+        total += d->counts[i];
+    }
+    return total;
+}
+#endif
+
+/**
+ * The sun's position in eye coordinates
+ */
+void get_sun_position(vec4* r, mat4 mv, worldData const * const w) {
     vec4 temp;
     mat4 ROTATE_SUN;
     mat4_rotate_x(ROTATE_SUN, w->sun_theta);
@@ -119,3 +444,18 @@ static void get_sun_position(vec4* r, mat4 mv, worldData const * const w) {
     mat4_mult_v(r, mv, &temp);
 }
 
+/**
+ * The sky blends from day to night as the sun goes down
+ */
+void get_sky_color(vec4* r, worldData const * const w) {
+    vec4 night_color = {0.0, 0.0, 0.05, 1.0};
+    vec4 day_color = {0.6, 0.85, 1.0, 1.0};
+
+    GLfloat const sun_angle = w->sun_theta * M_PI / 180.0;
+    GLfloat const day_percentage = (cos(sun_angle) + 1.0) / 2.0;
+    GLfloat const night_percentage = 1.0 - day_percentage;
+
+    vec4_mult_s(&night_color, &night_color, night_percentage);
+    vec4_mult_s(&day_color, &day_color, day_percentage);
+    vec4_add(r, &night_color, &day_color);
+}
@@ -3,7 +3,16 @@
  */
 #ifndef DISPLAY_H
 #define DISPLAY_H
+#include "terrain.h"
 
 void display();
 void reshape(int w, int h);
+void poll_tiles(int value);
+void poll_levels();
+void poll_watch(int value);
+void play_frames();
+void play_path();
+void report_cursor();
+void get_sun_position(vec4* r, mat4 mv, worldData const * const w);
+void get_sky_color(vec4* r, worldData const * const w);
 #endif
@@ -0,0 +1,64 @@
+/**
+ * frustum.c
+ *
+ * View frustum planes extracted from a projection times model view matrix,
+ * following Gribb and Hartmann: every plane is the fourth row of the
+ * matrix plus or minus one of the others.
+ */
+#include <math.h>
+#include "frustum.h"
+
+/**
+ *  Extract the planes of a frustum
+ *  @param[out] f  The frustum
+ *  @param[in] m  Projection times model view, row-major like mat4_mult()
+ */
+void
+frustum_extract(frustum * const f, mat4 m) {
+    unsigned int i;
+    for(i = 0; i < FRUSTUM_PLANES; i++) {
+        // Planes come in pairs: row 3 + row k, then row 3 - row k
+        GLuint const row = i / 2;
+        GLfloat const sign = (i % 2 == 0) ? 1.0f : -1.0f;
+        vec4* const p = &f->planes[i];
+        p->x = m[3][0] + sign * m[row][0];
+        p->y = m[3][1] + sign * m[row][1];
+        p->z = m[3][2] + sign * m[row][2];
+        p->w = m[3][3] + sign * m[row][3];
+
+        GLfloat const length = sqrtf(p->x * p->x + p->y * p->y 
+                                     + p->z * p->z);
+        if(length > 0.0f) {
+            p->x /= length;
+            p->y /= length;
+            p->z /= length;
+            p->w /= length;
+        }
+    }
+}
+
+/**
+ *  Test an axis-aligned box against a frustum. The test is conservative:
+ *  a few boxes near the corners of the frustum pass without being visible.
+ *  @param[in] f  The frustum
+ *  @param[in] min  The lowest corner of the box
+ *  @param[in] max  The highest corner of the box
+ *  @return 0 when the box is entirely outside one of the planes
+ */
+int
+frustum_test_box(frustum const * const f, GLfloat const min[3],
+                 GLfloat const max[3]) {
+    unsigned int i;
+    for(i = 0; i < FRUSTUM_PLANES; i++) {
+        vec4 const * const p = &f->planes[i];
+
+        // The corner furthest along the plane's normal
+        GLfloat const x = p->x >= 0.0f ? max[0] : min[0];
+        GLfloat const y = p->y >= 0.0f ? max[1] : min[1];
+        GLfloat const z = p->z >= 0.0f ? max[2] : min[2];
+        if(p->x * x + p->y * y + p->z * z + p->w < 0.0f) {
+            return 0;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,25 @@
+/**
+ * frustum.h
+ */
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+#include "vec.h"
+#include "mat.h"
+
+// Left, right, bottom, top, near, far
+#define FRUSTUM_PLANES  6
+
+/**
+ *  The planes bounding what a camera sees, in the coordinates of the
+ *  matrix they were extracted from. Each plane is (a, b, c, d) with its
+ *  normal pointing inside, so a point p is inside when a*x + b*y + c*z + d
+ *  is positive for every plane.
+ */
+typedef struct {
+    vec4 planes[FRUSTUM_PLANES];
+} frustum;
+
+void frustum_extract(frustum * const f, mat4 m);
+int frustum_test_box(frustum const * const f, GLfloat const min[3],
+                     GLfloat const max[3]);
+#endif
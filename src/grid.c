@@ -0,0 +1,407 @@
+/**
+ * grid.c
+ *
+ * Samples are stored as floats, or once a map is loaded optionally as 16
+ * bit steps above the lowest sample (see grid_quantize()), which halves the
+ * memory the grid takes and the bandwidth of every pass over it. Rows of a
+ * quantized grid are converted eight samples at a time.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "grid.h"
+
+typedef uint16_t v8u16 __attribute__ ((vector_size (16)));
+typedef float v8f32 __attribute__ ((vector_size (32)));
+typedef float v4f32 __attribute__ ((vector_size (16)));
+typedef int32_t v4s32 __attribute__ ((vector_size (16)));
+
+// Row and allocation alignment, in bytes
+#define GRID_ALIGN 64
+
+// Row pitches that are a multiple of this many bytes map every row of a
+// 3x3 neighbourhood to the same cache sets, so they get one more line
+#define GRID_ALIAS_STRIDE 4096
+
+/**
+ *  Allocate a grid. Samples are left uninitialized.
+ *  @param[out] g  The grid
+ *  @param[in] width  The number of samples per row
+ *  @param[in] height  The number of rows
+ *  @param[in] layout  How samples are arranged in memory
+ *  @return 1 on success, 0 if the allocation failed
+ */
+int
+grid_init(elevationGrid * const g, GLuint width, GLuint height,
+          gridLayout layout) {
+    size_t const line = GRID_ALIGN / sizeof(GLfloat);
+
+    g->width = width;
+    g->height = height;
+    g->layout = layout;
+    if(layout == GRID_TILED) {
+        size_t const tiles_x = (width + GRID_TILE_MASK) >> GRID_TILE_SHIFT;
+        size_t const tiles_z = (height + GRID_TILE_MASK) >> GRID_TILE_SHIFT;
+        g->pitch = tiles_x;
+        g->size = (tiles_x * tiles_z) << (2 * GRID_TILE_SHIFT);
+    }else {
+        g->pitch = (width + line - 1) / line * line;
+        if((g->pitch * sizeof(GLfloat)) % GRID_ALIAS_STRIDE == 0) {
+            g->pitch += line;
+        }
+        g->size = g->pitch * height;
+    }
+
+    g->quantized = NULL;
+    g->qscale = 1.0f;
+    g->qoffset = 0.0f;
+    void* data;
+    if(posix_memalign(&data, GRID_ALIGN, g->size * sizeof(GLfloat)) != 0) {
+        g->data = NULL;
+        return 0;
+    }
+    g->data = data;
+    return 1;
+}
+
+void
+grid_free(elevationGrid * const g) {
+    free( g->data );
+    free( g->quantized );
+    g->data = NULL;
+    g->quantized = NULL;
+}
+
+/**
+ *  The bytes the samples of a grid take, padding included
+ */
+size_t
+grid_bytes(elevationGrid const * const g) {
+    return g->size * (g->quantized != NULL ? sizeof(*g->quantized)
+                                           : sizeof(*g->data));
+}
+
+/**
+ *  Copy a contiguous run of samples out of the grid's storage
+ */
+static void
+read_run(elevationGrid const * const g, size_t offset, GLuint count,
+         GLfloat * const out) {
+    if(g->quantized == NULL) {
+        memcpy( out, g->data + offset, count * sizeof(*out) );
+        return;
+    }
+
+    uint16_t const * const in = g->quantized + offset;
+    v8f32 const scale = { g->qscale, g->qscale, g->qscale, g->qscale,
+                          g->qscale, g->qscale, g->qscale, g->qscale };
+    v8f32 const bias = { g->qoffset, g->qoffset, g->qoffset, g->qoffset,
+                         g->qoffset, g->qoffset, g->qoffset, g->qoffset };
+    GLuint i = 0;
+    for(; i + 8 <= count; i += 8) {
+        v8u16 q;
+        memcpy( &q, in + i, sizeof(q) );
+        v8f32 const v = bias + scale * __builtin_convertvector(q, v8f32);
+        memcpy( out + i, &v, sizeof(v) );
+    }
+    for(; i < count; i++) {
+        out[i] = g->qoffset + g->qscale * in[i];
+    }
+}
+
+/**
+ *  Copy a contiguous run of samples into the grid's storage
+ */
+static void
+write_run(elevationGrid * const g, size_t offset, GLuint count,
+          GLfloat const * const in) {
+    if(g->quantized == NULL) {
+        memcpy( g->data + offset, in, count * sizeof(*in) );
+        return;
+    }
+    uint16_t* const out = g->quantized + offset;
+    GLfloat const inverse = 1.0f / g->qscale;
+    v4f32 const zero = { 0 };
+    v4f32 const scale = zero + inverse;
+    v4f32 const bias = zero + g->qoffset;
+    v4f32 const half = zero + 0.5f;
+    v4f32 const top = zero + 65535.0f;
+    GLuint i = 0;
+    for(; i + 8 <= count; i += 8) {
+        v4s32 halves[2];
+        unsigned int k;
+        for(k = 0; k < 2; k++) {
+            v4f32 v;
+            memcpy( &v, in + i + 4 * k, sizeof(v) );
+            v = (v - bias) * scale + half;
+
+            // Clamp to [0, 65535] with masks, NaN going to 0
+            v4s32 const positive = v > zero;
+            v4s32 const over = v > top;
+            v4s32 const bits = ((v4s32) v & positive & ~over)
+                               | ((v4s32) top & over);
+            halves[k] = __builtin_convertvector((v4f32) bits, v4s32);
+        }
+        v8u16 const q = __builtin_shufflevector((v8u16) halves[0],
+                                                (v8u16) halves[1],
+                                                0, 2, 4, 6, 8, 10, 12, 14);
+        memcpy( out + i, &q, sizeof(q) );
+    }
+    for(; i < count; i++) {
+        out[i] = grid_quantize_sample(g, in[i]);
+    }
+}
+
+/**
+ *  Copy a run of samples from one row of the grid
+ *  @param[in] g  The grid
+ *  @param[in] z  The row
+ *  @param[in] x0  The first column
+ *  @param[in] count  The number of samples to copy
+ *  @param[out] out  The samples
+ */
+void
+grid_read_row(elevationGrid const * const g, GLuint z, GLuint x0,
+              GLuint count, GLfloat * const out) {
+    if(g->layout == GRID_ROW_MAJOR) {
+        read_run( g, grid_index(g, x0, z), count, out );
+        return;
+    }
+
+    GLuint i = 0;
+    while(i < count) {
+        GLuint const x = x0 + i;
+        GLuint run = GRID_TILE_SIZE - (x & GRID_TILE_MASK);
+        if(run > count - i) {
+            run = count - i;
+        }
+        read_run( g, grid_index(g, x, z), run, out + i );
+        i += run;
+    }
+}
+
+/**
+ *  Copy a run of samples into one row of the grid
+ *  @param[in,out] g  The grid
+ *  @param[in] z  The row
+ *  @param[in] x0  The first column
+ *  @param[in] count  The number of samples to copy
+ *  @param[in] in  The samples
+ */
+void
+grid_write_row(elevationGrid * const g, GLuint z, GLuint x0,
+               GLuint count, GLfloat const * const in) {
+    if(g->layout == GRID_ROW_MAJOR) {
+        write_run( g, grid_index(g, x0, z), count, in );
+        return;
+    }
+
+    GLuint i = 0;
+    while(i < count) {
+        GLuint const x = x0 + i;
+        GLuint run = GRID_TILE_SIZE - (x & GRID_TILE_MASK);
+        if(run > count - i) {
+            run = count - i;
+        }
+        write_run( g, grid_index(g, x, z), run, in + i );
+        i += run;
+    }
+}
+
+/**
+ *  Find where two grids of the same size differ, as the box around the
+ *  changed samples of each band of rows
+ *  @param[out] rects  The boxes, room for one per band
+ *  @param[in] before  The old grid
+ *  @param[in] after  The new grid
+ *  @param[in] band_rows  Rows per band
+ *  @return The number of boxes, bands without changes having none
+ */
+size_t
+grid_diff(gridRect * const rects, elevationGrid const * const before,
+          elevationGrid const * const after, GLuint band_rows) {
+    GLuint const width = before->width;
+    GLfloat* const rows = malloc(2 * width * sizeof(*rows));
+    if(rows == NULL) {
+        fprintf(stderr, "Unable to allocate rows to compare\n");
+        exit(1);
+    }
+    GLfloat* const old_row = rows;
+    GLfloat* const new_row = rows + width;
+
+    size_t count = 0;
+    GLuint z0, z;
+    for(z0 = 0; z0 < before->height; z0 += band_rows) {
+        GLuint const z_end = z0 + band_rows < before->height
+                             ? z0 + band_rows : before->height;
+        gridRect r = { width, z_end, 0, z0 };
+        for(z = z0; z < z_end; z++) {
+            grid_read_row( before, z, 0, width, old_row );
+            grid_read_row( after, z, 0, width, new_row );
+            GLuint first = 0, last = width;
+            while(first < width && old_row[first] == new_row[first]) {
+                first++;
+            }
+            if(first == width) {
+                continue;
+            }
+            while(old_row[last - 1] == new_row[last - 1]) {
+                last--;
+            }
+            r.x0 = first < r.x0 ? first : r.x0;
+            r.x1 = last > r.x1 ? last : r.x1;
+            r.z0 = z < r.z0 ? z : r.z0;
+            r.z1 = z + 1;
+        }
+        if(r.x0 < r.x1) {
+            rects[count++] = r;
+        }
+    }
+    free( rows );
+    return count;
+}
+
+/**
+ *  Look up a layout by the name used on the command line
+ *  @param[out] layout  The layout
+ *  @param[in] name  "row" or "tiled"
+ *  @return 1 if the name is known, 0 otherwise
+ */
+int
+grid_parse_layout(gridLayout * const layout, char const * const name) {
+    if(strcmp(name, "row") == 0) {
+        *layout = GRID_ROW_MAJOR;
+    }else if(strcmp(name, "tiled") == 0) {
+        *layout = GRID_TILED;
+    }else {
+        return 0;
+    }
+    return 1;
+}
+
+static inline v4f32
+blend(v4s32 mask, v4f32 a, v4f32 b) {
+    return (v4f32) (((v4s32) a & mask) | ((v4s32) b & ~mask));
+}
+
+/**
+ *  Widen a range to take in a run of samples, four at a time
+ */
+static void
+row_range(GLfloat const * const in, GLuint count, GLfloat * const low,
+          GLfloat * const high) {
+    v4f32 lo = { *low, *low, *low, *low };
+    v4f32 hi = { *high, *high, *high, *high };
+    GLuint i = 0;
+    for(; i + 4 <= count; i += 4) {
+        v4f32 v;
+        memcpy( &v, in + i, sizeof(v) );
+        lo = blend(v < lo, v, lo);
+        hi = blend(v > hi, v, hi);
+    }
+    for(; i < count; i++) {
+        lo[0] = in[i] < lo[0] ? in[i] : lo[0];
+        hi[0] = in[i] > hi[0] ? in[i] : hi[0];
+    }
+    for(i = 0; i < 4; i++) {
+        *low = lo[i] < *low ? lo[i] : *low;
+        *high = hi[i] > *high ? hi[i] : *high;
+    }
+}
+
+/**
+ *  The largest difference between two runs of samples
+ */
+static GLfloat
+largest_difference(GLfloat const * const a, GLfloat const * const b,
+                   GLuint count) {
+    v4s32 const magnitude = { 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF,
+                              0x7FFFFFFF };
+    v4f32 worst = { 0 };
+    GLuint i = 0;
+    for(; i + 4 <= count; i += 4) {
+        v4f32 va, vb;
+        memcpy( &va, a + i, sizeof(va) );
+        memcpy( &vb, b + i, sizeof(vb) );
+        v4f32 const d = (v4f32) ((v4s32) (va - vb) & magnitude);
+        worst = blend(d > worst, d, worst);
+    }
+    GLfloat largest = 0.0f;
+    for(; i < count; i++) {
+        GLfloat const d = fabsf(a[i] - b[i]);
+        largest = d > largest ? d : largest;
+    }
+    for(i = 0; i < 4; i++) {
+        largest = worst[i] > largest ? worst[i] : largest;
+    }
+    return largest;
+}
+
+/**
+ *  Store the samples of a float grid as 16 bit steps, when that keeps
+ *  every sample within a tolerance. Steps of 1 are tried first, which
+ *  store integer elevations spanning up to 65535 exactly, then the range
+ *  of the grid split into 65535 steps.
+ *  @param[in,out] g  The grid, left as floats if the error is too large
+ *  @param[in] tolerance  The largest error allowed, elevation units
+ *  @param[out] error  The largest error of any sample once quantized, or
+ *                     the first over the tolerance
+ *  @return 1 if the grid was quantized, 0 otherwise
+ */
+int
+grid_quantize(elevationGrid * const g, GLfloat tolerance,
+              GLfloat * const error) {
+    if(g->quantized != NULL) {
+        *error = 0.0f;
+        return 1;
+    }
+    GLfloat* const row = malloc(2 * g->width * sizeof(*row));
+    uint16_t* const quantized = malloc(g->size * sizeof(*quantized));
+    if(row == NULL || quantized == NULL) {
+        free( quantized );
+        free( row );
+        *error = INFINITY;
+        return 0;
+    }
+    GLfloat* const check = row + g->width;
+
+    GLfloat low = INFINITY, high = -INFINITY;
+    GLuint z;
+    for(z = 0; z < g->height; z++) {
+        grid_read_row( g, z, 0, g->width, row );
+        row_range( row, g->width, &low, &high );
+    }
+
+    // Quantize a copy of the grid's description, reading every row back to
+    // measure the error the way it will be read
+    GLfloat const steps[2] = { 1.0f, (high - low) / 65535.0f };
+    unsigned int const tries = high - low <= 65535.0f ? 2 : 1;
+    unsigned int t;
+    for(t = 2 - tries; t < 2; t++) {
+        elevationGrid q = *g;
+        q.data = NULL;
+        q.quantized = quantized;
+        q.qscale = steps[t] > 0.0f ? steps[t] : 1.0f;
+        q.qoffset = low;
+        GLfloat worst = 0.0f;
+        for(z = 0; z < g->height && worst <= tolerance; z++) {
+            grid_read_row( g, z, 0, g->width, row );
+            grid_write_row( &q, z, 0, g->width, row );
+            grid_read_row( &q, z, 0, g->width, check );
+            GLfloat const e = largest_difference(row, check, g->width);
+            worst = e > worst ? e : worst;
+        }
+        *error = worst;
+        if(worst <= tolerance) {
+            free( g->data );
+            *g = q;
+            free( row );
+            return 1;
+        }
+    }
+
+    free( quantized );
+    free( row );
+    return 0;
+}
@@ -0,0 +1,91 @@
+/**
+ * grid.h
+ */
+#ifndef GRID_H
+#define GRID_H
+#include <stddef.h>
+#include <stdint.h>
+#include <GL/glut.h>
+
+// Tiled grids store 16x16 blocks (1 KiB of floats) contiguously
+#define GRID_TILE_SHIFT 4
+#define GRID_TILE_SIZE  (1 << GRID_TILE_SHIFT)
+#define GRID_TILE_MASK  (GRID_TILE_SIZE - 1)
+
+typedef enum {
+    GRID_ROW_MAJOR,     // Rows padded to a whole number of cache lines
+    GRID_TILED          // Row-major 16x16 tiles, each tile contiguous
+} gridLayout;
+
+typedef struct {
+    GLuint width;
+    GLuint height;
+    gridLayout layout;
+    size_t pitch;       // Samples per row, or tiles per row when tiled
+    size_t size;        // Number of samples allocated
+    GLfloat* data;      // NULL when quantized
+    uint16_t* quantized;    // Samples as qoffset + qscale * q, or NULL
+    GLfloat qscale;
+    GLfloat qoffset;
+} elevationGrid;
+
+// Samples [x0, x1) of rows [z0, z1)
+typedef struct {
+    GLuint x0;
+    GLuint z0;
+    GLuint x1;
+    GLuint z1;
+} gridRect;
+
+int grid_init(elevationGrid * const g, GLuint width, GLuint height,
+              gridLayout layout);
+void grid_free(elevationGrid * const g);
+void grid_read_row(elevationGrid const * const g, GLuint z, GLuint x0,
+                   GLuint count, GLfloat * const out);
+void grid_write_row(elevationGrid * const g, GLuint z, GLuint x0,
+                    GLuint count, GLfloat const * const in);
+size_t grid_diff(gridRect * const rects, elevationGrid const * const before,
+                 elevationGrid const * const after, GLuint band_rows);
+int grid_parse_layout(gridLayout * const layout, char const * const name);
+int grid_quantize(elevationGrid * const g, GLfloat tolerance,
+                  GLfloat * const error);
+size_t grid_bytes(elevationGrid const * const g);
+
+/**
+ *  Offset of the sample at (x,z) from the start of the grid's data
+ */
+static inline size_t
+grid_index(elevationGrid const * const g, GLuint x, GLuint z) {
+    if(g->layout == GRID_TILED) {
+        size_t const tile = (size_t) (z >> GRID_TILE_SHIFT) * g->pitch
+                            + (x >> GRID_TILE_SHIFT);
+        return (tile << (2 * GRID_TILE_SHIFT))
+               | ((z & GRID_TILE_MASK) << GRID_TILE_SHIFT)
+               | (x & GRID_TILE_MASK);
+    }
+    return (size_t) z * g->pitch + x;
+}
+
+static inline uint16_t
+grid_quantize_sample(elevationGrid const * const g, GLfloat value) {
+    GLfloat const q = (value - g->qoffset) * (1.0f / g->qscale) + 0.5f;
+    return q <= 0.0f ? 0 : (q >= 65535.0f ? 65535 : (uint16_t) q);
+}
+
+static inline GLfloat
+grid_get(elevationGrid const * const g, GLuint x, GLuint z) {
+    if(g->quantized != NULL) {
+        return g->qoffset + g->qscale * g->quantized[grid_index(g, x, z)];
+    }
+    return g->data[grid_index(g, x, z)];
+}
+
+static inline void
+grid_set(elevationGrid * const g, GLuint x, GLuint z, GLfloat value) {
+    if(g->quantized != NULL) {
+        g->quantized[grid_index(g, x, z)] = grid_quantize_sample(g, value);
+        return;
+    }
+    g->data[grid_index(g, x, z)] = value;
+}
+#endif
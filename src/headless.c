@@ -0,0 +1,153 @@
+/**
+ * headless.c
+ *
+ * Renders one frame from the default camera into an image file with the
+ * software rasterizer, for machines without a GPU or a display.
+ */
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "headless.h"
+#include "init.h"
+#include "display.h"
+#include "camera.h"
+#include "mesh.h"
+#include "normals.h"
+#include "horizon.h"
+#include "raster.h"
+#include "rtin.h"
+#include "image.h"
+#include "pyramid.h"
+#include "trace.h"
+
+static double
+seconds_since(struct timespec const * const start) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ *  Load a map and render it without a window
+ *  @param[in] file  The elevation file, closed here
+ *  @param[in] opts  The command line options, with out set
+ */
+void
+render_headless(FILE * const file, optionsData const * const opts) {
+    TRACE_SPAN("render_headless");
+    // Pyramids are only drawn by streaming tiles into the GPU
+    if(opts->path != NULL) {
+        size_t const length = strlen(opts->path);
+        size_t const extension = strlen(PYRAMID_EXTENSION);
+        if(length > extension && strcmp(opts->path + length - extension,
+                                        PYRAMID_EXTENSION) == 0) {
+            fprintf(stderr, "--headless can't render a tile pyramid\n");
+            exit(1);
+        }
+    }
+
+    worldData w;
+    cameraData c;
+    init_world_data( &w );
+    init_camera_data( &c, w.cube_size );
+    w.pool = pool_create( opts->threads );
+
+    mapData mData;
+    load_map( &mData, file, &w, opts );
+
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    // One vertex per sample like the indexed layouts, drawn as triangles
+    size_t const num_vertices = (size_t) mData.mapWidth * mData.mapHeight;
+    if(num_vertices > INT_MAX || 6 * num_vertices > UINT_MAX) {
+        fprintf(stderr, "%u x %u samples is too large to render\n",
+                mData.mapWidth, mData.mapHeight);
+        exit(1);
+    }
+    vec4* const vertices = malloc(num_vertices * sizeof(*vertices));
+    vec3* const normals = malloc(num_vertices * sizeof(*normals));
+    if(vertices == NULL || normals == NULL) {
+        fprintf(stderr, "Unable to allocate %zu vertices\n", num_vertices);
+        exit(1);
+    }
+    mesh_build_vertices( vertices, &mData, w.pool );
+    compute_normals( normals, &mData, opts->normals, w.pool );
+    GLubyte* horizons = NULL;
+    if(opts->shadows) {
+        horizons = build_horizons( &mData, w.pool );
+    }
+
+    rtinMesh rtin;
+    GLuint* indices;
+    size_t num_triangles;
+    if(opts->mesh == MESH_RTIN) {
+        rtin_build( &rtin, &mData, opts->max_error, w.pool );
+        indices = rtin.indices;
+        num_triangles = rtin.triangles;
+    }else {
+        num_triangles = 2 * (size_t) (mData.mapWidth - 1)
+                        * (mData.mapHeight - 1);
+        indices = malloc(3 * num_triangles * sizeof(*indices));
+        if(indices == NULL) {
+            fprintf(stderr, "Unable to allocate %zu triangles\n",
+                    num_triangles);
+            exit(1);
+        }
+        mesh_build_indices( indices, MESH_TRIANGLES, &mData, w.pool );
+    }
+    double const mesh_seconds = seconds_since( &start );
+
+    // The uniforms init_program() and display() would set
+    rasterScene scene;
+    camera_model_view( scene.model_view, &c );
+    mat4_perspective( scene.projection, w.fovy,
+                      (GLfloat) opts->out_width / opts->out_height, 0.01,
+                      w.cube_size * 2.0 );
+    get_sun_position( &scene.light_position, scene.model_view, &w );
+    vec4_mult( &scene.ambient_product, &w.sun_light.ambient,
+               &w.ground_material.ambient );
+    vec4_mult( &scene.diffuse_product, &w.sun_light.diffuse,
+               &w.ground_material.diffuse );
+    vec4_mult( &scene.specular_product, &w.sun_light.specular,
+               &w.ground_material.specular );
+    scene.shininess = w.ground_material.shininess;
+    scene.max_elevation = mData.yScale
+                          * (mData.maxElevation - mData.minElevation);
+    get_sky_color( &scene.clear_color, &w );
+    horizon_sun_direction( &scene.sun_direction, &w );
+
+    rasterImage image;
+    if(!raster_image_init( &image, opts->out_width, opts->out_height )) {
+        fprintf(stderr, "Unable to allocate a %u x %u image\n",
+                opts->out_width, opts->out_height);
+        exit(1);
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    raster_draw( &image, &scene, vertices, normals, horizons, num_vertices,
+                 indices, num_triangles, w.pool );
+    double const draw_seconds = seconds_since( &start );
+
+    if(!image_write( opts->out, image.color, image.width, image.height )) {
+        fprintf(stderr, "Unable to write %s\n", opts->out);
+        exit(1);
+    }
+    printf("Rendered %zu triangles into %s (%u x %u): mesh %.3f s, "
+           "draw %.3f s\n", num_triangles, opts->out, image.width,
+           image.height, mesh_seconds, draw_seconds);
+
+    raster_image_free( &image );
+    if(opts->mesh == MESH_RTIN) {
+        rtin_free( &rtin );
+    }else {
+        free( indices );
+    }
+    free( horizons );
+    free( normals );
+    free( vertices );
+    grid_free( &mData.elevation );
+    pool_destroy( w.pool );
+}
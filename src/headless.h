@@ -0,0 +1,10 @@
+/**
+ * headless.h
+ */
+#ifndef HEADLESS_H
+#define HEADLESS_H
+#include <stdio.h>
+#include "terrain.h"
+
+void render_headless(FILE * const file, optionsData const * const opts);
+#endif
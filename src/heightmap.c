@@ -0,0 +1,516 @@
+/**
+ * heightmap.c
+ *
+ * Elevation queries against the map kept in memory: bilinear heights, and
+ * rays picked against the same triangles the indexed layouts draw.
+ *
+ * Rays are traced through a min/max pyramid. Each level holds the lowest
+ * and highest elevation of blocks twice as wide as the level below, down
+ * to the cells between four samples. A ray steps through the blocks of a
+ * level; where it passes over a block's highest point it moves on to the
+ * next block and up a level, otherwise it looks at the block's children.
+ * Over open ground a ray crosses the map in a number of steps that grows
+ * with the logarithm of its size rather than with the cells it crosses.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "heightmap.h"
+#include "trace.h"
+
+// Samples a ray is advanced to decide which block it is entering
+#define HEIGHTMAP_EPSILON   1e-6
+
+typedef struct {
+    heightMap* m;
+    unsigned int level;
+} levelBuild;
+
+static inline GLfloat
+min2(GLfloat a, GLfloat b) {
+    return a < b ? a : b;
+}
+
+static inline GLfloat
+max2(GLfloat a, GLfloat b) {
+    return a > b ? a : b;
+}
+
+/**
+ *  The range of a block of a level, from the level below, or from the
+ *  samples for level 1
+ */
+static heightRange
+build_block(heightMap const * const m, unsigned int l, GLuint i, GLuint j) {
+    heightLevel const * const below = &m->level[l - 1];
+    elevationGrid const * const g = &m->map.elevation;
+    heightRange r = { INFINITY, -INFINITY };
+    if(l == 1) {
+        // Three samples a side, fewer on the last row and column
+        GLuint const x_end = 2 * i + 2 < m->map.mapWidth
+                             ? 2 * i + 2 : m->map.mapWidth - 1;
+        GLuint const z_end = 2 * j + 2 < m->map.mapHeight
+                             ? 2 * j + 2 : m->map.mapHeight - 1;
+        GLuint x, z;
+        for(z = 2 * j; z <= z_end; z++) {
+            for(x = 2 * i; x <= x_end; x++) {
+                GLfloat const h = grid_get(g, x, z);
+                r.min = min2(r.min, h);
+                r.max = max2(r.max, h);
+            }
+        }
+    }else {
+        GLuint x, z;
+        for(z = 2 * j; z < 2 * j + 2 && z < below->height; z++) {
+            for(x = 2 * i; x < 2 * i + 2 && x < below->width; x++) {
+                heightRange const * const c
+                    = &below->ranges[(size_t) z * below->width + x];
+                r.min = min2(r.min, c->min);
+                r.max = max2(r.max, c->max);
+            }
+        }
+    }
+    return r;
+}
+
+/**
+ *  Fill a band of rows of a level
+ */
+static void
+build_band(void * const arg, unsigned int band) {
+    levelBuild const * const b = arg;
+    heightLevel const * const level = &b->m->level[b->level];
+
+    GLuint const first = band * HEIGHTMAP_BAND_ROWS;
+    GLuint const last = first + HEIGHTMAP_BAND_ROWS < level->height
+                        ? first + HEIGHTMAP_BAND_ROWS : level->height;
+    GLuint i, j;
+    for(j = first; j < last; j++) {
+        for(i = 0; i < level->width; i++) {
+            level->ranges[(size_t) j * level->width + i]
+                = build_block(b->m, b->level, i, j);
+        }
+    }
+}
+
+/**
+ *  Size and allocate the levels of the pyramid of a map, without building
+ *  them
+ *  @param[out] m  The pyramid
+ *  @param[in] mData  The map, whose elevation grid the pyramid shares
+ *  @return The bytes allocated, or 0 if the map is under 2 x 2 samples
+ */
+size_t
+heightmap_init(heightMap * const m, mapData const * const mData) {
+    if(mData->mapWidth < 2 || mData->mapHeight < 2) {
+        return 0;
+    }
+    m->map = *mData;
+    m->level[0].width = mData->mapWidth - 1;
+    m->level[0].height = mData->mapHeight - 1;
+    m->level[0].ranges = NULL;
+    m->levels = 1;
+
+    size_t bytes = 0;
+    while(m->level[m->levels - 1].width > 1
+          || m->level[m->levels - 1].height > 1) {
+        heightLevel const * const below = &m->level[m->levels - 1];
+        heightLevel* const level = &m->level[m->levels];
+        level->width = (below->width + 1) / 2;
+        level->height = (below->height + 1) / 2;
+        size_t const count = (size_t) level->width * level->height;
+        level->ranges = malloc(count * sizeof(*level->ranges));
+        if(level->ranges == NULL) {
+            fprintf(stderr, "Unable to allocate %u x %u height blocks\n",
+                    level->width, level->height);
+            exit(1);
+        }
+        bytes += count * sizeof(*level->ranges);
+        m->levels++;
+    }
+    return bytes;
+}
+
+/**
+ *  Build every level of a pyramid from its grid, a level at a time since
+ *  each is read from the one below
+ *  @param[in,out] m  The pyramid
+ *  @param[in] pool  The workers to build with
+ */
+void
+heightmap_build(heightMap * const m, threadPool * const pool) {
+    levelBuild b;
+    b.m = m;
+    for(b.level = 1; b.level < m->levels; b.level++) {
+        pool_run( pool, (m->level[b.level].height + HEIGHTMAP_BAND_ROWS - 1)
+                        / HEIGHTMAP_BAND_ROWS, build_band, &b );
+    }
+}
+
+/**
+ *  Build the pyramid of a map and keep the map for queries
+ *  @param[in,out] mData  The map, whose elevation grid the pyramid takes
+ *                        over and frees
+ *  @param[in] pool  The workers to build with
+ *  @return The pyramid, or NULL if the map is under 2 x 2 samples
+ */
+heightMap*
+heightmap_create(mapData * const mData, threadPool * const pool) {
+    TRACE_SPAN("build heightmap");
+    if(mData->mapWidth < 2 || mData->mapHeight < 2) {
+        return NULL;
+    }
+    heightMap* const m = calloc(1, sizeof(*m));
+    if(m == NULL) {
+        fprintf(stderr, "Unable to allocate the height pyramid\n");
+        exit(1);
+    }
+
+    struct timespec start, end;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    size_t const bytes = heightmap_init(m, mData);
+    heightmap_build( m, pool );
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    printf("Built a %u level height pyramid (%.1f MB) in %.3f s\n",
+           m->levels, bytes / 1e6, (end.tv_sec - start.tv_sec)
+                                   + (end.tv_nsec - start.tv_nsec) / 1e9);
+    return m;
+}
+
+/**
+ *  Refresh the blocks over samples whose elevations changed
+ *  @param[in,out] m  The pyramid, whose grid holds the new elevations
+ *  @param[in] x0  The first changed column
+ *  @param[in] z0  The first changed row
+ *  @param[in] x1  One past the last changed column
+ *  @param[in] z1  One past the last changed row
+ */
+void
+heightmap_update(heightMap * const m, GLuint x0, GLuint z0, GLuint x1,
+                 GLuint z1) {
+    // Block i of level 1 spans samples 2i to 2i + 2
+    GLuint i0 = x0 > 0 ? (x0 - 1) / 2 : 0;
+    GLuint j0 = z0 > 0 ? (z0 - 1) / 2 : 0;
+    GLuint i1 = (x1 - 1) / 2;
+    GLuint j1 = (z1 - 1) / 2;
+    unsigned int l;
+    for(l = 1; l < m->levels; l++) {
+        heightLevel* const level = &m->level[l];
+        i1 = i1 < level->width ? i1 : level->width - 1;
+        j1 = j1 < level->height ? j1 : level->height - 1;
+        GLuint i, j;
+        for(j = j0; j <= j1; j++) {
+            for(i = i0; i <= i1; i++) {
+                level->ranges[(size_t) j * level->width + i]
+                    = build_block(m, l, i, j);
+            }
+        }
+        i0 /= 2;
+        j0 /= 2;
+        i1 /= 2;
+        j1 /= 2;
+    }
+}
+
+void
+heightmap_free(heightMap * const m) {
+    unsigned int i;
+    for(i = 1; i < m->levels; i++) {
+        free( m->level[i].ranges );
+    }
+    grid_free( &m->map.elevation );
+    free( m );
+}
+
+/**
+ *  The elevation between samples, interpolated bilinearly
+ *  @param[in] m  The map
+ *  @param[in] x,z  Samples from the first column and row, clamped to the
+ *                  map
+ *  @return Map units
+ */
+GLfloat
+heightmap_elevation(heightMap const * const m, GLfloat x, GLfloat z) {
+    elevationGrid const * const g = &m->map.elevation;
+    GLfloat const x_max = m->map.mapWidth - 1;
+    GLfloat const z_max = m->map.mapHeight - 1;
+    x = x < 0.0f ? 0.0f : (x > x_max ? x_max : x);
+    z = z < 0.0f ? 0.0f : (z > z_max ? z_max : z);
+
+    GLuint i = (GLuint) x;
+    GLuint j = (GLuint) z;
+    i = i < m->map.mapWidth - 2 ? i : m->map.mapWidth - 2;
+    j = j < m->map.mapHeight - 2 ? j : m->map.mapHeight - 2;
+    GLfloat const u = x - i;
+    GLfloat const v = z - j;
+    GLfloat const top = (1.0f - u) * grid_get(g, i, j)
+                        + u * grid_get(g, i + 1, j);
+    GLfloat const bottom = (1.0f - u) * grid_get(g, i, j + 1)
+                           + u * grid_get(g, i + 1, j + 1);
+    return (1.0f - v) * top + v * bottom;
+}
+
+/**
+ *  The height of the ground under a point, interpolated bilinearly
+ *  @param[in] m  The map
+ *  @param[in] x,z  World coordinates, clamped to the map
+ *  @return World y
+ */
+GLfloat
+height_at(heightMap const * const m, GLfloat x, GLfloat z) {
+    mapData const * const map = &m->map;
+    GLfloat const elevation = heightmap_elevation(m,
+                                                  (x + map->xOffset) / map->scale,
+                                                  (z + map->zOffset) / map->scale);
+    return map->yScale * (elevation - map->minElevation);
+}
+
+/**
+ *  The elevation of the drawn surface in a cell, which is split into two
+ *  triangles along the diagonal the mesh uses for its row
+ *  @param[in] u,v  Position in the cell, 0 to 1
+ */
+static double
+cell_surface(double const h[4], GLuint row, double u, double v) {
+    // h holds the corners (0,0), (1,0), (0,1), (1,1)
+    if(row % 2 == 0) {
+        if(u + v <= 1.0) {
+            return h[0] + u * (h[1] - h[0]) + v * (h[2] - h[0]);
+        }
+        return h[3] + (1.0 - u) * (h[2] - h[3]) + (1.0 - v) * (h[1] - h[3]);
+    }
+    if(u >= v) {
+        return h[0] + u * (h[1] - h[0]) + v * (h[3] - h[1]);
+    }
+    return h[0] + v * (h[2] - h[0]) + u * (h[3] - h[2]);
+}
+
+/**
+ *  Where a ray, between two of its parameters, first goes below the
+ *  surface of a cell
+ *  @return 0 if it stays above it
+ */
+static int
+cell_hit(double * const t_hit, heightMap const * const m, GLuint i, GLuint j,
+         double const o[3], double const d[3], double t_in, double t_out) {
+    elevationGrid const * const g = &m->map.elevation;
+    double const h[4] = { grid_get(g, i, j), grid_get(g, i + 1, j),
+                          grid_get(g, i, j + 1), grid_get(g, i + 1, j + 1) };
+
+    // Split the segment where it crosses the diagonal, so the ray's height
+    // above the surface is linear along each piece
+    double t[3];
+    unsigned int n = 0;
+    t[n++] = t_in;
+    double const across = j % 2 == 0 ? d[0] + d[2] : d[0] - d[2];
+    if(across != 0.0) {
+        double const u0 = o[0] - i;
+        double const v0 = o[2] - j;
+        double const t_diagonal = j % 2 == 0 ? (1.0 - u0 - v0) / across
+                                             : (v0 - u0) / across;
+        if(t_diagonal > t_in && t_diagonal < t_out) {
+            t[n++] = t_diagonal;
+        }
+    }
+    t[n++] = t_out;
+
+    double above[3];
+    unsigned int k;
+    for(k = 0; k < n; k++) {
+        double u = o[0] + d[0] * t[k] - i;
+        double v = o[2] + d[2] * t[k] - j;
+        u = u < 0.0 ? 0.0 : (u > 1.0 ? 1.0 : u);
+        v = v < 0.0 ? 0.0 : (v > 1.0 ? 1.0 : v);
+        above[k] = o[1] + d[1] * t[k] - cell_surface(h, j, u, v);
+    }
+
+    // Rays starting under the ground hit it where they start
+    if(above[0] <= 0.0) {
+        *t_hit = t[0];
+        return 1;
+    }
+    for(k = 1; k < n; k++) {
+        if(above[k] <= 0.0) {
+            *t_hit = t[k - 1] + (t[k] - t[k - 1])
+                                * above[k - 1] / (above[k - 1] - above[k]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ *  The lowest and highest elevation of a block
+ */
+static heightRange
+block_range(heightMap const * const m, unsigned int level, GLuint i,
+            GLuint j) {
+    if(level > 0) {
+        heightLevel const * const l = &m->level[level];
+        return l->ranges[(size_t) j * l->width + i];
+    }
+    elevationGrid const * const g = &m->map.elevation;
+    GLfloat const a = grid_get(g, i, j);
+    GLfloat const b = grid_get(g, i + 1, j);
+    GLfloat const c = grid_get(g, i, j + 1);
+    GLfloat const e = grid_get(g, i + 1, j + 1);
+    heightRange r;
+    r.min = min2(min2(a, b), min2(c, e));
+    r.max = max2(max2(a, b), max2(c, e));
+    return r;
+}
+
+/**
+ *  Fill in a hit from a point of a ray in sample coordinates
+ */
+static void
+set_hit(heightHit * const hit, heightMap const * const m,
+        double const o[3], double const d[3], double t, double length) {
+    mapData const * const map = &m->map;
+    hit->x = o[0] + d[0] * t;
+    hit->z = o[2] + d[2] * t;
+    hit->elevation = o[1] + d[1] * t;
+    vec3_init( &hit->position, map->scale * hit->x - map->xOffset,
+               map->yScale * (hit->elevation - map->minElevation),
+               map->scale * hit->z - map->zOffset );
+    hit->distance = t * length;
+}
+
+/**
+ *  Find where a ray first meets the terrain
+ *  @param[out] hit  Where, if anywhere
+ *  @param[in] m  The map
+ *  @param[in] origin  Start of the ray, world coordinates
+ *  @param[in] direction  Direction of the ray, world coordinates
+ *  @return 0 if the ray misses the map
+ */
+int
+heightmap_pick(heightHit * const hit, heightMap const * const m,
+               vec3 const * const origin, vec3 const * const direction) {
+    mapData const * const map = &m->map;
+    double const width = map->mapWidth - 1;
+    double const height = map->mapHeight - 1;
+    double o[3], d[3];
+    o[0] = (origin->x + map->xOffset) / map->scale;
+    o[1] = origin->y / map->yScale + map->minElevation;
+    o[2] = (origin->z + map->zOffset) / map->scale;
+    d[0] = direction->x / map->scale;
+    d[1] = direction->y / map->yScale;
+    d[2] = direction->z / map->scale;
+    double const world_length = sqrt(direction->x * direction->x
+                                     + direction->y * direction->y
+                                     + direction->z * direction->z);
+    hit->steps = 0;
+
+    // Straight down or up
+    double const flat = sqrt(d[0] * d[0] + d[2] * d[2]);
+    if(flat < 1e-9 * fabs(d[1])) {
+        if(o[0] < 0.0 || o[0] > width || o[2] < 0.0 || o[2] > height
+           || d[1] == 0.0) {
+            return 0;
+        }
+        double const ground = heightmap_elevation(m, o[0], o[2]);
+        double t = (ground - o[1]) / d[1];
+        if(t < 0.0) {
+            if(o[1] > ground) {
+                return 0;
+            }
+            t = 0.0;
+        }
+        hit->steps = 1;
+        set_hit( hit, m, o, d, t, world_length );
+        return 1;
+    }
+
+    // From here on t counts samples travelled across the map
+    unsigned int k;
+    for(k = 0; k < 3; k++) {
+        d[k] /= flat;
+    }
+    double const length = world_length / flat;
+
+    // Clip to the map
+    double t = 0.0, t_end = INFINITY;
+    double const low[2] = { 0.0, 0.0 };
+    double const high[2] = { width, height };
+    for(k = 0; k < 2; k++) {
+        double const p = o[2 * k];
+        double const v = d[2 * k];
+        if(v == 0.0) {
+            if(p < low[k] || p > high[k]) {
+                return 0;
+            }
+            continue;
+        }
+        double const a = (low[k] - p) / v;
+        double const b = (high[k] - p) / v;
+        t = fmax(t, fmin(a, b));
+        t_end = fmin(t_end, fmax(a, b));
+    }
+    if(t > t_end) {
+        return 0;
+    }
+
+    unsigned int const top = m->levels - 1;
+    unsigned int level = top;
+    while(t <= t_end) {
+        hit->steps++;
+        double const size = (double) ((size_t) 1 << level);
+        heightLevel const * const l = &m->level[level];
+
+        // The block the ray is entering
+        double const x = o[0] + d[0] * (t + HEIGHTMAP_EPSILON);
+        double const z = o[2] + d[2] * (t + HEIGHTMAP_EPSILON);
+        double const fi = floor(x / size);
+        double const fj = floor(z / size);
+        GLuint const i = fi < 0.0 ? 0 : (fi >= l->width ? l->width - 1
+                                                        : (GLuint) fi);
+        GLuint const j = fj < 0.0 ? 0 : (fj >= l->height ? l->height - 1
+                                                         : (GLuint) fj);
+
+        // Where it leaves it
+        double t_out = t_end;
+        double const x_low = i * size;
+        double const x_high = fmin((i + 1) * size, width);
+        double const z_low = j * size;
+        double const z_high = fmin((j + 1) * size, height);
+        if(d[0] > 0.0) {
+            t_out = fmin(t_out, (x_high - o[0]) / d[0]);
+        }else if(d[0] < 0.0) {
+            t_out = fmin(t_out, (x_low - o[0]) / d[0]);
+        }
+        if(d[2] > 0.0) {
+            t_out = fmin(t_out, (z_high - o[2]) / d[2]);
+        }else if(d[2] < 0.0) {
+            t_out = fmin(t_out, (z_low - o[2]) / d[2]);
+        }
+        t_out = fmax(t_out, t);
+
+        heightRange const r = block_range(m, level, i, j);
+        double const lowest = o[1] + d[1] * (d[1] < 0.0 ? t_out : t);
+        double const highest = o[1] + d[1] * (d[1] < 0.0 ? t : t_out);
+        if(highest < r.min) {
+            // Under the whole block, so already under the ground
+            set_hit( hit, m, o, d, t, length );
+            return 1;
+        }
+        if(lowest <= r.max) {
+            if(level > 0) {
+                level--;
+                continue;
+            }
+            double t_hit;
+            if(cell_hit( &t_hit, m, i, j, o, d, t, t_out )) {
+                set_hit( hit, m, o, d, t_hit, length );
+                return 1;
+            }
+        }else if(level < top) {
+            level++;
+        }
+
+        // Past the block, always moving forward
+        t = fmax(t_out, t + HEIGHTMAP_EPSILON);
+    }
+    return 0;
+}
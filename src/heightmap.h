@@ -0,0 +1,55 @@
+/**
+ * heightmap.h
+ */
+#ifndef HEIGHTMAP_H
+#define HEIGHTMAP_H
+#include "terrain.h"
+#include "pool.h"
+
+// Enough levels for maps 2^32 samples wide
+#define HEIGHTMAP_MAX_LEVELS    32
+
+// Rows of cells built by one task
+#define HEIGHTMAP_BAND_ROWS     64
+
+typedef struct {
+    GLfloat min;
+    GLfloat max;
+} heightRange;
+
+// The lowest and highest elevation of square blocks of cells, a level's
+// blocks 2^level cells wide. Level 0, the cells between four samples, is
+// read from the grid itself.
+typedef struct {
+    GLuint width;               // Blocks
+    GLuint height;
+    heightRange* ranges;        // Row-major, NULL for level 0
+} heightLevel;
+
+struct heightMap {
+    mapData map;                // Owns the elevation grid
+    unsigned int levels;        // The top level is a single block
+    heightLevel level[HEIGHTMAP_MAX_LEVELS];
+};
+
+// Where a ray met the terrain
+typedef struct {
+    vec3 position;              // World coordinates
+    GLfloat x;                  // Samples from the first column
+    GLfloat z;                  // Samples from the first row
+    GLfloat elevation;          // Map units
+    GLfloat distance;           // Along the ray, world units
+    unsigned int steps;         // Blocks visited on the way
+} heightHit;
+
+size_t heightmap_init(heightMap * const m, mapData const * const mData);
+void heightmap_build(heightMap * const m, threadPool * const pool);
+heightMap* heightmap_create(mapData * const mData, threadPool * const pool);
+void heightmap_update(heightMap * const m, GLuint x0, GLuint z0, GLuint x1,
+                      GLuint z1);
+void heightmap_free(heightMap * const m);
+GLfloat heightmap_elevation(heightMap const * const m, GLfloat x, GLfloat z);
+GLfloat height_at(heightMap const * const m, GLfloat x, GLfloat z);
+int heightmap_pick(heightHit * const hit, heightMap const * const m,
+                   vec3 const * const origin, vec3 const * const direction);
+#endif
@@ -0,0 +1,246 @@
+/**
+ * horizon.c
+ *
+ * Horizon angles: for every sample and each of HORIZON_AZIMUTHS
+ * directions, how high above the horizontal the terrain rises when looking
+ * that way. A sample is lit when the sun is higher than its horizon in the
+ * sun's direction, so shadows for any sun angle cost one lookup.
+ *
+ * Each direction is swept one line of samples at a time, starting from the
+ * end the direction points to. The samples already passed are kept as the
+ * upper convex hull of their (distance, height) points; the horizon of the
+ * next sample is the hull vertex its tangent touches. Vertices under that
+ * tangent can never be the horizon of a sample further back, so they are
+ * popped for good and each line takes time linear in its length.
+ *
+ * Angles are stored in a byte each, 0 for level or below and 255 for
+ * vertical, HORIZON_AZIMUTHS bytes per sample.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "horizon.h"
+#include "trace.h"
+
+static GLint const step_x[HORIZON_AZIMUTHS] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+static GLint const step_z[HORIZON_AZIMUTHS] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+
+typedef struct {
+    GLubyte* horizons;
+    mapData const * mData;
+    unsigned int azimuth;
+    GLuint lines;
+} horizonSweep;
+
+/**
+ *  Quantize the slope of a horizon
+ */
+static GLubyte
+quantize(double slope) {
+    if(slope <= 0.0) {
+        return 0;
+    }
+    return (GLubyte) (atan(slope) / (M_PI / 2.0) * 255.0 + 0.5);
+}
+
+/**
+ *  The first sample of a line of a sweep, on the edge the sweep direction
+ *  points away from
+ */
+static void
+line_start(GLint * const x, GLint * const z, mapData const * const mData,
+           unsigned int azimuth, GLuint line) {
+    GLint const dx = step_x[azimuth];
+    GLint const dz = step_z[azimuth];
+    GLint const edge_x = dx > 0 ? 0 : (GLint) mData->mapWidth - 1;
+    GLint const edge_z = dz > 0 ? 0 : (GLint) mData->mapHeight - 1;
+    if(dz == 0) {
+        *x = edge_x;
+        *z = line;
+    }else if(dx == 0 || line < mData->mapWidth) {
+        *x = line;
+        *z = edge_z;
+    }else {
+        // The other edge, without the corner the first one has
+        *x = edge_x;
+        *z = line - mData->mapWidth + (dz > 0 ? 1 : 0);
+    }
+}
+
+static GLuint
+line_count(mapData const * const mData, unsigned int azimuth) {
+    if(step_z[azimuth] == 0) {
+        return mData->mapHeight;
+    }else if(step_x[azimuth] == 0) {
+        return mData->mapWidth;
+    }
+    return mData->mapWidth + mData->mapHeight - 1;
+}
+
+/**
+ *  Sweep a band of lines of one direction
+ */
+static void
+sweep_band(void * const arg, unsigned int band) {
+    horizonSweep const * const s = arg;
+    mapData const * const mData = s->mData;
+    GLint const dx = step_x[s->azimuth];
+    GLint const dz = step_z[s->azimuth];
+    GLint const width = mData->mapWidth;
+    GLint const height = mData->mapHeight;
+
+    // Distances in elevation units, so slopes don't depend on the scale
+    double const spacing = mData->resolution * (dx != 0 && dz != 0
+                                                ? M_SQRT2 : 1.0);
+    GLuint const longest = width > height ? width : height;
+    GLint* const line_x = malloc(longest * sizeof(*line_x));
+    GLint* const line_z = malloc(longest * sizeof(*line_z));
+    double* const hull_t = malloc(longest * sizeof(*hull_t));
+    double* const hull_h = malloc(longest * sizeof(*hull_h));
+    if(line_x == NULL || line_z == NULL || hull_t == NULL || hull_h == NULL) {
+        fprintf(stderr, "Unable to allocate the horizon sweep\n");
+        exit(1);
+    }
+
+    GLuint const first = band * HORIZON_BAND_LINES;
+    GLuint const last = first + HORIZON_BAND_LINES < s->lines
+                        ? first + HORIZON_BAND_LINES : s->lines;
+    GLuint line;
+    for(line = first; line < last; line++) {
+        GLint x, z;
+        line_start( &x, &z, mData, s->azimuth, line );
+        GLuint n = 0;
+        while(x >= 0 && x < width && z >= 0 && z < height) {
+            line_x[n] = x;
+            line_z[n] = z;
+            n++;
+            x += dx;
+            z += dz;
+        }
+
+        // From the far end back, so the hull holds the samples ahead
+        GLuint top = 0;
+        GLuint i = n;
+        while(i-- > 0) {
+            double const t = i * spacing;
+            double const h = grid_get(&mData->elevation, line_x[i],
+                                      line_z[i]);
+            while(top >= 2
+                  && (hull_h[top - 2] - h) * (hull_t[top - 1] - t)
+                     >= (hull_h[top - 1] - h) * (hull_t[top - 2] - t)) {
+                top--;
+            }
+
+            double slope = 0.0;
+            if(top > 0) {
+                slope = (hull_h[top - 1] - h) / (hull_t[top - 1] - t);
+            }
+            s->horizons[((size_t) line_z[i] * width + line_x[i])
+                        * HORIZON_AZIMUTHS + s->azimuth] = quantize(slope);
+
+            hull_t[top] = t;
+            hull_h[top] = h;
+            top++;
+        }
+    }
+
+    free( hull_h );
+    free( hull_t );
+    free( line_z );
+    free( line_x );
+}
+
+/**
+ *  Find the horizon of every sample in every direction, one direction at
+ *  a time with bands of lines spread across the pool
+ *  @param[out] horizons  HORIZON_AZIMUTHS angles per sample, row-major
+ *  @param[in] mData  The current map
+ *  @param[in] pool  The workers to sweep with
+ */
+void
+compute_horizons(GLubyte * const horizons, mapData const * const mData,
+                 threadPool * const pool) {
+    TRACE_SPAN("horizons");
+    horizonSweep s;
+    s.horizons = horizons;
+    s.mData = mData;
+    for(s.azimuth = 0; s.azimuth < HORIZON_AZIMUTHS; s.azimuth++) {
+        s.lines = line_count(mData, s.azimuth);
+        pool_run( pool, (s.lines + HORIZON_BAND_LINES - 1)
+                        / HORIZON_BAND_LINES, sweep_band, &s );
+    }
+}
+
+/**
+ *  The horizon of one sample found by checking every sample ahead of it,
+ *  to check the sweep against
+ */
+GLubyte
+horizon_brute_force(mapData const * const mData, GLuint x, GLuint z,
+                    unsigned int azimuth) {
+    GLint const dx = step_x[azimuth];
+    GLint const dz = step_z[azimuth];
+    double const spacing = mData->resolution * (dx != 0 && dz != 0
+                                                ? M_SQRT2 : 1.0);
+    double const h = grid_get(&mData->elevation, x, z);
+    double slope = 0.0;
+    GLint px = (GLint) x + dx, pz = (GLint) z + dz;
+    GLuint steps = 1;
+    while(px >= 0 && px < (GLint) mData->mapWidth && pz >= 0
+          && pz < (GLint) mData->mapHeight) {
+        double const s = (grid_get(&mData->elevation, px, pz) - h)
+                         / (steps * spacing);
+        slope = s > slope ? s : slope;
+        px += dx;
+        pz += dz;
+        steps++;
+    }
+    return quantize(slope);
+}
+
+/**
+ *  The direction of the sun, world coordinates: its position rotated like
+ *  get_sun_position() does, seen from the center of the map
+ */
+void
+horizon_sun_direction(vec3 * const d, worldData const * const w) {
+    vec4 position;
+    mat4 ROTATE_SUN;
+    mat4_rotate_x( ROTATE_SUN, w->sun_theta );
+    mat4_mult_v( &position, ROTATE_SUN, &w->sun_light.position );
+    vec3_init( d, position.x, position.y, position.z );
+    vec3_norm( d, d );
+}
+
+/**
+ *  How much of the sun reaches a sample, blending the horizons of the two
+ *  directions either side of the sun. Matches shaders/vshader_gradient.glsl.
+ *  @param[in] horizons  The HORIZON_AZIMUTHS angles of the sample
+ *  @param[in] sun_direction  Unit vector towards the sun
+ *  @return 0 in shadow to 1 in the sun
+ */
+GLfloat
+horizon_sunlight(GLubyte const * const horizons,
+                 vec3 const * const sun_direction) {
+    GLfloat azimuth = 0.0f;
+    if(fabsf(sun_direction->x) + fabsf(sun_direction->z) > 1e-6f) {
+        azimuth = atan2f(sun_direction->z, sun_direction->x)
+                  / (M_PI / 4.0);
+        if(azimuth < 0.0f) {
+            azimuth += HORIZON_AZIMUTHS;
+        }
+    }
+    unsigned int const a = (unsigned int) azimuth % HORIZON_AZIMUTHS;
+    unsigned int const b = (a + 1) % HORIZON_AZIMUTHS;
+    GLfloat const t = azimuth - floorf(azimuth);
+    GLfloat const horizon = ((1.0f - t) * horizons[a] + t * horizons[b])
+                            / 255.0f * (M_PI / 2.0);
+
+    GLfloat const y = sun_direction->y > 1.0f ? 1.0f
+                      : (sun_direction->y < -1.0f ? -1.0f : sun_direction->y);
+    GLfloat const elevation = asinf(y);
+    GLfloat const low = horizon - HORIZON_SOFTNESS;
+    GLfloat k = (elevation - low) / (2.0f * HORIZON_SOFTNESS);
+    k = k < 0.0f ? 0.0f : (k > 1.0f ? 1.0f : k);
+    return k * k * (3.0f - 2.0f * k);
+}
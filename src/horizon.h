@@ -0,0 +1,27 @@
+/**
+ * horizon.h
+ */
+#ifndef HORIZON_H
+#define HORIZON_H
+#include "terrain.h"
+#include "pool.h"
+
+// Directions horizons are found in, every 45 degrees starting at +x and
+// turning towards +z, so each follows grid rows, columns or diagonals
+#define HORIZON_AZIMUTHS    8
+
+// Lines of samples swept by one task
+#define HORIZON_BAND_LINES  64
+
+// Half the width, in radians, of the band of sun elevations over which a
+// sample fades into the shadow of its horizon
+#define HORIZON_SOFTNESS    0.02f
+
+void compute_horizons(GLubyte * const horizons, mapData const * const mData,
+                      threadPool * const pool);
+GLubyte horizon_brute_force(mapData const * const mData, GLuint x, GLuint z,
+                            unsigned int azimuth);
+void horizon_sun_direction(vec3 * const d, worldData const * const w);
+GLfloat horizon_sunlight(GLubyte const * const horizons,
+                         vec3 const * const sun_direction);
+#endif
@@ -0,0 +1,174 @@
+/**
+ * image.c
+ *
+ * Writes RGB images as binary PPM, or as PNG when the path ends in .png.
+ * PNG data is stored in uncompressed deflate blocks so no zlib is needed;
+ * the files are about as large as a PPM.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "image.h"
+
+// Largest stored deflate block
+#define PNG_BLOCK_SIZE 65535
+
+typedef struct {
+    FILE* out;
+    uint32_t crc;
+    uint32_t adler_a;           // Adler-32 of the zlib stream
+    uint32_t adler_b;
+} pngWriter;
+
+static uint32_t crc_table[256];
+
+static void
+init_crc_table() {
+    uint32_t n, k;
+    for(n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for(k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+static void
+png_bytes(pngWriter * const w, void const * const data, size_t size) {
+    unsigned char const * const p = data;
+    size_t i;
+    for(i = 0; i < size; i++) {
+        w->crc = crc_table[(w->crc ^ p[i]) & 0xFF] ^ (w->crc >> 8);
+    }
+    fwrite( data, 1, size, w->out );
+}
+
+static void
+png_u32(pngWriter * const w, uint32_t value) {
+    unsigned char const be[4] = { value >> 24, value >> 16, value >> 8,
+                                  value };
+    png_bytes( w, be, 4 );
+}
+
+/**
+ *  Bytes of the zlib stream, also added to its Adler-32
+ */
+static void
+png_deflated(pngWriter * const w, void const * const data, size_t size) {
+    unsigned char const * const p = data;
+    size_t i;
+    for(i = 0; i < size; i++) {
+        w->adler_a = (w->adler_a + p[i]) % 65521;
+        w->adler_b = (w->adler_b + w->adler_a) % 65521;
+    }
+    png_bytes( w, data, size );
+}
+
+/**
+ *  Start a chunk. Its CRC covers its type and data.
+ */
+static void
+png_chunk(pngWriter * const w, char const * const type, uint32_t length) {
+    unsigned char const be[4] = { length >> 24, length >> 16, length >> 8,
+                                  length };
+    fwrite( be, 1, 4, w->out );
+    w->crc = 0xFFFFFFFFu;
+    png_bytes( w, type, 4 );
+}
+
+static void
+png_end_chunk(pngWriter * const w) {
+    uint32_t const crc = w->crc ^ 0xFFFFFFFFu;
+    png_u32( w, crc );
+}
+
+static void
+write_png(FILE * const out, unsigned char const * const rgb,
+          unsigned int width, unsigned int height) {
+    static unsigned char const signature[8] = { 0x89, 'P', 'N', 'G',
+                                                '\r', '\n', 0x1A, '\n' };
+    init_crc_table();
+    fwrite( signature, 1, sizeof(signature), out );
+
+    pngWriter w;
+    w.out = out;
+    png_chunk( &w, "IHDR", 13 );
+    png_u32( &w, width );
+    png_u32( &w, height );
+    unsigned char const format[5] = { 8, 2, 0, 0, 0 };  // 8 bit RGB
+    png_bytes( &w, format, sizeof(format) );
+    png_end_chunk( &w );
+
+    // Every row starts with filter type 0, then the rows are cut into
+    // stored blocks
+    size_t const row_bytes = 1 + (size_t) width * 3;
+    size_t const raw = row_bytes * height;
+    size_t const blocks = raw > 0 ? (raw + PNG_BLOCK_SIZE - 1) / PNG_BLOCK_SIZE
+                                  : 1;
+    png_chunk( &w, "IDAT", 2 + raw + 5 * blocks + 4 );
+    unsigned char const zlib[2] = { 0x78, 0x01 };
+    png_bytes( &w, zlib, sizeof(zlib) );
+    w.adler_a = 1;
+    w.adler_b = 0;
+
+    size_t offset = 0;
+    size_t block;
+    for(block = 0; block < blocks; block++) {
+        size_t const size = raw - offset < PNG_BLOCK_SIZE ? raw - offset
+                                                          : PNG_BLOCK_SIZE;
+        unsigned char const header[5] = { block + 1 == blocks, size,
+                                          size >> 8, ~size, ~size >> 8 };
+        png_bytes( &w, header, sizeof(header) );
+
+        size_t const end = offset + size;
+        while(offset < end) {
+            size_t const row = offset / row_bytes;
+            size_t const column = offset % row_bytes;
+            size_t n = row_bytes - column;
+            n = n < end - offset ? n : end - offset;
+            if(column == 0) {
+                unsigned char const filter = 0;
+                png_deflated( &w, &filter, 1 );
+                n = 1;
+            }else {
+                png_deflated( &w, rgb + row * (row_bytes - 1) + column - 1,
+                              n );
+            }
+            offset += n;
+        }
+    }
+    png_u32( &w, (w.adler_b << 16) | w.adler_a );
+    png_end_chunk( &w );
+
+    png_chunk( &w, "IEND", 0 );
+    png_end_chunk( &w );
+}
+
+/**
+ *  Write an image
+ *  @param[in] path  The file, PNG if it ends in .png and PPM otherwise
+ *  @param[in] rgb  The pixels, 3 bytes each, top row first
+ *  @param[in] width  Pixels per row
+ *  @param[in] height  Rows
+ *  @return 0 if the file couldn't be written
+ */
+int
+image_write(char const * const path, unsigned char const * const rgb,
+            unsigned int width, unsigned int height) {
+    FILE* const out = fopen(path, "wb");
+    if(out == NULL) {
+        return 0;
+    }
+
+    size_t const length = strlen(path);
+    if(length > 4 && strcmp(path + length - 4, ".png") == 0) {
+        write_png( out, rgb, width, height );
+    }else {
+        fprintf(out, "P6\n%u %u\n255\n", width, height);
+        fwrite( rgb, 3, (size_t) width * height, out );
+    }
+
+    int const ok = !ferror(out);
+    return fclose( out ) == 0 && ok;
+}
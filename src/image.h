@@ -0,0 +1,9 @@
+/**
+ * image.h
+ */
+#ifndef IMAGE_H
+#define IMAGE_H
+
+int image_write(char const * const path, unsigned char const * const rgb,
+                unsigned int width, unsigned int height);
+#endif
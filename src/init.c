@@ -2,10 +2,34 @@
  * init.c
  */
 #include <assert.h>
+#include <limits.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include "init.h"
 #include "terrain.h"
 #include "shader.h"
+#include "mapfile.h"
+#include "parse.h"
+#include "dem.h"
+#include "mosaic.h"
+#include "rowindex.h"
+#include "cache.h"
+#include "normals.h"
+#include "mesh.h"
+#include "lod.h"
+#include "rtin.h"
+#include "pyramid.h"
+#include "stream.h"
+#include "progressive.h"
+#include "replay.h"
+#include "horizon.h"
+#include "heightmap.h"
+#include "update.h"
+#include "watch.h"
+#include "playback.h"
+#include "trace.h"
 
 worldData world;
 cameraData camera;
@@ -23,6 +47,7 @@ init_world_data(worldData * const w) {
 
     // Location and properties of light representing the sun
     w->sun_theta = 0;
+    w->shadows = 0;
     vec4_init( &w->sun_light.position, 0.0f, w->cube_size, 0.0f, 1.0f );
     vec4_init( &w->sun_light.ambient, 1.0f, 1.0f, 1.0f, 1.0f );
     vec4_init( &w->sun_light.diffuse, 1.0f, 1.0f, 1.0f, 1.0f );
@@ -33,6 +58,26 @@ init_world_data(worldData * const w) {
     vec4_init( &w->ground_material.diffuse, 1.0f, 1.0f, 1.0f, 1.0f );
     vec4_init( &w->ground_material.specular, 0.2f, 0.2f, 0.2f, 1.0f );
     w->ground_material.shininess = 30.0f;
+
+    // Projection, updated by reshape()
+    w->fovy = 45.0f;
+    w->viewport_width = 1;
+    w->viewport_height = 1;
+    w->heights = NULL;
+    w->follow_ground = 0;
+    w->cursor[0] = '\0';
+    mat4_create_i( w->projection );
+    w->cull = 1;
+
+    w->num_triangles = 0;
+    w->lod = NULL;
+    w->stream = NULL;
+    w->loader = NULL;
+    w->recorder = NULL;
+    w->replay = NULL;
+    w->updater = NULL;
+    w->watch = NULL;
+    w->player = NULL;
 }
 
 void 
@@ -52,19 +97,28 @@ init_camera_data(cameraData * const c, GLfloat cube_size) {
 }
 
 /**
- *  Load and store map data from a file
- *  @param[out] mData  The map data read from the file
- *  @param[in] fileData  The file to read from
- *  @param[in] worldData  The current world
+ *  Number of seconds elapsed since a starting time
+ *  @param[in] start  The starting time from CLOCK_MONOTONIC
  */
-void 
-load_file(mapData * const mData, 
-          FILE * const fileData, 
-          worldData const * const w) {
-    // Read map height/width and initialize scaling coefficients
-    fscanf( fileData, "%u", &mData->mapWidth );
-    fscanf( fileData, "%u", &mData->mapHeight );
+static double
+seconds_since(struct timespec const * const start) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
 
+/**
+ *  Initialize the scaling coefficients that map grid indices and
+ *  elevations to world coordinates
+ *  @param[in,out] mData  The map, with its width and height already set
+ *  @param[in] w  The current world
+ *  @param[in] resolution  The distance between two samples, in elevation
+ *                         units
+ */
+static void
+set_map_scale(mapData * const mData, 
+              worldData const * const w, 
+              GLfloat resolution) {
     GLfloat const fx = (GLfloat) mData->mapWidth;
     GLfloat const fz = (GLfloat) mData->mapHeight;
 
@@ -77,343 +131,517 @@ load_file(mapData * const mData,
     mData->zOffset = (mData->scale * fz) / 2.0f;
 
     // Resolution
-    GLfloat resolution;
-    fscanf( fileData, "%f", &resolution );
+    mData->resolution = resolution;
     mData->yScale = mData->scale / resolution;
+}
+
+/**
+ *  Allocate the elevation grid of a map
+ *  @param[in,out] mData  The map, with its width and height already set
+ *  @param[in] layout  The memory layout of the grid
+ */
+static void
+alloc_elevation_data(mapData * const mData, gridLayout layout) {
+    if(!grid_init( &mData->elevation, mData->mapWidth, mData->mapHeight,
+                   layout )) {
+        fprintf(stderr, "Unable to allocate %u x %u elevation samples\n",
+                mData->mapWidth, mData->mapHeight);
+        exit(1);
+    }
+}
 
-    GLfloat maxElevation = 0.0f;
-    GLfloat minElevation = 0.0f;
-    mData->elevationData = malloc(mData->mapHeight 
-                                  * sizeof(*mData->elevationData));
-    unsigned int row, col;
+/**
+ *  Load map data from a valid cache instead of parsing the source file
+ *  @param[out] mData  The map data stored in the cache
+ *  @param[in] cache  The cache opened for the source file
+ *  @param[in] w  The current world
+ *  @param[in] opts  The command line options
+ */
+static void
+load_cache(mapData * const mData,
+           terrainCache const * const cache,
+           worldData const * const w,
+           optionsData const * const opts) {
+    TRACE_SPAN("load_cache");
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    cacheHeader const * const h = cache->header;
+    mData->mapWidth = h->mapWidth;
+    mData->mapHeight = h->mapHeight;
+    mData->minElevation = h->minElevation;
+    mData->maxElevation = h->maxElevation;
+    set_map_scale( mData, w, h->resolution );
+    alloc_elevation_data( mData, opts->layout );
+
+    unsigned int row;
     for(row = 0; row < mData->mapHeight; row++) {
-        mData->elevationData[row] = malloc(mData->mapWidth 
-                                        * sizeof(*mData->elevationData[row]));
-        for(col = 0; col < mData->mapWidth; col++) {
-            GLfloat input;
-            fscanf( fileData, "%f", &input ); 
-            if(input < 0.0f) {
-                input = 0.0f;
-            }
-            mData->elevationData[row][col] = input;
-            if(input > maxElevation) {
-                maxElevation = input;
-            }
+        grid_write_row( &mData->elevation, row, 0, mData->mapWidth,
+                        cache->heights + (size_t) row * mData->mapWidth );
+    }
+
+    printf("Loaded %u x %u samples from cache in %.3f s\n",
+           mData->mapWidth, mData->mapHeight, seconds_since( &start ));
+}
+
+/**
+ *  Load a binary elevation file by converting its mapped samples
+ *  @param[out] mData  The map data read from the file
+ *  @param[in] fileData  The file to read from, closed here
+ *  @param[in] w  The current world
+ *  @param[in] opts  The command line options, naming the file
+ *  @param[in] format  The format of the file
+ */
+static void
+load_dem(mapData * const mData, FILE * const fileData,
+         worldData const * const w, optionsData const * const opts,
+         demFormat format) {
+    TRACE_SPAN("load_dem");
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
 
-            if(input > 0.0f) {
-                if(minElevation == 0.0f || input < minElevation) {
-                    minElevation = input;
-                }
+    mappedFile file;
+    if(map_file( &file, fileno( fileData ) ) != 0) {
+        perror( "Unable to read elevation data" );
+        exit(1);
+    }
+    demHeader h;
+    if(!dem_read_header( &h, opts->path, format, file.size )) {
+        exit(1);
+    }
+    mData->mapWidth = h.width;
+    mData->mapHeight = h.height;
+    set_map_scale( mData, w, h.resolution );
+    alloc_elevation_data( mData, opts->layout );
+
+    demResult result;
+    dem_convert( &result, &mData->elevation, &h, file.data, w->pool );
+    mData->minElevation = result.minElevation;
+    mData->maxElevation = result.maxElevation;
+
+    double const megabytes = file.size / 1e6;
+    unmap_file( &file );
+    fclose( fileData );
+
+    double const elapsed = seconds_since( &start );
+    printf("Loaded %u x %u %s samples (%.1f MB) in %.3f s, %.1f MB/s, "
+           "%zu without data\n", mData->mapWidth, mData->mapHeight,
+           dem_format_name(format), megabytes, elapsed, megabytes / elapsed,
+           result.nodata);
+}
+
+/**
+ *  Stitch the tiles of a mosaic into one map
+ */
+static void
+load_mosaic(mapData * const mData, worldData const * const w,
+            optionsData const * const opts) {
+    TRACE_SPAN("load_mosaic");
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    mosaic m;
+    if(!mosaic_open( &m, opts->mosaic, opts->tiles, opts->num_tiles )) {
+        exit(1);
+    }
+    mData->mapWidth = m.width;
+    mData->mapHeight = m.height;
+    set_map_scale( mData, w, m.resolution );
+    alloc_elevation_data( mData, opts->layout );
+
+    demResult result;
+    mosaic_load( &result, &mData->elevation, &m, w->pool );
+    mData->minElevation = result.minElevation;
+    mData->maxElevation = result.maxElevation;
+
+    printf("Stitched %u tiles into %u x %u samples in %.3f s, %zu without"
+           " data\n", m.count, mData->mapWidth, mData->mapHeight,
+           seconds_since( &start ), result.nodata);
+    mosaic_free( &m );
+}
+
+/**
+ *  Parse a window of a text file, finding its rows through the file's
+ *  .tvi index, which is built and written the first time
+ */
+static void
+load_crop(mapData * const mData, FILE * const fileData,
+          worldData const * const w, optionsData const * const opts) {
+    TRACE_SPAN("load_crop");
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    mappedFile file;
+    if(map_file( &file, fileno( fileData ) ) != 0) {
+        perror( "Unable to read elevation data" );
+        exit(1);
+    }
+    rowIndex idx;
+    if(!opts->use_cache || !rowindex_open( &idx, opts->path )) {
+        if(!rowindex_build( &idx, file.data, file.size, w->pool )) {
+            exit(1);
+        }
+        printf("Indexed %u rows of %s in %.3f s\n", idx.height, opts->path,
+               seconds_since( &start ));
+        if(opts->use_cache) {
+            if(rowindex_write( &idx, opts->path )) {
+                printf("Wrote index %s%s\n", opts->path, ROWINDEX_EXTENSION);
+            }else {
+                fprintf(stderr, "Unable to write index %s%s\n", opts->path,
+                        ROWINDEX_EXTENSION);
             }
         }
+        clock_gettime( CLOCK_MONOTONIC, &start );
+    }
+    if((size_t) opts->crop_x + opts->crop_width > idx.width
+       || (size_t) opts->crop_z + opts->crop_height > idx.height) {
+        fprintf(stderr, "--crop %u,%u,%u,%u is outside the %u x %u"
+                        " samples of %s\n", opts->crop_x, opts->crop_z,
+                opts->crop_width, opts->crop_height, idx.width, idx.height,
+                opts->path);
+        exit(1);
+    }
+
+    mData->mapWidth = opts->crop_width;
+    mData->mapHeight = opts->crop_height;
+    set_map_scale( mData, w, idx.resolution );
+    alloc_elevation_data( mData, opts->layout );
+
+    parseResult result;
+    rowindex_parse( &result, &mData->elevation, &idx, file.data, file.size,
+                    opts->crop_x, opts->crop_z, w->pool );
+    if(result.error != NULL) {
+        fprintf(stderr, "Invalid elevation value at byte %zu\n",
+                (size_t) (result.error - file.data));
+        exit(1);
     }
+    mData->maxElevation = result.maxElevation;
+    mData->minElevation = result.minElevation;
+
+    GLuint const width = idx.width, height = idx.height;
+    rowindex_close( &idx );
+    unmap_file( &file );
     fclose( fileData );
 
-    mData->maxElevation = maxElevation;
-    mData->minElevation = minElevation;
+    printf("Parsed %u x %u samples at %u,%u of %u x %u in %.3f s\n",
+           mData->mapWidth, mData->mapHeight, opts->crop_x, opts->crop_z,
+           width, height, seconds_since( &start ));
 }
 
 /**
- *  Convert a point from the (x,z) index to the a 4-dimensional point in
- *  world coordinates
- *  @param[out] v  The 4 dimensional point in world coordinates
- *  @param[in] x  The x index of the point in the map
- *  @param[in] z  The z index of the point in the map
- *  @param[in] mData  The current map
+ *  Load and store map data from a file
+ *  @param[out] mData  The map data read from the file
+ *  @param[in] fileData  The file to read from
+ *  @param[in] worldData  The current world
+ *  @param[in] opts  The command line options
  */
 void 
-make_vertex(vec4 * const v, int x, int z, mapData const * const mData) {
-    v->x = mData->scale * x - mData->xOffset;
+load_file(mapData * const mData, 
+          FILE * const fileData, 
+          worldData const * const w,
+          optionsData const * const opts) {
+    if(opts->mosaic != NULL || opts->num_tiles > 0) {
+        load_mosaic( mData, w, opts );
+        return;
+    }
+    demFormat const format = opts->path != NULL ? dem_detect(opts->path)
+                                                : DEM_TEXT;
+    if(format != DEM_TEXT) {
+        if(opts->crop) {
+            fprintf(stderr, "--crop needs a text elevation file\n");
+            exit(1);
+        }
+        load_dem( mData, fileData, w, opts, format );
+        return;
+    }
+    if(opts->crop) {
+        load_crop( mData, fileData, w, opts );
+        return;
+    }
+
+    TRACE_SPAN("load_file");
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
 
-    GLfloat const y = mData->elevationData[z][x] - mData->minElevation;
-    v->y = mData->yScale * y;
+    // Map the whole file (or slurp stdin) instead of going through stdio
+    mappedFile file;
+    if(map_file( &file, fileno( fileData ) ) != 0) {
+        perror( "Unable to read elevation data" );
+        exit(1);
+    }
+    char const * s = file.data;
+    char const * const end = file.data + file.size;
+
+    // Read map height/width and initialize scaling coefficients
+    GLfloat resolution;
+    if(!parse_uint( &s, end, &mData->mapWidth ) 
+       || !parse_uint( &s, end, &mData->mapHeight )
+       || parse_float( &s, end, &resolution ) != 1) {
+        fprintf(stderr, "Invalid elevation file header\n");
+        exit(1);
+    }
+    if(mData->mapWidth < 2 || mData->mapHeight < 2) {
+        fprintf(stderr, "Elevation data must be at least 2 x 2 samples\n");
+        exit(1);
+    }
+
+    set_map_scale( mData, w, resolution );
+    alloc_elevation_data( mData, opts->layout );
+
+    size_t const samples = (size_t) mData->mapWidth * mData->mapHeight;
+    parseResult result;
+    parse_elevations( &result, &mData->elevation, s, end, w->pool );
+    if(result.error != NULL) {
+        fprintf(stderr, "Invalid elevation value at byte %zu\n",
+                (size_t) (result.error - file.data));
+        exit(1);
+    }
+    if(result.count < samples) {
+        fprintf(stderr, "Expected %zu elevation values, found %zu\n",
+                samples, result.count);
+        exit(1);
+    }
+
+    double const megabytes = file.size / 1e6;
+    unmap_file( &file );
+    fclose( fileData );
 
-    v->z = mData->scale * z - mData->zOffset;
-    v->w = 1.0f;
+    mData->maxElevation = result.maxElevation;
+    mData->minElevation = result.minElevation;
+
+    double const elapsed = seconds_since( &start );
+    printf("Parsed %u x %u samples (%.1f MB) in %.3f s, %.1f MB/s\n",
+           mData->mapWidth, mData->mapHeight, megabytes, elapsed,
+           megabytes / elapsed);
 }
 
 /**
- *  Given (x,z) find the normal for (a)   
- *      + 
- *    a | b
- *  +-(x,z)-+ 
- *    d | c 
- *      +
- *  @param[out] n  The flat normal
- *  @param[in] x  The x index of the point in the map
- *  @param[in] z  The z index of the point in the map
+ *  Print the memory the chosen mesh layout takes next to the other layouts
  *  @param[in] mData  The current map
+ *  @param[in] mesh  The layout that will be drawn
+ *  @param[in] compact  Whether the indexed layouts use compact vertices
  */
-void
-make_normal_top_left(vec3 * const n, int x, int z, mapData const * const mData) {
-    if(x <= 0 || z <= 0) {
-       vec3_init( n, 0.0f, 0.0f, 0.0f );
-       return;
-    }
-    vec4 vertex;
-    make_vertex( &vertex, x, z, mData );
-
-    vec4 u;
-    vec4 vertex_d;
-    make_vertex( &vertex_d, x-1, z, mData );
-    vec4_sub(&u, &vertex, &vertex_d );
-
-    vec4 v;
-    make_vertex( &vertex_d, x, z-1, mData );
-    vec4_sub(&v, &vertex_d, &vertex );
-    
-    vec3 c;
-    vec4_cross( &c, &u, &v );
-    vec3_norm( n, &c );
+static void
+report_mesh_size(mapData const * const mData, meshMode mesh, int compact) {
+    static meshMode const layouts[] = { MESH_STRIP, MESH_INDEXED, 
+                                        MESH_TRIANGLES, MESH_CHUNKED };
+    unsigned int i;
+    for(i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        size_t const vertex_bytes = (compact && layouts[i] != MESH_STRIP)
+                                    ? sizeof(compactVertex)
+                                    : sizeof(vec4) + sizeof(vec3);
+        size_t const v = mesh_vertex_count(layouts[i], mData->mapWidth,
+                                           mData->mapHeight);
+        size_t const n = mesh_index_count(layouts[i], mData->mapWidth,
+                                          mData->mapHeight);
+        printf("%c %-9s %10zu vertices (%7.1f MB) + %10zu indices "
+               "(%7.1f MB) = %7.1f MB\n",
+               layouts[i] == mesh ? '*' : ' ', mesh_mode_name(layouts[i]),
+               v, v * vertex_bytes / 1e6, n, n * sizeof(GLuint) / 1e6,
+               (v * vertex_bytes + n * sizeof(GLuint)) / 1e6);
+    }
 }
 
 /**
- *  Given (x,z) find the normal for (b)   
- *      + 
- *    a | b
- *  +-(x,z)-+ 
- *    d | c 
- *      +
- *  @param[out] n  The flat normal
- *  @param[in] x  The x index of the point in the map
- *  @param[in] z  The z index of the point in the map
+ *  Print how far an RTIN mesh got below the triangles of the full grid
  *  @param[in] mData  The current map
+ *  @param[in] rtin  The mesh
+ *  @param[in] max_error  The error it was built for
  */
-void
-make_normal_top_right(vec3 * const n, int x, int z, mapData const * const mData) {
-    if(x >= mData->mapWidth - 1 || z <= 0) {
-       vec3_init( n, 0.0f, 0.0f, 0.0f );
-       return;
-    }
-    vec4 vertex;
-    make_vertex( &vertex, x, z, mData );
-
-    vec4 u;
-    vec4 vertex_d;
-    make_vertex( &vertex_d, x, z-1, mData );
-    vec4_sub(&u, &vertex, &vertex_d );
-
-    vec4 v;
-    make_vertex( &vertex_d, x+1, z, mData );
-    vec4_sub(&v, &vertex_d, &vertex );
-    
-    vec3 c;
-    vec4_cross( &c, &u, &v );
-    vec3_norm( n, &c );
+static void
+report_rtin(mapData const * const mData, rtinMesh const * const rtin,
+            GLfloat max_error) {
+    double const full = 2.0 * (mData->mapWidth - 1) * (mData->mapHeight - 1);
+    printf("  rtin      %10zu triangles, %.2f%% of the full grid (%.1f MB of "
+           "indices)\n", rtin->triangles, 100.0 * rtin->triangles / full,
+           3 * rtin->triangles * sizeof(GLuint) / 1e6);
+    printf("  rtin      error max %g mean %g, limit %g\n",
+           rtin->max_error, rtin->mean_error, max_error);
 }
 
 /**
- *  Given (x,z) find the normal for (c)   
- *      + 
- *    a | b
- *  +-(x,z)-+ 
- *    d | c 
- *      +
- *  @param[out] n  The flat normal
- *  @param[in] x  The x index of the point in the map
- *  @param[in] z  The z index of the point in the map
- *  @param[in] mData  The current map
+ *  Write the cache for the source file and report the outcome
  */
-void
-make_normal_bot_right(vec3 * const n, int x, int z, mapData const * const mData) {
-    if(x >= mData->mapWidth - 1 || z >= mData->mapHeight - 1) {
-       vec3_init( n, 0.0f, 0.0f, 0.0f );
-       return;
-    }
-    vec4 vertex;
-    make_vertex( &vertex, x, z, mData );
-
-    vec4 u;
-    vec4 vertex_d;
-    make_vertex( &vertex_d, x+1, z, mData );
-    vec4_sub(&u, &vertex, &vertex_d );
-
-    vec4 v;
-    make_vertex( &vertex_d, x, z+1, mData );
-    vec4_sub(&v, &vertex_d, &vertex );
-    
-    vec3 c;
-    vec4_cross( &c, &u, &v );
-    vec3_norm( n, &c );
+static void
+write_cache(char const * const path, mapData const * const mData,
+            meshMode mesh, normalMode normal_mode,
+            vec4 const * const vertices, vec3 const * const normals,
+            GLuint num_vertices, GLubyte const * const horizons) {
+    TRACE_SPAN("write_cache");
+    if(cache_write( path, mData, mesh, normal_mode, vertices, normals,
+                    num_vertices, horizons )) {
+        printf("Wrote cache %s%s\n", path, CACHE_EXTENSION);
+    }else {
+        fprintf(stderr, "Unable to write cache %s%s\n", 
+                path, CACHE_EXTENSION);
+    }
 }
 
 /**
- *  Given (x,z) find the normal for (d)   
- *      + 
- *    a | b
- *  +-(x,z)-+ 
- *    d | c 
- *      +
- *  @param[out] n  The flat normal
- *  @param[in] x  The x index of the point in the map
- *  @param[in] z  The z index of the point in the map
- *  @param[in] mData  The current map
+ *  Store the heights in 16 bits when --quantize allows it
  */
-void
-make_normal_bot_left(vec3 * const n, int x, int z, mapData const * const mData) {
-    if(x <= 0 || z >= mData->mapHeight - 1) {
-       vec3_init( n, 0.0f, 0.0f, 0.0f );
-       return;
-    }
-    vec4 vertex;
-    make_vertex( &vertex, x, z, mData );
-
-    vec4 u;
-    vec4 vertex_d;
-    make_vertex( &vertex_d, x, z+1, mData );
-    vec4_sub(&u, &vertex, &vertex_d );
-
-    vec4 v;
-    make_vertex( &vertex_d, x-1, z, mData );
-    vec4_sub(&v, &vertex_d, &vertex );
-    
-    vec3 c;
-    vec4_cross( &c, &u, &v );
-    vec3_norm( n, &c );
+static void
+quantize_heights(mapData * const mData, optionsData const * const opts) {
+    if(opts->quantize < 0.0f) {
+        return;
+    }
+    TRACE_SPAN("quantize");
+    size_t const bytes = grid_bytes(&mData->elevation);
+    GLfloat error;
+    if(grid_quantize( &mData->elevation, opts->quantize, &error )) {
+        printf("Stored heights in 16 bits, steps of %g, largest error %g "
+               "(%.1f MB instead of %.1f MB)\n", mData->elevation.qscale,
+               error, grid_bytes(&mData->elevation) / 1e6, bytes / 1e6);
+    }else {
+        printf("Kept 32 bit heights, 16 bits would be off by %g, more "
+               "than %g\n", error, opts->quantize);
+    }
 }
 
-
 /**
- *  Return the normal for a given point by averaging the flat normals of 
- *  the faces surrounding it.
- *  @param[out] v  The averaged normal
- *  @param[in] x  The x index of the point in the map
- *  @param[in] z  The z index of the point in the map
- *  @param[in] mData  The current map 
+ *  Load the elevations of a map from its cache when it has a valid one,
+ *  otherwise parse the file and cache its heights
+ *  @param[out] mData  The map data
+ *  @param[in] file  The file to read from, closed here
+ *  @param[in] w  The current world
+ *  @param[in] opts  The command line options
  */
 void
-get_average_normal(vec3 * const v, 
-                   unsigned int x, 
-                   unsigned int z, 
-                   mapData const * const mData) {
-    vec3 n1 = { 0.0f, 0.0f, 0.0f };
-    vec3 n2 = { 0.0f, 0.0f, 0.0f };
-    vec3 n3 = { 0.0f, 0.0f, 0.0f };
-    vec3 n4 = { 0.0f, 0.0f, 0.0f };
-    make_normal_top_left( &n1, x, z, mData );
-    make_normal_top_right( &n2, x, z, mData );
-    make_normal_bot_left( &n3, x, z, mData );
-    make_normal_bot_right( &n4, x, z, mData );
-
-    vec3 sum;
-    vec3_add( &sum, &n3, &n4 );
-    vec3_add( &sum, &n2, &sum );
-    vec3_add( &sum, &n1, &sum );
-    vec3_norm( v, &sum );
+load_map(mapData * const mData, FILE * const file, worldData const * const w,
+         optionsData const * const opts) {
+    int const can_cache = opts->use_cache && opts->path != NULL
+                          && !opts->crop;
+    terrainCache cache;
+    if(can_cache && cache_open( &cache, opts->path )) {
+        load_cache( mData, &cache, w, opts );
+        cache_close( &cache );
+        fclose( file );
+        quantize_heights( mData, opts );
+        return;
+    }
+    load_file( mData, file, w, opts );
+    if(can_cache) {
+        write_cache( opts->path, mData, opts->mesh, opts->normals, NULL,
+                     NULL, 0, NULL );
+    }
+    quantize_heights( mData, opts );
 }
 
 /**
- *  Initialize the display state using elevation data from a FILE
- *  @param[in] file  The file to load the elevation data from. 
+ *  Find the horizons of every sample and report how long it took
+ *  @return The horizons, HORIZON_AZIMUTHS per sample
  */
-void
-init(FILE* const file) {
-    init_world_data( &world );
-    init_camera_data( &camera, world.cube_size );
-
-    mapData mData;
-    load_file( &mData, file, &world );
-
-    world.num_vertices = (mData.mapHeight - 1) * (mData.mapWidth * 2) + 2;
-
-    vec4* const vertices = malloc(world.num_vertices * sizeof(*vertices));
-    vec3* const normals = malloc(world.num_vertices * sizeof(*normals));
-
-    // Calculate position of each vertex and the associated normal
-    int v_index = 0;
-    unsigned int z, x;
-    for(z = 0; z < mData.mapHeight - 1; z++) {
-        // Strip triangles
-        if(z % 2 == 0) {
-            // Even rows go left to right
-            for(x = 0; x < mData.mapWidth; x++) {
-                make_vertex( &vertices[v_index], x, z, &mData );
-                get_average_normal( &normals[v_index], x, z, &mData );
-                v_index++;
-
-                make_vertex( &vertices[v_index], x, z+1, &mData );
-                get_average_normal( &normals[v_index], x, z+1, &mData );
-                v_index++;
-            }
-
-            // Add degenerate triangles at end of row
-            if(z != mData.mapHeight - 2) {
-                make_vertex( &vertices[v_index], x-1, z, &mData );
-                get_average_normal( &normals[v_index], x-1, z, &mData );
-                v_index++;
-            }else {
-                make_vertex( &vertices[v_index], x-1, z, &mData );
-                get_average_normal( &normals[v_index], x-1, z, &mData );
-                v_index++;
-                make_vertex( &vertices[v_index], x-1, z+1, &mData );
-                get_average_normal( &normals[v_index], x-1, z+1, &mData );
-                v_index++;
-            }
-        }else {
-            // Odd rows go right to left
-            for(x = mData.mapWidth - 1; x > 0; x--) {
-                make_vertex( &vertices[v_index], x, z, &mData );
-                get_average_normal( &normals[v_index], x, z, &mData );
-                v_index++;
-                make_vertex( &vertices[v_index], x, z+1, &mData );
-                get_average_normal( &normals[v_index], x, z+1, &mData );
-                v_index++;
-            }
-
-            if(z != mData.mapHeight - 2) {
-                make_vertex( &vertices[v_index], x, z, &mData );
-                get_average_normal( &normals[v_index], x, z, &mData );
-                v_index++;
-            }else {
-                make_vertex( &vertices[v_index], x, z, &mData );
-                get_average_normal( &normals[v_index], x, z, &mData );
-                v_index++;
-                make_vertex(&vertices[v_index], x, z+1, &mData);
-                get_average_normal( &normals[v_index], x, z+1, &mData );
-                v_index++;
-            }
-        }
+GLubyte*
+build_horizons(mapData const * const mData, threadPool * const pool) {
+    size_t const samples = (size_t) mData->mapWidth * mData->mapHeight;
+    GLubyte* const horizons = malloc(samples * HORIZON_AZIMUTHS);
+    if(horizons == NULL) {
+        fprintf(stderr, "Unable to allocate the horizons of %zu samples\n",
+                samples);
+        exit(1);
     }
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    compute_horizons( horizons, mData, pool );
+    double const elapsed = seconds_since( &start );
+    printf("Found horizons in %u directions (%.1f MB) in %.3f s, "
+           "%.1f Msamples/s\n", HORIZON_AZIMUTHS,
+           samples * HORIZON_AZIMUTHS / 1e6, elapsed, samples / elapsed / 1e6);
+    return horizons;
+}
 
-    // Create a vertex array object
-    GLuint vao[1];
-    glGenVertexArrays( 1, &vao[0] );
-    glBindVertexArray( vao[0] );
-    
-    // Create and initialize a buffer object
-    GLuint buffer;
-    glGenBuffers( 1, &buffer );
-    glBindBuffer( GL_ARRAY_BUFFER, buffer );
+/**
+ *  Point the compact vertex shader at the compact vertices and give it
+ *  what it needs to rebuild world positions from them
+ *  @param[in] program  The compact shader program
+ *  @param[in] mData  The current map
+ *  @param[in] q  The quantizer used for the heights
+ */
+static void
+init_compact_attributes(GLuint program, mapData const * const mData,
+                        heightQuantizer const * const q) {
+    GLuint const vGrid = glGetAttribLocation( program, "vGrid" );
+    glEnableVertexAttribArray( vGrid );
+    glVertexAttribPointer( vGrid, 3, GL_UNSIGNED_SHORT, GL_FALSE, 
+                           sizeof(compactVertex), 
+                           BUFFER_OFFSET(offsetof(compactVertex, x)) );
 
-    // Allocate buffer
-    size_t vertexSize = world.num_vertices * sizeof(vec4);
-    size_t normalSize = world.num_vertices * sizeof(vec3);
-    glBufferData( GL_ARRAY_BUFFER,vertexSize + normalSize,NULL,GL_STATIC_DRAW );
+    GLuint const vOctNormal = glGetAttribLocation( program, "vOctNormal" );
+    glEnableVertexAttribArray( vOctNormal );
+    glVertexAttribPointer( vOctNormal, 2, GL_UNSIGNED_BYTE, GL_TRUE, 
+                           sizeof(compactVertex), 
+                           BUFFER_OFFSET(offsetof(compactVertex, normal)) );
 
-        // Store the vertices as sub buffers
-        glBufferSubData( GL_ARRAY_BUFFER, 0, vertexSize, vertices );
-        glBufferSubData( GL_ARRAY_BUFFER, vertexSize, normalSize, normals );
+    // Same mapping as make_vertex(), applied to the decoded height
+    glUniform1f( glGetUniformLocation( program, "grid_scale" ), 
+                 mData->scale );
+    glUniform2f( glGetUniformLocation( program, "grid_offset" ), 
+                 mData->xOffset, mData->zOffset );
+    glUniform1f( glGetUniformLocation( program, "height_scale" ), 
+                 mData->yScale * q->step );
+    glUniform1f( glGetUniformLocation( program, "height_offset" ), 
+                 mData->yScale * (q->low - mData->minElevation) );
+}
 
-    GLuint const program = init_shader( "shaders/vshader_gradient.glsl",
+/**
+ *  Load the shaders and set up their attributes and the uniforms that
+ *  don't change between frames
+ *  @param[in] mData  The current map
+ *  @param[in] compact  The quantizer of compact vertices, NULL for float
+ *                      vertices
+ *  @param[in] vertexSize  The bytes of float positions before the normals
+ *  @param[in] horizonOffset  Where the horizons start in the vertex
+ *                            buffer, 0 if there are none
+ *  @return The program
+ */
+static GLuint
+init_program(mapData const * const mData, 
+             heightQuantizer const * const compact,
+             size_t vertexSize, size_t horizonOffset) {
+    GLuint const program = init_shader( compact != NULL
+                                        ? "shaders/vshader_compact.glsl"
+                                        : "shaders/vshader_gradient.glsl",
                                         "shaders/fshader_gradient.glsl" );
     glUseProgram( program );
     
-    // Initialize the vertex position attribute from the vertex shader
-    GLuint const vPosition = glGetAttribLocation( program, "vPosition" );
-    glEnableVertexAttribArray( vPosition );
-    glVertexAttribPointer( vPosition, 4, GL_FLOAT, GL_FALSE, 0, 
-                           BUFFER_OFFSET(0) );
-    
-    // Initialize the normal position attribute from the vertex shader
-    GLuint const vNormal = glGetAttribLocation( program, "vNormal" );
-    glEnableVertexAttribArray( vNormal );
-    glVertexAttribPointer( vNormal, 3, GL_FLOAT, GL_FALSE,0, 
-                           BUFFER_OFFSET(vertexSize) );
+    if(compact != NULL) {
+        init_compact_attributes( program, mData, compact );
+    }else {
+        // Initialize the vertex position attribute from the vertex shader
+        GLuint const vPosition = glGetAttribLocation( program, "vPosition" );
+        glEnableVertexAttribArray( vPosition );
+        glVertexAttribPointer( vPosition, 4, GL_FLOAT, GL_FALSE, 0, 
+                               BUFFER_OFFSET(0) );
+        
+        // Initialize the normal position attribute from the vertex shader
+        GLuint const vNormal = glGetAttribLocation( program, "vNormal" );
+        glEnableVertexAttribArray( vNormal );
+        glVertexAttribPointer( vNormal, 3, GL_FLOAT, GL_FALSE,0, 
+                               BUFFER_OFFSET(vertexSize) );
+    }
+
+    // Horizons are bytes normalized to [0, 1], four directions each
+    world.shadows = (horizonOffset > 0);
+    world.sun_direction_pos = glGetUniformLocation( program, "sun_direction" );
+    glUniform1f( glGetUniformLocation( program, "shadows" ),
+                 world.shadows ? 1.0f : 0.0f );
+    if(world.shadows) {
+        GLuint const vHorizon0 = glGetAttribLocation( program, "vHorizon0" );
+        GLuint const vHorizon1 = glGetAttribLocation( program, "vHorizon1" );
+        glEnableVertexAttribArray( vHorizon0 );
+        glVertexAttribPointer( vHorizon0, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+                               HORIZON_AZIMUTHS,
+                               BUFFER_OFFSET(horizonOffset) );
+        glEnableVertexAttribArray( vHorizon1 );
+        glVertexAttribPointer( vHorizon1, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+                               HORIZON_AZIMUTHS,
+                               BUFFER_OFFSET(horizonOffset + 4) );
+    }
 
     // Send max elevation in world coordinates so that shader can compute
     // the correct gradient color
-    GLfloat const max_elevation = mData.yScale 
-                                  * (mData.maxElevation - mData.minElevation);
+    GLfloat const max_elevation = mData->yScale 
+                                  * (mData->maxElevation - mData->minElevation);
     glUniform1f( glGetUniformLocation( program, "max_elevation" ),
                  max_elevation );
 
@@ -457,12 +685,423 @@ init(FILE* const file) {
     glEnable( GL_DEPTH_TEST );
     glClearColor( 1.0f, 1.0f, 1.0f, 1.0f );
     glutSwapBuffers();
+    return program;
+}
 
-    free( normals );
-    free( vertices );
-    unsigned int i;
-    for(i=0; i<mData.mapHeight; i++) {
-        free( mData.elevationData[i] );
+/**
+ *  Whether a path names a tile pyramid rather than an elevation file
+ */
+static int
+is_pyramid(char const * const path) {
+    size_t const length = strlen(path);
+    size_t const extension = strlen(PYRAMID_EXTENSION);
+    return length > extension
+           && strcmp(path + length - extension, PYRAMID_EXTENSION) == 0;
+}
+
+/**
+ *  Initialize the display state to stream the tiles of a pyramid. Nothing
+ *  is read up front but the header; the GPU gets room for
+ *  STREAM_GPU_TILES tiles.
+ *  @param[in] file  The pyramid opened as a FILE, closed here
+ *  @param[in] opts  The command line options
+ */
+static void
+init_stream(FILE * const file, optionsData const * const opts) {
+    fclose( file );
+    pyramid p;
+    if(!pyramid_open( &p, opts->path )) {
+        fprintf(stderr, "Invalid tile pyramid: %s\n", opts->path);
+        exit(1);
     }
-    free( mData.elevationData );
+
+    pyramidHeader const * const h = &p.header;
+    mapData mData;
+    memset( &mData, 0, sizeof(mData) );
+    mData.mapWidth = h->mapWidth;
+    mData.mapHeight = h->mapHeight;
+    mData.minElevation = h->minElevation;
+    mData.maxElevation = h->maxElevation;
+    set_map_scale( &mData, &world, h->resolution );
+
+    world.stream = stream_create( &p, &mData, opts->cache_budget,
+                                  opts->normals );
+    world.num_vertices = STREAM_GPU_TILES * LOD_CHUNK_VERTICES;
+    world.num_indices = world.stream->index_count;
+    printf("Streaming %u x %u samples, %u levels of %u x %u tiles, "
+           "%zu MB tile cache\n", h->mapWidth, h->mapHeight, h->levels,
+           PYRAMID_TILE_SIZE, PYRAMID_TILE_SIZE, opts->cache_budget >> 20);
+
+    GLuint vao[1];
+    glGenVertexArrays( 1, &vao[0] );
+    glBindVertexArray( vao[0] );
+
+    // Tiles are uploaded into their slots as they are drawn
+    size_t const vertexSize = world.num_vertices * sizeof(vec4);
+    size_t const normalSize = world.num_vertices * sizeof(vec3);
+    glGenBuffers( 1, &world.stream->vertex_buffer );
+    glBindBuffer( GL_ARRAY_BUFFER, world.stream->vertex_buffer );
+    glBufferData( GL_ARRAY_BUFFER, vertexSize + normalSize, NULL,
+                  GL_DYNAMIC_DRAW );
+
+    GLuint index_buffer;
+    glGenBuffers( 1, &index_buffer );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, index_buffer );
+    TRACE_TALLY(TRACE_UPLOAD_BYTES,
+                world.num_indices * sizeof(*world.stream->indices));
+    glBufferData( GL_ELEMENT_ARRAY_BUFFER,
+                  world.num_indices * sizeof(*world.stream->indices),
+                  world.stream->indices, GL_STATIC_DRAW );
+
+    init_program( &mData, NULL, vertexSize, 0 );
+}
+
+/**
+ *  Initialize the display state to draw a map that loads in the
+ *  background. Until the first preview is ready the buffers are empty.
+ *  @param[in] file  The file to load the elevation data from, closed by
+ *                   the loader
+ *  @param[in] opts  The command line options
+ */
+static void
+init_progressive(FILE * const file, optionsData const * const opts) {
+    world.mesh = opts->mesh;
+    world.num_vertices = 0;
+    world.num_indices = 0;
+    world.loader = progressive_start( file, &world, opts );
+    progressiveLoader* const l = world.loader;
+
+    GLuint vao[1];
+    glGenVertexArrays( 1, &vao[0] );
+    glBindVertexArray( vao[0] );
+
+    glGenBuffers( 1, &l->vertex_buffer );
+    glBindBuffer( GL_ARRAY_BUFFER, l->vertex_buffer );
+    glGenBuffers( 1, &l->index_buffer );
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, l->index_buffer );
+    if(world.mesh == MESH_INDEXED) {
+        glEnable( GL_PRIMITIVE_RESTART );
+        glPrimitiveRestartIndex( MESH_RESTART_INDEX );
+    }
+
+    // Levels reset the normals and the elevation range as they come in
+    mapData none;
+    memset( &none, 0, sizeof(none) );
+    GLuint const program = init_program( &none, NULL, 0, 0 );
+    l->normal_attribute = glGetAttribLocation( program, "vNormal" );
+    l->max_elevation_pos = glGetUniformLocation( program, "max_elevation" );
+}
+
+/**
+ *  Start recording the camera, or load the path to replay
+ *  @param[in] opts  The command line options
+ */
+static void
+init_paths(optionsData const * const opts) {
+    if(opts->record != NULL) {
+        world.recorder = malloc(sizeof(*world.recorder));
+        if(world.recorder == NULL
+           || !path_recorder_open( world.recorder, opts->record )) {
+            fprintf(stderr, "Unable to write camera path: %s\n",
+                    opts->record);
+            exit(1);
+        }
+    }
+    if(opts->replay != NULL) {
+        world.replay = replay_create( opts->replay, opts );
+        printf("Replaying %zu frames of %s\n", world.replay->frames,
+               opts->replay);
+    }
+}
+
+/**
+ *  Initialize the display state using elevation data from a FILE
+ *  @param[in] file  The file to load the elevation data from. 
+ *  @param[in] opts  The command line options
+ */
+void
+init(FILE* const file, optionsData const * const opts) {
+    TRACE_SPAN("init");
+    init_world_data( &world );
+    init_camera_data( &camera, world.cube_size );
+    world.pool = pool_create( opts->threads );
+    init_paths( opts );
+
+    if(opts->path != NULL && is_pyramid(opts->path)) {
+        if(opts->shadows || opts->crop || opts->watch
+           || opts->play != NULL) {
+            fprintf(stderr, "--shadows, --crop, --watch and --play can't"
+                            " stream a tile pyramid\n");
+            exit(1);
+        }
+        init_stream( file, opts );
+        return;
+    }
+    if(opts->progressive) {
+        init_progressive( file, opts );
+        return;
+    }
+
+    // Skip parsing (and possibly meshing) when a valid cache exists
+    int const can_cache = opts->use_cache && opts->path != NULL
+                          && !opts->crop;
+    terrainCache cache;
+    int const cached = can_cache && cache_open( &cache, opts->path );
+    int cache_mapped = cached;
+
+    mapData mData;
+    int has_cache = cached;
+    if(cached) {
+        load_cache( &mData, &cache, &world, opts );
+        fclose( file );
+    }else {
+        load_file( &mData, file, &world, opts );
+
+        // Like load_map(), the cache keeps the parsed heights rather than
+        // the quantized ones
+        if(can_cache && opts->quantize >= 0.0f) {
+            write_cache( opts->path, &mData, opts->mesh, opts->normals,
+                         NULL, NULL, 0, NULL );
+            has_cache = 1;
+        }
+    }
+    quantize_heights( &mData, opts );
+
+    // Nor are meshes and horizons made from quantized heights cached
+    int const can_write = can_cache && mData.elevation.quantized == NULL;
+
+    world.mesh = opts->mesh;
+    size_t const num_vertices = mesh_vertex_count(world.mesh, mData.mapWidth,
+                                                  mData.mapHeight);
+    size_t const num_indices = mesh_index_count(world.mesh, mData.mapWidth,
+                                                mData.mapHeight);
+    if(num_vertices > INT_MAX || num_indices > INT_MAX) {
+        fprintf(stderr, "%u x %u samples is too large for a %s mesh\n",
+                mData.mapWidth, mData.mapHeight, mesh_mode_name(world.mesh));
+        exit(1);
+    }
+    if(opts->compact && (mData.mapWidth > COMPACT_MAX_SIZE 
+                         || mData.mapHeight > COMPACT_MAX_SIZE)) {
+        fprintf(stderr, "Compact vertices hold at most %u x %u samples\n",
+                COMPACT_MAX_SIZE, COMPACT_MAX_SIZE);
+        exit(1);
+    }
+    world.num_vertices = num_vertices;
+    world.num_indices = num_indices;
+    world.num_triangles = mesh_triangle_count(mData.mapWidth, mData.mapHeight);
+    report_mesh_size( &mData, world.mesh, opts->compact );
+
+    vec4* built_vertices = NULL;
+    vec3* built_normals = NULL;
+    vec4 const * vertices = NULL;
+    vec3 const * normals = NULL;
+    compactVertex* compact = NULL;
+    heightQuantizer quantizer;
+    GLubyte* built_horizons = NULL;
+    GLubyte const * horizons = NULL;
+    if(opts->shadows) {
+        if(cached && cache.horizons != NULL) {
+            horizons = cache.horizons;
+        }else {
+            built_horizons = build_horizons( &mData, world.pool );
+            horizons = built_horizons;
+        }
+    }
+    if(world.mesh == MESH_CHUNKED) {
+        world.lod = lod_state_create( &mData, opts->lod_threshold, 
+                                      world.pool );
+    }
+
+    if(opts->compact || world.mesh == MESH_CHUNKED) {
+        // Compact and chunked vertices are cheap to rebuild, only heights
+        // are cached
+        if(opts->compact) {
+            compact = malloc(world.num_vertices * sizeof(*compact));
+        }else {
+            built_vertices = malloc(world.num_vertices 
+                                    * sizeof(*built_vertices));
+            built_normals = malloc(world.num_vertices 
+                                   * sizeof(*built_normals));
+        }
+        if(world.mesh == MESH_CHUNKED) {
+            mesh_build_chunks( built_vertices, built_normals, compact,
+                               &quantizer, &world.lod->terrain, &mData,
+                               opts->normals, world.pool );
+        }else {
+            mesh_build_compact( compact, &quantizer, &mData, opts->normals,
+                                world.pool );
+        }
+        vertices = built_vertices;
+        normals = built_normals;
+
+        if(can_write && !has_cache) {
+            write_cache( opts->path, &mData, world.mesh, opts->normals,
+                         NULL, NULL, 0, NULL );
+        }
+    }else if(cached && cache.vertices != NULL 
+       && cache.header->meshLayout == (uint32_t) world.mesh
+       && cache.header->normalMode == (uint32_t) opts->normals
+       && cache.header->numVertices == world.num_vertices) {
+        vertices = cache.vertices;
+        normals = cache.normals;
+
+        // Add new horizons to the cache, which stays mapped meanwhile
+        if(can_write && built_horizons != NULL) {
+            write_cache( opts->path, &mData, world.mesh, opts->normals,
+                         vertices, normals, world.num_vertices, horizons );
+        }
+    }else {
+        built_vertices = malloc(world.num_vertices * sizeof(*built_vertices));
+
+        // Normals are computed once per sample. The strip gathers them,
+        // the indexed layouts use them as they are.
+        vec3* const sample_normals = malloc((size_t) mData.mapWidth 
+                                            * mData.mapHeight
+                                            * sizeof(*sample_normals));
+        compute_normals( sample_normals, &mData, opts->normals, world.pool );
+        if(world.mesh == MESH_STRIP) {
+            built_normals = malloc(world.num_vertices * sizeof(*built_normals));
+            mesh_build_strip( built_vertices, built_normals, sample_normals,
+                              &mData, world.pool );
+            free( sample_normals );
+        }else {
+            mesh_build_vertices( built_vertices, &mData, world.pool );
+            built_normals = sample_normals;
+        }
+        vertices = built_vertices;
+        normals = built_normals;
+
+        // Write a new cache if there was none, or add the mesh or the
+        // horizons to it
+        if(can_write && (!has_cache || opts->cache_mesh
+                         || built_horizons != NULL)) {
+            int const with_mesh = opts->cache_mesh;
+            if(cache_mapped && built_horizons == horizons) {
+                cache_close( &cache );
+                cache_mapped = 0;
+            }
+            write_cache( opts->path, &mData, world.mesh, opts->normals,
+                         with_mesh ? vertices : NULL,
+                         with_mesh ? normals : NULL,
+                         world.num_vertices, horizons );
+        }
+    }
+
+    // Create a vertex array object
+    GLuint vao[1];
+    glGenVertexArrays( 1, &vao[0] );
+    glBindVertexArray( vao[0] );
+    
+    // Create and initialize a buffer object
+    GLuint buffer;
+    glGenBuffers( 1, &buffer );
+    glBindBuffer( GL_ARRAY_BUFFER, buffer );
+
+    // Allocate buffer
+    size_t vertexSize = world.num_vertices * sizeof(vec4);
+    size_t normalSize = world.num_vertices * sizeof(vec3);
+    size_t const horizonSize = horizons != NULL
+                               ? world.num_vertices * HORIZON_AZIMUTHS : 0;
+    if(compact != NULL) {
+        TRACE_SPAN("upload vertices");
+        TRACE_TALLY(TRACE_UPLOAD_BYTES, world.num_vertices * sizeof(*compact));
+        glBufferData( GL_ARRAY_BUFFER, world.num_vertices * sizeof(*compact),
+                      compact, GL_STATIC_DRAW );
+        free( compact );
+    }else {
+        TRACE_SPAN("upload vertices");
+        TRACE_TALLY(TRACE_UPLOAD_BYTES, vertexSize + normalSize + horizonSize);
+        glBufferData( GL_ARRAY_BUFFER,vertexSize + normalSize + horizonSize,
+                      NULL,GL_STATIC_DRAW );
+
+        // Store the vertices as sub buffers
+        glBufferSubData( GL_ARRAY_BUFFER, 0, vertexSize, vertices );
+        glBufferSubData( GL_ARRAY_BUFFER, vertexSize, normalSize, normals );
+        if(horizons != NULL) {
+            glBufferSubData( GL_ARRAY_BUFFER, vertexSize + normalSize,
+                             horizonSize, horizons );
+        }
+    }
+
+    // The index buffer is part of the vertex array object's state
+    if(world.mesh == MESH_RTIN) {
+        rtinMesh rtin;
+        rtin_build( &rtin, &mData, opts->max_error, world.pool );
+        report_rtin( &mData, &rtin, opts->max_error );
+        if(3 * rtin.triangles > INT_MAX) {
+            fprintf(stderr, "%zu triangles are too many to draw\n", 
+                    rtin.triangles);
+            exit(1);
+        }
+        world.num_indices = 3 * rtin.triangles;
+        world.num_triangles = rtin.triangles;
+
+        TRACE_SPAN("upload indices");
+        TRACE_TALLY(TRACE_UPLOAD_BYTES,
+                    world.num_indices * sizeof(*rtin.indices));
+        GLuint index_buffer;
+        glGenBuffers( 1, &index_buffer );
+        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, index_buffer );
+        glBufferData( GL_ELEMENT_ARRAY_BUFFER, 
+                      world.num_indices * sizeof(*rtin.indices),
+                      rtin.indices, GL_STATIC_DRAW );
+        rtin_free( &rtin );
+    }else if(world.num_indices > 0) {
+        GLuint* const indices = malloc(num_indices * sizeof(*indices));
+        mesh_build_indices( indices, world.mesh, &mData, world.pool );
+
+        TRACE_SPAN("upload indices");
+        TRACE_TALLY(TRACE_UPLOAD_BYTES, num_indices * sizeof(*indices));
+        GLuint index_buffer;
+        glGenBuffers( 1, &index_buffer );
+        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, index_buffer );
+        glBufferData( GL_ELEMENT_ARRAY_BUFFER, num_indices * sizeof(*indices),
+                      indices, GL_STATIC_DRAW );
+        free( indices );
+
+        if(world.mesh == MESH_INDEXED) {
+            glEnable( GL_PRIMITIVE_RESTART );
+            glPrimitiveRestartIndex( MESH_RESTART_INDEX );
+        }
+    }else if(world.mesh == MESH_CHUNKED) {
+        lodTerrain const * const lod = &world.lod->terrain;
+        TRACE_SPAN("upload indices");
+        TRACE_TALLY(TRACE_UPLOAD_BYTES,
+                    lod->index_total * sizeof(*lod->indices));
+        GLuint index_buffer;
+        glGenBuffers( 1, &index_buffer );
+        glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, index_buffer );
+        glBufferData( GL_ELEMENT_ARRAY_BUFFER, 
+                      lod->index_total * sizeof(*lod->indices),
+                      lod->indices, GL_STATIC_DRAW );
+    }
+
+    GLuint const program = init_program( &mData,
+                                         opts->compact ? &quantizer : NULL,
+                                         vertexSize,
+                                         horizons != NULL
+                                         ? vertexSize + normalSize : 0 );
+
+    if(cache_mapped) {
+        cache_close( &cache );
+    }
+    free( built_horizons );
+    free( built_normals );
+    free( built_vertices );
+
+    // The elevations stay for picking and ground following
+    world.heights = heightmap_create( &mData, world.pool );
+    if(world.heights == NULL) {
+        grid_free( &mData.elevation );
+    }else if(opts->watch) {
+        world.updater = update_create( buffer, vertexSize, program,
+                                       opts->normals );
+        world.watch = watch_start( &world.heights->map, &world, opts );
+    }else if(opts->play != NULL) {
+        world.player = playback_start( &world.heights->map, &world, opts,
+                                       buffer, vertexSize, program );
+    }
+
+    // What startup uploaded, before the first frame's counters
+    TRACE_FRAME_COUNTERS();
 }
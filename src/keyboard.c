@@ -3,6 +3,9 @@
  */
 #include "terrain.h"
 #include "keyboard.h"
+#include "camera.h"
+#include "heightmap.h"
+#include "playback.h"
 
 // Global variables defined in init.c
 extern worldData world;
@@ -22,16 +25,21 @@ extern cameraData camera;
  *
  *  f - toggle wireframe
  *  g - cycle polygon fill
+ *  c - toggle frustum culling of chunked meshes
+ *  h - toggle following the ground
  *
  *  v/V - rotate sun along X axis
  * 
  *  1/! - increase/decrease shininess
+ *
+ *  space - play/pause a sequence of grids
+ *  ./, - step a frame forward/back
  */
 void keyboard( unsigned char key, int x, int y ) {
-    GLfloat const DegreesToRadians = M_PI / 180.0;
     GLfloat step = world.cube_size * 0.01; // Amount to translate per step
     GLfloat angleStep = 5.0; // Amount to rotate per step
     GLfloat const sunAngleStep = 5.0; // Amount sun moves in degrees per step
+    vec3 heading;
 
     switch(key) {
         case 033:
@@ -40,20 +48,18 @@ void keyboard( unsigned char key, int x, int y ) {
         case 'W': // Move forward in direction of camera face
             step /= 5.0;
         case 'w':
-            camera.viewer[0] -= step * -sin(camera.theta[1] * DegreesToRadians) 
-                                    * cos(camera.theta[0] * DegreesToRadians); 
-            camera.viewer[1] -= step * sin(camera.theta[0] * DegreesToRadians); 
-            camera.viewer[2] -= step * cos(camera.theta[1] * DegreesToRadians) 
-                                    * cos(camera.theta[0] * DegreesToRadians);
+            camera_heading(&heading, &camera);
+            camera.viewer[0] += step * heading.x;
+            camera.viewer[1] += step * heading.y;
+            camera.viewer[2] += step * heading.z;
             break;
         case 'S': // Move backward from direction of camera face
             step /= 5.0;
         case 's':
-            camera.viewer[0] += step * -sin(camera.theta[1] * DegreesToRadians) 
-                                    * cos(camera.theta[0] * DegreesToRadians);
-            camera.viewer[1] += step * sin(camera.theta[0] * DegreesToRadians); 
-            camera.viewer[2] += step * cos(camera.theta[1] * DegreesToRadians) 
-                                    * cos(camera.theta[0] * DegreesToRadians);
+            camera_heading(&heading, &camera);
+            camera.viewer[0] -= step * heading.x;
+            camera.viewer[1] -= step * heading.y;
+            camera.viewer[2] -= step * heading.z;
             break;
         case 'D': // Rotate camera clockwise around y axis
             angleStep /= 5.0;
@@ -106,6 +112,12 @@ void keyboard( unsigned char key, int x, int y ) {
                 world.fill_mode = 0;
             }
             break;
+        case 'c': // Toggle frustum culling
+            world.cull = !world.cull;
+            break;
+        case 'h': // Toggle walking over the ground
+            world.follow_ground = !world.follow_ground;
+            break;
         case 'v': // Rotate sun
             world.sun_theta += sunAngleStep;
             break;
@@ -121,11 +133,31 @@ void keyboard( unsigned char key, int x, int y ) {
                 world.ground_material.shininess = 1.0;
             }
             break;
+        case ' ': // Play or pause a sequence of grids
+            if(world.player == NULL) {
+                return;
+            }
+            playback_toggle(world.player);
+            break;
+        case '.': // Step through a sequence of grids
+        case ',':
+            if(world.player == NULL) {
+                return;
+            }
+            playback_step(world.player, key == '.' ? 1 : -1);
+            break;
         default:
             return; // Don't redisplay if nothing updated
             break;
     }
 
+    // Stand on the ground wherever the camera moved
+    if(world.follow_ground && world.heights != NULL) {
+        GLfloat const eye_height = world.cube_size * 0.01;
+        camera.viewer[1] = height_at(world.heights, camera.viewer[0],
+                                     camera.viewer[2]) + eye_height;
+    }
+
     // Ask nicely for a redraw
     glutPostRedisplay();
 }
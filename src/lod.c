@@ -0,0 +1,413 @@
+/**
+ * lod.c
+ *
+ * Chunked level of detail. The map is cut into chunks of LOD_CHUNK_SIZE
+ * cells. Every chunk can be drawn at LOD_LEVELS decimations of its
+ * samples, and the selector picks the coarsest one whose error projects
+ * to less than a threshold in pixels. Chunks at different levels are
+ * joined by skirts hanging down from their edges, which hide the cracks
+ * between them. Nothing here talks to OpenGL.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include "lod.h"
+#include "trace.h"
+
+/**
+ *  Elevation of a sample, clamped to the map so partial chunks along the
+ *  right and bottom edges repeat the last row or column
+ */
+static GLfloat
+clamped_height(mapData const * const mData, GLuint x, GLuint z) {
+    x = x < mData->mapWidth ? x : mData->mapWidth - 1;
+    z = z < mData->mapHeight ? z : mData->mapHeight - 1;
+    return grid_get(&mData->elevation, x, z);
+}
+
+typedef struct {
+    lodTerrain* lod;
+    mapData const * mData;
+} lodBuild;
+
+/**
+ *  Measure the error of every level of a chunk: the largest difference
+ *  between a sample and the decimated surface over it. Cells are split
+ *  along the same diagonal as the index patterns.
+ */
+static void
+measure_chunk(void * const arg, unsigned int index) {
+    lodBuild const * const b = arg;
+    lodChunk* const chunk = &b->lod->chunks[index];
+
+    GLfloat h[LOD_CHUNK_SAMPLES][LOD_CHUNK_SAMPLES];
+    GLuint x, z;
+    chunk->low = chunk->high = clamped_height(b->mData, chunk->x0, chunk->z0);
+    for(z = 0; z < LOD_CHUNK_SAMPLES; z++) {
+        for(x = 0; x < LOD_CHUNK_SAMPLES; x++) {
+            GLfloat const v = clamped_height(b->mData, chunk->x0 + x,
+                                             chunk->z0 + z);
+            h[z][x] = v;
+            chunk->low = v < chunk->low ? v : chunk->low;
+            chunk->high = v > chunk->high ? v : chunk->high;
+        }
+    }
+
+    chunk->error[0] = 0.0f;
+    unsigned int level;
+    for(level = 1; level < LOD_LEVELS; level++) {
+        GLuint const step = 1 << level;
+        GLfloat error = chunk->error[level - 1];
+
+        GLuint cx, cz, i, j;
+        for(cz = 0; cz < LOD_CHUNK_SIZE; cz += step) {
+            for(cx = 0; cx < LOD_CHUNK_SIZE; cx += step) {
+                GLfloat const a = h[cz][cx];
+                GLfloat const c = h[cz][cx + step];
+                GLfloat const bl = h[cz + step][cx];
+                GLfloat const d = h[cz + step][cx + step];
+                for(j = 0; j <= step; j++) {
+                    for(i = 0; i <= step; i++) {
+                        GLfloat const u = (GLfloat) i / step;
+                        GLfloat const v = (GLfloat) j / step;
+                        GLfloat const surface = (u + v <= 1.0f)
+                            ? a + (c - a) * u + (bl - a) * v
+                            : d + (bl - d) * (1.0f - u) + (c - d) * (1.0f - v);
+                        GLfloat const e = fabsf(h[cz + j][cx + i] - surface);
+                        error = e > error ? e : error;
+                    }
+                }
+            }
+        }
+        chunk->error[level] = error;
+    }
+}
+
+/**
+ *  Append the index pattern of one level: two triangles per cell, then a
+ *  strip of two triangles per edge segment joining each edge to its skirt
+ *  @return The end of the pattern
+ */
+GLushort*
+lod_build_pattern(GLushort* out, unsigned int level) {
+    GLuint const step = 1 << level;
+    GLuint const row = LOD_CHUNK_SAMPLES;
+
+    GLuint x, z;
+    for(z = 0; z < LOD_CHUNK_SIZE; z += step) {
+        for(x = 0; x < LOD_CHUNK_SIZE; x += step) {
+            GLushort const a = z * row + x;
+            GLushort const b = (z + step) * row + x;
+            GLushort const c = a + step;
+            GLushort const d = b + step;
+            *out++ = a;
+            *out++ = b;
+            *out++ = c;
+            *out++ = c;
+            *out++ = b;
+            *out++ = d;
+        }
+    }
+
+    // Top, bottom, left and right edges, in the order of the skirts
+    unsigned int edge;
+    for(edge = 0; edge < 4; edge++) {
+        GLushort const skirt = LOD_SKIRT_START + edge * LOD_CHUNK_SAMPLES;
+        GLuint i;
+        for(i = 0; i < LOD_CHUNK_SIZE; i += step) {
+            GLushort e0, e1;
+            if(edge < 2) {
+                GLuint const z_edge = (edge == 0) ? 0 : LOD_CHUNK_SIZE;
+                e0 = z_edge * row + i;
+                e1 = e0 + step;
+            }else {
+                GLuint const x_edge = (edge == 2) ? 0 : LOD_CHUNK_SIZE;
+                e0 = i * row + x_edge;
+                e1 = e0 + step * row;
+            }
+            *out++ = e0;
+            *out++ = skirt + i;
+            *out++ = e1;
+            *out++ = e1;
+            *out++ = skirt + i;
+            *out++ = skirt + i + step;
+        }
+    }
+    return out;
+}
+
+/**
+ *  Cut a map into chunks and measure the error of each of their levels
+ *  @param[out] lod  The chunked terrain
+ *  @param[in] mData  The map
+ *  @param[in] pool  The workers to measure with
+ */
+void
+lod_init(lodTerrain * const lod, mapData const * const mData,
+         threadPool * const pool) {
+    lod->map_width = mData->mapWidth;
+    lod->map_height = mData->mapHeight;
+    lod->scale = mData->scale;
+    lod->yScale = mData->yScale;
+    lod->xOffset = mData->xOffset;
+    lod->zOffset = mData->zOffset;
+    lod->minElevation = mData->minElevation;
+
+    lod->chunks_x = (mData->mapWidth - 1 + LOD_CHUNK_SIZE - 1) / LOD_CHUNK_SIZE;
+    lod->chunks_z = (mData->mapHeight - 1 + LOD_CHUNK_SIZE - 1) / LOD_CHUNK_SIZE;
+    GLuint const count = lod_chunk_count(lod);
+    lod->chunks = malloc(count * sizeof(*lod->chunks));
+
+    GLuint i;
+    for(i = 0; i < count; i++) {
+        lod->chunks[i].x0 = (i % lod->chunks_x) * LOD_CHUNK_SIZE;
+        lod->chunks[i].z0 = (i / lod->chunks_x) * LOD_CHUNK_SIZE;
+    }
+
+    lodBuild b;
+    b.lod = lod;
+    b.mData = mData;
+    pool_run( pool, count, measure_chunk, &b );
+
+    // A skirt must reach below whatever its neighbours may draw, so it
+    // covers the coarsest error of the chunk and of its neighbours, plus
+    // a little to hide rounding at T-junctions
+    GLfloat const minimum = LOD_CHUNK_SIZE * mData->resolution * 0.01f;
+    for(i = 0; i < count; i++) {
+        GLuint const cx = i % lod->chunks_x;
+        GLuint const cz = i / lod->chunks_x;
+        GLfloat worst = 0.0f;
+        int dx, dz;
+        for(dz = -1; dz <= 1; dz++) {
+            for(dx = -1; dx <= 1; dx++) {
+                if((dx != 0 && dz != 0)
+                   || (int) cx + dx < 0 || (int) cx + dx >= (int) lod->chunks_x
+                   || (int) cz + dz < 0 || (int) cz + dz >= (int) lod->chunks_z) {
+                    continue;
+                }
+                lodChunk const * const n = &lod->chunks[(cz + dz) * lod->chunks_x
+                                                        + cx + dx];
+                GLfloat const e = n->error[LOD_LEVELS - 1];
+                worst = e > worst ? e : worst;
+            }
+        }
+        lod->chunks[i].skirt = lod->chunks[i].error[LOD_LEVELS - 1] + worst
+                               + minimum;
+    }
+
+    // Every chunk shares the same index patterns
+    lod->index_total = 0;
+    unsigned int level;
+    for(level = 0; level < LOD_LEVELS; level++) {
+        GLuint const cells = LOD_CHUNK_SIZE >> level;
+        lod->index_offset[level] = lod->index_total;
+        lod->index_count[level] = 6 * (cells * cells + 4 * cells);
+        lod->index_total += lod->index_count[level];
+    }
+    lod->indices = malloc(lod->index_total * sizeof(*lod->indices));
+    for(level = 0; level < LOD_LEVELS; level++) {
+        lod_build_pattern( lod->indices + lod->index_offset[level], level );
+    }
+}
+
+/**
+ *  Build the chunks of a map along with the per-frame selection state
+ *  @param[in] mData  The map
+ *  @param[in] threshold  Largest allowed error, pixels
+ *  @param[in] pool  The workers to measure the chunks with
+ *  @return The state, for the lifetime of the program
+ */
+lodState*
+lod_state_create(mapData const * const mData, GLfloat threshold,
+                 threadPool * const pool) {
+    TRACE_SPAN("lod errors");
+    lodState* const state = malloc(sizeof(*state));
+    lod_init( &state->terrain, mData, pool );
+    state->levels = calloc(lod_chunk_count(&state->terrain), 
+                           sizeof(*state->levels));
+    lod_draw_list_init( &state->draws, &state->terrain );
+    state->stats.chunks = 0;
+    state->stats.culled_chunks = 0;
+    state->stats.triangles = 0;
+    state->stats.culled_triangles = 0;
+    state->threshold = threshold;
+    return state;
+}
+
+void
+lod_free(lodTerrain * const lod) {
+    free( lod->chunks );
+    free( lod->indices );
+    lod->chunks = NULL;
+    lod->indices = NULL;
+}
+
+GLuint
+lod_chunk_count(lodTerrain const * const lod) {
+    return lod->chunks_x * lod->chunks_z;
+}
+
+/**
+ *  The map sample behind a vertex of a chunk
+ *  @param[in] lod  The chunked terrain
+ *  @param[in] chunk  The chunk
+ *  @param[in] vertex  The vertex, below LOD_CHUNK_VERTICES
+ *  @param[out] x  The sample column, clamped to the map
+ *  @param[out] z  The sample row, clamped to the map
+ *  @param[out] skirt  Whether the vertex belongs to a skirt
+ */
+void
+lod_chunk_sample(lodTerrain const * const lod, GLuint chunk, GLuint vertex,
+                 GLuint * const x, GLuint * const z, int * const skirt) {
+    GLuint lx, lz;
+    if(vertex < LOD_SKIRT_START) {
+        lx = vertex % LOD_CHUNK_SAMPLES;
+        lz = vertex / LOD_CHUNK_SAMPLES;
+        *skirt = 0;
+    }else {
+        GLuint const edge = (vertex - LOD_SKIRT_START) / LOD_CHUNK_SAMPLES;
+        GLuint const i = (vertex - LOD_SKIRT_START) % LOD_CHUNK_SAMPLES;
+        lx = (edge < 2) ? i : (edge == 2 ? 0 : LOD_CHUNK_SIZE);
+        lz = (edge >= 2) ? i : (edge == 0 ? 0 : LOD_CHUNK_SIZE);
+        *skirt = 1;
+    }
+
+    *x = lod->chunks[chunk].x0 + lx;
+    *z = lod->chunks[chunk].z0 + lz;
+    *x = *x < lod->map_width ? *x : lod->map_width - 1;
+    *z = *z < lod->map_height ? *z : lod->map_height - 1;
+}
+
+/**
+ *  The world space box around a chunk
+ *  @param[in] lod  The chunked terrain
+ *  @param[in] chunk  The chunk
+ *  @param[out] min  The lowest corner
+ *  @param[out] max  The highest corner
+ */
+void
+lod_chunk_bounds(lodTerrain const * const lod, GLuint chunk,
+                 GLfloat min[3], GLfloat max[3]) {
+    lodChunk const * const c = &lod->chunks[chunk];
+    GLuint const x1 = c->x0 + LOD_CHUNK_SIZE < lod->map_width
+                      ? c->x0 + LOD_CHUNK_SIZE : lod->map_width - 1;
+    GLuint const z1 = c->z0 + LOD_CHUNK_SIZE < lod->map_height
+                      ? c->z0 + LOD_CHUNK_SIZE : lod->map_height - 1;
+
+    // Skirts hang below the lowest sample
+    min[0] = lod->scale * c->x0 - lod->xOffset;
+    min[1] = lod->yScale * (c->low - c->skirt - lod->minElevation);
+    min[2] = lod->scale * c->z0 - lod->zOffset;
+    max[0] = lod->scale * x1 - lod->xOffset;
+    max[1] = lod->yScale * (c->high - lod->minElevation);
+    max[2] = lod->scale * z1 - lod->zOffset;
+}
+
+/**
+ *  Distance from a point to a box
+ */
+GLfloat
+lod_box_distance(GLfloat const min[3], GLfloat const max[3],
+             vec3 const * const eye) {
+    GLfloat const p[3] = { eye->x, eye->y, eye->z };
+
+    GLfloat sum = 0.0f;
+    unsigned int i;
+    for(i = 0; i < 3; i++) {
+        GLfloat const d = p[i] < min[i] ? min[i] - p[i]
+                          : (p[i] > max[i] ? p[i] - max[i] : 0.0f);
+        sum += d * d;
+    }
+    return sqrtf(sum);
+}
+
+/**
+ *  Pick the level of every chunk: the coarsest one whose error, seen from
+ *  the nearest point of the chunk, covers at most view->threshold pixels.
+ *  Chunks outside view->frustum are marked LOD_CULLED.
+ *  @param[in] lod  The chunked terrain
+ *  @param[in] view  The camera
+ *  @param[out] levels  The level of each chunk
+ *  @param[out] stats  What was selected and culled
+ */
+void
+lod_select(lodTerrain const * const lod, lodView const * const view,
+           GLubyte * const levels, lodStats * const stats) {
+    // Pixels covered by one world unit at distance one
+    GLfloat const pixels = view->viewport_height
+                           / (2.0f * tanf(view->fovy * M_PI / 360.0f));
+    GLuint const count = lod_chunk_count(lod);
+    stats->chunks = count;
+    stats->culled_chunks = 0;
+    stats->triangles = 0;
+    stats->culled_triangles = 0;
+
+    GLuint i;
+    for(i = 0; i < count; i++) {
+        lodChunk const * const c = &lod->chunks[i];
+        GLfloat min[3], max[3];
+        lod_chunk_bounds(lod, i, min, max);
+        GLfloat const distance = lod_box_distance(min, max, &view->eye);
+        GLfloat const allowed = view->threshold * distance / pixels;
+
+        unsigned int level = 0;
+        while(level + 1 < LOD_LEVELS
+              && lod->yScale * c->error[level + 1] <= allowed) {
+            level++;
+        }
+
+        size_t const triangles = lod->index_count[level] / 3;
+        if(view->frustum != NULL && !frustum_test_box(view->frustum, min, max)) {
+            levels[i] = LOD_CULLED;
+            stats->culled_chunks++;
+            stats->culled_triangles += triangles;
+        }else {
+            levels[i] = level;
+            stats->triangles += triangles;
+        }
+    }
+}
+
+/**
+ *  Allocate a draw list large enough for every chunk
+ */
+void
+lod_draw_list_init(lodDrawList * const list, lodTerrain const * const lod) {
+    GLuint const count = lod_chunk_count(lod);
+    list->counts = malloc(count * sizeof(*list->counts));
+    list->offsets = malloc(count * sizeof(*list->offsets));
+    list->base_vertices = malloc(count * sizeof(*list->base_vertices));
+    list->draws = 0;
+}
+
+void
+lod_draw_list_free(lodDrawList * const list) {
+    free( list->counts );
+    free( list->offsets );
+    free( list->base_vertices );
+}
+
+/**
+ *  Turn the selected levels into the arguments of one multi-draw call
+ *  @param[out] list  The draw list
+ *  @param[in] lod  The chunked terrain
+ *  @param[in] levels  The level of each chunk, culled chunks are skipped
+ */
+void
+lod_draw_list_build(lodDrawList * const list, lodTerrain const * const lod,
+                    GLubyte const * const levels) {
+    GLuint const count = lod_chunk_count(lod);
+    list->draws = 0;
+
+    GLuint i;
+    for(i = 0; i < count; i++) {
+        GLuint const level = levels[i];
+        if(level == LOD_CULLED) {
+            continue;
+        }
+        GLsizei const n = list->draws++;
+        list->counts[n] = lod->index_count[level];
+        list->offsets[n] = BUFFER_OFFSET(lod->index_offset[level]
+                                         * sizeof(GLushort));
+        list->base_vertices[n] = i * LOD_CHUNK_VERTICES;
+    }
+}
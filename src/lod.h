@@ -0,0 +1,111 @@
+/**
+ * lod.h
+ */
+#ifndef LOD_H
+#define LOD_H
+#include "terrain.h"
+#include "pool.h"
+#include "frustum.h"
+
+// Chunks are 64x64 cells. Level l samples every 2^l-th sample of a chunk,
+// down to a single quad at the last level.
+#define LOD_CHUNK_SIZE      64
+#define LOD_LEVELS          7
+#define LOD_CHUNK_SAMPLES   (LOD_CHUNK_SIZE + 1)
+
+// Each chunk stores its samples row-major followed by four skirts, one
+// lowered copy of each edge: top, bottom, left, right
+#define LOD_SKIRT_START     (LOD_CHUNK_SAMPLES * LOD_CHUNK_SAMPLES)
+#define LOD_CHUNK_VERTICES  (LOD_SKIRT_START + 4 * LOD_CHUNK_SAMPLES)
+
+// Level of a chunk outside the view frustum
+#define LOD_CULLED          0xFF
+
+typedef struct {
+    GLuint x0;                      // First sample of the chunk
+    GLuint z0;
+    GLfloat low;                    // Elevation range of the samples
+    GLfloat high;
+    GLfloat error[LOD_LEVELS];      // Largest elevation error of each
+                                    // level, never decreasing
+    GLfloat skirt;                  // How far the skirts hang down
+} lodChunk;
+
+typedef struct {
+    GLuint chunks_x;
+    GLuint chunks_z;
+    lodChunk* chunks;
+
+    // Index patterns of every level, relative to the chunk's first vertex
+    GLushort* indices;
+    GLuint index_offset[LOD_LEVELS];
+    GLuint index_count[LOD_LEVELS];
+    GLuint index_total;
+
+    // Copied from the map to place chunks in world coordinates
+    GLuint map_width;
+    GLuint map_height;
+    GLfloat scale;
+    GLfloat yScale;
+    GLfloat xOffset;
+    GLfloat zOffset;
+    GLfloat minElevation;
+} lodTerrain;
+
+// What the selector needs to know about the camera
+typedef struct {
+    vec3 eye;                   // Camera position, world coordinates
+    GLfloat fovy;               // Vertical field of view, degrees
+    GLfloat viewport_height;    // Pixels
+    GLfloat threshold;          // Largest allowed error, pixels
+    frustum const * frustum;    // World space, NULL to draw every chunk
+} lodView;
+
+// What a selection drew and culled
+typedef struct {
+    GLuint chunks;
+    GLuint culled_chunks;
+    size_t triangles;
+    size_t culled_triangles;    // Triangles the culled chunks would have
+} lodStats;
+
+// Arguments of one glMultiDrawElementsBaseVertex() call
+typedef struct {
+    GLsizei* counts;
+    GLvoid** offsets;
+    GLint* base_vertices;
+    GLsizei draws;
+} lodDrawList;
+
+// Everything the display needs to draw a chunked mesh
+struct lodState {
+    lodTerrain terrain;
+    GLubyte* levels;            // Level of each chunk this frame
+    lodDrawList draws;
+    lodStats stats;             // Of the last selection
+    GLfloat threshold;          // Largest allowed error, pixels
+};
+
+lodState* lod_state_create(mapData const * const mData, GLfloat threshold,
+                           threadPool * const pool);
+void lod_init(lodTerrain * const lod, mapData const * const mData,
+              threadPool * const pool);
+void lod_free(lodTerrain * const lod);
+GLuint lod_chunk_count(lodTerrain const * const lod);
+void lod_chunk_sample(lodTerrain const * const lod, GLuint chunk,
+                      GLuint vertex, GLuint * const x, GLuint * const z,
+                      int * const skirt);
+GLushort* lod_build_pattern(GLushort* out, unsigned int level);
+GLfloat lod_box_distance(GLfloat const min[3], GLfloat const max[3],
+                         vec3 const * const eye);
+void lod_chunk_bounds(lodTerrain const * const lod, GLuint chunk,
+                      GLfloat min[3], GLfloat max[3]);
+void lod_select(lodTerrain const * const lod, lodView const * const view,
+                GLubyte * const levels, lodStats * const stats);
+void lod_draw_list_init(lodDrawList * const list,
+                        lodTerrain const * const lod);
+void lod_draw_list_free(lodDrawList * const list);
+void lod_draw_list_build(lodDrawList * const list,
+                         lodTerrain const * const lod,
+                         GLubyte const * const levels);
+#endif
@@ -1,26 +1,373 @@
 /**
  * main.c
  */
+#include <getopt.h>
 #include <stdio.h>
 #include <unistd.h>
 #include "display.h"
 #include "keyboard.h"
 #include "mouse.h"
 #include "init.h"
+#include "normals.h"
+#include "mesh.h"
+#include "stream.h"
+#include "headless.h"
+#include "watch.h"
+#include "playback.h"
+#include "trace.h"
+
+enum {
+    OPTION_NO_CACHE = 256,
+    OPTION_CACHE_MESH,
+    OPTION_LAYOUT,
+    OPTION_NORMALS,
+    OPTION_MESH,
+    OPTION_COMPACT,
+    OPTION_LOD_ERROR,
+    OPTION_MAX_ERROR,
+    OPTION_CACHE_BUDGET,
+    OPTION_PROGRESSIVE,
+    OPTION_HEADLESS,
+    OPTION_OUT,
+    OPTION_SIZE,
+    OPTION_RECORD,
+    OPTION_REPLAY,
+    OPTION_STATS,
+    OPTION_FRAME_TIMES,
+    OPTION_SHADOWS,
+    OPTION_MOSAIC,
+    OPTION_CROP,
+    OPTION_QUANTIZE,
+    OPTION_WATCH,
+    OPTION_PLAY
+};
+
+static void
+usage(char const * const program) {
+    fprintf(stderr, "Usage: %s [ -j THREADS ] [ --no-cache ] [ --cache-mesh ]"
+                    " [ --layout row|tiled ] [ --normals exact|fast ]"
+                    " [ --mesh strip|indexed|triangles|chunked|rtin ]"
+                    " [ --compact ] [ --lod-error PIXELS ]"
+                    " [ --max-error ELEVATION ] [ --cache-budget MB ]"
+                    " [ --progressive ] [ --shadows ]"
+                    " [ --crop X,Z,WIDTH,HEIGHT ] [ --quantize ERROR ]"
+                    " [ --watch ] [ --play FPS ]"
+                    " [ --headless --out IMAGE.png|IMAGE.ppm"
+                    " [ --size WIDTHxHEIGHT ] ]"
+                    " [ --record PATH | --replay PATH [ --stats FILE.csv ]"
+                    " [ --frame-times FILE.csv ] ]"
+                    " [ FILE | PYRAMID.tvp | --mosaic LIST | TILE... ]\n",
+                    program);
+    exit(1);
+}
 
 int main(int argc, char* argv[]) {
+    TRACE_INIT();
+
+    static struct option const long_options[] = {
+        { "no-cache",   no_argument, NULL, OPTION_NO_CACHE },
+        { "cache-mesh", no_argument, NULL, OPTION_CACHE_MESH },
+        { "layout",     required_argument, NULL, OPTION_LAYOUT },
+        { "normals",    required_argument, NULL, OPTION_NORMALS },
+        { "mesh",       required_argument, NULL, OPTION_MESH },
+        { "compact",    no_argument, NULL, OPTION_COMPACT },
+        { "lod-error",  required_argument, NULL, OPTION_LOD_ERROR },
+        { "max-error",  required_argument, NULL, OPTION_MAX_ERROR },
+        { "cache-budget", required_argument, NULL, OPTION_CACHE_BUDGET },
+        { "progressive", no_argument, NULL, OPTION_PROGRESSIVE },
+        { "headless",   no_argument, NULL, OPTION_HEADLESS },
+        { "out",        required_argument, NULL, OPTION_OUT },
+        { "size",       required_argument, NULL, OPTION_SIZE },
+        { "record",     required_argument, NULL, OPTION_RECORD },
+        { "replay",     required_argument, NULL, OPTION_REPLAY },
+        { "stats",      required_argument, NULL, OPTION_STATS },
+        { "frame-times", required_argument, NULL, OPTION_FRAME_TIMES },
+        { "shadows",    no_argument, NULL, OPTION_SHADOWS },
+        { "mosaic",     required_argument, NULL, OPTION_MOSAIC },
+        { "crop",       required_argument, NULL, OPTION_CROP },
+        { "quantize",   required_argument, NULL, OPTION_QUANTIZE },
+        { "watch",      no_argument, NULL, OPTION_WATCH },
+        { "play",       required_argument, NULL, OPTION_PLAY },
+        { NULL, 0, NULL, 0 }
+    };
+
+    optionsData options;
+    options.path = NULL;
+    options.mosaic = NULL;
+    options.tiles = NULL;
+    options.num_tiles = 0;
+    options.crop = 0;
+    options.quantize = -1.0f;
+    options.watch = 0;
+    options.play = NULL;
+    options.play_fps = 0.0f;
+    options.use_cache = 1;
+    options.cache_mesh = 0;
+    options.layout = GRID_ROW_MAJOR;
+    options.normals = NORMALS_EXACT;
+    options.mesh = MESH_INDEXED;
+    options.compact = 0;
+    options.lod_threshold = 1.0f;
+    options.max_error = 1.0f;
+    options.cache_budget = (size_t) 512 << 20;
+    options.progressive = 0;
+    options.shadows = 0;
+    options.out = NULL;
+    options.out_width = 512;
+    options.out_height = 512;
+    int headless = 0;
+    int play = 0;
+    options.record = NULL;
+    options.replay = NULL;
+    options.stats = NULL;
+    options.frame_times = NULL;
+    options.threads = 0;
+
+    int c;
+    while((c = getopt_long(argc, argv, "j:", long_options, NULL)) != -1) {
+        switch(c) {
+            case 'j':
+                options.threads = atoi(optarg);
+                if(options.threads < 1) {
+                    usage(argv[0]);
+                }
+                break;
+            case OPTION_NO_CACHE:
+                options.use_cache = 0;
+                break;
+            case OPTION_CACHE_MESH:
+                options.cache_mesh = 1;
+                break;
+            case OPTION_LAYOUT:
+                if(!grid_parse_layout( &options.layout, optarg )) {
+                    usage(argv[0]);
+                }
+                break;
+            case OPTION_NORMALS:
+                if(!normals_parse_mode( &options.normals, optarg )) {
+                    usage(argv[0]);
+                }
+                break;
+            case OPTION_MESH:
+                if(!mesh_parse_mode( &options.mesh, optarg )) {
+                    usage(argv[0]);
+                }
+                break;
+            case OPTION_COMPACT:
+                options.compact = 1;
+                break;
+            case OPTION_LOD_ERROR:
+                options.lod_threshold = atof(optarg);
+                if(options.lod_threshold <= 0.0f) {
+                    usage(argv[0]);
+                }
+                break;
+            case OPTION_MAX_ERROR:
+                options.max_error = atof(optarg);
+                if(options.max_error < 0.0f) {
+                    usage(argv[0]);
+                }
+                break;
+            case OPTION_CACHE_BUDGET:
+                if(atoi(optarg) < 1) {
+                    usage(argv[0]);
+                }
+                options.cache_budget = (size_t) atoi(optarg) << 20;
+                break;
+            case OPTION_PROGRESSIVE:
+                options.progressive = 1;
+                break;
+            case OPTION_HEADLESS:
+                headless = 1;
+                break;
+            case OPTION_OUT:
+                options.out = optarg;
+                break;
+            case OPTION_SIZE:
+                if(sscanf(optarg, "%ux%u", &options.out_width,
+                          &options.out_height) != 2
+                   || options.out_width < 1 || options.out_height < 1
+                   || options.out_width > 16384
+                   || options.out_height > 16384) {
+                    usage(argv[0]);
+                }
+                break;
+            case OPTION_RECORD:
+                options.record = optarg;
+                break;
+            case OPTION_REPLAY:
+                options.replay = optarg;
+                break;
+            case OPTION_STATS:
+                options.stats = optarg;
+                break;
+            case OPTION_FRAME_TIMES:
+                options.frame_times = optarg;
+                break;
+            case OPTION_SHADOWS:
+                options.shadows = 1;
+                break;
+            case OPTION_MOSAIC:
+                options.mosaic = optarg;
+                break;
+            case OPTION_CROP:
+                if(sscanf(optarg, "%u,%u,%u,%u", &options.crop_x,
+                          &options.crop_z, &options.crop_width,
+                          &options.crop_height) != 4
+                   || options.crop_width < 2 || options.crop_height < 2) {
+                    usage(argv[0]);
+                }
+                options.crop = 1;
+                break;
+            case OPTION_QUANTIZE:
+                options.quantize = atof(optarg);
+                if(options.quantize < 0.0f) {
+                    usage(argv[0]);
+                }
+                break;
+            case OPTION_WATCH:
+                options.watch = 1;
+                break;
+            case OPTION_PLAY:
+                options.play_fps = atof(optarg);
+                play = 1;
+                if(options.play_fps < 0.0f) {
+                    usage(argv[0]);
+                }
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    // Compact vertices can't be duplicated into the serpentine strip
+    if(options.compact && options.mesh == MESH_STRIP) {
+        fprintf(stderr, "--compact needs an indexed mesh\n");
+        usage(argv[0]);
+    }
+
+    // Previews are built like the float indexed layouts
+    if(options.progressive && (options.compact
+                               || (options.mesh != MESH_INDEXED
+                                   && options.mesh != MESH_TRIANGLES))) {
+        fprintf(stderr, "--progressive needs --mesh indexed or triangles"
+                        " without --compact\n");
+        usage(argv[0]);
+    }
+
+    // Horizons are per sample, so only layouts with one vertex per sample
+    // can carry them
+    if(options.shadows && (options.compact || options.progressive
+                           || (options.mesh != MESH_INDEXED
+                               && options.mesh != MESH_TRIANGLES
+                               && options.mesh != MESH_RTIN))) {
+        fprintf(stderr, "--shadows needs --mesh indexed, triangles or rtin"
+                        " without --compact or --progressive\n");
+        usage(argv[0]);
+    }
+
+    // Rendering without a window needs somewhere to put the image
+    if(headless != (options.out != NULL)) {
+        fprintf(stderr, "--headless and --out go together\n");
+        usage(argv[0]);
+    }
+    if(headless && (options.progressive || options.record != NULL
+                    || options.replay != NULL)) {
+        fprintf(stderr, "--progressive, --record and --replay need a"
+                        " window\n");
+        usage(argv[0]);
+    }
+
+    // Replays time a map that is already loaded, one path at a time
+    if(options.replay != NULL && (options.progressive
+                                  || options.record != NULL)) {
+        fprintf(stderr, "--replay can't be combined with --progressive"
+                        " or --record\n");
+        usage(argv[0]);
+    }
+    if(options.replay == NULL && (options.stats != NULL
+                                  || options.frame_times != NULL)) {
+        fprintf(stderr, "--stats and --frame-times need --replay\n");
+        usage(argv[0]);
+    }
+
+    // Several files, or a list of them, are stitched into one map
+    if(options.mosaic != NULL && optind < argc) {
+        fprintf(stderr, "--mosaic takes its tiles from the list\n");
+        usage(argv[0]);
+    }
+    if(argc - optind > 1) {
+        options.tiles = argv + optind;
+        options.num_tiles = argc - optind;
+    }
+
+    // Windows are found by seeking in the file
+    if(options.crop && (optind == argc || options.num_tiles > 0
+                        || options.mosaic != NULL)) {
+        fprintf(stderr, "--crop needs a FILE\n");
+        usage(argv[0]);
+    }
+
+    // Updates patch float vertices made one per sample, or the strip made
+    // from them, and can't redo horizons or coarser levels
+    if(options.watch && (optind == argc || options.num_tiles > 0
+                         || options.mosaic != NULL)) {
+        fprintf(stderr, "--watch needs a FILE\n");
+        usage(argv[0]);
+    }
+    if(options.watch && (options.compact || options.progressive
+                         || options.shadows || headless
+                         || options.quantize >= 0.0f
+                         || (options.mesh != MESH_STRIP
+                             && options.mesh != MESH_INDEXED
+                             && options.mesh != MESH_TRIANGLES))) {
+        fprintf(stderr, "--watch needs --mesh strip, indexed or triangles"
+                        " without --compact, --progressive, --shadows,"
+                        " --quantize or --headless\n");
+        usage(argv[0]);
+    }
+
+    // Frames are patched into the same vertex buffer as updates are, and
+    // played from the idle callback
+    if(play && (optind == argc || options.num_tiles > 0
+                                || options.mosaic != NULL)) {
+        fprintf(stderr, "--play needs a DIRECTORY or FILE of grids\n");
+        usage(argv[0]);
+    }
+    if(play && (options.compact || options.progressive || options.shadows
+                || headless || options.quantize >= 0.0f || options.watch
+                || options.crop || options.replay != NULL
+                || (options.mesh != MESH_STRIP
+                    && options.mesh != MESH_INDEXED
+                    && options.mesh != MESH_TRIANGLES))) {
+        fprintf(stderr, "--play needs --mesh strip, indexed or triangles"
+                        " without --compact, --progressive, --shadows,"
+                        " --quantize, --headless, --watch, --crop or"
+                        " --replay\n");
+        usage(argv[0]);
+    }
 
     FILE* elevation_file = NULL;
-    if(argc > 1) {
-        elevation_file = fopen(argv[1],"r");
+    if(optind < argc && options.num_tiles == 0) {
+        options.path = argv[optind];
+        if(play) {
+            options.play = argv[optind];
+            options.path = playback_first_frame(options.play);
+        }
+        elevation_file = fopen(options.path,"r");
         if(elevation_file == NULL) {
-            fprintf(stderr, "Unable to open file: %s\n", argv[1]);
+            fprintf(stderr, "Unable to open file: %s\n", options.path);
             exit(1);
         }
-    }else {
+    }else if(options.mosaic == NULL && options.num_tiles == 0) {
         elevation_file = stdin;
     }
 
+    if(headless) {
+        render_headless(elevation_file, &options);
+        return 0;
+    }
+
     glutInit( &argc, argv );
 
     // Init with double and depth buffering
@@ -32,13 +379,27 @@ int main(int argc, char* argv[]) {
     glewInit();
 
     // Initializes state for drawing
-    init(elevation_file);
+    init(elevation_file, &options);
     
     glutDisplayFunc(display);
     glutKeyboardFunc(keyboard);
     glutReshapeFunc(reshape);
     glutMotionFunc(mouse_move);
+    glutPassiveMotionFunc(mouse_hover);
     glutMouseFunc(mouse_click);
+    glutTimerFunc(STREAM_POLL_MS, poll_tiles, 0);
+    if(options.watch) {
+        glutTimerFunc(WATCH_POLL_MS, poll_watch, 0);
+    }
+    if(options.progressive) {
+        glutIdleFunc(poll_levels);
+    }
+    if(options.replay != NULL) {
+        glutIdleFunc(play_path);
+    }
+    if(play) {
+        glutIdleFunc(play_frames);
+    }
 
     glutMainLoop();
 
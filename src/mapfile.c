@@ -0,0 +1,98 @@
+/**
+ * mapfile.c
+ */
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mapfile.h"
+
+// Size of each read() when the input can't be mapped (pipes, terminals)
+#define READ_BLOCK_SIZE (1 << 20)
+
+/**
+ *  Slurp a non-seekable descriptor into memory using large block reads
+ *  @param[out] m  The buffer holding the contents of the descriptor
+ *  @param[in] fd  The descriptor to read until EOF
+ *  @return 0 on success, -1 on error
+ */
+static int
+read_file(mappedFile * const m, int fd) {
+    size_t capacity = READ_BLOCK_SIZE;
+    size_t size = 0;
+    char* buffer = malloc(capacity);
+    if(buffer == NULL) {
+        return -1;
+    }
+
+    for(;;) {
+        if(capacity - size < READ_BLOCK_SIZE) {
+            capacity *= 2;
+            char* const grown = realloc(buffer, capacity);
+            if(grown == NULL) {
+                free( buffer );
+                return -1;
+            }
+            buffer = grown;
+        }
+
+        ssize_t const n = read(fd, buffer + size, READ_BLOCK_SIZE);
+        if(n < 0) {
+            free( buffer );
+            return -1;
+        }else if(n == 0) {
+            break;
+        }
+        size += n;
+    }
+
+    m->data = buffer;
+    m->size = size;
+    m->mapped = 0;
+    return 0;
+}
+
+/**
+ *  Make the whole contents of a descriptor available in memory. Regular
+ *  files are memory-mapped read-only, anything else is read in blocks.
+ *  @param[out] m  The mapping
+ *  @param[in] fd  The descriptor to map. It is not closed.
+ *  @return 0 on success, -1 on error
+ */
+int
+map_file(mappedFile * const m, int fd) {
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        return -1;
+    }
+
+    if(!S_ISREG(st.st_mode) || st.st_size == 0) {
+        return read_file(m, fd);
+    }
+
+    void* const data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(data == MAP_FAILED) {
+        return read_file(m, fd);
+    }
+    madvise( data, st.st_size, MADV_WILLNEED );
+
+    m->data = data;
+    m->size = st.st_size;
+    m->mapped = 1;
+    return 0;
+}
+
+/**
+ *  Release a mapping created by map_file()
+ *  @param[in] m  The mapping to release
+ */
+void
+unmap_file(mappedFile * const m) {
+    if(m->mapped) {
+        munmap( (void*) m->data, m->size );
+    }else {
+        free( (void*) m->data );
+    }
+    m->data = NULL;
+    m->size = 0;
+}
@@ -0,0 +1,16 @@
+/**
+ * mapfile.h
+ */
+#ifndef MAPFILE_H
+#define MAPFILE_H
+#include <stddef.h>
+
+typedef struct {
+    char const * data;
+    size_t size;
+    int mapped;     // 1 if data is mmap'd, 0 if it was read into a buffer
+} mappedFile;
+
+int map_file(mappedFile * const m, int fd);
+void unmap_file(mappedFile * const m);
+#endif
@@ -103,4 +103,5 @@ void mat4_perspective(mat4 r, GLfloat fovy, GLfloat aspect,
     r[2][2] = -(zFar + zNear)/(zFar - zNear);
     r[2][3] = -2.0*zFar*zNear/(zFar - zNear);
     r[3][2] = -1.0;
+    r[3][3] = 0.0;
 }
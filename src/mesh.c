@@ -0,0 +1,703 @@
+/**
+ * mesh.c
+ *
+ * Builds the vertex and index arrays of the terrain mesh. Nothing here
+ * talks to OpenGL, so the layouts can be built and checked without a
+ * context.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mesh.h"
+#include "normals.h"
+#include "trace.h"
+
+// Rows per task when building the mesh on the pool
+#define MESH_BAND_ROWS 32
+
+/**
+ *  Convert a point from the (x,z) index to the a 4-dimensional point in
+ *  world coordinates
+ *  @param[out] v  The 4 dimensional point in world coordinates
+ *  @param[in] x  The x index of the point in the map
+ *  @param[in] z  The z index of the point in the map
+ *  @param[in] mData  The current map
+ */
+void 
+make_vertex(vec4 * const v, int x, int z, mapData const * const mData) {
+    v->x = mData->scale * x - mData->xOffset;
+
+    GLfloat const y = grid_get(&mData->elevation, x, z) - mData->minElevation;
+    v->y = mData->yScale * y;
+
+    v->z = mData->scale * z - mData->zOffset;
+    v->w = 1.0f;
+}
+
+/**
+ *  Number of strip vertices emitted before row z. Even rows go left to
+ *  right and emit 2 * width + 1 vertices, odd rows go right to left and
+ *  emit 2 * width - 1; the last row adds one more to close the strip.
+ */
+size_t
+mesh_strip_row_start(GLuint z, GLuint width) {
+    return (size_t) (z / 2) * 4 * width + (z % 2) * (2 * width + 1);
+}
+
+/**
+ *  The sample a vertex of the serpentine strip was made from, the inverse
+ *  of build_strip_band()
+ *  @param[out] x  The column of the sample
+ *  @param[out] z  The row of the sample
+ *  @param[in] index  The vertex, below mesh_vertex_count()
+ *  @param[in] width  The number of samples in a row
+ *  @param[in] height  The number of rows
+ */
+void
+mesh_strip_sample(GLuint * const x, GLuint * const z, size_t index,
+                  GLuint width, GLuint height) {
+    size_t const pair = index / (4 * (size_t) width);
+    size_t offset = index % (4 * (size_t) width);
+    GLuint row = 2 * pair;
+    if(offset >= 2 * (size_t) width + 1 && row + 1 < height - 1) {
+        row++;
+        offset -= 2 * (size_t) width + 1;
+    }
+
+    if(row % 2 == 0) {
+        // Left to right, then the degenerate vertices at the last column
+        if(offset < 2 * (size_t) width) {
+            *x = offset / 2;
+            *z = row + offset % 2;
+        }else {
+            *x = width - 1;
+            *z = row + (offset - 2 * width);
+        }
+    }else {
+        // Right to left down to column 1, then column 0
+        if(offset < 2 * (size_t) (width - 1)) {
+            *x = width - 1 - offset / 2;
+            *z = row + offset % 2;
+        }else {
+            *x = 0;
+            *z = row + (offset - 2 * (width - 1));
+        }
+    }
+}
+
+typedef struct {
+    vec4* vertices;
+    vec3* normals;
+    vec3 const * sample_normals;
+    GLuint* indices;
+    meshMode mode;
+    compactVertex* compact;
+    heightQuantizer quantizer;
+    normalMode normal_mode;
+    GLfloat* band_low;          // Lowest elevation of each band
+    lodTerrain const * lod;
+    mapData const * mData;
+} meshBands;
+
+/**
+ *  One past the last row of a band, clamped to the number of rows
+ */
+static GLuint
+band_end(unsigned int band, GLuint rows) {
+    GLuint const z_end = (band + 1) * MESH_BAND_ROWS;
+    return z_end < rows ? z_end : rows;
+}
+
+/**
+ *  Build the serpentine triangle strip for a band of rows. Every row
+ *  starts at a fixed offset, so bands can be built in any order.
+ *  @param[in] arg  The strip being built
+ *  @param[in] band  The band of rows to build
+ */
+static void
+build_strip_band(void * const arg, unsigned int band) {
+    meshBands const * const b = arg;
+    vec4* const vertices = b->vertices;
+    vec3* const normals = b->normals;
+    vec3 const * const sample_normals = b->sample_normals;
+    mapData const * const mData = b->mData;
+    size_t const width = mData->mapWidth;
+
+    GLuint const z_end = band_end(band, mData->mapHeight - 1);
+
+    // Calculate position of each vertex and the associated normal
+    unsigned int z, x;
+    for(z = band * MESH_BAND_ROWS; z < z_end; z++) {
+        size_t v_index = mesh_strip_row_start(z, width);
+
+        // Strip triangles
+        if(z % 2 == 0) {
+            // Even rows go left to right
+            for(x = 0; x < mData->mapWidth; x++) {
+                make_vertex( &vertices[v_index], x, z, mData );
+                normals[v_index] = sample_normals[z * width + x];
+                v_index++;
+
+                make_vertex( &vertices[v_index], x, z+1, mData );
+                normals[v_index] = sample_normals[(z+1) * width + x];
+                v_index++;
+            }
+
+            // Add degenerate triangles at end of row
+            if(z != mData->mapHeight - 2) {
+                make_vertex( &vertices[v_index], x-1, z, mData );
+                normals[v_index] = sample_normals[z * width + x-1];
+                v_index++;
+            }else {
+                make_vertex( &vertices[v_index], x-1, z, mData );
+                normals[v_index] = sample_normals[z * width + x-1];
+                v_index++;
+                make_vertex( &vertices[v_index], x-1, z+1, mData );
+                normals[v_index] = sample_normals[(z+1) * width + x-1];
+                v_index++;
+            }
+        }else {
+            // Odd rows go right to left
+            for(x = mData->mapWidth - 1; x > 0; x--) {
+                make_vertex( &vertices[v_index], x, z, mData );
+                normals[v_index] = sample_normals[z * width + x];
+                v_index++;
+                make_vertex( &vertices[v_index], x, z+1, mData );
+                normals[v_index] = sample_normals[(z+1) * width + x];
+                v_index++;
+            }
+
+            if(z != mData->mapHeight - 2) {
+                make_vertex( &vertices[v_index], x, z, mData );
+                normals[v_index] = sample_normals[z * width + x];
+                v_index++;
+            }else {
+                make_vertex( &vertices[v_index], x, z, mData );
+                normals[v_index] = sample_normals[z * width + x];
+                v_index++;
+                make_vertex(&vertices[v_index], x, z+1, mData);
+                normals[v_index] = sample_normals[(z+1) * width + x];
+                v_index++;
+            }
+        }
+    }
+}
+
+/**
+ *  Position every sample of a band of rows, one vertex per sample
+ */
+static void
+sample_vertex_band(void * const arg, unsigned int band) {
+    meshBands const * const b = arg;
+    mapData const * const mData = b->mData;
+    size_t const width = mData->mapWidth;
+    GLuint const z_end = band_end(band, mData->mapHeight);
+
+    GLuint x, z;
+    for(z = band * MESH_BAND_ROWS; z < z_end; z++) {
+        vec4* const row = b->vertices + z * width;
+        for(x = 0; x < mData->mapWidth; x++) {
+            make_vertex( &row[x], x, z, mData );
+        }
+    }
+}
+
+/**
+ *  Index a band of rows of quads across every stripe, see vcache.c
+ */
+static void
+index_band(void * const arg, unsigned int band) {
+    meshBands const * const b = arg;
+    GLuint const height = b->mData->mapHeight;
+    vcache_index_rows( b->indices, b->mode, b->mData->mapWidth, height,
+                       VCACHE_STRIPE_QUADS, band * MESH_BAND_ROWS,
+                       band_end(band, height - 1) );
+}
+
+/**
+ *  Find the lowest elevation of a band of rows. Only positive samples
+ *  count towards mData->minElevation, this includes the rest.
+ */
+static void
+low_band(void * const arg, unsigned int band) {
+    meshBands const * const b = arg;
+    mapData const * const mData = b->mData;
+    GLuint const z_end = band_end(band, mData->mapHeight);
+    GLfloat* const row = malloc(mData->mapWidth * sizeof(*row));
+
+    GLfloat low = mData->maxElevation;
+    GLuint x, z;
+    for(z = band * MESH_BAND_ROWS; z < z_end; z++) {
+        grid_read_row( &mData->elevation, z, 0, mData->mapWidth, row );
+        for(x = 0; x < mData->mapWidth; x++) {
+            low = row[x] < low ? row[x] : low;
+        }
+    }
+
+    b->band_low[band] = low;
+    free( row );
+}
+
+/**
+ *  Encode the samples of a band of rows as compact vertices. The normals
+ *  of the band are computed into a scratch buffer, so the full-size float
+ *  normals never exist.
+ */
+static void
+compact_band(void * const arg, unsigned int band) {
+    meshBands const * const b = arg;
+    mapData const * const mData = b->mData;
+    size_t const width = mData->mapWidth;
+    GLuint const z0 = band * MESH_BAND_ROWS;
+    GLuint const z_end = band_end(band, mData->mapHeight);
+
+    vec3* const normals = malloc(MESH_BAND_ROWS * width * sizeof(*normals));
+    GLfloat* const row = malloc(width * sizeof(*row));
+    compute_normal_rows( normals, mData, b->normal_mode, z0, z_end );
+
+    GLuint x, z;
+    for(z = z0; z < z_end; z++) {
+        grid_read_row( &mData->elevation, z, 0, mData->mapWidth, row );
+        compactVertex* const out = b->compact + z * width;
+        vec3 const * const n = normals + (z - z0) * width;
+        for(x = 0; x < mData->mapWidth; x++) {
+            out[x].x = x;
+            out[x].z = z;
+            out[x].height = compact_quantize(&b->quantizer, row[x]);
+            compact_encode_normal( out[x].normal, &n[x] );
+        }
+    }
+
+    free( row );
+    free( normals );
+}
+
+/**
+ *  Build the vertices of one row of chunks. The normals of the rows the
+ *  chunks cover are computed into a scratch buffer first.
+ */
+static void
+chunk_row(void * const arg, unsigned int row) {
+    meshBands const * const b = arg;
+    lodTerrain const * const lod = b->lod;
+    mapData const * const mData = b->mData;
+    size_t const width = mData->mapWidth;
+
+    GLuint const z0 = row * LOD_CHUNK_SIZE;
+    GLuint const z_end = z0 + LOD_CHUNK_SAMPLES < mData->mapHeight
+                         ? z0 + LOD_CHUNK_SAMPLES : mData->mapHeight;
+    vec3* const normals = malloc((z_end - z0) * width * sizeof(*normals));
+    compute_normal_rows( normals, mData, b->normal_mode, z0, z_end );
+
+    GLuint cx, v;
+    for(cx = 0; cx < lod->chunks_x; cx++) {
+        GLuint const chunk = row * lod->chunks_x + cx;
+        size_t const base = (size_t) chunk * LOD_CHUNK_VERTICES;
+        GLfloat const skirt = lod->chunks[chunk].skirt;
+
+        for(v = 0; v < LOD_CHUNK_VERTICES; v++) {
+            GLuint x, z;
+            int is_skirt;
+            lod_chunk_sample( lod, chunk, v, &x, &z, &is_skirt );
+            vec3 const * const n = &normals[(z - z0) * width + x];
+
+            if(b->compact != NULL) {
+                compactVertex* const out = &b->compact[base + v];
+                GLfloat const h = grid_get(&mData->elevation, x, z)
+                                  - (is_skirt ? skirt : 0.0f);
+                out->x = x;
+                out->z = z;
+                out->height = compact_quantize(&b->quantizer, h);
+                compact_encode_normal( out->normal, n );
+            }else {
+                make_vertex( &b->vertices[base + v], x, z, mData );
+                if(is_skirt) {
+                    b->vertices[base + v].y -= mData->yScale * skirt;
+                }
+                b->normals[base + v] = *n;
+            }
+        }
+    }
+
+    free( normals );
+}
+
+/**
+ *  Number of vertices in the mesh of a map
+ *  @param[in] mode  The mesh layout
+ *  @param[in] width  The number of samples in a row
+ *  @param[in] height  The number of rows
+ */
+size_t
+mesh_vertex_count(meshMode mode, GLuint width, GLuint height) {
+    if(mode == MESH_STRIP) {
+        return mesh_strip_row_start(height - 1, width) + 1;
+    }else if(mode == MESH_CHUNKED) {
+        size_t const chunks_x = (width - 1 + LOD_CHUNK_SIZE - 1) 
+                                / LOD_CHUNK_SIZE;
+        size_t const chunks_z = (height - 1 + LOD_CHUNK_SIZE - 1) 
+                                / LOD_CHUNK_SIZE;
+        return chunks_x * chunks_z * LOD_CHUNK_VERTICES;
+    }
+    return (size_t) width * height;
+}
+
+/**
+ *  Number of indices in the mesh of a map, 0 for the unindexed strip, for
+ *  the chunked mesh, whose small index patterns are shared by all chunks,
+ *  and for RTIN meshes, which depend on the heights
+ *  @param[in] mode  The mesh layout
+ *  @param[in] width  The number of samples in a row
+ *  @param[in] height  The number of rows
+ */
+size_t
+mesh_index_count(meshMode mode, GLuint width, GLuint height) {
+    if(mode == MESH_INDEXED || mode == MESH_TRIANGLES) {
+        return vcache_index_count(mode, width, height, VCACHE_STRIPE_QUADS);
+    }
+    return 0;
+}
+
+/**
+ *  Number of triangles covering a map at full resolution, which the
+ *  strip, indexed and triangle layouts all draw
+ */
+size_t
+mesh_triangle_count(GLuint width, GLuint height) {
+    return 2 * (size_t) (width - 1) * (height - 1);
+}
+
+/**
+ *  Build the serpentine triangle strip covering the whole map, duplicating
+ *  vertices where rows meet
+ *  @param[out] vertices  The strip vertices, mesh_vertex_count() long
+ *  @param[out] normals  The strip normals, mesh_vertex_count() long
+ *  @param[in] sample_normals  The normal of every sample, row-major
+ *  @param[in] mData  The current map
+ *  @param[in] pool  The workers to build with
+ */
+void
+mesh_build_strip(vec4 * const vertices, 
+                 vec3 * const normals, 
+                 vec3 const * const sample_normals,
+                 mapData const * const mData,
+                 threadPool * const pool) {
+    TRACE_SPAN("build strip");
+    meshBands b;
+    memset( &b, 0, sizeof(b) );
+    b.vertices = vertices;
+    b.normals = normals;
+    b.sample_normals = sample_normals;
+    b.mData = mData;
+
+    GLuint const rows = mData->mapHeight - 1;
+    pool_run( pool, (rows + MESH_BAND_ROWS - 1) / MESH_BAND_ROWS,
+              build_strip_band, &b );
+}
+
+/**
+ *  Position every sample of the map for the indexed layouts. The normals
+ *  of the indexed layouts are the per-sample normals themselves.
+ *  @param[out] vertices  One vertex per sample, row-major
+ *  @param[in] mData  The current map
+ *  @param[in] pool  The workers to build with
+ */
+void
+mesh_build_vertices(vec4 * const vertices, mapData const * const mData,
+                    threadPool * const pool) {
+    TRACE_SPAN("build vertices");
+    meshBands b;
+    memset( &b, 0, sizeof(b) );
+    b.vertices = vertices;
+    b.mData = mData;
+
+    pool_run( pool, (mData->mapHeight + MESH_BAND_ROWS - 1) / MESH_BAND_ROWS,
+              sample_vertex_band, &b );
+}
+
+/**
+ *  Build the index buffer of an indexed layout
+ *  @param[out] indices  The indices, mesh_index_count() long
+ *  @param[in] mode  MESH_INDEXED or MESH_TRIANGLES
+ *  @param[in] mData  The current map
+ *  @param[in] pool  The workers to build with
+ */
+void
+mesh_build_indices(GLuint * const indices, meshMode mode,
+                   mapData const * const mData, threadPool * const pool) {
+    TRACE_SPAN("build indices");
+    meshBands b;
+    memset( &b, 0, sizeof(b) );
+    b.indices = indices;
+    b.mode = mode;
+    b.mData = mData;
+
+    GLuint const rows = mData->mapHeight - 1;
+    pool_run( pool, (rows + MESH_BAND_ROWS - 1) / MESH_BAND_ROWS,
+              index_band, &b );
+}
+
+/**
+ *  Build the compact vertices of the indexed layouts, one per sample
+ *  @param[out] vertices  One vertex per sample, row-major
+ *  @param[out] q  The quantizer used for the heights
+ *  @param[in] mData  The current map
+ *  @param[in] mode  How to compute the normals
+ *  @param[in] pool  The workers to build with
+ */
+void
+mesh_build_compact(compactVertex * const vertices, 
+                   heightQuantizer * const q,
+                   mapData const * const mData, 
+                   normalMode mode,
+                   threadPool * const pool) {
+    TRACE_SPAN("build compact vertices");
+    unsigned int const bands = (mData->mapHeight + MESH_BAND_ROWS - 1) 
+                               / MESH_BAND_ROWS;
+    meshBands b;
+    memset( &b, 0, sizeof(b) );
+    b.compact = vertices;
+    b.normal_mode = mode;
+    b.band_low = malloc(bands * sizeof(*b.band_low));
+    b.mData = mData;
+
+    pool_run( pool, bands, low_band, &b );
+    GLfloat low = mData->maxElevation;
+    unsigned int i;
+    for(i = 0; i < bands; i++) {
+        low = b.band_low[i] < low ? b.band_low[i] : low;
+    }
+    free( b.band_low );
+    b.band_low = NULL;
+
+    compact_init_quantizer( &b.quantizer, low, mData->maxElevation );
+    pool_run( pool, bands, compact_band, &b );
+    *q = b.quantizer;
+}
+
+/**
+ *  Build the vertices of every chunk of a chunked mesh, LOD_CHUNK_VERTICES
+ *  per chunk. Exactly one of vertices or compact is used.
+ *  @param[out] vertices  The float positions, or NULL for compact vertices
+ *  @param[out] normals  The float normals, or NULL for compact vertices
+ *  @param[out] compact  The compact vertices, or NULL for float vertices
+ *  @param[out] q  The quantizer of the compact heights, or NULL
+ *  @param[in] lod  The chunks
+ *  @param[in] mData  The current map
+ *  @param[in] mode  How to compute the normals
+ *  @param[in] pool  The workers to build with
+ */
+void
+mesh_build_chunks(vec4 * const vertices,
+                  vec3 * const normals,
+                  compactVertex * const compact,
+                  heightQuantizer * const q,
+                  lodTerrain const * const lod,
+                  mapData const * const mData,
+                  normalMode mode,
+                  threadPool * const pool) {
+    TRACE_SPAN("build chunks");
+    meshBands b;
+    memset( &b, 0, sizeof(b) );
+    b.vertices = vertices;
+    b.normals = normals;
+    b.compact = compact;
+    b.normal_mode = mode;
+    b.lod = lod;
+    b.mData = mData;
+
+    if(compact != NULL) {
+        // The quantized range has to reach the bottom of the skirts
+        GLfloat low = lod->chunks[0].low - lod->chunks[0].skirt;
+        GLfloat high = lod->chunks[0].high;
+        GLuint i;
+        for(i = 1; i < lod_chunk_count(lod); i++) {
+            lodChunk const * const c = &lod->chunks[i];
+            low = c->low - c->skirt < low ? c->low - c->skirt : low;
+            high = c->high > high ? c->high : high;
+        }
+        compact_init_quantizer( &b.quantizer, low, high );
+        *q = b.quantizer;
+    }
+
+    pool_run( pool, lod->chunks_z, chunk_row, &b );
+}
+
+/**
+ *  Find the ranges of the vertex buffer made from a rectangle of samples.
+ *  In the one vertex per sample layouts a range is a row of the
+ *  rectangle. The strip repeats each row of samples in the strip rows
+ *  above and below it; a range covers the rectangle's columns of a strip
+ *  row, so it also takes in the row of samples next to the rectangle.
+ *  Ranges that touch are merged, a rectangle as wide as the map being a
+ *  single range.
+ *  @param[out] ranges  Room for dirty->z1 - dirty->z0 + 1 ranges
+ *  @param[in] mode  MESH_STRIP, MESH_INDEXED or MESH_TRIANGLES
+ *  @param[in] width  The number of samples in a row
+ *  @param[in] height  The number of rows
+ *  @param[in] dirty  The samples
+ *  @return The number of ranges
+ */
+size_t
+mesh_patch_ranges(meshRange * const ranges, meshMode mode, GLuint width,
+                  GLuint height, gridRect const * const dirty) {
+    size_t count = 0;
+    GLuint z;
+    if(mode == MESH_STRIP) {
+        GLuint const first = dirty->z0 > 0 ? dirty->z0 - 1 : 0;
+        GLuint const end = dirty->z1 < height - 1 ? dirty->z1 : height - 1;
+        size_t const total = mesh_vertex_count(MESH_STRIP, width, height);
+        for(z = first; z < end; z++) {
+            size_t const start = mesh_strip_row_start(z, width);
+            size_t const row_end = z + 1 < height - 1
+                                   ? mesh_strip_row_start(z + 1, width)
+                                   : total;
+            size_t lo, hi;
+            if(z % 2 == 0) {
+                lo = start + 2 * (size_t) dirty->x0;
+                hi = dirty->x1 == width ? row_end
+                                        : start + 2 * (size_t) dirty->x1;
+            }else {
+                lo = start + 2 * (size_t) (width - dirty->x1);
+                hi = dirty->x0 == 0 ? row_end
+                                    : start + 2 * (size_t) (width - dirty->x0);
+            }
+            if(count > 0 && ranges[count - 1].first
+                            + ranges[count - 1].count >= lo) {
+                ranges[count - 1].count = hi - ranges[count - 1].first;
+            }else {
+                ranges[count].first = lo;
+                ranges[count].count = hi - lo;
+                count++;
+            }
+        }
+        return count;
+    }
+
+    for(z = dirty->z0; z < dirty->z1; z++) {
+        size_t const lo = (size_t) z * width + dirty->x0;
+        if(count > 0 && ranges[count - 1].first
+                        + ranges[count - 1].count == lo) {
+            ranges[count - 1].count += dirty->x1 - dirty->x0;
+        }else {
+            ranges[count].first = lo;
+            ranges[count].count = dirty->x1 - dirty->x0;
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ *  Rebuild the vertices that changed with a rectangle of heights. The
+ *  normals of the samples around the rectangle depend on it too, so it is
+ *  padded by one sample; normals are recomputed for only those samples,
+ *  and for the row beyond them that the strip's ranges take in.
+ *  @param[out] p  The ranges and their new vertices and normals
+ *  @param[in] mData  The map, already holding the new heights
+ *  @param[in] mode  MESH_STRIP, MESH_INDEXED or MESH_TRIANGLES
+ *  @param[in] normals  How the normals are computed
+ *  @param[in] changed  The samples whose heights changed
+ */
+void
+mesh_build_patch(meshPatch * const p, mapData const * const mData,
+                 meshMode mode, normalMode normals,
+                 gridRect const * const changed) {
+    TRACE_SPAN("build patch");
+    GLuint const width = mData->mapWidth;
+    GLuint const height = mData->mapHeight;
+    gridRect* const d = &p->dirty;
+    d->x0 = changed->x0 > 0 ? changed->x0 - 1 : 0;
+    d->z0 = changed->z0 > 0 ? changed->z0 - 1 : 0;
+    d->x1 = changed->x1 < width ? changed->x1 + 1 : width;
+    d->z1 = changed->z1 < height ? changed->z1 + 1 : height;
+
+    p->ranges = malloc((d->z1 - d->z0 + 1) * sizeof(*p->ranges));
+    p->num_ranges = mesh_patch_ranges(p->ranges, mode, width, height, d);
+    p->num_vertices = 0;
+    size_t i;
+    for(i = 0; i < p->num_ranges; i++) {
+        p->num_vertices += p->ranges[i].count;
+    }
+
+    // The samples the ranges were made from
+    gridRect n = *d;
+    if(mode == MESH_STRIP) {
+        n.z0 = d->z0 > 0 ? d->z0 - 1 : 0;
+        n.z1 = d->z1 < height ? d->z1 + 1 : height;
+    }
+    GLuint const n_width = n.x1 - n.x0;
+    vec3* const sample_normals = malloc((size_t) n_width * (n.z1 - n.z0)
+                                        * sizeof(*sample_normals));
+    p->vertices = malloc(p->num_vertices * sizeof(*p->vertices));
+    p->normals = malloc(p->num_vertices * sizeof(*p->normals));
+    if(p->ranges == NULL || sample_normals == NULL || p->vertices == NULL
+       || p->normals == NULL) {
+        fprintf(stderr, "Unable to allocate %zu vertices to update\n",
+                p->num_vertices);
+        exit(1);
+    }
+    compute_normal_rect( sample_normals, mData, normals, n.x0, n.x1, n.z0,
+                         n.z1 );
+
+    size_t out = 0;
+    for(i = 0; i < p->num_ranges; i++) {
+        size_t v;
+        for(v = p->ranges[i].first; v < p->ranges[i].first
+                                        + p->ranges[i].count; v++) {
+            GLuint x, z;
+            if(mode == MESH_STRIP) {
+                mesh_strip_sample( &x, &z, v, width, height );
+            }else {
+                x = v % width;
+                z = v / width;
+            }
+            make_vertex( &p->vertices[out], x, z, mData );
+            p->normals[out] = sample_normals[(size_t) (z - n.z0) * n_width
+                                             + x - n.x0];
+            out++;
+        }
+    }
+    free( sample_normals );
+}
+
+void
+mesh_patch_free(meshPatch * const p) {
+    free( p->normals );
+    free( p->vertices );
+    free( p->ranges );
+}
+
+/**
+ *  Look up a mesh layout by the name used on the command line
+ *  @param[out] mode  The layout
+ *  @param[in] name  "strip", "indexed", "triangles", "chunked" or "rtin"
+ *  @return 1 if the name is known, 0 otherwise
+ */
+int
+mesh_parse_mode(meshMode * const mode, char const * const name) {
+    if(strcmp(name, "strip") == 0) {
+        *mode = MESH_STRIP;
+    }else if(strcmp(name, "chunked") == 0) {
+        *mode = MESH_CHUNKED;
+    }else if(strcmp(name, "rtin") == 0) {
+        *mode = MESH_RTIN;
+    }else if(strcmp(name, "indexed") == 0) {
+        *mode = MESH_INDEXED;
+    }else if(strcmp(name, "triangles") == 0) {
+        *mode = MESH_TRIANGLES;
+    }else {
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ *  Short name of a mesh layout
+ */
+char const *
+mesh_mode_name(meshMode mode) {
+    static char const * const names[] = { "strip", "indexed", "triangles",
+                                          "chunked", "rtin" };
+    return names[mode];
+}
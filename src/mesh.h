@@ -0,0 +1,66 @@
+/**
+ * mesh.h
+ */
+#ifndef MESH_H
+#define MESH_H
+#include <stddef.h>
+#include "terrain.h"
+#include "pool.h"
+#include "compact.h"
+#include "lod.h"
+#include "vcache.h"
+
+// Separates the strips of MESH_INDEXED
+#define MESH_RESTART_INDEX VCACHE_RESTART_INDEX
+
+// Vertices [first, first + count) of a vertex buffer
+typedef struct {
+    size_t first;
+    size_t count;
+} meshRange;
+
+// New positions and normals for ranges of the vertex buffer of the strip,
+// indexed or triangle layouts, after a rectangle of heights changed
+typedef struct {
+    gridRect dirty;         // The changed samples and their neighbours
+    meshRange* ranges;
+    size_t num_ranges;
+    vec4* vertices;         // Of every range, one after another
+    vec3* normals;
+    size_t num_vertices;
+} meshPatch;
+
+void make_vertex(vec4 * const v, int x, int z, mapData const * const mData);
+size_t mesh_vertex_count(meshMode mode, GLuint width, GLuint height);
+size_t mesh_strip_row_start(GLuint z, GLuint width);
+void mesh_strip_sample(GLuint * const x, GLuint * const z, size_t index,
+                       GLuint width, GLuint height);
+size_t mesh_index_count(meshMode mode, GLuint width, GLuint height);
+size_t mesh_triangle_count(GLuint width, GLuint height);
+void mesh_build_strip(vec4 * const vertices, vec3 * const normals,
+                      vec3 const * const sample_normals,
+                      mapData const * const mData, threadPool * const pool);
+void mesh_build_vertices(vec4 * const vertices, mapData const * const mData,
+                         threadPool * const pool);
+void mesh_build_indices(GLuint * const indices, meshMode mode,
+                        mapData const * const mData, threadPool * const pool);
+void mesh_build_compact(compactVertex * const vertices,
+                        heightQuantizer * const q,
+                        mapData const * const mData, normalMode mode,
+                        threadPool * const pool);
+void mesh_build_chunks(vec4 * const vertices, vec3 * const normals,
+                       compactVertex * const compact,
+                       heightQuantizer * const q,
+                       lodTerrain const * const lod,
+                       mapData const * const mData, normalMode mode,
+                       threadPool * const pool);
+size_t mesh_patch_ranges(meshRange * const ranges, meshMode mode,
+                         GLuint width, GLuint height,
+                         gridRect const * const dirty);
+void mesh_build_patch(meshPatch * const p, mapData const * const mData,
+                      meshMode mode, normalMode normals,
+                      gridRect const * const changed);
+void mesh_patch_free(meshPatch * const p);
+int mesh_parse_mode(meshMode * const mode, char const * const name);
+char const * mesh_mode_name(meshMode mode);
+#endif
@@ -0,0 +1,499 @@
+/**
+ * mosaic.c
+ *
+ * Many elevation tiles stitched into one grid. Tiles are placed either by
+ * a list of tiles, one "PATH X Z" line each with the grid position of the
+ * tile's first sample, or by their georeference: the name of an .hgt tile
+ * or the corner in the .hdr of a .bil or .flt grid. Text tiles carry no
+ * georeference and need a list.
+ *
+ * Each tile is read by its own task straight into its slot of the grid.
+ * Where tiles overlap, as SRTM tiles do along their shared edges, every
+ * sample belongs to the last tile in the list that covers it, so tasks
+ * never write the same sample and the result doesn't depend on the order
+ * they run in. Samples no tile covers are treated like samples without
+ * data and set to the lowest elevation of the mosaic.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "mosaic.h"
+#include "mapfile.h"
+#include "parse.h"
+#include "trace.h"
+
+// A run of samples of one row, [begin, end)
+typedef struct {
+    GLint begin;
+    GLint end;
+} mosaicSpan;
+
+typedef struct {
+    mosaic const * m;
+    elevationGrid* grid;
+    demResult* results;     // One per tile
+    GLfloat fill;
+} mosaicLoad;
+
+/**
+ *  The samples of a row of the grid that belong to a tile: the ones it
+ *  covers that no later tile covers
+ *  @param[out] out  Room for m->count spans
+ *  @param[out] scratch  Room for as many again
+ *  @return The number of spans, in order
+ */
+static unsigned int
+owned_spans(mosaicSpan * const out, mosaicSpan * scratch,
+            mosaic const * const m, unsigned int tile, GLint z) {
+    mosaicTile const * const t = &m->tiles[tile];
+    if(z < t->z || z >= t->z + (GLint) t->height) {
+        return 0;
+    }
+    mosaicSpan* spans = out;
+    spans[0].begin = t->x;
+    spans[0].end = t->x + t->width;
+    unsigned int n = 1;
+
+    unsigned int later;
+    for(later = tile + 1; later < m->count && n > 0; later++) {
+        mosaicTile const * const u = &m->tiles[later];
+        if(z < u->z || z >= u->z + (GLint) u->height) {
+            continue;
+        }
+        GLint const begin = u->x, end = u->x + u->width;
+        unsigned int kept = 0, i;
+        for(i = 0; i < n; i++) {
+            if(end <= spans[i].begin || begin >= spans[i].end) {
+                scratch[kept++] = spans[i];
+                continue;
+            }
+            if(spans[i].begin < begin) {
+                scratch[kept].begin = spans[i].begin;
+                scratch[kept++].end = begin;
+            }
+            if(end < spans[i].end) {
+                scratch[kept].begin = end;
+                scratch[kept++].end = spans[i].end;
+            }
+        }
+        mosaicSpan* const swap = spans;
+        spans = scratch;
+        scratch = swap;
+        n = kept;
+    }
+
+    // The spans may have ended up in the scratch buffer
+    if(spans != out) {
+        memcpy( out, spans, n * sizeof(*spans) );
+    }
+    return n;
+}
+
+/**
+ *  Read the size and spacing of a tile
+ *  @return 0 if it can't be read, with a message
+ */
+static int
+read_tile(mosaicTile * const t) {
+    t->format = dem_detect(t->path);
+    FILE* const file = fopen(t->path, "r");
+    if(file == NULL) {
+        fprintf(stderr, "Unable to open tile: %s\n", t->path);
+        return 0;
+    }
+
+    int ok = 1;
+    if(t->format != DEM_TEXT) {
+        struct stat st;
+        ok = fstat( fileno( file ), &st ) == 0
+             && dem_read_header( &t->header, t->path, t->format,
+                                 st.st_size );
+        t->width = t->header.width;
+        t->height = t->header.height;
+        t->resolution = t->header.resolution;
+    }else {
+        mappedFile data;
+        if(map_file( &data, fileno( file ) ) != 0) {
+            perror( t->path );
+            fclose( file );
+            return 0;
+        }
+        char const * s = data.data;
+        char const * const end = data.data + data.size;
+        if(!parse_uint( &s, end, &t->width )
+           || !parse_uint( &s, end, &t->height )
+           || parse_float( &s, end, &t->resolution ) != 1
+           || t->width < 2 || t->height < 2) {
+            fprintf(stderr, "%s: invalid elevation file header\n", t->path);
+            ok = 0;
+        }
+        unmap_file( &data );
+        t->header.has_origin = 0;
+    }
+    fclose( file );
+    return ok;
+}
+
+/**
+ *  Read a list of tiles, resolving their paths against the list's
+ *  directory
+ *  @return 0 if it can't be read, with a message
+ */
+static int
+read_list(mosaic * const m, char const * const list) {
+    FILE* const file = fopen(list, "r");
+    if(file == NULL) {
+        fprintf(stderr, "Unable to open list of tiles: %s\n", list);
+        return 0;
+    }
+    char const * const slash = strrchr(list, '/');
+    size_t const dir = slash != NULL ? (size_t) (slash - list) + 1 : 0;
+
+    unsigned int capacity = 0, line_number = 0;
+    char line[1024];
+    int ok = 1;
+    while(ok && fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char path[1024];
+        long x, z;
+        int const fields = sscanf(line, "%1023s %ld %ld", path, &x, &z);
+        if(fields < 1 || path[0] == '#') {
+            continue;
+        }
+        if(fields == 2 || (fields == 3 && (x < 0 || z < 0))) {
+            fprintf(stderr, "%s:%u: expected PATH [ X Z ] with X and Z not"
+                            " negative\n", list, line_number);
+            ok = 0;
+            break;
+        }
+
+        if(m->count == capacity) {
+            capacity = capacity > 0 ? 2 * capacity : 16;
+            mosaicTile* const tiles = realloc(m->tiles,
+                                              capacity * sizeof(*tiles));
+            if(tiles == NULL) {
+                fprintf(stderr, "Unable to allocate the list of tiles\n");
+                exit(1);
+            }
+            m->tiles = tiles;
+        }
+        mosaicTile* const t = &m->tiles[m->count++];
+        size_t const prefix = path[0] == '/' ? 0 : dir;
+        t->path = malloc(prefix + strlen(path) + 1);
+        if(t->path == NULL) {
+            fprintf(stderr, "Unable to allocate the list of tiles\n");
+            exit(1);
+        }
+        memcpy( t->path, list, prefix );
+        strcpy( t->path + prefix, path );
+        t->placed = fields == 3;
+        t->x = x;
+        t->z = z;
+    }
+    fclose( file );
+    return ok;
+}
+
+/**
+ *  Place tiles by their georeference, relative to the tile furthest up
+ *  and left
+ *  @return 0 if some can't be placed, with a message
+ */
+static int
+place_tiles(mosaic * const m) {
+    double const cell = m->tiles[0].header.cell;
+    double left = INFINITY, top = -INFINITY;
+    unsigned int i;
+    for(i = 0; i < m->count; i++) {
+        demHeader const * const h = &m->tiles[i].header;
+        if(!h->has_origin) {
+            fprintf(stderr, "%s: no georeference, give its position in a"
+                            " list of tiles\n", m->tiles[i].path);
+            return 0;
+        }
+        if(fabs(h->cell - cell) > MOSAIC_SPACING_TOLERANCE * cell) {
+            fprintf(stderr, "%s: samples are %g apart, %g in %s\n",
+                    m->tiles[i].path, h->cell, cell, m->tiles[0].path);
+            return 0;
+        }
+        left = h->left < left ? h->left : left;
+        top = h->top > top ? h->top : top;
+    }
+    for(i = 0; i < m->count; i++) {
+        demHeader const * const h = &m->tiles[i].header;
+        m->tiles[i].x = lround((h->left - left) / cell);
+        m->tiles[i].z = lround((top - h->top) / cell);
+    }
+    return 1;
+}
+
+/**
+ *  Read the headers of the tiles of a mosaic and place them on one grid
+ *  @param[out] m  The tiles and the size of the grid
+ *  @param[in] list  A list of tiles, or NULL to use paths
+ *  @param[in] paths  The tiles when there is no list
+ *  @param[in] count  The number of paths
+ *  @return 0 if the tiles can't be stitched, with a message
+ */
+int
+mosaic_open(mosaic * const m, char const * const list,
+            char * const * const paths, unsigned int count) {
+    m->tiles = NULL;
+    m->count = 0;
+    if(list != NULL) {
+        if(!read_list( m, list )) {
+            mosaic_free( m );
+            return 0;
+        }
+    }else {
+        m->tiles = malloc(count * sizeof(*m->tiles));
+        if(m->tiles == NULL) {
+            fprintf(stderr, "Unable to allocate the list of tiles\n");
+            exit(1);
+        }
+        for(m->count = 0; m->count < count; m->count++) {
+            mosaicTile* const t = &m->tiles[m->count];
+            t->path = strdup(paths[m->count]);
+            if(t->path == NULL) {
+                fprintf(stderr, "Unable to allocate the list of tiles\n");
+                exit(1);
+            }
+            t->placed = 0;
+        }
+    }
+    if(m->count == 0) {
+        fprintf(stderr, "%s: no tiles\n", list);
+        mosaic_free( m );
+        return 0;
+    }
+
+    // Either every tile has its position in the list or none does
+    unsigned int i, placed = 0;
+    for(i = 0; i < m->count; i++) {
+        if(!read_tile( &m->tiles[i] )) {
+            mosaic_free( m );
+            return 0;
+        }
+        placed += m->tiles[i].placed;
+    }
+    if(placed > 0 && placed < m->count) {
+        fprintf(stderr, "%s: give every tile a position or none\n", list);
+        mosaic_free( m );
+        return 0;
+    }
+    if(placed == 0 && !place_tiles( m )) {
+        mosaic_free( m );
+        return 0;
+    }
+
+    m->resolution = m->tiles[0].resolution;
+    m->width = m->height = 0;
+    for(i = 0; i < m->count; i++) {
+        mosaicTile const * const t = &m->tiles[i];
+        if(fabsf(t->resolution - m->resolution)
+           > MOSAIC_SPACING_TOLERANCE * m->resolution) {
+            fprintf(stderr, "%s: resolution %g differs from %g in %s\n",
+                    t->path, t->resolution, m->resolution, m->tiles[0].path);
+            mosaic_free( m );
+            return 0;
+        }
+        GLuint const right = t->x + t->width, bottom = t->z + t->height;
+        m->width = right > m->width ? right : m->width;
+        m->height = bottom > m->height ? bottom : m->height;
+    }
+    return 1;
+}
+
+/**
+ *  Read a tile into the samples of the grid it owns
+ */
+static void
+load_tile(void * const arg, unsigned int index) {
+    mosaicLoad const * const l = arg;
+    mosaic const * const m = l->m;
+    mosaicTile const * const t = &m->tiles[index];
+    TRACE_SPAN("mosaic_tile");
+
+    FILE* const file = fopen(t->path, "r");
+    mappedFile data;
+    if(file == NULL || map_file( &data, fileno( file ) ) != 0) {
+        fprintf(stderr, "Unable to read tile: %s\n", t->path);
+        exit(1);
+    }
+    GLfloat* const row = malloc(t->width * sizeof(*row));
+    mosaicSpan* const spans = malloc(2 * m->count * sizeof(*spans));
+    if(row == NULL || spans == NULL) {
+        fprintf(stderr, "Unable to allocate a row of %s\n", t->path);
+        exit(1);
+    }
+
+    // Text tiles are clamped at 0 and their lowest elevation is the lowest
+    // above 0, like a single text file
+    int const text = t->format == DEM_TEXT;
+    char const * s = data.data;
+    char const * const end = data.data + data.size;
+    if(text) {
+        GLuint width, height;
+        GLfloat resolution;
+        parse_uint( &s, end, &width );
+        parse_uint( &s, end, &height );
+        parse_float( &s, end, &resolution );
+    }
+
+    demResult r;
+    r.minElevation = INFINITY;
+    r.maxElevation = -INFINITY;
+    r.nodata = 0;
+    GLuint z, x;
+    for(z = 0; z < t->height; z++) {
+        unsigned int const n = owned_spans(spans, spans + m->count, m, index,
+                                           t->z + z);
+        if(text) {
+            for(x = 0; x < t->width; x++) {
+                if(parse_float( &s, end, &row[x] ) != 1) {
+                    fprintf(stderr, "%s: invalid or missing elevation value"
+                                    " at byte %zu\n", t->path,
+                            (size_t) (s - data.data));
+                    exit(1);
+                }
+                row[x] = row[x] < 0.0f ? 0.0f : row[x];
+            }
+        }else if(n > 0) {
+            dem_read_row( row, &t->header, data.data, z );
+        }
+
+        unsigned int i;
+        for(i = 0; i < n; i++) {
+            GLfloat const * const in = row + (spans[i].begin - t->x);
+            GLuint const count = spans[i].end - spans[i].begin;
+            grid_write_row( l->grid, t->z + z, spans[i].begin, count, in );
+            for(x = 0; x < count; x++) {
+                if(isnan(in[x])) {
+                    r.nodata++;
+                    continue;
+                }
+                r.maxElevation = fmaxf(r.maxElevation, in[x]);
+                if(!text || in[x] > 0.0f) {
+                    r.minElevation = fminf(r.minElevation, in[x]);
+                }
+            }
+        }
+    }
+    l->results[index] = r;
+
+    free( spans );
+    free( row );
+    unmap_file( &data );
+    fclose( file );
+}
+
+/**
+ *  Set the samples of a band of rows without data to l->fill
+ */
+static void
+fill_band(void * const arg, unsigned int band) {
+    mosaicLoad const * const l = arg;
+    GLuint const width = l->grid->width;
+    GLfloat* const row = malloc(width * sizeof(*row));
+    if(row == NULL) {
+        fprintf(stderr, "Unable to allocate a row of the mosaic\n");
+        exit(1);
+    }
+    GLuint const first = band * MOSAIC_BAND_ROWS;
+    GLuint const last = first + MOSAIC_BAND_ROWS < l->grid->height
+                        ? first + MOSAIC_BAND_ROWS : l->grid->height;
+    GLuint z, x;
+    for(z = first; z < last; z++) {
+        if(isnan(l->fill)) {
+            for(x = 0; x < width; x++) {
+                row[x] = NAN;
+            }
+        }else {
+            grid_read_row( l->grid, z, 0, width, row );
+            for(x = 0; x < width; x++) {
+                row[x] = isnan(row[x]) ? l->fill : row[x];
+            }
+        }
+        grid_write_row( l->grid, z, 0, width, row );
+    }
+    free( row );
+}
+
+/**
+ *  Read every tile of a mosaic into a grid, one task per tile
+ *  @param[out] r  The lowest and highest elevations, and the samples
+ *                 without data or outside every tile
+ *  @param[out] grid  The grid, m->width x m->height
+ *  @param[in] m  The placed tiles
+ *  @param[in] pool  The workers to read with
+ */
+void
+mosaic_load(demResult * const r, elevationGrid * const grid,
+            mosaic const * const m, threadPool * const pool) {
+    TRACE_SPAN("mosaic_load");
+    mosaicLoad l;
+    l.m = m;
+    l.grid = grid;
+    l.results = malloc(m->count * sizeof(*l.results));
+    mosaicSpan* const spans = malloc(2 * m->count * sizeof(*spans));
+    if(l.results == NULL || spans == NULL) {
+        fprintf(stderr, "Unable to allocate the mosaic\n");
+        exit(1);
+    }
+    unsigned int const bands = (grid->height + MOSAIC_BAND_ROWS - 1)
+                               / MOSAIC_BAND_ROWS;
+
+    // Samples between tiles start out without data
+    size_t covered = 0;
+    unsigned int i;
+    GLuint z;
+    for(i = 0; i < m->count; i++) {
+        for(z = 0; z < m->tiles[i].height; z++) {
+            unsigned int const n = owned_spans(spans, spans + m->count, m, i,
+                                               m->tiles[i].z + z);
+            unsigned int j;
+            for(j = 0; j < n; j++) {
+                covered += spans[j].end - spans[j].begin;
+            }
+        }
+    }
+    size_t const gaps = (size_t) grid->width * grid->height - covered;
+    if(gaps > 0) {
+        l.fill = NAN;
+        pool_run( pool, bands, fill_band, &l );
+    }
+
+    pool_run( pool, m->count, load_tile, &l );
+
+    r->minElevation = INFINITY;
+    r->maxElevation = -INFINITY;
+    r->nodata = gaps;
+    for(i = 0; i < m->count; i++) {
+        r->minElevation = fminf(r->minElevation, l.results[i].minElevation);
+        r->maxElevation = fmaxf(r->maxElevation, l.results[i].maxElevation);
+        r->nodata += l.results[i].nodata;
+    }
+    if(r->maxElevation < r->minElevation) {
+        r->minElevation = r->maxElevation = 0.0f;
+    }
+    if(r->nodata > 0) {
+        l.fill = r->minElevation;
+        pool_run( pool, bands, fill_band, &l );
+    }
+
+    free( spans );
+    free( l.results );
+}
+
+void
+mosaic_free(mosaic * const m) {
+    unsigned int i;
+    for(i = 0; i < m->count; i++) {
+        free( m->tiles[i].path );
+    }
+    free( m->tiles );
+    m->tiles = NULL;
+    m->count = 0;
+}
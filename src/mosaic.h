@@ -0,0 +1,47 @@
+/**
+ * mosaic.h
+ */
+#ifndef MOSAIC_H
+#define MOSAIC_H
+#include "terrain.h"
+#include "dem.h"
+#include "grid.h"
+#include "pool.h"
+
+// Extension of a list of tiles and their offsets
+#define MOSAIC_EXTENSION ".mosaic"
+
+// Rows of the combined grid filled by one task
+#define MOSAIC_BAND_ROWS 64
+
+// Tiles whose spacing differs by more than this can't be stitched
+#define MOSAIC_SPACING_TOLERANCE 1e-3
+
+typedef struct {
+    char* path;
+    demFormat format;
+    demHeader header;       // Binary tiles only
+    GLuint width;           // Samples
+    GLuint height;
+    GLfloat resolution;     // Distance between samples, elevation units
+    GLint x;                // Grid position of the first sample
+    GLint z;
+    int placed;             // Position given by the list of tiles
+} mosaicTile;
+
+// Tiles placed on one grid. Where tiles overlap, the later one in the list
+// wins.
+typedef struct {
+    mosaicTile* tiles;
+    unsigned int count;
+    GLuint width;           // Samples covering every tile
+    GLuint height;
+    GLfloat resolution;
+} mosaic;
+
+int mosaic_open(mosaic * const m, char const * const list,
+                char * const * const paths, unsigned int count);
+void mosaic_load(demResult * const r, elevationGrid * const grid,
+                 mosaic const * const m, threadPool * const pool);
+void mosaic_free(mosaic * const m);
+#endif
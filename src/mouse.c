@@ -4,7 +4,11 @@
 #include <stdio.h>
 #include "terrain.h"
 #include "mouse.h"
+#include "camera.h"
+#include "display.h"
+#include "heightmap.h"
 
+extern worldData world;
 extern cameraData camera;
 
 /**
@@ -45,3 +49,31 @@ mouse_click(int button, int state, int x, int y) {
         }
     }
 }
+
+/**
+ * Callback function to handle mouse movement with no button down. Shows
+ * the map position and elevation of the terrain under the mouse.
+ */
+void
+mouse_hover(int x, int y) {
+    if(world.heights == NULL) {
+        return;
+    }
+
+    mat4 mv;
+    camera_model_view(mv, &camera);
+    GLfloat const ndc_x = 2.0f * (x + 0.5f) / world.viewport_width - 1.0f;
+    GLfloat const ndc_y = 1.0f - 2.0f * (y + 0.5f) / world.viewport_height;
+    vec3 origin, direction;
+    camera_ray(&origin, &direction, mv, world.projection, ndc_x, ndc_y);
+
+    heightHit hit;
+    if(heightmap_pick(&hit, world.heights, &origin, &direction)) {
+        snprintf(world.cursor, sizeof(world.cursor),
+                 "column %.1f, row %.1f: elevation %.1f",
+                 hit.x, hit.z, hit.elevation);
+    }else {
+        world.cursor[0] = '\0';
+    }
+    report_cursor();
+}
@@ -3,4 +3,5 @@
 
 void mouse_move(int x, int y);
 void mouse_click(int button, int state, int x, int y);
+void mouse_hover(int x, int y);
 #endif
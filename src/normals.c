@@ -0,0 +1,260 @@
+/**
+ * normals.c
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "normals.h"
+#include "mesh.h"
+#include "trace.h"
+
+// Rows per task when computing normals on the pool
+#define NORMAL_BAND_ROWS 32
+
+/**
+ *  The flat normal of the triangle (a, b, c) at corner b, computed the same
+ *  way (and so with the same rounding) as the original per-vertex code
+ */
+static void
+corner_normal(vec3 * const n,
+              vec4 const * const a,
+              vec4 const * const b,
+              vec4 const * const c) {
+    vec4 u;
+    vec4_sub( &u, b, a );
+
+    vec4 v;
+    vec4_sub( &v, c, b );
+
+    vec3 cross;
+    vec4_cross( &cross, &u, &v );
+    vec3_norm( n, &cross );
+}
+
+/**
+ *  Position the samples [x0, x1) of a row
+ */
+static void
+make_vertex_row(vec4 * const row, GLuint z, mapData const * const mData,
+                GLuint x0, GLuint x1) {
+    GLuint x;
+    for(x = x0; x < x1; x++) {
+        make_vertex( &row[x], x, z, mData );
+    }
+}
+
+/**
+ *  Given (x,z), average the flat normals of the four corners around it:
+ *      +
+ *    a | b
+ *  +-(x,z)-+
+ *    d | c
+ *      +
+ *  Corners that fall outside the map contribute a zero normal. Each
+ *  vertex position is computed once per row and each corner normal once
+ *  per vertex; the strip used to redo all of it for every copy of a vertex.
+ *  Only columns [x0, x1) are computed, and their neighbours positioned.
+ */
+static void
+exact_normal_rows(vec3 * const normals, mapData const * const mData,
+                  GLuint x0, GLuint x1, GLuint z0, GLuint z1) {
+    GLuint const width = mData->mapWidth;
+    GLuint const height = mData->mapHeight;
+    GLuint const lo = x0 > 0 ? x0 - 1 : 0;
+    GLuint const hi = x1 < width ? x1 + 1 : width;
+
+    // Rolling window of vertex positions for rows z-1, z and z+1
+    vec4* rows = malloc(3 * width * sizeof(*rows));
+    vec4* above = rows;
+    vec4* here = rows + width;
+    vec4* below = rows + 2 * width;
+
+    if(z0 > 0) {
+        make_vertex_row( above, z0 - 1, mData, lo, hi );
+    }
+    make_vertex_row( here, z0, mData, lo, hi );
+
+    GLuint x, z;
+    for(z = z0; z < z1; z++) {
+        if(z + 1 < height) {
+            make_vertex_row( below, z + 1, mData, lo, hi );
+        }
+
+        vec3* const out = normals + (size_t) (z - z0) * (x1 - x0);
+        for(x = x0; x < x1; x++) {
+            vec3 n1 = { 0.0f, 0.0f, 0.0f };
+            vec3 n2 = { 0.0f, 0.0f, 0.0f };
+            vec3 n3 = { 0.0f, 0.0f, 0.0f };
+            vec3 n4 = { 0.0f, 0.0f, 0.0f };
+
+            if(x > 0 && z > 0) {
+                corner_normal( &n1, &here[x-1], &here[x], &above[x] );
+            }
+            if(x < width - 1 && z > 0) {
+                corner_normal( &n2, &above[x], &here[x], &here[x+1] );
+            }
+            if(x > 0 && z < height - 1) {
+                corner_normal( &n3, &below[x], &here[x], &here[x-1] );
+            }
+            if(x < width - 1 && z < height - 1) {
+                corner_normal( &n4, &here[x+1], &here[x], &below[x] );
+            }
+
+            vec3 sum;
+            vec3_add( &sum, &n3, &n4 );
+            vec3_add( &sum, &n2, &sum );
+            vec3_add( &sum, &n1, &sum );
+            vec3_norm( &out[x - x0], &sum );
+        }
+
+        vec4* const recycled = above;
+        above = here;
+        here = below;
+        below = recycled;
+    }
+
+    free( rows );
+}
+
+/**
+ *  Normals from the central differences of the neighbouring heights, or
+ *  one-sided differences on the border, for columns [x0, x1)
+ */
+static void
+fast_normal_rows(vec3 * const normals, mapData const * const mData,
+                 GLuint x0, GLuint x1, GLuint z0, GLuint z1) {
+    GLuint const width = mData->mapWidth;
+    GLuint const height = mData->mapHeight;
+    GLfloat const yScale = mData->yScale;
+    GLuint const lo = x0 > 0 ? x0 - 1 : 0;
+    GLuint const hi = x1 < width ? x1 + 1 : width;
+
+    GLfloat* const rows = malloc(3 * width * sizeof(*rows));
+    GLfloat* const above = rows;
+    GLfloat* const here = rows + width;
+    GLfloat* const below = rows + 2 * width;
+
+    GLuint x, z;
+    for(z = z0; z < z1; z++) {
+        GLuint const zu = z > 0 ? z - 1 : z;
+        GLuint const zd = z + 1 < height ? z + 1 : z;
+        grid_read_row( &mData->elevation, zu, x0, x1 - x0, above + x0 );
+        grid_read_row( &mData->elevation, z, lo, hi - lo, here + lo );
+        grid_read_row( &mData->elevation, zd, x0, x1 - x0, below + x0 );
+
+        GLfloat const dz = mData->scale * (zd - zu);
+        vec3* const out = normals + (size_t) (z - z0) * (x1 - x0);
+        for(x = x0; x < x1; x++) {
+            GLuint const xl = x > 0 ? x - 1 : x;
+            GLuint const xr = x + 1 < width ? x + 1 : x;
+            GLfloat const dx = mData->scale * (xr - xl);
+            GLfloat const dydx = yScale * (here[xr] - here[xl]);
+            GLfloat const dydz = yScale * (below[x] - above[x]);
+
+            vec3 n;
+            vec3_init( &n, -dz * dydx, dz * dx, -dx * dydz );
+            vec3_norm( &out[x - x0], &n );
+        }
+    }
+
+    free( rows );
+}
+
+/**
+ *  Compute the normals of the rows [z0, z1) of the map
+ *  @param[out] normals  One normal per sample of those rows, row-major,
+ *                       starting with row z0
+ *  @param[in] mData  The current map
+ *  @param[in] mode  How to compute the normals
+ *  @param[in] z0  The first row to compute
+ *  @param[in] z1  One past the last row to compute
+ */
+void
+compute_normal_rows(vec3 * const normals, mapData const * const mData,
+                    normalMode mode, GLuint z0, GLuint z1) {
+    compute_normal_rect( normals, mData, mode, 0, mData->mapWidth, z0, z1 );
+}
+
+/**
+ *  Compute the normals of a rectangle of samples, the same as
+ *  compute_normals() would for them
+ *  @param[out] normals  One normal per sample of the rectangle, x1 - x0
+ *                       per row, starting with row z0
+ *  @param[in] mData  The current map
+ *  @param[in] mode  How to compute the normals
+ *  @param[in] x0  The first column to compute
+ *  @param[in] x1  One past the last column to compute
+ *  @param[in] z0  The first row to compute
+ *  @param[in] z1  One past the last row to compute
+ */
+void
+compute_normal_rect(vec3 * const normals, mapData const * const mData,
+                    normalMode mode, GLuint x0, GLuint x1, GLuint z0,
+                    GLuint z1) {
+    if(x0 >= x1 || z0 >= z1) {
+        return;
+    }
+    if(mode == NORMALS_FAST) {
+        fast_normal_rows( normals, mData, x0, x1, z0, z1 );
+    }else {
+        exact_normal_rows( normals, mData, x0, x1, z0, z1 );
+    }
+}
+
+typedef struct {
+    vec3* normals;
+    mapData const * mData;
+    normalMode mode;
+} normalBands;
+
+static void
+normal_band(void * const arg, unsigned int band) {
+    normalBands const * const b = arg;
+    GLuint const z0 = band * NORMAL_BAND_ROWS;
+    GLuint z1 = z0 + NORMAL_BAND_ROWS;
+    if(z1 > b->mData->mapHeight) {
+        z1 = b->mData->mapHeight;
+    }
+    compute_normal_rows( b->normals + (size_t) z0 * b->mData->mapWidth,
+                         b->mData, b->mode, z0, z1 );
+}
+
+/**
+ *  Compute the normal of every sample of the map in one sweep, split into
+ *  bands of rows across the pool. Bands write disjoint rows, so the result
+ *  doesn't depend on the number of workers.
+ *  @param[out] normals  One normal per sample, row-major
+ *  @param[in] mData  The current map
+ *  @param[in] mode  How to compute the normals
+ *  @param[in] pool  The workers to compute with
+ */
+void
+compute_normals(vec3 * const normals, mapData const * const mData,
+                normalMode mode, threadPool * const pool) {
+    TRACE_SPAN("normals");
+    normalBands b;
+    b.normals = normals;
+    b.mData = mData;
+    b.mode = mode;
+
+    unsigned int const bands = (mData->mapHeight + NORMAL_BAND_ROWS - 1)
+                               / NORMAL_BAND_ROWS;
+    pool_run( pool, bands, normal_band, &b );
+}
+
+/**
+ *  Look up a normal mode by the name used on the command line
+ *  @param[out] mode  The mode
+ *  @param[in] name  "exact" or "fast"
+ *  @return 1 if the name is known, 0 otherwise
+ */
+int
+normals_parse_mode(normalMode * const mode, char const * const name) {
+    if(strcmp(name, "exact") == 0) {
+        *mode = NORMALS_EXACT;
+    }else if(strcmp(name, "fast") == 0) {
+        *mode = NORMALS_FAST;
+    }else {
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,16 @@
+/**
+ * normals.h
+ */
+#ifndef NORMALS_H
+#define NORMALS_H
+#include "terrain.h"
+
+void compute_normals(vec3 * const normals, mapData const * const mData,
+                     normalMode mode, threadPool * const pool);
+void compute_normal_rows(vec3 * const normals, mapData const * const mData,
+                         normalMode mode, GLuint z0, GLuint z1);
+void compute_normal_rect(vec3 * const normals, mapData const * const mData,
+                         normalMode mode, GLuint x0, GLuint x1, GLuint z0,
+                         GLuint z1);
+int normals_parse_mode(normalMode * const mode, char const * const name);
+#endif
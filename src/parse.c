@@ -0,0 +1,517 @@
+/**
+ * parse.c
+ */
+#include <float.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parse.h"
+#include "trace.h"
+
+// Don't bother splitting inputs smaller than this across threads
+#define MIN_CHUNK_SIZE (1 << 20)
+
+// Extra chunks give idle workers something to steal
+#define CHUNKS_PER_WORKER 4
+
+// Longest token handed to strtof() when the fast path can't be used
+#define MAX_TOKEN_LENGTH 64
+
+// Whitespace as recognized by scanf() in the C locale
+static unsigned char const is_space[256] = {
+    ['\t'] = 1, ['\n'] = 1, ['\v'] = 1, ['\f'] = 1, ['\r'] = 1, [' '] = 1
+};
+
+// Powers of ten that are exactly representable as a double
+static double const exact_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+typedef struct {
+    char const * begin;
+    char const * end;
+    size_t first;           // Index of the first token in this chunk
+    size_t tokens;          // Number of tokens in this chunk
+    size_t limit;           // Total number of samples wanted
+    elevationGrid* grid;
+    GLfloat minElevation;
+    GLfloat maxElevation;
+    char const * error;
+    char const * base;      // Offsets are recorded from here
+    uint64_t* offsets;      // Token offsets, see index_tokens()
+    GLuint width;           // Samples per row
+    GLuint stride;
+} parseChunk;
+
+/**
+ *  Parse an unsigned decimal integer, skipping leading whitespace
+ *  @param[in,out] p  The read position, advanced past the number
+ *  @param[in] end  The end of the input
+ *  @param[out] out  The parsed number
+ *  @return 1 if a number was parsed, 0 otherwise
+ */
+int
+parse_uint(char const ** const p, char const * const end, GLuint * const out) {
+    char const * s = *p;
+    while(s < end && is_space[(unsigned char) *s]) {
+        s++;
+    }
+    if(s < end && *s == '+') {
+        s++;
+    }
+
+    char const * const digits = s;
+    GLuint value = 0;
+    while(s < end) {
+        unsigned int const d = (unsigned char) *s - '0';
+        if(d > 9) {
+            break;
+        }
+        value = value * 10 + d;
+        s++;
+    }
+    if(s == digits || (s < end && !is_space[(unsigned char) *s])) {
+        return 0;
+    }
+
+    *out = value;
+    *p = s;
+    return 1;
+}
+
+/**
+ *  Parse a token that the fast path rejected (too many digits, huge
+ *  exponents, inf/nan, hex floats) with strtof()
+ *  @return 1 if the whole token was a number, -1 otherwise
+ */
+static int
+parse_float_slow(char const ** const p, char const * const end,
+                 char const * const token, GLfloat * const out) {
+    char const * s = token;
+    while(s < end && !is_space[(unsigned char) *s]) {
+        s++;
+    }
+
+    size_t const length = s - token;
+    if(length >= MAX_TOKEN_LENGTH) {
+        *p = token;
+        return -1;
+    }
+
+    char buffer[MAX_TOKEN_LENGTH];
+    memcpy( buffer, token, length );
+    buffer[length] = '\0';
+
+    char* parsed_end;
+    GLfloat const value = strtof(buffer, &parsed_end);
+    if(parsed_end != buffer + length) {
+        *p = token;
+        return -1;
+    }
+
+    *out = value;
+    *p = s;
+    return 1;
+}
+
+/**
+ *  Parse a decimal floating point number, skipping leading whitespace.
+ *  The result is bit-identical to scanf("%f") in the C locale: the digits
+ *  are gathered into a 64-bit mantissa and scaled by an exact power of ten
+ *  in double precision, which is correctly rounded. Rounding that double
+ *  to float only differs from rounding the decimal value directly when
+ *  the double lands exactly halfway between two floats, so those cases
+ *  (and anything else out of range) fall back to strtof().
+ *  @param[in,out] p  The read position, advanced past the number
+ *  @param[in] end  The end of the input
+ *  @param[out] out  The parsed number
+ *  @return 1 if a number was parsed, 0 at the end of input, -1 if the next
+ *          token is not a number (p is left at the token)
+ */
+int
+parse_float(char const ** const p, char const * const end, GLfloat * const out) {
+    char const * s = *p;
+    while(s < end && is_space[(unsigned char) *s]) {
+        s++;
+    }
+    if(s == end) {
+        *p = s;
+        return 0;
+    }
+
+    char const * const token = s;
+    int const negative = (*s == '-');
+    if(*s == '-' || *s == '+') {
+        s++;
+    }
+
+    uint64_t mantissa = 0;
+    int significant = 0;
+    int exponent = 0;
+    int any_digits = 0;
+    int slow = 0;
+
+    // Integer part
+    while(s < end) {
+        unsigned int const d = (unsigned char) *s - '0';
+        if(d > 9) {
+            break;
+        }
+        if(significant < 19) {
+            mantissa = mantissa * 10 + d;
+            significant += (mantissa != 0);
+        }else {
+            slow = 1;
+        }
+        any_digits = 1;
+        s++;
+    }
+
+    // Fractional part
+    if(s < end && *s == '.') {
+        s++;
+        while(s < end) {
+            unsigned int const d = (unsigned char) *s - '0';
+            if(d > 9) {
+                break;
+            }
+            if(significant < 19) {
+                mantissa = mantissa * 10 + d;
+                significant += (mantissa != 0);
+                exponent--;
+            }else {
+                slow = 1;
+            }
+            any_digits = 1;
+            s++;
+        }
+    }
+
+    // Exponent
+    if(s < end && (*s == 'e' || *s == 'E')) {
+        s++;
+        int const negative_exponent = (s < end && *s == '-');
+        if(s < end && (*s == '-' || *s == '+')) {
+            s++;
+        }
+
+        int e = 0;
+        char const * const digits = s;
+        while(s < end) {
+            unsigned int const d = (unsigned char) *s - '0';
+            if(d > 9) {
+                break;
+            }
+            if(e < 100000) {
+                e = e * 10 + d;
+            }
+            s++;
+        }
+        slow |= (s == digits);
+        exponent += negative_exponent ? -e : e;
+    }
+
+    if(!any_digits || (s < end && !is_space[(unsigned char) *s])) {
+        slow = 1;
+    }
+
+    if(!slow) {
+        if(mantissa == 0) {
+            *out = negative ? -0.0f : 0.0f;
+            *p = s;
+            return 1;
+        }
+
+        if(mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+            double value = (double) mantissa;
+            if(exponent < 0) {
+                value /= exact_pow10[-exponent];
+            }else {
+                value *= exact_pow10[exponent];
+            }
+
+            if(value >= FLT_MIN && value <= FLT_MAX) {
+                uint64_t bits;
+                memcpy( &bits, &value, sizeof(bits) );
+                if((bits & 0x1FFFFFFFULL) != 0x10000000ULL) {
+                    GLfloat const f = (GLfloat) value;
+                    *out = negative ? -f : f;
+                    *p = s;
+                    return 1;
+                }
+            }
+        }
+    }
+
+    return parse_float_slow(p, end, token, out);
+}
+
+/**
+ *  Skip whitespace separated tokens without parsing them
+ *  @param[in,out] p  The read position, advanced past the tokens
+ *  @param[in] end  The end of the input
+ *  @param[in] n  The number of tokens to skip
+ *  @return The number of tokens skipped, less than n at the end of input
+ */
+size_t
+skip_tokens(char const ** const p, char const * const end, size_t n) {
+    char const * s = *p;
+    size_t skipped;
+    for(skipped = 0; skipped < n; skipped++) {
+        while(s < end && is_space[(unsigned char) *s]) {
+            s++;
+        }
+        if(s == end) {
+            break;
+        }
+        while(s < end && !is_space[(unsigned char) *s]) {
+            s++;
+        }
+    }
+    *p = s;
+    return skipped;
+}
+
+/**
+ *  Count the whitespace separated tokens in a range of characters
+ *  @param[in] begin  The start of the range
+ *  @param[in] end  The end of the range
+ *  @return The number of tokens that start inside the range
+ */
+size_t
+count_tokens(char const * begin, char const * const end) {
+    size_t count = 0;
+    unsigned int previous_space = 1;
+    for(; begin < end; begin++) {
+        unsigned int const space = is_space[(unsigned char) *begin];
+        count += previous_space & (space ^ 1);
+        previous_space = space;
+    }
+    return count;
+}
+
+static void
+count_chunk(void * const arg, unsigned int index) {
+    parseChunk* const c = (parseChunk*) arg + index;
+    c->tokens = count_tokens(c->begin, c->end);
+}
+
+static void
+parse_chunk(void * const arg, unsigned int index) {
+    parseChunk* const c = (parseChunk*) arg + index;
+    char const * s = c->begin;
+
+    size_t last = c->first + c->tokens;
+    if(last > c->limit) {
+        last = c->limit;
+    }
+
+    // Samples are stored in row-major file order
+    GLuint const width = c->grid->width;
+    GLuint x = c->first % width;
+    GLuint z = c->first / width;
+
+    GLfloat maxElevation = 0.0f;
+    GLfloat minElevation = 0.0f;
+    size_t i;
+    for(i = c->first; i < last; i++) {
+        GLfloat input;
+        if(parse_float(&s, c->end, &input) != 1) {
+            c->error = s;
+            break;
+        }
+        if(input < 0.0f) {
+            input = 0.0f;
+        }
+        grid_set( c->grid, x, z, input );
+        if(++x == width) {
+            x = 0;
+            z++;
+        }
+        if(input > maxElevation) {
+            maxElevation = input;
+        }
+
+        if(input > 0.0f) {
+            if(minElevation == 0.0f || input < minElevation) {
+                minElevation = input;
+            }
+        }
+    }
+
+    c->minElevation = minElevation;
+    c->maxElevation = maxElevation;
+}
+
+/**
+ *  Record where every stride-th sample of each row starts
+ */
+static void
+index_chunk(void * const arg, unsigned int index) {
+    parseChunk* const c = (parseChunk*) arg + index;
+    GLuint const width = c->width;
+    GLuint const per_row = (width + c->stride - 1) / c->stride;
+    char const * s = c->begin;
+
+    size_t last = c->first + c->tokens;
+    if(last > c->limit) {
+        last = c->limit;
+    }
+    GLuint x = c->first % width;
+    size_t z = c->first / width;
+    size_t i;
+    for(i = c->first; i < last; i++) {
+        while(is_space[(unsigned char) *s]) {
+            s++;
+        }
+        if(x % c->stride == 0) {
+            c->offsets[z * per_row + x / c->stride] = s - c->base;
+        }
+        while(s < c->end && !is_space[(unsigned char) *s]) {
+            s++;
+        }
+        if(++x == width) {
+            x = 0;
+            z++;
+        }
+    }
+}
+
+/**
+ *  Split a range of characters at whitespace into a few chunks per worker
+ *  and count the tokens in each, so a second pass knows the index of the
+ *  first token of every chunk
+ *  @param[out] n  The number of chunks
+ *  @return The chunks, to be freed
+ */
+static parseChunk*
+split_chunks(unsigned int * const n, char const * const begin,
+             char const * const end, size_t limit, elevationGrid * const grid,
+             threadPool * const pool) {
+    size_t const length = end - begin;
+    unsigned int count = pool_size(pool) * CHUNKS_PER_WORKER;
+    if(count > length / MIN_CHUNK_SIZE) {
+        count = length / MIN_CHUNK_SIZE;
+    }
+    if(count < 1) {
+        count = 1;
+    }
+
+    // Split the input at whitespace so no token straddles two chunks
+    parseChunk* const chunks = calloc(count, sizeof(*chunks));
+    if(chunks == NULL) {
+        fprintf(stderr, "Unable to allocate the parser\n");
+        exit(1);
+    }
+    unsigned int i;
+    char const * split = begin;
+    for(i = 0; i < count; i++) {
+        chunks[i].begin = split;
+        if(i == count - 1) {
+            split = end;
+        }else {
+            split = begin + (length / count) * (i + 1);
+            if(split < chunks[i].begin) {
+                split = chunks[i].begin;
+            }
+            while(split < end && !is_space[(unsigned char) *split]) {
+                split++;
+            }
+        }
+        chunks[i].end = split;
+        chunks[i].limit = limit;
+        chunks[i].grid = grid;
+    }
+
+    pool_run( pool, count, count_chunk, chunks );
+
+    size_t first = 0;
+    for(i = 0; i < count; i++) {
+        chunks[i].first = first;
+        first += chunks[i].tokens;
+    }
+    *n = count;
+    return chunks;
+}
+
+/**
+ *  Parse elevation samples from a range of characters. Negative samples are
+ *  clamped to 0. The range is split at whitespace boundaries into a few
+ *  chunks per worker; a first pass counts the tokens in each chunk so that
+ *  the second pass can write every sample straight to its final index.
+ *  @param[out] r  The number of samples parsed and their min/max
+ *  @param[out] grid  The grid receiving the samples, in row-major order
+ *  @param[in] begin  The start of the sample data
+ *  @param[in] end  The end of the sample data
+ *  @param[in] pool  The workers to parse with
+ */
+void
+parse_elevations(parseResult * const r, elevationGrid * const grid,
+                 char const * const begin, char const * const end,
+                 threadPool * const pool) {
+    TRACE_SPAN("parse");
+    size_t const count = (size_t) grid->width * grid->height;
+    unsigned int n, i;
+    parseChunk* const chunks = split_chunks(&n, begin, end, count, grid, pool);
+    size_t const first = chunks[n - 1].first + chunks[n - 1].tokens;
+
+    pool_run( pool, n, parse_chunk, chunks );
+
+    // Merge in chunk order so the first error reported is the earliest
+    r->count = first < count ? first : count;
+    r->error = NULL;
+    r->maxElevation = 0.0f;
+    r->minElevation = 0.0f;
+    for(i = 0; i < n; i++) {
+        if(chunks[i].error != NULL && r->error == NULL) {
+            r->error = chunks[i].error;
+        }
+        if(chunks[i].maxElevation > r->maxElevation) {
+            r->maxElevation = chunks[i].maxElevation;
+        }
+        GLfloat const m = chunks[i].minElevation;
+        if(m > 0.0f && (r->minElevation == 0.0f || m < r->minElevation)) {
+            r->minElevation = m;
+        }
+    }
+    free( chunks );
+}
+
+/**
+ *  Find where every stride-th sample of each row of a grid starts, so a
+ *  window of the grid can later be parsed without reading the samples
+ *  before it. Split across the pool like parse_elevations().
+ *  @param[out] offsets  ceil(width / stride) offsets per row, from base
+ *  @param[in] base  The start of the file
+ *  @param[in] begin  The start of the sample data
+ *  @param[in] end  The end of the sample data
+ *  @param[in] width  Samples per row
+ *  @param[in] height  Rows
+ *  @param[in] stride  Samples between offsets within a row
+ *  @param[in] pool  The workers to scan with
+ *  @return The number of samples found, at most width x height
+ */
+size_t
+index_tokens(uint64_t * const offsets, char const * const base,
+             char const * const begin, char const * const end,
+             GLuint width, GLuint height, GLuint stride,
+             threadPool * const pool) {
+    TRACE_SPAN("index_tokens");
+    size_t const count = (size_t) width * height;
+    unsigned int n, i;
+    parseChunk* const chunks = split_chunks(&n, begin, end, count, NULL, pool);
+    size_t const found = chunks[n - 1].first + chunks[n - 1].tokens;
+    for(i = 0; i < n; i++) {
+        chunks[i].base = base;
+        chunks[i].offsets = offsets;
+        chunks[i].width = width;
+        chunks[i].stride = stride;
+    }
+
+    pool_run( pool, n, index_chunk, chunks );
+
+    free( chunks );
+    return found < count ? found : count;
+}
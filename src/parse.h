@@ -0,0 +1,30 @@
+/**
+ * parse.h
+ */
+#ifndef PARSE_H
+#define PARSE_H
+#include <stddef.h>
+#include <stdint.h>
+#include "terrain.h"
+#include "grid.h"
+#include "pool.h"
+
+typedef struct {
+    size_t count;               // Number of samples stored
+    GLfloat minElevation;       // Smallest positive sample, 0 if none
+    GLfloat maxElevation;       // Largest sample, at least 0
+    char const * error;         // First malformed token, NULL if none
+} parseResult;
+
+int parse_uint(char const ** const p, char const * const end, GLuint * const out);
+int parse_float(char const ** const p, char const * const end, GLfloat * const out);
+size_t skip_tokens(char const ** const p, char const * const end, size_t n);
+size_t count_tokens(char const * begin, char const * const end);
+void parse_elevations(parseResult * const r, elevationGrid * const grid,
+                      char const * const begin, char const * const end,
+                      threadPool * const pool);
+size_t index_tokens(uint64_t * const offsets, char const * const base,
+                    char const * const begin, char const * const end,
+                    GLuint width, GLuint height, GLuint stride,
+                    threadPool * const pool);
+#endif
@@ -0,0 +1,600 @@
+/**
+ * playback.c
+ *
+ * Plays a sequence of same-sized grids, such as the timesteps of a flood
+ * or erosion simulation: either the files of a directory in name order or
+ * the grids of one text file written one after another. The first frame
+ * is loaded like any map and fixes the placement and the index buffer.
+ * A decoder thread then reads, normals and meshes the frames ahead of the
+ * display into two buffers, so frame N + 1 is ready while frame N is drawn
+ * and the display only uploads the positions and normals. The decoder also
+ * builds each frame's min/max pyramid, which the display swaps in with its
+ * grid for picking and ground following. The vertex
+ * buffer is orphaned before each upload, so the driver hands out fresh
+ * storage instead of waiting for the draws still reading the last frame.
+ */
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "playback.h"
+#include "cache.h"
+#include "dem.h"
+#include "heightmap.h"
+#include "mesh.h"
+#include "normals.h"
+#include "parse.h"
+#include "pyramid.h"
+#include "rowindex.h"
+#include "trace.h"
+
+static double
+now() {
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int
+ends_with(char const * const s, char const * const suffix) {
+    size_t const length = strlen(s), n = strlen(suffix);
+    return length >= n && strcmp(s + length - n, suffix) == 0;
+}
+
+static int
+compare_names(void const * a, void const * b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/**
+ *  The grids of a directory, sorted by name. Hidden files and the files
+ *  the viewer and the .bil/.flt formats keep next to grids are left out.
+ *  @param[out] count  The number of grids
+ *  @param[in] directory  The directory
+ *  @return Their paths, or NULL if path isn't a directory
+ */
+static char**
+list_frames(GLuint * const count, char const * const directory) {
+    DIR* const d = opendir(directory);
+    if(d == NULL) {
+        return NULL;
+    }
+    char** paths = NULL;
+    size_t n = 0, capacity = 0;
+    struct dirent const * e;
+    while((e = readdir(d)) != NULL) {
+        if(e->d_name[0] == '.' || ends_with(e->d_name, CACHE_EXTENSION)
+           || ends_with(e->d_name, ROWINDEX_EXTENSION)
+           || ends_with(e->d_name, PYRAMID_EXTENSION)
+           || ends_with(e->d_name, DEM_HEADER_EXTENSION)) {
+            continue;
+        }
+        char* const path = malloc(strlen(directory) + strlen(e->d_name) + 2);
+        sprintf( path, "%s/%s", directory, e->d_name );
+        struct stat st;
+        if(stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            free( path );
+            continue;
+        }
+        if(n == capacity) {
+            capacity = capacity > 0 ? 2 * capacity : 64;
+            paths = realloc(paths, capacity * sizeof(*paths));
+            if(paths == NULL) {
+                fprintf(stderr, "Unable to list %s\n", directory);
+                exit(1);
+            }
+        }
+        paths[n++] = path;
+    }
+    closedir( d );
+    if(n == 0) {
+        fprintf(stderr, "No elevation files in %s\n", directory);
+        exit(1);
+    }
+    qsort( paths, n, sizeof(*paths), compare_names );
+    *count = n;
+    return paths;
+}
+
+/**
+ *  The file holding the first frame of a sequence
+ *  @param[in] path  A directory of grids, or a text file of grids
+ *  @return The first grid of the directory, or path itself
+ */
+char const *
+playback_first_frame(char const * const path) {
+    GLuint count, i;
+    char** const paths = list_frames(&count, path);
+    if(paths == NULL) {
+        return path;
+    }
+    for(i = 1; i < count; i++) {
+        free( paths[i] );
+    }
+    char const * const first = paths[0];
+    free( paths );
+    return first;
+}
+
+/**
+ *  Find where each grid of a text file of grids starts, checking every one
+ *  is the size of the first frame
+ */
+static void
+index_stream(framePlayer * const p, char const * const path) {
+    TRACE_SPAN("index frames");
+    double const start = now();
+    FILE* const file = fopen(path, "r");
+    if(file == NULL || map_file( &p->stream, fileno( file ) ) != 0) {
+        fprintf(stderr, "Unable to read %s\n", path);
+        exit(1);
+    }
+    fclose( file );
+
+    char const * s = p->stream.data;
+    char const * const end = p->stream.data + p->stream.size;
+    size_t capacity = 0;
+    p->count = 0;
+    for(;;) {
+        while(s < end && (*s == ' ' || *s == '\t' || *s == '\r'
+                          || *s == '\n')) {
+            s++;
+        }
+        if(s == end) {
+            break;
+        }
+        if(p->count == capacity) {
+            capacity = capacity > 0 ? 2 * capacity : 64;
+            p->offsets = realloc(p->offsets, capacity * sizeof(*p->offsets));
+            if(p->offsets == NULL) {
+                fprintf(stderr, "Unable to index %s\n", path);
+                exit(1);
+            }
+        }
+        p->offsets[p->count] = s - p->stream.data;
+
+        GLuint width, height;
+        GLfloat resolution;
+        if(!parse_uint( &s, end, &width ) || !parse_uint( &s, end, &height )
+           || parse_float( &s, end, &resolution ) != 1) {
+            fprintf(stderr, "Invalid header of frame %u of %s\n",
+                    p->count + 1, path);
+            exit(1);
+        }
+        if(width != p->placement.mapWidth
+           || height != p->placement.mapHeight) {
+            fprintf(stderr, "Frame %u of %s is %u x %u samples, the first "
+                            "is %u x %u\n", p->count + 1, path, width,
+                    height, p->placement.mapWidth, p->placement.mapHeight);
+            exit(1);
+        }
+        size_t const samples = (size_t) width * height;
+        if(skip_tokens( &s, end, samples ) < samples) {
+            fprintf(stderr, "Expected %zu elevation values in frame %u of "
+                            "%s\n", samples, p->count + 1, path);
+            exit(1);
+        }
+        p->count++;
+    }
+    printf("Found %u frames in %s in %.3f s\n", p->count, path,
+           now() - start);
+}
+
+static void
+check_size(elevationGrid const * const grid, char const * const path,
+           GLuint width, GLuint height) {
+    if(width != grid->width || height != grid->height) {
+        fprintf(stderr, "%s is %u x %u samples, the first frame is "
+                        "%u x %u\n", path, width, height, grid->width,
+                grid->height);
+        exit(1);
+    }
+}
+
+/**
+ *  Read the heights of a frame from its own file
+ *  @return The highest elevation
+ */
+static GLfloat
+read_file(framePlayer * const p, elevationGrid * const grid,
+          char const * const path) {
+    FILE* const file = fopen(path, "r");
+    mappedFile m;
+    if(file == NULL || map_file( &m, fileno( file ) ) != 0) {
+        fprintf(stderr, "Unable to read %s\n", path);
+        exit(1);
+    }
+    fclose( file );
+
+    GLfloat max;
+    demFormat const format = dem_detect(path);
+    if(format != DEM_TEXT) {
+        demHeader h;
+        if(!dem_read_header( &h, path, format, m.size )) {
+            exit(1);
+        }
+        check_size( grid, path, h.width, h.height );
+        demResult r;
+        dem_convert( &r, grid, &h, m.data, p->world->pool );
+        max = r.maxElevation;
+    }else {
+        char const * s = m.data;
+        char const * const end = m.data + m.size;
+        GLuint width, height;
+        GLfloat resolution;
+        if(!parse_uint( &s, end, &width ) || !parse_uint( &s, end, &height )
+           || parse_float( &s, end, &resolution ) != 1) {
+            fprintf(stderr, "Invalid elevation file header in %s\n", path);
+            exit(1);
+        }
+        check_size( grid, path, width, height );
+        parseResult r;
+        parse_elevations( &r, grid, s, end, p->world->pool );
+        if(r.error != NULL || r.count < (size_t) width * height) {
+            fprintf(stderr, "Invalid elevation values in %s\n", path);
+            exit(1);
+        }
+        max = r.maxElevation;
+    }
+    unmap_file( &m );
+    return max;
+}
+
+/**
+ *  Read the heights of a frame of a text file of grids
+ *  @return The highest elevation
+ */
+static GLfloat
+read_stream(framePlayer * const p, elevationGrid * const grid,
+            GLuint index) {
+    char const * s = p->stream.data + p->offsets[index];
+    char const * const end = index + 1 < p->count
+                             ? p->stream.data + p->offsets[index + 1]
+                             : p->stream.data + p->stream.size;
+    skip_tokens( &s, end, 3 );
+    parseResult r;
+    parse_elevations( &r, grid, s, end, p->world->pool );
+    if(r.error != NULL) {
+        fprintf(stderr, "Invalid elevation value in frame %u of %s\n",
+                index + 1, p->opts.play);
+        exit(1);
+    }
+    return r.maxElevation;
+}
+
+/**
+ *  Read a frame and build its vertices, normals and height pyramid, placed
+ *  like the first
+ */
+static void
+decode(framePlayer * const p, playbackFrame * const f, GLuint index) {
+    TRACE_SPAN("decode frame");
+    double const start = now();
+    elevationGrid* const grid = &f->heights.map.elevation;
+    f->index = index;
+    f->maxElevation = p->paths != NULL
+                      ? read_file(p, grid, p->paths[index])
+                      : read_stream(p, grid, index);
+
+    mapData m = p->placement;
+    m.elevation = *grid;
+    threadPool* const pool = p->world->pool;
+    if(p->opts.mesh == MESH_STRIP) {
+        compute_normals( p->sample_normals, &m, p->opts.normals, pool );
+        mesh_build_strip( f->vertices, f->normals, p->sample_normals, &m,
+                          pool );
+    }else {
+        mesh_build_vertices( f->vertices, &m, pool );
+        compute_normals( f->normals, &m, p->opts.normals, pool );
+    }
+    heightmap_build( &f->heights, pool );
+    f->decode_seconds = now() - start;
+}
+
+static void*
+decoder_thread(void * const arg) {
+    framePlayer* const p = arg;
+    pthread_mutex_lock( &p->lock );
+    for(;;) {
+        while(p->num_spare == 0) {
+            pthread_cond_wait( &p->wake, &p->lock );
+        }
+        playbackFrame* const f = p->spare[--p->num_spare];
+        GLuint const index = p->request;
+        p->request = (index + 1) % p->count;
+        p->busy = 1;
+        p->decoding = index;
+        pthread_mutex_unlock( &p->lock );
+
+        decode( p, f, index );
+
+        pthread_mutex_lock( &p->lock );
+        while(p->ready != NULL) {
+            pthread_cond_wait( &p->wake, &p->lock );
+        }
+        p->ready = f;
+        p->busy = 0;
+    }
+    return NULL;
+}
+
+/**
+ *  Start playing a sequence whose first frame is already drawn
+ *  @param[in] mData  The first frame, placing every other, at least 2 x 2
+ *                    samples
+ *  @param[in] w  The world, whose pool the decoder shares
+ *  @param[in] opts  The command line options, naming the sequence
+ *  @param[in] vertex_buffer  The buffer, positions followed by normals
+ *  @param[in] normal_offset  Bytes of positions
+ *  @param[in] program  The shader program drawing the mesh
+ *  @return The player, for the lifetime of the program
+ */
+framePlayer*
+playback_start(mapData const * const mData, worldData const * const w,
+               optionsData const * const opts, GLuint vertex_buffer,
+               size_t normal_offset, GLuint program) {
+    framePlayer* const p = calloc(1, sizeof(*p));
+    if(p == NULL) {
+        fprintf(stderr, "Unable to allocate the player\n");
+        exit(1);
+    }
+    p->opts = *opts;
+    p->world = w;
+    p->placement = *mData;
+    p->paths = list_frames(&p->count, opts->play);
+    if(p->paths == NULL) {
+        index_stream( p, opts->play );
+    }
+
+    size_t const num_vertices = mesh_vertex_count(opts->mesh,
+                                                  mData->mapWidth,
+                                                  mData->mapHeight);
+    size_t const samples = (size_t) mData->mapWidth * mData->mapHeight;
+    if(opts->mesh == MESH_STRIP) {
+        p->sample_normals = malloc(samples * sizeof(*p->sample_normals));
+        if(p->sample_normals == NULL) {
+            fprintf(stderr, "Unable to allocate %zu normals\n", samples);
+            exit(1);
+        }
+    }
+    unsigned int i;
+    for(i = 0; i < PLAYBACK_BUFFERS; i++) {
+        playbackFrame* const f = &p->frames[i];
+        mapData m = *mData;
+        f->vertices = malloc(num_vertices * sizeof(*f->vertices));
+        f->normals = malloc(num_vertices * sizeof(*f->normals));
+        if(f->vertices == NULL || f->normals == NULL
+           || !grid_init( &m.elevation, mData->mapWidth, mData->mapHeight,
+                          mData->elevation.layout )) {
+            fprintf(stderr, "Unable to allocate %zu vertices to play\n",
+                    num_vertices);
+            exit(1);
+        }
+        heightmap_init( &f->heights, &m );
+        p->spare[p->num_spare++] = f;
+    }
+
+    p->vertex_buffer = vertex_buffer;
+    p->normal_offset = normal_offset;
+    p->max_elevation_pos = glGetUniformLocation( program, "max_elevation" );
+    p->interval = opts->play_fps > 0.0f ? 1.0 / opts->play_fps : 0.0;
+    p->shown = 0;
+    p->wanted = 1 % p->count;
+    p->request = p->wanted;
+    p->playing = p->count > 1;
+    p->due = now() + p->interval;
+
+    pthread_mutex_init( &p->lock, NULL );
+    pthread_cond_init( &p->wake, NULL );
+    if(pthread_create( &p->thread, NULL, decoder_thread, p ) != 0) {
+        fprintf(stderr, "Unable to start the decoder thread\n");
+        exit(1);
+    }
+    pthread_detach( p->thread );
+    printf("Playing %u frames of %s\n", p->count, opts->play);
+    return p;
+}
+
+/**
+ *  Take the wanted frame if it is decoded. A frame decoded for a position
+ *  the display has since left is given back, and the wanted one asked for
+ *  unless it is already being decoded.
+ */
+static playbackFrame*
+take(framePlayer * const p) {
+    pthread_mutex_lock( &p->lock );
+    playbackFrame* f = p->ready;
+    if(f != NULL) {
+        p->ready = NULL;
+        if(f->index != p->wanted) {
+            p->spare[p->num_spare++] = f;
+            f = NULL;
+        }
+        pthread_cond_signal( &p->wake );
+    }
+    if(f == NULL && !(p->busy && p->decoding == p->wanted)) {
+        p->request = p->wanted;
+    }
+    pthread_mutex_unlock( &p->lock );
+    return f;
+}
+
+static void
+give_back(framePlayer * const p, playbackFrame * const f) {
+    pthread_mutex_lock( &p->lock );
+    p->spare[p->num_spare++] = f;
+    pthread_cond_signal( &p->wake );
+    pthread_mutex_unlock( &p->lock );
+}
+
+static int
+compare_seconds(void const * a, void const * b) {
+    double const x = *(double const *) a, y = *(double const *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ *  Print the frame rate and costs of the frames shown since the last
+ *  report, and start counting again
+ */
+static void
+report(framePlayer * const p) {
+    playbackStats* const s = &p->stats;
+    if(s->frames == 0) {
+        return;
+    }
+    double sorted[PLAYBACK_REPORT_FRAMES];
+    memcpy( sorted, s->decode_seconds, s->frames * sizeof(*sorted) );
+    qsort( sorted, s->frames, sizeof(*sorted), compare_seconds );
+    double mean = 0.0;
+    unsigned int i;
+    for(i = 0; i < s->frames; i++) {
+        mean += sorted[i];
+    }
+    mean /= s->frames;
+
+    // Frames shown per second between the first and the last
+    double const elapsed = s->last - s->start;
+    double const fps = s->frames > 1 && elapsed > 0.0
+                       ? (s->frames - 1) / elapsed : 0.0;
+    printf("%u frames up to frame %u: %.1f frames/s", s->frames,
+           p->shown + 1, fps);
+    if(p->interval > 0.0) {
+        printf(" of %.1f", 1.0 / p->interval);
+    }
+    printf(", decoded in %.1f ms mean, %.1f ms p95, %.1f ms max, uploaded "
+           "in %.1f ms mean, %u late\n", 1e3 * mean,
+           1e3 * sorted[(s->frames * 95 + 99) / 100 - 1],
+           1e3 * sorted[s->frames - 1], 1e3 * s->upload_seconds / s->frames,
+           s->late);
+    s->frames = 0;
+    s->late = 0;
+    s->upload_seconds = 0.0;
+}
+
+/**
+ *  Upload a frame in place of the one drawn, and keep its heights and
+ *  pyramid for picking and ground following
+ */
+static void
+show(framePlayer * const p, playbackFrame * const f, worldData * const w) {
+    TRACE_SPAN("upload frame");
+    double const start = now();
+    size_t const vertex_bytes = w->num_vertices * sizeof(vec4);
+    size_t const normal_bytes = w->num_vertices * sizeof(vec3);
+    glBindBuffer( GL_ARRAY_BUFFER, p->vertex_buffer );
+    glBufferData( GL_ARRAY_BUFFER, p->normal_offset + normal_bytes, NULL,
+                  GL_STREAM_DRAW );
+    glBufferSubData( GL_ARRAY_BUFFER, 0, vertex_bytes, f->vertices );
+    glBufferSubData( GL_ARRAY_BUFFER, p->normal_offset, normal_bytes,
+                     f->normals );
+    TRACE_TALLY(TRACE_UPLOAD_BYTES, vertex_bytes + normal_bytes);
+
+    // The frame's buffer takes the heights and blocks shown before. Both
+    // pyramids were sized from the first frame, so their levels match.
+    mapData* const map = &w->heights->map;
+    elevationGrid const before = map->elevation;
+    map->elevation = f->heights.map.elevation;
+    f->heights.map.elevation = before;
+    unsigned int l;
+    for(l = 1; l < w->heights->levels; l++) {
+        heightRange* const ranges = w->heights->level[l].ranges;
+        w->heights->level[l].ranges = f->heights.level[l].ranges;
+        f->heights.level[l].ranges = ranges;
+    }
+
+    // Like update_heights(), the gradient only grows
+    if(f->maxElevation > map->maxElevation) {
+        map->maxElevation = f->maxElevation;
+        glUniform1f( p->max_elevation_pos, map->yScale
+                     * (map->maxElevation - map->minElevation) );
+    }
+
+    double const end = now();
+    playbackStats* const s = &p->stats;
+    if(s->frames == 0) {
+        s->start = end;
+    }
+    s->decode_seconds[s->frames++] = f->decode_seconds;
+    s->upload_seconds += end - start;
+    s->last = end;
+    p->shown = f->index;
+}
+
+/**
+ *  Show the next frame if it is due and decoded
+ *  @return 1 if a new frame was uploaded and should be drawn
+ */
+int
+playback_poll(framePlayer * const p, worldData * const w) {
+    if(p->wanted == p->shown) {
+        return 0;
+    }
+    double const t = now();
+    if(p->playing && t < p->due) {
+        return 0;
+    }
+    playbackFrame* const f = take(p);
+    if(f == NULL) {
+        if(p->playing && p->interval > 0.0 && !p->waiting) {
+            p->stats.late++;
+            p->waiting = 1;
+        }
+        return 0;
+    }
+    show( p, f, w );
+    give_back( p, f );
+    p->waiting = 0;
+
+    if(!p->playing) {
+        printf("Frame %u of %u, decoded in %.1f ms\n", p->shown + 1,
+               p->count, 1e3 * p->stats.decode_seconds[0]);
+        p->stats.frames = 0;
+        return 1;
+    }
+    p->wanted = (p->shown + 1) % p->count;
+
+    // A late frame moves the ones after it back instead of bunching them
+    p->due = p->due + p->interval > t ? p->due + p->interval
+                                      : t + p->interval;
+    if((p->shown + 1 == p->count && p->stats.frames > 1)
+       || p->stats.frames == PLAYBACK_REPORT_FRAMES) {
+        report( p );
+    }
+    return 1;
+}
+
+/**
+ *  Pause the sequence, or play it on from the frame drawn
+ */
+void
+playback_toggle(framePlayer * const p) {
+    if(p->count < 2) {
+        return;
+    }
+    p->playing = !p->playing;
+    if(p->playing) {
+        p->wanted = (p->shown + 1) % p->count;
+        p->due = now() + p->interval;
+        p->stats.frames = 0;
+    }else {
+        report( p );
+        p->wanted = p->shown;
+        printf("Paused at frame %u of %u\n", p->shown + 1, p->count);
+    }
+}
+
+/**
+ *  Pause and move a number of frames from the one drawn
+ *  @param[in] frames  Forward if positive, back if negative
+ */
+void
+playback_step(framePlayer * const p, int frames) {
+    if(p->playing) {
+        playback_toggle( p );
+    }
+    long const n = p->count;
+    p->wanted = (((long) p->shown + frames) % n + n) % n;
+}
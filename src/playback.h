@@ -0,0 +1,94 @@
+/**
+ * playback.h
+ */
+#ifndef PLAYBACK_H
+#define PLAYBACK_H
+#include <pthread.h>
+#include "terrain.h"
+#include "heightmap.h"
+#include "mapfile.h"
+
+// Frames decoded on the CPU: one waiting for the display while the next
+// is decoded
+#define PLAYBACK_BUFFERS        2
+
+// Microseconds the idle callback sleeps while the next frame isn't due or
+// isn't decoded yet
+#define PLAYBACK_POLL_US        1000
+
+// Frames shown between two reports of the frame rate, at most; a report
+// is also printed when the sequence starts over and on pause
+#define PLAYBACK_REPORT_FRAMES  256
+
+// One frame of the sequence, ready to upload
+typedef struct {
+    GLuint index;               // Of the frame in the sequence
+    heightMap heights;          // Its grid and min/max pyramid
+    GLfloat maxElevation;
+    vec4* vertices;             // The whole vertex buffer
+    vec3* normals;
+    double decode_seconds;      // Reading the grid, meshing it and
+                                // building its pyramid
+} playbackFrame;
+
+// What the frames shown since the last report cost
+typedef struct {
+    unsigned int frames;
+    double start;               // When the first was shown
+    double last;                // When the last one was
+    unsigned int late;          // Frames that weren't decoded when due,
+                                // when playing at a set rate
+    double upload_seconds;
+    double decode_seconds[PLAYBACK_REPORT_FRAMES];
+} playbackStats;
+
+// Plays a directory of same-sized grids, or a text file of grids one after
+// another, decoding each frame on a thread of its own while the one
+// before it is drawn
+struct framePlayer {
+    // Decoder side
+    optionsData opts;
+    worldData const * world;    // Only its pool is used
+    mapData placement;          // Of the first frame, without elevations
+    char** paths;               // One file per frame, or NULL for a stream
+    mappedFile stream;          // Grids one after another
+    size_t* offsets;            // Where each grid of the stream starts
+    GLuint count;               // Frames in the sequence
+    vec3* sample_normals;       // Scratch for the strip layout
+    playbackFrame frames[PLAYBACK_BUFFERS];
+    pthread_t thread;
+
+    // Shared with the decoder under the lock
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        // A buffer was freed or a frame taken
+    GLuint request;             // Next frame to decode
+    int busy;                   // Whether a frame is being decoded
+    GLuint decoding;            // Which one, while busy
+    playbackFrame* ready;       // Decoded and not taken yet
+    playbackFrame* spare[PLAYBACK_BUFFERS];
+    unsigned int num_spare;
+
+    // Display side
+    GLuint vertex_buffer;
+    size_t normal_offset;       // Bytes of positions
+    GLuint max_elevation_pos;
+    GLuint shown;               // The frame drawn
+    GLuint wanted;              // The frame to draw next
+    int playing;
+    int waiting;                // Whether the wanted frame is overdue
+    double interval;            // Seconds between frames, 0 for as fast
+                                // as they are decoded
+    double due;                 // When the wanted frame should be shown
+    playbackStats stats;
+};
+
+char const * playback_first_frame(char const * const path);
+framePlayer* playback_start(mapData const * const mData,
+                            worldData const * const w,
+                            optionsData const * const opts,
+                            GLuint vertex_buffer, size_t normal_offset,
+                            GLuint program);
+int playback_poll(framePlayer * const p, worldData * const w);
+void playback_toggle(framePlayer * const p);
+void playback_step(framePlayer * const p, int frames);
+#endif
@@ -0,0 +1,251 @@
+/**
+ * pool.c
+ *
+ * A small work-stealing thread pool. pool_run() splits its index range
+ * evenly across the workers' deques; each worker takes indices from the
+ * front of its own deque and, once that is empty, steals the back half of
+ * another worker's remaining range.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pool.h"
+#include "trace.h"
+
+typedef struct {
+    pthread_mutex_t lock;
+    unsigned int head;      // Next index to run
+    unsigned int tail;      // One past the last index to run
+    char padding[64];       // Keep deques on separate cache lines
+} poolDeque;
+
+struct threadPool {
+    unsigned int size;      // Number of workers, including the caller
+    pthread_t* threads;
+    poolDeque* deques;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    unsigned long generation;
+    unsigned int active;    // Workers still busy with the current run
+    int shutdown;
+
+    poolTask task;
+    void* arg;
+};
+
+typedef struct {
+    threadPool* pool;
+    unsigned int id;
+} poolWorker;
+
+static int
+pop_own(poolDeque * const d, unsigned int * const index) {
+    int found = 0;
+    pthread_mutex_lock( &d->lock );
+    if(d->head < d->tail) {
+        *index = d->head++;
+        found = 1;
+    }
+    pthread_mutex_unlock( &d->lock );
+    return found;
+}
+
+/**
+ *  Move the back half of another worker's range into our own deque
+ *  @return 1 if anything was stolen
+ */
+static int
+steal(threadPool * const pool, unsigned int id) {
+    unsigned int i;
+    for(i = 1; i < pool->size; i++) {
+        poolDeque* const victim = &pool->deques[(id + i) % pool->size];
+        unsigned int head = 0, tail = 0;
+
+        pthread_mutex_lock( &victim->lock );
+        unsigned int const left = victim->tail - victim->head;
+        if(left > 0) {
+            unsigned int const take = (left + 1) / 2;
+            tail = victim->tail;
+            head = tail - take;
+            victim->tail = head;
+        }
+        pthread_mutex_unlock( &victim->lock );
+
+        if(head < tail) {
+            poolDeque* const own = &pool->deques[id];
+            pthread_mutex_lock( &own->lock );
+            own->head = head;
+            own->tail = tail;
+            pthread_mutex_unlock( &own->lock );
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void
+work(threadPool * const pool, unsigned int id) {
+    TRACE_SPAN("pool work");
+    poolDeque* const own = &pool->deques[id];
+    for(;;) {
+        unsigned int index;
+        if(pop_own( own, &index )) {
+            pool->task( pool->arg, index );
+        }else if(!steal( pool, id )) {
+            return;
+        }
+    }
+}
+
+static void*
+worker_main(void* arg) {
+    poolWorker* const worker = arg;
+    threadPool* const pool = worker->pool;
+    unsigned long seen = 0;
+
+    for(;;) {
+        pthread_mutex_lock( &pool->lock );
+        while(pool->generation == seen && !pool->shutdown) {
+            pthread_cond_wait( &pool->wake, &pool->lock );
+        }
+        if(pool->shutdown) {
+            pthread_mutex_unlock( &pool->lock );
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock( &pool->lock );
+
+        work( pool, worker->id );
+
+        pthread_mutex_lock( &pool->lock );
+        if(--pool->active == 0) {
+            pthread_cond_signal( &pool->done );
+        }
+        pthread_mutex_unlock( &pool->lock );
+    }
+
+    free( worker );
+    return NULL;
+}
+
+/**
+ *  The number of online CPUs, used when no thread count is given
+ */
+unsigned int
+pool_default_threads() {
+    long const cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? cpus : 1;
+}
+
+/**
+ *  Create a pool. The thread calling pool_run() counts as one of the
+ *  workers, so threads - 1 threads are started.
+ *  @param[in] threads  The number of workers, 0 for one per CPU
+ *  @return The pool
+ */
+threadPool*
+pool_create(unsigned int threads) {
+    threadPool* const pool = calloc(1, sizeof(*pool));
+    pool->size = threads > 0 ? threads : pool_default_threads();
+    pool->threads = calloc(pool->size, sizeof(*pool->threads));
+    pool->deques = calloc(pool->size, sizeof(*pool->deques));
+    pthread_mutex_init( &pool->lock, NULL );
+    pthread_cond_init( &pool->wake, NULL );
+    pthread_cond_init( &pool->done, NULL );
+
+    unsigned int i;
+    for(i = 0; i < pool->size; i++) {
+        pthread_mutex_init( &pool->deques[i].lock, NULL );
+    }
+
+    for(i = 1; i < pool->size; i++) {
+        poolWorker* const worker = malloc(sizeof(*worker));
+        worker->pool = pool;
+        worker->id = i;
+        if(pthread_create(&pool->threads[i], NULL, worker_main, worker) != 0) {
+            // Run with the workers we managed to start
+            free( worker );
+            pool->size = i;
+            break;
+        }
+    }
+    return pool;
+}
+
+/**
+ *  Stop the workers and free the pool
+ */
+void
+pool_destroy(threadPool * const pool) {
+    pthread_mutex_lock( &pool->lock );
+    pool->shutdown = 1;
+    pthread_cond_broadcast( &pool->wake );
+    pthread_mutex_unlock( &pool->lock );
+
+    unsigned int i;
+    for(i = 1; i < pool->size; i++) {
+        pthread_join( pool->threads[i], NULL );
+    }
+    for(i = 0; i < pool->size; i++) {
+        pthread_mutex_destroy( &pool->deques[i].lock );
+    }
+    pthread_mutex_destroy( &pool->lock );
+    pthread_cond_destroy( &pool->wake );
+    pthread_cond_destroy( &pool->done );
+    free( pool->deques );
+    free( pool->threads );
+    free( pool );
+}
+
+unsigned int
+pool_size(threadPool const * const pool) {
+    return pool->size;
+}
+
+/**
+ *  Run task(arg, i) for every i in [0, count) and wait for all of them to
+ *  finish. Tasks may run in any order and on any worker, so they must only
+ *  write to state owned by their index. Not reentrant: tasks must not call
+ *  pool_run() on the same pool.
+ *  @param[in] pool  The pool
+ *  @param[in] count  The number of indices
+ *  @param[in] task  The function to run for each index
+ *  @param[in] arg  The first argument passed to task
+ */
+void
+pool_run(threadPool * const pool, unsigned int count,
+         poolTask task, void * const arg) {
+    unsigned int i;
+    if(pool->size == 1 || count <= 1) {
+        for(i = 0; i < count; i++) {
+            task( arg, i );
+        }
+        return;
+    }
+
+    pthread_mutex_lock( &pool->lock );
+    pool->task = task;
+    pool->arg = arg;
+    for(i = 0; i < pool->size; i++) {
+        poolDeque* const d = &pool->deques[i];
+        pthread_mutex_lock( &d->lock );
+        d->head = (unsigned long) count * i / pool->size;
+        d->tail = (unsigned long) count * (i + 1) / pool->size;
+        pthread_mutex_unlock( &d->lock );
+    }
+    pool->active = pool->size;
+    pool->generation++;
+    pthread_cond_broadcast( &pool->wake );
+    pthread_mutex_unlock( &pool->lock );
+
+    work( pool, 0 );
+
+    pthread_mutex_lock( &pool->lock );
+    pool->active--;
+    while(pool->active > 0) {
+        pthread_cond_wait( &pool->done, &pool->lock );
+    }
+    pthread_mutex_unlock( &pool->lock );
+}
@@ -0,0 +1,18 @@
+/**
+ * pool.h
+ */
+#ifndef POOL_H
+#define POOL_H
+
+typedef struct threadPool threadPool;
+
+// A task is called once for every index of a pool_run()
+typedef void (*poolTask)(void * const arg, unsigned int index);
+
+threadPool* pool_create(unsigned int threads);
+void pool_destroy(threadPool * const pool);
+unsigned int pool_size(threadPool const * const pool);
+void pool_run(threadPool * const pool, unsigned int count,
+              poolTask task, void * const arg);
+unsigned int pool_default_threads();
+#endif
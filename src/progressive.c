@@ -0,0 +1,225 @@
+/**
+ * progressive.c
+ *
+ * Loads a map on a thread of its own so the window is up and interactive
+ * right away. Once the elevations are in, the loader meshes every 16th
+ * sample, then every 4th, then every sample, publishing each level as it
+ * is done. The display swaps a level in whenever it finds a new one; a
+ * level superseded before the display saw it is dropped by the loader.
+ */
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include "progressive.h"
+#include "init.h"
+#include "mesh.h"
+#include "normals.h"
+#include "trace.h"
+
+/**
+ *  Publish a level, dropping the one before it if it wasn't taken yet
+ */
+static void
+publish(progressiveLoader * const l, progressiveMesh * const m) {
+    progressiveMesh* const old = __atomic_exchange_n(&l->ready, m,
+                                                     __ATOMIC_ACQ_REL);
+    if(old != NULL) {
+        progressive_mesh_free( old );
+    }
+}
+
+/**
+ *  Keep every step-th sample of a map, and always its last row and column
+ *  @param[out] coarse  The coarser map, placed like the full one
+ *  @param[in] full  The full map
+ *  @param[in] step  Samples between two kept samples
+ */
+static void
+decimate(mapData * const coarse, mapData const * const full, GLuint step) {
+    *coarse = *full;
+    coarse->mapWidth = (full->mapWidth + step - 2) / step + 1;
+    coarse->mapHeight = (full->mapHeight + step - 2) / step + 1;
+    coarse->scale = full->scale * step;
+    if(!grid_init( &coarse->elevation, coarse->mapWidth, coarse->mapHeight,
+                   GRID_ROW_MAJOR )) {
+        fprintf(stderr, "Unable to allocate %u x %u elevation samples\n",
+                coarse->mapWidth, coarse->mapHeight);
+        exit(1);
+    }
+
+    GLuint x, z;
+    for(z = 0; z < coarse->mapHeight; z++) {
+        GLuint const fz = z * step < full->mapHeight ? z * step
+                                                     : full->mapHeight - 1;
+        for(x = 0; x < coarse->mapWidth; x++) {
+            GLuint const fx = x * step < full->mapWidth ? x * step
+                                                        : full->mapWidth - 1;
+            grid_set( &coarse->elevation, x, z,
+                      grid_get(&full->elevation, fx, fz) );
+        }
+    }
+}
+
+/**
+ *  Mesh a map the way init() does for the indexed layouts
+ *  @param[in] mData  The map to mesh, the full one or a decimated one
+ *  @param[in] full  The full map
+ *  @param[in] step  Samples of the full map between two of mData
+ */
+static progressiveMesh*
+build_level(progressiveLoader const * const l, mapData const * const mData,
+            mapData const * const full, GLuint step) {
+    TRACE_SPAN("build level");
+    progressiveMesh* const m = malloc(sizeof(*m));
+    m->step = step;
+    m->map = *full;
+    memset( &m->map.elevation, 0, sizeof(m->map.elevation) );
+    m->num_vertices = mesh_vertex_count(l->opts.mesh, mData->mapWidth,
+                                        mData->mapHeight);
+    m->num_indices = mesh_index_count(l->opts.mesh, mData->mapWidth,
+                                      mData->mapHeight);
+    m->num_triangles = mesh_triangle_count(mData->mapWidth, mData->mapHeight);
+
+    threadPool* const pool = l->world->pool;
+    m->vertices = malloc(m->num_vertices * sizeof(*m->vertices));
+    m->normals = malloc(m->num_vertices * sizeof(*m->normals));
+    m->indices = malloc(m->num_indices * sizeof(*m->indices));
+    mesh_build_vertices( m->vertices, mData, pool );
+    compute_normals( m->normals, mData, l->opts.normals, pool );
+    mesh_build_indices( m->indices, l->opts.mesh, mData, pool );
+
+    // The last row and column were clamped to the edge of the full map
+    if(step > 1) {
+        GLuint i;
+        for(i = 0; i < mData->mapHeight; i++) {
+            m->vertices[(i + 1) * mData->mapWidth - 1].x
+                = full->scale * (full->mapWidth - 1) - full->xOffset;
+        }
+        vec4* const last_row = m->vertices
+                               + (mData->mapHeight - 1) * mData->mapWidth;
+        for(i = 0; i < mData->mapWidth; i++) {
+            last_row[i].z = full->scale * (full->mapHeight - 1)
+                            - full->zOffset;
+        }
+    }
+    return m;
+}
+
+static void*
+load_thread(void * const arg) {
+    progressiveLoader* const l = arg;
+    mapData full;
+    load_map( &full, l->file, l->world, &l->opts );
+
+    size_t const num_vertices = mesh_vertex_count(l->opts.mesh, full.mapWidth,
+                                                  full.mapHeight);
+    size_t const num_indices = mesh_index_count(l->opts.mesh, full.mapWidth,
+                                                full.mapHeight);
+    if(num_vertices > INT_MAX || num_indices > INT_MAX) {
+        fprintf(stderr, "%u x %u samples is too large for a %s mesh\n",
+                full.mapWidth, full.mapHeight, mesh_mode_name(l->opts.mesh));
+        exit(1);
+    }
+
+    GLuint step;
+    for(step = PROGRESSIVE_FIRST_STEP; step > 1; step /= PROGRESSIVE_REFINE) {
+        mapData coarse;
+        decimate( &coarse, &full, step );
+        publish( l, build_level(l, &coarse, &full, step) );
+        grid_free( &coarse.elevation );
+    }
+    publish( l, build_level(l, &full, &full, 1) );
+    grid_free( &full.elevation );
+    return NULL;
+}
+
+/**
+ *  Start loading a map in the background
+ *  @param[in] file  The elevation file, closed by the loader
+ *  @param[in] w  The world, whose pool the loader shares
+ *  @param[in] opts  The command line options, for an indexed float mesh
+ *  @return The loader, for the lifetime of the program
+ */
+progressiveLoader*
+progressive_start(FILE * const file, worldData const * const w,
+                  optionsData const * const opts) {
+    progressiveLoader* const l = calloc(1, sizeof(*l));
+    l->file = file;
+    l->opts = *opts;
+    l->world = w;
+    clock_gettime( CLOCK_MONOTONIC, &l->start );
+    if(pthread_create( &l->thread, NULL, load_thread, l ) != 0) {
+        fprintf(stderr, "Unable to start the loader thread\n");
+        exit(1);
+    }
+    pthread_detach( l->thread );
+    return l;
+}
+
+/**
+ *  Take the newest level published, without waiting
+ *  @return The level, to be freed by the caller, or NULL if there is no
+ *          new one
+ */
+progressiveMesh*
+progressive_take(progressiveLoader * const l) {
+    return __atomic_exchange_n(&l->ready, NULL, __ATOMIC_ACQ_REL);
+}
+
+/**
+ *  Replace the buffers drawn with a level
+ *  @param[in] l  The loader, whose buffers are bound to the vertex array
+ *  @param[in] m  The level
+ *  @param[in,out] w  The world, drawing the level from now on
+ */
+void
+progressive_upload(progressiveLoader * const l,
+                   progressiveMesh const * const m,
+                   worldData * const w) {
+    TRACE_SPAN("upload level");
+    size_t const vertexSize = m->num_vertices * sizeof(vec4);
+    size_t const normalSize = m->num_vertices * sizeof(vec3);
+    TRACE_TALLY(TRACE_UPLOAD_BYTES, vertexSize + normalSize
+                                    + m->num_indices * sizeof(*m->indices));
+    glBindBuffer( GL_ARRAY_BUFFER, l->vertex_buffer );
+    glBufferData( GL_ARRAY_BUFFER, vertexSize + normalSize, NULL,
+                  GL_STATIC_DRAW );
+    glBufferSubData( GL_ARRAY_BUFFER, 0, vertexSize, m->vertices );
+    glBufferSubData( GL_ARRAY_BUFFER, vertexSize, normalSize, m->normals );
+
+    // The normals start after however many positions this level has
+    glVertexAttribPointer( l->normal_attribute, 3, GL_FLOAT, GL_FALSE, 0,
+                           BUFFER_OFFSET(vertexSize) );
+
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, l->index_buffer );
+    glBufferData( GL_ELEMENT_ARRAY_BUFFER,
+                  m->num_indices * sizeof(*m->indices), m->indices,
+                  GL_STATIC_DRAW );
+
+    glUniform1f( l->max_elevation_pos,
+                 m->map.yScale * (m->map.maxElevation - m->map.minElevation) );
+
+    w->num_vertices = m->num_vertices;
+    w->num_indices = m->num_indices;
+    w->num_triangles = m->num_triangles;
+    l->step = m->step;
+}
+
+void
+progressive_mesh_free(progressiveMesh * const m) {
+    free( m->indices );
+    free( m->normals );
+    free( m->vertices );
+    free( m );
+}
+
+/**
+ *  Seconds since the loader started
+ */
+double
+progressive_seconds(progressiveLoader const * const l) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (now.tv_sec - l->start.tv_sec)
+           + (now.tv_nsec - l->start.tv_nsec) / 1e9;
+}
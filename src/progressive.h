@@ -0,0 +1,62 @@
+/**
+ * progressive.h
+ */
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include "terrain.h"
+
+// The first preview keeps every 16th sample, each next one 4 times as many
+// per side, down to the full map
+#define PROGRESSIVE_FIRST_STEP  16
+#define PROGRESSIVE_REFINE      4
+
+// Microseconds the idle callback sleeps while nothing new is ready
+#define PROGRESSIVE_POLL_US     2000
+
+// One finished level, built by the loader and uploaded by the display
+typedef struct {
+    GLuint step;                // Map samples between two vertices
+    mapData map;                // Placement of the full map, without
+                                // elevations
+    vec4* vertices;
+    vec3* normals;
+    GLuint num_vertices;
+    GLuint* indices;
+    GLuint num_indices;
+    size_t num_triangles;
+} progressiveMesh;
+
+// Loads a map in the background while the display draws what is ready
+struct progressiveLoader {
+    FILE* file;
+    optionsData opts;
+    worldData const * world;    // Only its cube size and pool are used
+    struct timespec start;
+    pthread_t thread;
+
+    // Handed from the loader to the display without a lock: whoever
+    // exchanges a mesh out of it owns the mesh
+    progressiveMesh* ready;
+
+    // Display side
+    GLuint vertex_buffer;
+    GLuint index_buffer;
+    GLuint normal_attribute;
+    GLuint max_elevation_pos;
+    GLuint step;                // Of the level uploaded last, 0 for none
+    GLuint reported_step;       // Of the level last logged as drawn
+};
+
+progressiveLoader* progressive_start(FILE * const file,
+                                     worldData const * const w,
+                                     optionsData const * const opts);
+progressiveMesh* progressive_take(progressiveLoader * const l);
+void progressive_upload(progressiveLoader * const l,
+                        progressiveMesh const * const m,
+                        worldData * const w);
+void progressive_mesh_free(progressiveMesh * const m);
+double progressive_seconds(progressiveLoader const * const l);
+#endif
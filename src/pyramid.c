@@ -0,0 +1,323 @@
+/**
+ * pyramid.c
+ *
+ * Tiled, decimated storage for maps larger than memory. The writer takes
+ * the rows of a map one at a time and only keeps one row of tiles of every
+ * level in memory. Tiles are read back individually with pread(), so any
+ * number of threads can share a pyramid.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "pyramid.h"
+
+static char const pyramid_magic[4] = { 'T', 'V', 'P', '\0' };
+
+// Tiles start on page boundaries
+#define PYRAMID_ALIGN 4096
+
+size_t
+pyramid_tile_bytes(pyramid const * const p) {
+    return (size_t) PYRAMID_TILE_SAMPLES * PYRAMID_TILE_SAMPLES
+           * sizeof(GLfloat);
+}
+
+/**
+ *  Open a pyramid written by pyramid_writer_close()
+ *  @param[out] p  The pyramid
+ *  @param[in] path  The .tvp file
+ *  @return 1 if the file is a valid pyramid, 0 otherwise
+ */
+int
+pyramid_open(pyramid * const p, char const * const path) {
+    p->fd = open(path, O_RDONLY);
+    if(p->fd < 0) {
+        return 0;
+    }
+
+    struct stat st;
+    pyramidHeader const * const h = &p->header;
+    if(fstat(p->fd, &st) != 0
+       || pread(p->fd, &p->header, sizeof(p->header), 0)
+          != (ssize_t) sizeof(p->header)
+       || memcmp(h->magic, pyramid_magic, sizeof(pyramid_magic)) != 0
+       || h->version != PYRAMID_VERSION
+       || h->tileSize != PYRAMID_TILE_SIZE
+       || h->levels == 0 || h->levels > PYRAMID_MAX_LEVELS) {
+        pyramid_close( p );
+        return 0;
+    }
+
+    pyramidLevel const * const last = &h->level[h->levels - 1];
+    uint64_t const end = last->offset + (uint64_t) last->tilesX
+                         * last->tilesZ * pyramid_tile_bytes(p);
+    if(end > (uint64_t) st.st_size) {
+        pyramid_close( p );
+        return 0;
+    }
+    return 1;
+}
+
+void
+pyramid_close(pyramid * const p) {
+    if(p->fd >= 0) {
+        close( p->fd );
+    }
+    p->fd = -1;
+}
+
+/**
+ *  Read one tile
+ *  @param[in] p  The pyramid
+ *  @param[in] level  The level of the tile
+ *  @param[in] x, z  The column and row of the tile in its level
+ *  @param[out] out  PYRAMID_TILE_SAMPLES squared heights, row-major
+ *  @return 1 if the tile was read, 0 otherwise
+ */
+int
+pyramid_read_tile(pyramid const * const p, GLuint level, GLuint x, GLuint z,
+                  GLfloat * const out) {
+    if(level >= p->header.levels) {
+        return 0;
+    }
+    pyramidLevel const * const l = &p->header.level[level];
+    if(x >= l->tilesX || z >= l->tilesZ) {
+        return 0;
+    }
+    size_t const bytes = pyramid_tile_bytes(p);
+    off_t const offset = l->offset + ((uint64_t) z * l->tilesX + x) * bytes;
+    return pread(p->fd, out, bytes, offset) == (ssize_t) bytes;
+}
+
+static uint64_t
+align_offset(uint64_t offset) {
+    return (offset + PYRAMID_ALIGN - 1) & ~(uint64_t) (PYRAMID_ALIGN - 1);
+}
+
+/**
+ *  Start writing a pyramid. The file appears under its name once
+ *  pyramid_writer_close() succeeds.
+ *  @param[out] w  The writer
+ *  @param[in] path  The .tvp file
+ *  @param[in] width  The samples in a row of the map
+ *  @param[in] height  The rows of the map
+ *  @param[in] resolution  The distance between two samples
+ *  @return 1 if the file was created, 0 otherwise
+ */
+int
+pyramid_writer_open(pyramidWriter * const w, char const * const path,
+                    GLuint width, GLuint height, GLfloat resolution) {
+    memset( w, 0, sizeof(*w) );
+    pyramidHeader* const h = &w->header;
+    memcpy( h->magic, pyramid_magic, sizeof(pyramid_magic) );
+    h->version = PYRAMID_VERSION;
+    h->mapWidth = width;
+    h->mapHeight = height;
+    h->tileSize = PYRAMID_TILE_SIZE;
+    h->resolution = resolution;
+
+    // Halve the map until it fits in a single tile
+    size_t const tile_bytes = (size_t) PYRAMID_TILE_SAMPLES
+                              * PYRAMID_TILE_SAMPLES * sizeof(GLfloat);
+    uint64_t offset = align_offset(sizeof(*h));
+    GLuint level_width = width, level_height = height;
+    while(h->levels < PYRAMID_MAX_LEVELS) {
+        pyramidLevel* const l = &h->level[h->levels++];
+        l->width = level_width;
+        l->height = level_height;
+        l->tilesX = (level_width - 1 + PYRAMID_TILE_SIZE - 1)
+                    / PYRAMID_TILE_SIZE;
+        l->tilesZ = (level_height - 1 + PYRAMID_TILE_SIZE - 1)
+                    / PYRAMID_TILE_SIZE;
+        l->tilesX = l->tilesX > 0 ? l->tilesX : 1;
+        l->tilesZ = l->tilesZ > 0 ? l->tilesZ : 1;
+        l->offset = offset;
+        offset += (uint64_t) l->tilesX * l->tilesZ * tile_bytes;
+
+        if(level_width <= PYRAMID_TILE_SAMPLES
+           && level_height <= PYRAMID_TILE_SAMPLES) {
+            break;
+        }
+        // Every other sample, keeping the last one
+        level_width = level_width / 2 + 1;
+        level_height = level_height / 2 + 1;
+    }
+
+    unsigned int i;
+    for(i = 0; i < h->levels; i++) {
+        w->bands[i] = malloc((size_t) PYRAMID_TILE_SAMPLES * h->level[i].width
+                             * sizeof(GLfloat));
+    }
+    w->tile = malloc(tile_bytes);
+
+    size_t const length = strlen(path);
+    w->path = malloc(length + 1);
+    memcpy( w->path, path, length + 1 );
+    w->temp = malloc(length + 32);
+    sprintf( w->temp, "%s.%ld", path, (long) getpid() );
+    w->fd = open(w->temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    w->ok = (w->fd >= 0);
+    return w->ok;
+}
+
+/**
+ *  Where row z of a level goes in its band. The last row of a row of tiles
+ *  is also the first of the next one, and moves there once written.
+ */
+static GLuint
+band_row(GLuint z) {
+    return (z > 0 && z % PYRAMID_TILE_SIZE == 0) ? PYRAMID_TILE_SIZE
+                                                 : z % PYRAMID_TILE_SIZE;
+}
+
+/**
+ *  Write the tiles of the band of a level, padding columns past the edge
+ */
+static void
+write_band(pyramidWriter * const w, GLuint level, GLuint tz) {
+    pyramidLevel const * const l = &w->header.level[level];
+    GLfloat const * const band = w->bands[level];
+    size_t const tile_bytes = (size_t) PYRAMID_TILE_SAMPLES
+                              * PYRAMID_TILE_SAMPLES * sizeof(GLfloat);
+    GLuint tx, r, c;
+    for(tx = 0; w->ok && tx < l->tilesX; tx++) {
+        for(r = 0; r < PYRAMID_TILE_SAMPLES; r++) {
+            for(c = 0; c < PYRAMID_TILE_SAMPLES; c++) {
+                GLuint const x = tx * PYRAMID_TILE_SIZE + c;
+                w->tile[r * PYRAMID_TILE_SAMPLES + c]
+                    = band[(size_t) r * l->width
+                           + (x < l->width ? x : l->width - 1)];
+            }
+        }
+        off_t const offset = l->offset
+                             + ((uint64_t) tz * l->tilesX + tx) * tile_bytes;
+        w->ok = pwrite(w->fd, w->tile, tile_bytes, offset)
+                == (ssize_t) tile_bytes;
+    }
+}
+
+/**
+ *  Hand a row already stored in the band of a level to the next level,
+ *  then write the band out if the row completes it
+ */
+static void
+finish_row(pyramidWriter * const w, GLuint level) {
+    pyramidLevel const * const l = &w->header.level[level];
+    GLuint const z = w->rows[level]++;
+    GLuint const r = band_row(z);
+    GLfloat* const row = w->bands[level] + (size_t) r * l->width;
+
+    // Even rows and columns make up the next level
+    if(z % 2 == 0 && level + 1 < w->header.levels) {
+        pyramidLevel const * const next = &w->header.level[level + 1];
+        GLfloat* const out = w->bands[level + 1]
+                             + (size_t) band_row(w->rows[level + 1])
+                               * next->width;
+        GLuint x;
+        for(x = 0; x < next->width; x++) {
+            out[x] = row[2 * x < l->width ? 2 * x : l->width - 1];
+        }
+        finish_row( w, level + 1 );
+    }
+
+    if(r == PYRAMID_TILE_SIZE) {
+        write_band( w, level, z / PYRAMID_TILE_SIZE - 1 );
+        memcpy( w->bands[level], row, l->width * sizeof(GLfloat) );
+    }
+}
+
+/**
+ *  Add the next row of the map
+ *  @param[in] w  The writer
+ *  @param[in] row  mapWidth heights
+ */
+void
+pyramid_writer_row(pyramidWriter * const w, GLfloat const * const row) {
+    pyramidHeader* const h = &w->header;
+    if(w->rows[0] >= h->mapHeight) {
+        w->ok = 0;
+        return;
+    }
+
+    GLuint x;
+    for(x = 0; x < h->mapWidth; x++) {
+        if(row[x] > h->maxElevation) {
+            h->maxElevation = row[x];
+        }
+        if(row[x] > 0.0f
+           && (h->minElevation == 0.0f || row[x] < h->minElevation)) {
+            h->minElevation = row[x];
+        }
+    }
+
+    memcpy( w->bands[0] + (size_t) band_row(w->rows[0]) * h->mapWidth, row,
+            h->mapWidth * sizeof(GLfloat) );
+    finish_row( w, 0 );
+}
+
+/**
+ *  Write the last rows of tiles and the header, then move the pyramid into
+ *  place
+ *  @return 1 if the whole pyramid was written, 0 otherwise
+ */
+int
+pyramid_writer_close(pyramidWriter * const w) {
+    pyramidHeader const * const h = &w->header;
+    w->ok = w->ok && w->rows[0] == h->mapHeight;
+
+    GLuint i;
+    for(i = 0; w->ok && i < h->levels; i++) {
+        pyramidLevel const * const l = &h->level[i];
+        GLuint const last = w->rows[i] - 1;
+        GLuint const r = (last > 0 && last % PYRAMID_TILE_SIZE == 0)
+                         ? 0 : last % PYRAMID_TILE_SIZE;
+        GLfloat const * const row = w->bands[i] + (size_t) r * l->width;
+
+        // An odd last row is repeated as the last row of the next level
+        if(last % 2 == 1 && i + 1 < h->levels) {
+            pyramidLevel const * const next = &h->level[i + 1];
+            GLfloat* const out = w->bands[i + 1]
+                                 + (size_t) band_row(w->rows[i + 1])
+                                   * next->width;
+            GLuint x;
+            for(x = 0; x < next->width; x++) {
+                out[x] = row[2 * x < l->width ? 2 * x : l->width - 1];
+            }
+            finish_row( w, i + 1 );
+        }
+
+        // Pad a partial row of tiles with copies of its last row
+        if(r > 0) {
+            GLuint pad;
+            for(pad = r + 1; pad < PYRAMID_TILE_SAMPLES; pad++) {
+                memcpy( w->bands[i] + (size_t) pad * l->width, row,
+                        l->width * sizeof(GLfloat) );
+            }
+            write_band( w, i, last / PYRAMID_TILE_SIZE );
+        }
+        w->ok = w->ok && w->rows[i] == l->height;
+    }
+
+    if(w->fd >= 0) {
+        w->ok = w->ok
+                && pwrite(w->fd, h, sizeof(*h), 0) == (ssize_t) sizeof(*h);
+        w->ok = (close( w->fd ) == 0) && w->ok;
+    }
+    if(w->ok) {
+        w->ok = (rename( w->temp, w->path ) == 0);
+    }
+    if(!w->ok) {
+        unlink( w->temp );
+    }
+
+    for(i = 0; i < h->levels; i++) {
+        free( w->bands[i] );
+    }
+    free( w->tile );
+    free( w->temp );
+    free( w->path );
+    return w->ok;
+}
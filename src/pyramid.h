@@ -0,0 +1,74 @@
+/**
+ * pyramid.h
+ */
+#ifndef PYRAMID_H
+#define PYRAMID_H
+#include <stdint.h>
+#include <stddef.h>
+#include <GL/glut.h>
+
+#define PYRAMID_EXTENSION   ".tvp"
+#define PYRAMID_VERSION     1
+#define PYRAMID_MAX_LEVELS  24
+
+// Cells per side of a tile. Tiles store one more sample per side, so that
+// neighbouring tiles share their edges.
+#define PYRAMID_TILE_SIZE   64
+#define PYRAMID_TILE_SAMPLES (PYRAMID_TILE_SIZE + 1)
+
+typedef struct {
+    uint32_t width;             // Samples
+    uint32_t height;
+    uint32_t tilesX;
+    uint32_t tilesZ;
+    uint64_t offset;            // Of the first tile, tiles are row-major
+} pyramidLevel;
+
+/**
+ *  On-disk header of a .tvp file, stored in native byte order. Level 0
+ *  holds the map's samples, every further level every other sample of the
+ *  one before, down to a level that fits in a single tile. Samples past
+ *  the right and bottom edges of a level repeat its last column and row.
+ */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t mapWidth;
+    uint32_t mapHeight;
+    uint32_t tileSize;
+    uint32_t levels;
+    float resolution;
+    float minElevation;         // Same meaning as in mapData
+    float maxElevation;
+    uint32_t reserved;
+    pyramidLevel level[PYRAMID_MAX_LEVELS];
+} pyramidHeader;
+
+typedef struct {
+    int fd;
+    pyramidHeader header;
+} pyramid;
+
+typedef struct {
+    int fd;
+    char* path;                 // Written to a temporary file until closed
+    char* temp;
+    pyramidHeader header;
+    GLfloat* bands[PYRAMID_MAX_LEVELS];     // The rows of the current row
+                                            // of tiles of each level
+    GLuint rows[PYRAMID_MAX_LEVELS];        // Rows received by each level
+    GLfloat* tile;
+    int ok;
+} pyramidWriter;
+
+int pyramid_open(pyramid * const p, char const * const path);
+void pyramid_close(pyramid * const p);
+size_t pyramid_tile_bytes(pyramid const * const p);
+int pyramid_read_tile(pyramid const * const p, GLuint level, GLuint x,
+                      GLuint z, GLfloat * const out);
+
+int pyramid_writer_open(pyramidWriter * const w, char const * const path,
+                        GLuint width, GLuint height, GLfloat resolution);
+void pyramid_writer_row(pyramidWriter * const w, GLfloat const * const row);
+int pyramid_writer_close(pyramidWriter * const w);
+#endif
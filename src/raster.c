@@ -0,0 +1,654 @@
+/**
+ * raster.c
+ *
+ * Draws a triangle mesh into an image on the CPU, with the same
+ * transformations, gradient and Phong lighting as
+ * shaders/vshader_gradient.glsl and shaders/fshader_gradient.glsl. Nothing
+ * here needs an OpenGL context.
+ *
+ * Vertices are transformed in bands, then triangles are sorted into the
+ * image tiles their bounds touch. Each tile is drawn by one task, walking
+ * its triangles in mesh order so the image doesn't depend on the number of
+ * threads. Window coordinates are snapped to 1/16 of a pixel, which makes
+ * the edge functions exact in double precision: triangles sharing an edge
+ * leave no gaps however small they get. They are evaluated four pixels at
+ * a time with GCC vector extensions, which compile to SSE or NEON.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "raster.h"
+#include "horizon.h"
+#include "trace.h"
+
+typedef double v4d __attribute__ ((vector_size (32)));
+typedef long long v4l __attribute__ ((vector_size (32)));
+
+// A vector of one value; a macro since returning a vector from a function
+// changes the ABI when AVX is off
+#define splat(f)            ((v4d) { (f), (f), (f), (f) })
+
+// Sub-pixel steps of snapped window coordinates
+#define RASTER_SUBPIXELS    16.0
+
+// Triangles reaching further outside the view than this many times its
+// half width are clipped, which bounds window coordinates
+#define RASTER_GUARD_BAND   2.0f
+
+// The near plane and the four sides of the guard band
+#define RASTER_PLANES       5
+#define RASTER_MAX_POLYGON  (3 + RASTER_PLANES)
+
+// The varyings of the shaders, interpolated linearly when clipping
+typedef struct {
+    GLfloat clip[4];
+    GLfloat eye[3];             // Position, eye coordinates
+    GLfloat normal[3];          // Eye coordinates
+    GLfloat intensity;          // Height as a fraction of max_elevation
+    GLfloat sunlight;           // 0 in the shadow of the terrain
+} rasterVertex;
+
+#define RASTER_VARYINGS (sizeof(rasterVertex) / sizeof(GLfloat))
+
+// A vertex in window coordinates, top row first
+typedef struct {
+    GLfloat x;
+    GLfloat y;
+    GLfloat z;
+    GLfloat inv_w;
+    rasterVertex const * v;
+} screenVertex;
+
+typedef struct {
+    GLuint* triangles;
+    size_t count;
+    size_t capacity;
+} rasterBin;
+
+typedef struct {
+    rasterImage* image;
+    rasterScene const * scene;
+    mat4 model_view;
+    mat4 projection;
+    vec4 const * vertices;
+    vec3 const * normals;
+    GLubyte const * horizons;
+    GLuint num_vertices;
+    GLuint const * indices;
+    size_t num_triangles;
+    rasterVertex* transformed;
+    GLuint tiles_x;
+    GLuint tiles_y;
+    rasterBin* bins;            // RASTER_BIN_TASKS rows of tiles_x * tiles_y
+} rasterJob;
+
+/**
+ *  Allocate an image
+ *  @return 0 if there isn't enough memory
+ */
+int
+raster_image_init(rasterImage * const image, GLuint width, GLuint height) {
+    image->width = width;
+    image->height = height;
+    image->color = malloc((size_t) width * height * 3);
+    image->depth = malloc((size_t) width * height * sizeof(*image->depth));
+    if(image->color == NULL || image->depth == NULL) {
+        raster_image_free( image );
+        return 0;
+    }
+    return 1;
+}
+
+void
+raster_image_free(rasterImage * const image) {
+    free( image->color );
+    free( image->depth );
+    image->color = NULL;
+    image->depth = NULL;
+}
+
+/**
+ *  Run the vertex shader over a band of vertices
+ */
+static void
+transform_band(void * const arg, unsigned int band) {
+    rasterJob* const job = arg;
+    GLuint const start = band * RASTER_VERTEX_BAND;
+    GLuint const end = job->num_vertices - start < RASTER_VERTEX_BAND
+                       ? job->num_vertices : start + RASTER_VERTEX_BAND;
+
+    GLuint i;
+    for(i = start; i < end; i++) {
+        rasterVertex* const out = &job->transformed[i];
+        vec4 eye, clip;
+        mat4_mult_v( &eye, job->model_view, &job->vertices[i] );
+        mat4_mult_v( &clip, job->projection, &eye );
+        out->clip[0] = clip.x;
+        out->clip[1] = clip.y;
+        out->clip[2] = clip.z;
+        out->clip[3] = clip.w;
+        out->eye[0] = eye.x;
+        out->eye[1] = eye.y;
+        out->eye[2] = eye.z;
+
+        vec4 normal, eye_normal;
+        vec4_init( &normal, job->normals[i].x, job->normals[i].y,
+                   job->normals[i].z, 0.0f );
+        mat4_mult_v( &eye_normal, job->model_view, &normal );
+        out->normal[0] = eye_normal.x;
+        out->normal[1] = eye_normal.y;
+        out->normal[2] = eye_normal.z;
+        out->intensity = job->vertices[i].y / job->scene->max_elevation;
+        out->sunlight = 1.0f;
+        if(job->horizons != NULL) {
+            out->sunlight = horizon_sunlight(&job->horizons[(size_t) i
+                                                            * HORIZON_AZIMUTHS],
+                                             &job->scene->sun_direction);
+        }
+    }
+}
+
+/**
+ *  How far inside a clipping plane a vertex is, negative outside
+ */
+static GLfloat
+plane_distance(rasterVertex const * const v, unsigned int plane) {
+    GLfloat const guard = RASTER_GUARD_BAND * v->clip[3];
+    switch(plane) {
+        case 0:
+            return v->clip[2] + v->clip[3];
+        case 1:
+            return guard - v->clip[0];
+        case 2:
+            return guard + v->clip[0];
+        case 3:
+            return guard - v->clip[1];
+        default:
+            return guard + v->clip[1];
+    }
+}
+
+/**
+ *  Clip a triangle against the near plane and the guard band
+ *  @param[out] out  The polygon left, in order
+ *  @return The number of vertices of the polygon, 0 if nothing is left
+ */
+static unsigned int
+clip_triangle(rasterVertex const * const in[3],
+              rasterVertex out[RASTER_MAX_POLYGON]) {
+    rasterVertex buffer[RASTER_MAX_POLYGON];
+    rasterVertex* from = out;
+    rasterVertex* to = buffer;
+    unsigned int n = 3;
+    unsigned int plane, i, k;
+    for(i = 0; i < 3; i++) {
+        out[i] = *in[i];
+    }
+
+    for(plane = 0; plane < RASTER_PLANES && n > 0; plane++) {
+        unsigned int m = 0;
+        for(i = 0; i < n; i++) {
+            rasterVertex const * const a = &from[i];
+            rasterVertex const * const b = &from[(i + 1) % n];
+            GLfloat const da = plane_distance(a, plane);
+            GLfloat const db = plane_distance(b, plane);
+            if(da >= 0.0f) {
+                to[m++] = *a;
+            }
+            if((da >= 0.0f) != (db >= 0.0f)) {
+                GLfloat const t = da / (da - db);
+                GLfloat const * const fa = (GLfloat const *) a;
+                GLfloat const * const fb = (GLfloat const *) b;
+                GLfloat* const f = (GLfloat*) &to[m++];
+                for(k = 0; k < RASTER_VARYINGS; k++) {
+                    f[k] = fa[k] + t * (fb[k] - fa[k]);
+                }
+            }
+        }
+        rasterVertex* const swap = from;
+        from = to;
+        to = swap;
+        n = m;
+    }
+    if(from != out) {
+        for(i = 0; i < n; i++) {
+            out[i] = from[i];
+        }
+    }
+    return n;
+}
+
+/**
+ *  Whether any vertex of a triangle is outside a clipping plane
+ */
+static int
+needs_clipping(rasterVertex const * const v[3]) {
+    unsigned int plane, i;
+    for(plane = 0; plane < RASTER_PLANES; plane++) {
+        for(i = 0; i < 3; i++) {
+            if(plane_distance(v[i], plane) < 0.0f) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void
+project(screenVertex * const s, rasterVertex const * const v,
+        rasterImage const * const image) {
+    s->inv_w = 1.0f / v->clip[3];
+    s->x = (v->clip[0] * s->inv_w + 1.0f) * 0.5f * image->width;
+    s->y = (1.0f - v->clip[1] * s->inv_w) * 0.5f * image->height;
+    s->z = v->clip[2] * s->inv_w;
+    s->v = v;
+}
+
+/**
+ *  Whether all three vertices are outside the same side of the view volume
+ */
+static int
+outside(rasterVertex const * const v[3]) {
+    unsigned int axis;
+    for(axis = 0; axis < 3; axis++) {
+        if(v[0]->clip[axis] > v[0]->clip[3]
+           && v[1]->clip[axis] > v[1]->clip[3]
+           && v[2]->clip[axis] > v[2]->clip[3]) {
+            return 1;
+        }
+        if(v[0]->clip[axis] < -v[0]->clip[3]
+           && v[1]->clip[axis] < -v[1]->clip[3]
+           && v[2]->clip[axis] < -v[2]->clip[3]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void
+triangle_vertices(rasterJob const * const job, size_t t,
+                  rasterVertex const * v[3]) {
+    GLuint const * const index = job->indices + 3 * t;
+    v[0] = &job->transformed[index[0]];
+    v[1] = &job->transformed[index[1]];
+    v[2] = &job->transformed[index[2]];
+}
+
+static void
+bin_add(rasterBin * const bin, GLuint triangle) {
+    if(bin->count == bin->capacity) {
+        bin->capacity = bin->capacity > 0 ? 2 * bin->capacity : 64;
+        bin->triangles = realloc(bin->triangles,
+                                 bin->capacity * sizeof(*bin->triangles));
+    }
+    bin->triangles[bin->count++] = triangle;
+}
+
+/**
+ *  Sort a range of triangles into the tiles their screen bounds touch
+ */
+static void
+bin_task(void * const arg, unsigned int task) {
+    rasterJob* const job = arg;
+    rasterImage const * const image = job->image;
+    size_t const per_task = (job->num_triangles + RASTER_BIN_TASKS - 1)
+                            / RASTER_BIN_TASKS;
+    size_t const start = task * per_task;
+    size_t const end = start + per_task < job->num_triangles
+                       ? start + per_task : job->num_triangles;
+    rasterBin* const bins = job->bins
+                            + (size_t) task * job->tiles_x * job->tiles_y;
+
+    size_t t;
+    for(t = start; t < end; t++) {
+        rasterVertex const * v[3];
+        triangle_vertices( job, t, v );
+        if(outside(v)) {
+            continue;
+        }
+
+        rasterVertex clipped[RASTER_MAX_POLYGON];
+        unsigned int n = 3;
+        if(needs_clipping(v)) {
+            n = clip_triangle(v, clipped);
+        }else {
+            clipped[0] = *v[0];
+            clipped[1] = *v[1];
+            clipped[2] = *v[2];
+        }
+
+        GLfloat min_x = image->width, max_x = 0.0f;
+        GLfloat min_y = image->height, max_y = 0.0f;
+        unsigned int i;
+        for(i = 0; i < n; i++) {
+            screenVertex s;
+            project( &s, &clipped[i], image );
+            min_x = s.x < min_x ? s.x : min_x;
+            max_x = s.x > max_x ? s.x : max_x;
+            min_y = s.y < min_y ? s.y : min_y;
+            max_y = s.y > max_y ? s.y : max_y;
+        }
+        if(n == 0 || max_x < 0.0f || max_y < 0.0f || min_x >= image->width
+           || min_y >= image->height) {
+            continue;
+        }
+
+        GLuint const tx0 = min_x > 0.0f ? min_x / RASTER_TILE_SIZE : 0;
+        GLuint const ty0 = min_y > 0.0f ? min_y / RASTER_TILE_SIZE : 0;
+        GLuint const tx1 = max_x < image->width
+                           ? max_x / RASTER_TILE_SIZE : job->tiles_x - 1;
+        GLuint const ty1 = max_y < image->height
+                           ? max_y / RASTER_TILE_SIZE : job->tiles_y - 1;
+        GLuint tx, ty;
+        for(ty = ty0; ty <= ty1; ty++) {
+            for(tx = tx0; tx <= tx1; tx++) {
+                bin_add( &bins[ty * job->tiles_x + tx], t );
+            }
+        }
+    }
+}
+
+static void
+normalize3(GLfloat v[3]) {
+    GLfloat const length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    if(length > 0.0f) {
+        v[0] /= length;
+        v[1] /= length;
+        v[2] /= length;
+    }
+}
+
+static GLfloat
+dot3(GLfloat const a[3], GLfloat const b[3]) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+/**
+ *  The fragment shader
+ *  @param[out] rgb  The pixel
+ *  @param[in] s  The uniforms
+ *  @param[in] v  The interpolated varyings
+ */
+static void
+shade(unsigned char rgb[3], rasterScene const * const s,
+      rasterVertex const * const v) {
+    static GLfloat const color_high[3] = { 0.40f, 0.6f, 0.3f };
+    static GLfloat const color_low[3] = { 0.06f, 0.15f, 0.04f };
+
+    GLfloat intensity = v->intensity;
+    intensity = intensity > 1.0f ? 1.0f : (intensity < 0.0f ? 0.0f
+                                                              : intensity);
+
+    GLfloat N[3], E[3], L[3], H[3];
+    unsigned int i;
+    for(i = 0; i < 3; i++) {
+        N[i] = v->normal[i];
+        E[i] = -v->eye[i];
+    }
+    L[0] = s->light_position.x - v->eye[0];
+    L[1] = s->light_position.y - v->eye[1];
+    L[2] = s->light_position.z - v->eye[2];
+    normalize3( N );
+    normalize3( E );
+    normalize3( L );
+    for(i = 0; i < 3; i++) {
+        H[i] = L[i] + E[i];
+    }
+    normalize3( H );
+
+    // The shader takes the length of L after normalizing it, so the
+    // attenuation is constant
+    GLfloat const attenuation = 1.0f / 1.75f;
+    GLfloat const LdotN = dot3(L, N);
+    GLfloat const Kd = LdotN > 0.0f ? LdotN : 0.0f;
+    GLfloat const NdotH = dot3(N, H);
+    GLfloat const Ks = LdotN < 0.0f ? 0.0f
+                       : powf(NdotH > 0.0f ? NdotH : 0.0f, s->shininess);
+
+    GLfloat const * const ambient = &s->ambient_product.x;
+    GLfloat const * const diffuse = &s->diffuse_product.x;
+    GLfloat const * const specular = &s->specular_product.x;
+    for(i = 0; i < 3; i++) {
+        GLfloat const lighting = ambient[i]
+                                 + v->sunlight * attenuation * Kd * diffuse[i]
+                                 + v->sunlight * attenuation * Ks * specular[i];
+        GLfloat c = lighting * (intensity * color_high[i]
+                                + (1.0f - intensity) * color_low[i]);
+        c = c > 1.0f ? 1.0f : (c < 0.0f ? 0.0f : c);
+        rgb[i] = (unsigned char) (c * 255.0f + 0.5f);
+    }
+}
+
+/**
+ *  A window coordinate relative to the corner of a tile, snapped
+ */
+static double
+snap(GLfloat coordinate, GLint origin) {
+    return floor((coordinate - origin) * RASTER_SUBPIXELS + 0.5)
+           / RASTER_SUBPIXELS;
+}
+
+/**
+ *  Draw the part of a triangle inside a tile
+ *  @param[in] x0,y0,x1,y1  The pixels of the tile, inclusive
+ */
+static void
+draw_triangle(rasterJob const * const job, screenVertex const * const a,
+              screenVertex const * const b, screenVertex const * const c,
+              GLint x0, GLint y0, GLint x1, GLint y1) {
+    // Each edge function is the area of the triangle a pixel makes with
+    // the edge opposite one vertex, and so the weight of that vertex. A
+    // shared edge gives its two triangles exactly opposite functions.
+    double const ax = snap(a->x, x0), ay = snap(a->y, y0);
+    double const bx = snap(b->x, x0), by = snap(b->y, y0);
+    double const cx = snap(c->x, x0), cy = snap(c->y, y0);
+    double A[3], B[3], C[3];
+    A[0] = by - cy;
+    B[0] = cx - bx;
+    C[0] = bx * cy - by * cx;
+    A[1] = cy - ay;
+    B[1] = ax - cx;
+    C[1] = cx * ay - cy * ax;
+    A[2] = ay - by;
+    B[2] = bx - ax;
+    C[2] = ax * by - ay * bx;
+    double area = C[0] + C[1] + C[2];
+    if(area == 0.0) {
+        return;
+    }
+
+    // Nothing is culled, so either winding is drawn
+    unsigned int i;
+    if(area < 0.0) {
+        for(i = 0; i < 3; i++) {
+            A[i] = -A[i];
+            B[i] = -B[i];
+            C[i] = -C[i];
+        }
+        area = -area;
+    }
+
+    // The pixel centers inside the bounds, relative to the tile
+    GLint const width = x1 - x0;
+    GLint const height = y1 - y0;
+    double const min_x = fmin(ax, fmin(bx, cx));
+    double const max_x = fmax(ax, fmax(bx, cx));
+    double const min_y = fmin(ay, fmin(by, cy));
+    double const max_y = fmax(ay, fmax(by, cy));
+    if(min_x > width + 1 || max_x < 0.0 || min_y > height + 1
+       || max_y < 0.0) {
+        return;
+    }
+    GLint const left = min_x > 0.0 ? (GLint) min_x : 0;
+    GLint const top = min_y > 0.0 ? (GLint) min_y : 0;
+    GLint const right = max_x < width ? (GLint) max_x : width;
+    GLint const bottom = max_y < height ? (GLint) max_y : height;
+
+    rasterImage* const image = job->image;
+    double const inv_area = 1.0 / area;
+    v4d const lanes = { 0.5, 1.5, 2.5, 3.5 };
+    v4d const zero = splat(0.0);
+    GLint x, y;
+    for(y = top; y <= bottom; y++) {
+        double const py = y + 0.5;
+        size_t const row = (size_t) (y0 + y) * image->width + x0;
+        GLfloat* const depth_row = image->depth + row;
+        for(x = left; x <= right; x += 4) {
+            v4d const px = splat(x) + lanes;
+            v4d const e0 = splat(A[0]) * px + splat(B[0] * py + C[0]);
+            v4d const e1 = splat(A[1]) * px + splat(B[1] * py + C[1]);
+            v4d const e2 = splat(A[2]) * px + splat(B[2] * py + C[2]);
+            v4l const inside = (e0 >= zero) & (e1 >= zero) & (e2 >= zero)
+                               & (px < splat(right + 1));
+            if(!(inside[0] | inside[1] | inside[2] | inside[3])) {
+                continue;
+            }
+
+            unsigned int lane;
+            for(lane = 0; lane < 4; lane++) {
+                if(!inside[lane]) {
+                    continue;
+                }
+                GLfloat const l0 = e0[lane] * inv_area;
+                GLfloat const l1 = e1[lane] * inv_area;
+                GLfloat const l2 = e2[lane] * inv_area;
+                GLfloat const z = l0 * a->z + l1 * b->z + l2 * c->z;
+                if(z >= depth_row[x + lane] || z > 1.0f) {
+                    continue;
+                }
+                depth_row[x + lane] = z;
+
+                // Perspective correct weights of the varyings
+                GLfloat const w0 = l0 * a->inv_w;
+                GLfloat const w1 = l1 * b->inv_w;
+                GLfloat const w2 = l2 * c->inv_w;
+                GLfloat const sum = w0 + w1 + w2;
+                GLfloat const * const fa = (GLfloat const *) a->v;
+                GLfloat const * const fb = (GLfloat const *) b->v;
+                GLfloat const * const fc = (GLfloat const *) c->v;
+                rasterVertex v;
+                GLfloat* const f = (GLfloat*) &v;
+                unsigned int k;
+                for(k = 0; k < RASTER_VARYINGS; k++) {
+                    f[k] = (w0 * fa[k] + w1 * fb[k] + w2 * fc[k]) / sum;
+                }
+                shade( image->color + (row + x + lane) * 3, job->scene, &v );
+            }
+        }
+    }
+}
+
+/**
+ *  Clear a tile and draw the triangles binned to it, in mesh order
+ */
+static void
+tile_task(void * const arg, unsigned int tile) {
+    rasterJob* const job = arg;
+    rasterImage* const image = job->image;
+    GLint const x0 = (tile % job->tiles_x) * RASTER_TILE_SIZE;
+    GLint const y0 = (tile / job->tiles_x) * RASTER_TILE_SIZE;
+    GLint const x1 = x0 + RASTER_TILE_SIZE < (GLint) image->width
+                     ? x0 + RASTER_TILE_SIZE - 1 : (GLint) image->width - 1;
+    GLint const y1 = y0 + RASTER_TILE_SIZE < (GLint) image->height
+                     ? y0 + RASTER_TILE_SIZE - 1 : (GLint) image->height - 1;
+
+    unsigned char clear[3];
+    unsigned int i;
+    for(i = 0; i < 3; i++) {
+        GLfloat const c = (&job->scene->clear_color.x)[i];
+        clear[i] = (unsigned char) (c * 255.0f + 0.5f);
+    }
+    GLint x, y;
+    for(y = y0; y <= y1; y++) {
+        for(x = x0; x <= x1; x++) {
+            image->depth[(size_t) y * image->width + x] = 1.0f;
+            memcpy( image->color + ((size_t) y * image->width + x) * 3,
+                    clear, 3 );
+        }
+    }
+
+    unsigned int task;
+    for(task = 0; task < RASTER_BIN_TASKS; task++) {
+        rasterBin const * const bin = &job->bins[(size_t) task * job->tiles_x
+                                                 * job->tiles_y + tile];
+        size_t j;
+        for(j = 0; j < bin->count; j++) {
+            rasterVertex const * v[3];
+            triangle_vertices( job, bin->triangles[j], v );
+
+            rasterVertex clipped[RASTER_MAX_POLYGON];
+            screenVertex s[RASTER_MAX_POLYGON];
+            unsigned int n = 3;
+            if(needs_clipping(v)) {
+                n = clip_triangle(v, clipped);
+                for(i = 0; i < n; i++) {
+                    project( &s[i], &clipped[i], image );
+                }
+            }else {
+                for(i = 0; i < 3; i++) {
+                    project( &s[i], v[i], image );
+                }
+            }
+
+            // A clipped polygon is drawn as a fan
+            for(i = 1; i + 1 < n; i++) {
+                draw_triangle( job, &s[0], &s[i], &s[i + 1], x0, y0, x1, y1 );
+            }
+        }
+    }
+}
+
+/**
+ *  Clear an image and draw a triangle list into it
+ *  @param[in,out] image  The image
+ *  @param[in] scene  The matrices, lights and background
+ *  @param[in] vertices  Positions, world coordinates
+ *  @param[in] normals  One per vertex
+ *  @param[in] horizons  HORIZON_AZIMUTHS per vertex, or NULL to draw
+ *                       without shadows
+ *  @param[in] num_vertices  The number of vertices
+ *  @param[in] indices  Three per triangle
+ *  @param[in] num_triangles  The number of triangles
+ *  @param[in] pool  The workers to draw with
+ */
+void
+raster_draw(rasterImage * const image, rasterScene const * const scene,
+            vec4 const * const vertices, vec3 const * const normals,
+            GLubyte const * const horizons, GLuint num_vertices, GLuint const * const indices,
+            size_t num_triangles, threadPool * const pool) {
+    TRACE_SPAN("raster");
+    rasterJob job;
+    job.image = image;
+    job.scene = scene;
+    memcpy( job.model_view, scene->model_view, sizeof(job.model_view) );
+    memcpy( job.projection, scene->projection, sizeof(job.projection) );
+    job.vertices = vertices;
+    job.normals = normals;
+    job.horizons = horizons;
+    job.num_vertices = num_vertices;
+    job.indices = indices;
+    job.num_triangles = num_triangles;
+    job.tiles_x = (image->width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    job.tiles_y = (image->height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+
+    size_t const tiles = (size_t) job.tiles_x * job.tiles_y;
+    job.transformed = malloc((size_t) num_vertices * sizeof(*job.transformed));
+    job.bins = calloc(RASTER_BIN_TASKS * tiles, sizeof(*job.bins));
+    if(job.transformed == NULL || job.bins == NULL) {
+        fprintf(stderr, "Unable to allocate the rasterizer's buffers\n");
+        exit(1);
+    }
+
+    pool_run( pool, (num_vertices + RASTER_VERTEX_BAND - 1)
+                    / RASTER_VERTEX_BAND, transform_band, &job );
+    pool_run( pool, RASTER_BIN_TASKS, bin_task, &job );
+    pool_run( pool, tiles, tile_task, &job );
+
+    size_t i;
+    for(i = 0; i < RASTER_BIN_TASKS * tiles; i++) {
+        free( job.bins[i].triangles );
+    }
+    free( job.bins );
+    free( job.transformed );
+}
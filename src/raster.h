@@ -0,0 +1,44 @@
+/**
+ * raster.h
+ */
+#ifndef RASTER_H
+#define RASTER_H
+#include <stddef.h>
+#include "terrain.h"
+
+// The image is drawn in square tiles, one task each. Triangles are sorted
+// into the tiles they touch by RASTER_BIN_TASKS tasks first.
+#define RASTER_TILE_SIZE    64
+#define RASTER_BIN_TASKS    64
+
+// Vertices transformed per task
+#define RASTER_VERTEX_BAND  65536
+
+typedef struct {
+    GLuint width;
+    GLuint height;
+    unsigned char* color;       // RGB, top row first
+    GLfloat* depth;             // Normalized device z
+} rasterImage;
+
+// What the gradient shaders get as uniforms
+typedef struct {
+    mat4 model_view;
+    mat4 projection;
+    vec4 light_position;        // Eye coordinates
+    vec4 ambient_product;
+    vec4 diffuse_product;
+    vec4 specular_product;
+    GLfloat shininess;
+    GLfloat max_elevation;      // World y of the highest sample
+    vec4 clear_color;
+    vec3 sun_direction;         // World coordinates, for the horizons
+} rasterScene;
+
+int raster_image_init(rasterImage * const image, GLuint width, GLuint height);
+void raster_image_free(rasterImage * const image);
+void raster_draw(rasterImage * const image, rasterScene const * const scene,
+                 vec4 const * const vertices, vec3 const * const normals,
+                 GLubyte const * const horizons, GLuint num_vertices, GLuint const * const indices,
+                 size_t num_triangles, threadPool * const pool);
+#endif
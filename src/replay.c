@@ -0,0 +1,365 @@
+/**
+ * replay.c
+ *
+ * Camera paths: keyframes of the camera and the sun recorded from a live
+ * session, and replayed through display() at a fixed number of frames per
+ * second of path so two builds draw exactly the same frames.
+ *
+ * A path file is text, one keyframe per line:
+ *
+ *     time viewer.x viewer.y viewer.z theta.x theta.y theta.z sun_theta
+ *
+ * with times in seconds, increasing, and angles in degrees. Lines starting
+ * with '#' are comments.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "replay.h"
+#include "mesh.h"
+
+/**
+ *  Read a camera path
+ *  @param[out] path  The keyframes, freed with path_free()
+ *  @param[in] file_name  The path file
+ *  @return 0 if the file can't be read or isn't a path, with a message
+ */
+int
+path_load(cameraPath * const path, char const * const file_name) {
+    path->keys = NULL;
+    path->count = 0;
+    path->capacity = 0;
+
+    FILE* const file = fopen(file_name, "r");
+    if(file == NULL) {
+        fprintf(stderr, "Unable to open camera path: %s\n", file_name);
+        return 0;
+    }
+
+    char line[512];
+    unsigned int line_number = 0;
+    while(fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char const * p = line;
+        while(*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if(*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') {
+            continue;
+        }
+
+        pathKey k;
+        if(sscanf(p, "%lf %f %f %f %f %f %f %f", &k.time, &k.viewer[0],
+                  &k.viewer[1], &k.viewer[2], &k.theta[0], &k.theta[1],
+                  &k.theta[2], &k.sun_theta) != 8
+           || (path->count > 0 && k.time < path->keys[path->count - 1].time)) {
+            fprintf(stderr, "%s:%u: expected a keyframe later than the "
+                            "last\n", file_name, line_number);
+            fclose( file );
+            path_free( path );
+            return 0;
+        }
+
+        if(path->count == path->capacity) {
+            path->capacity = path->capacity > 0 ? 2 * path->capacity : 64;
+            path->keys = realloc(path->keys,
+                                 path->capacity * sizeof(*path->keys));
+            if(path->keys == NULL) {
+                fprintf(stderr, "Unable to allocate %zu keyframes\n",
+                        path->capacity);
+                exit(1);
+            }
+        }
+        path->keys[path->count++] = k;
+    }
+    fclose( file );
+
+    if(path->count == 0) {
+        fprintf(stderr, "No keyframes in camera path: %s\n", file_name);
+        return 0;
+    }
+    return 1;
+}
+
+void
+path_free(cameraPath * const path) {
+    free( path->keys );
+    path->keys = NULL;
+    path->count = 0;
+    path->capacity = 0;
+}
+
+/**
+ *  Seconds from the first keyframe to the last
+ */
+double
+path_duration(cameraPath const * const path) {
+    return path->keys[path->count - 1].time - path->keys[0].time;
+}
+
+/**
+ *  Where the camera is along a path, between the two nearest keyframes
+ *  @param[out] key  The interpolated keyframe
+ *  @param[in] path  The path, with at least one keyframe
+ *  @param[in] time  Seconds since the first keyframe, clamped to the path
+ */
+void
+path_sample(pathKey * const key, cameraPath const * const path,
+            double time) {
+    pathKey const * const keys = path->keys;
+    time += keys[0].time;
+    if(time <= keys[0].time) {
+        *key = keys[0];
+        return;
+    }
+    if(time >= keys[path->count - 1].time) {
+        *key = keys[path->count - 1];
+        return;
+    }
+
+    // The last keyframe at or before the time
+    size_t low = 0, high = path->count - 1;
+    while(high - low > 1) {
+        size_t const middle = low + (high - low) / 2;
+        if(keys[middle].time <= time) {
+            low = middle;
+        }else {
+            high = middle;
+        }
+    }
+
+    pathKey const * const a = &keys[low];
+    pathKey const * const b = &keys[high];
+    double const span = b->time - a->time;
+    GLfloat const t = span > 0.0 ? (time - a->time) / span : 1.0f;
+    unsigned int i;
+    key->time = time;
+    for(i = 0; i < 3; i++) {
+        key->viewer[i] = a->viewer[i] + t * (b->viewer[i] - a->viewer[i]);
+        key->theta[i] = a->theta[i] + t * (b->theta[i] - a->theta[i]);
+    }
+    key->sun_theta = a->sun_theta + t * (b->sun_theta - a->sun_theta);
+}
+
+/**
+ *  Move the camera and the sun to a keyframe
+ */
+void
+path_apply(pathKey const * const key, cameraData * const c,
+           worldData * const w) {
+    memcpy( c->viewer, key->viewer, sizeof(c->viewer) );
+    memcpy( c->theta, key->theta, sizeof(c->theta) );
+    w->sun_theta = key->sun_theta;
+}
+
+/**
+ *  Start recording a path
+ *  @param[out] r  The recorder
+ *  @param[in] file_name  The path file, replaced
+ *  @return 0 if the file can't be created
+ */
+int
+path_recorder_open(pathRecorder * const r, char const * const file_name) {
+    r->file = fopen(file_name, "w");
+    if(r->file == NULL) {
+        return 0;
+    }
+    fprintf(r->file, "# time viewer.x viewer.y viewer.z "
+                     "theta.x theta.y theta.z sun_theta\n");
+    clock_gettime( CLOCK_MONOTONIC, &r->start );
+    r->recorded = 0;
+    return 1;
+}
+
+/**
+ *  Write a keyframe if the camera or the sun moved since the last one.
+ *  Every keyframe is flushed, since the viewer exits from the keyboard
+ *  callback.
+ */
+void
+path_record(pathRecorder * const r, cameraData const * const c,
+            worldData const * const w) {
+    pathKey k;
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    k.time = (now.tv_sec - r->start.tv_sec)
+             + (now.tv_nsec - r->start.tv_nsec) / 1e9;
+    memcpy( k.viewer, c->viewer, sizeof(k.viewer) );
+    memcpy( k.theta, c->theta, sizeof(k.theta) );
+    k.sun_theta = w->sun_theta;
+    if(r->recorded && memcmp(k.viewer, r->last.viewer, sizeof(k.viewer)) == 0
+       && memcmp(k.theta, r->last.theta, sizeof(k.theta)) == 0
+       && k.sun_theta == r->last.sun_theta) {
+        return;
+    }
+
+    // Hold the last position until just before the move, so the replay
+    // doesn't drift through the time the camera stood still
+    if(r->recorded && k.time - r->last.time > 1.0 / REPLAY_RATE) {
+        pathKey hold = r->last;
+        hold.time = k.time - 1.0 / REPLAY_RATE;
+        fprintf(r->file, "%.6f %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n",
+                hold.time, hold.viewer[0], hold.viewer[1], hold.viewer[2],
+                hold.theta[0], hold.theta[1], hold.theta[2], hold.sun_theta);
+    }
+    fprintf(r->file, "%.6f %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n",
+            k.time, k.viewer[0], k.viewer[1], k.viewer[2],
+            k.theta[0], k.theta[1], k.theta[2], k.sun_theta);
+    fflush( r->file );
+    r->last = k;
+    r->recorded = 1;
+}
+
+void
+frame_log_add(frameLog * const log, double seconds, size_t triangles) {
+    if(log->count == log->capacity) {
+        log->capacity = log->capacity > 0 ? 2 * log->capacity : 256;
+        log->seconds = realloc(log->seconds,
+                               log->capacity * sizeof(*log->seconds));
+        log->triangles = realloc(log->triangles,
+                                 log->capacity * sizeof(*log->triangles));
+        if(log->seconds == NULL || log->triangles == NULL) {
+            fprintf(stderr, "Unable to allocate %zu frame times\n",
+                    log->capacity);
+            exit(1);
+        }
+    }
+    log->seconds[log->count] = seconds;
+    log->triangles[log->count] = triangles;
+    log->count++;
+}
+
+void
+frame_log_free(frameLog * const log) {
+    free( log->seconds );
+    free( log->triangles );
+    log->seconds = NULL;
+    log->triangles = NULL;
+    log->count = 0;
+    log->capacity = 0;
+}
+
+/**
+ *  Write the time and triangles of every frame as CSV
+ *  @return 0 if the file can't be written
+ */
+int
+frame_log_write(frameLog const * const log, char const * const file_name) {
+    FILE* const file = fopen(file_name, "w");
+    if(file == NULL) {
+        return 0;
+    }
+    fprintf(file, "frame,ms,triangles\n");
+    size_t i;
+    for(i = 0; i < log->count; i++) {
+        fprintf(file, "%zu,%.4f,%zu\n", i, log->seconds[i] * 1e3,
+                log->triangles[i]);
+    }
+    return fclose(file) == 0;
+}
+
+static int
+compare_doubles(void const * const a, void const * const b) {
+    double const x = *(double const *) a;
+    double const y = *(double const *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ *  The nearest rank percentile of sorted values
+ */
+static double
+percentile(double const * const sorted, size_t count, double p) {
+    size_t rank = (size_t) ceil(p * count);
+    rank = rank > 0 ? rank - 1 : 0;
+    return sorted[rank < count ? rank : count - 1];
+}
+
+/**
+ *  Print the frame time percentiles and triangle counts of a replay, and
+ *  append them as a CSV row to a file, with a header if it's new
+ *  @param[in] log  The timed frames, at least one
+ *  @param[in] map,mesh  The first columns of the row
+ *  @param[in] file_name  The CSV file, or NULL to only print
+ *  @return 0 if the file can't be written
+ */
+int
+frame_log_summary(frameLog const * const log, char const * const map,
+                  char const * const mesh, char const * const file_name) {
+    double* const sorted = malloc(log->count * sizeof(*sorted));
+    if(sorted == NULL) {
+        fprintf(stderr, "Unable to allocate %zu frame times\n", log->count);
+        exit(1);
+    }
+    memcpy( sorted, log->seconds, log->count * sizeof(*sorted) );
+    qsort( sorted, log->count, sizeof(*sorted), compare_doubles );
+
+    double total = 0.0;
+    size_t min_triangles = log->triangles[0], max_triangles = 0;
+    double total_triangles = 0.0;
+    size_t i;
+    for(i = 0; i < log->count; i++) {
+        total += log->seconds[i];
+        total_triangles += log->triangles[i];
+        min_triangles = log->triangles[i] < min_triangles
+                        ? log->triangles[i] : min_triangles;
+        max_triangles = log->triangles[i] > max_triangles
+                        ? log->triangles[i] : max_triangles;
+    }
+
+    char row[512];
+    snprintf(row, sizeof(row), "%s,%s,%zu,%.4f,%.4f,%.4f,%.4f,%.4f,"
+             "%zu,%.0f,%zu", map, mesh, log->count, sorted[0] * 1e3,
+             total / log->count * 1e3, percentile(sorted, log->count, 0.5) * 1e3,
+             percentile(sorted, log->count, 0.95) * 1e3,
+             percentile(sorted, log->count, 0.99) * 1e3, min_triangles,
+             total_triangles / log->count, max_triangles);
+    free( sorted );
+
+    char const * const header = "map,mesh,frames,min_ms,mean_ms,p50_ms,"
+                                "p95_ms,p99_ms,min_triangles,"
+                                "mean_triangles,max_triangles";
+    printf("%s\n%s\n", header, row);
+    if(file_name == NULL) {
+        return 1;
+    }
+
+    FILE* const file = fopen(file_name, "a");
+    if(file == NULL) {
+        return 0;
+    }
+    if(ftell(file) == 0) {
+        fprintf(file, "%s\n", header);
+    }
+    fprintf(file, "%s\n", row);
+    return fclose(file) == 0;
+}
+
+/**
+ *  Load a path to replay
+ *  @param[in] file_name  The path file
+ *  @param[in] opts  The command line options, naming the output files
+ */
+pathReplay*
+replay_create(char const * const file_name, optionsData const * const opts) {
+    pathReplay* const r = calloc(1, sizeof(*r));
+    if(r == NULL || !path_load( &r->path, file_name )) {
+        exit(1);
+    }
+    r->frames = (size_t) (path_duration(&r->path) * REPLAY_RATE) + 1;
+    r->next = 0;
+    r->stats_path = opts->stats;
+    r->times_path = opts->frame_times;
+    r->map = opts->path != NULL ? opts->path
+             : (opts->mosaic != NULL ? opts->mosaic : "-");
+    r->mesh = mesh_mode_name(opts->mesh);
+    return r;
+}
+
+void
+replay_free(pathReplay * const r) {
+    path_free( &r->path );
+    frame_log_free( &r->log );
+    free( r );
+}
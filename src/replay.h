@@ -0,0 +1,81 @@
+/**
+ * replay.h
+ */
+#ifndef REPLAY_H
+#define REPLAY_H
+#include <stdio.h>
+#include <time.h>
+#include "terrain.h"
+
+// Frames drawn per second of path time when replaying
+#define REPLAY_RATE     60
+
+// Frames drawn at the start of the path before any is timed, while
+// buffers and shaders settle
+#define REPLAY_WARMUP   10
+
+// Where the camera and the sun are at one time
+typedef struct {
+    double time;                // Seconds since the start of the path
+    GLfloat viewer[3];
+    GLfloat theta[3];
+    GLfloat sun_theta;
+} pathKey;
+
+// Keyframes in time order, interpolated linearly
+typedef struct {
+    pathKey* keys;
+    size_t count;
+    size_t capacity;
+} cameraPath;
+
+// Writes a keyframe to a path file whenever the camera or sun moved
+struct pathRecorder {
+    FILE* file;
+    struct timespec start;
+    pathKey last;
+    int recorded;               // Whether last was written
+};
+
+// How long each replayed frame took and what it drew
+typedef struct {
+    double* seconds;
+    size_t* triangles;
+    size_t count;
+    size_t capacity;
+} frameLog;
+
+// A path being replayed by the display
+struct pathReplay {
+    cameraPath path;
+    size_t frames;              // Timed, REPLAY_RATE per second of path
+    size_t next;                // Counting the warm up frames
+    frameLog log;
+    char const * stats_path;    // Summary appended here, or NULL
+    char const * times_path;    // Every frame written here, or NULL
+    char const * map;           // Columns of the summary telling runs
+    char const * mesh;          // apart
+};
+
+int path_load(cameraPath * const path, char const * const file_name);
+void path_free(cameraPath * const path);
+double path_duration(cameraPath const * const path);
+void path_sample(pathKey * const key, cameraPath const * const path,
+                 double time);
+void path_apply(pathKey const * const key, cameraData * const c,
+                worldData * const w);
+
+int path_recorder_open(pathRecorder * const r, char const * const file_name);
+void path_record(pathRecorder * const r, cameraData const * const c,
+                 worldData const * const w);
+
+void frame_log_add(frameLog * const log, double seconds, size_t triangles);
+void frame_log_free(frameLog * const log);
+int frame_log_write(frameLog const * const log, char const * const file_name);
+int frame_log_summary(frameLog const * const log, char const * const map,
+                      char const * const mesh, char const * const file_name);
+
+pathReplay* replay_create(char const * const file_name,
+                          optionsData const * const opts);
+void replay_free(pathReplay * const r);
+#endif
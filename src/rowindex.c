@@ -0,0 +1,317 @@
+/**
+ * rowindex.c
+ *
+ * A sidecar (.tvi) recording where the rows of a text elevation file
+ * start, and every ROWINDEX_STRIDE samples within them, so a window of a
+ * huge file can be parsed without tokenizing everything before it. The
+ * index is built once with a pass over the whole file and is valid while
+ * the size and modification time of the file are unchanged; unlike the
+ * .tvc cache the contents aren't hashed, which would read the whole file.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "rowindex.h"
+#include "trace.h"
+
+static char const index_magic[4] = { 'T', 'V', 'I', '\0' };
+
+typedef struct {
+    elevationGrid* grid;
+    rowIndex const * idx;
+    char const * data;
+    char const * end;
+    GLuint x0;
+    GLuint z0;
+    parseResult* bands;     // One per band
+} windowParse;
+
+/**
+ *  The name of the index belonging to a source file
+ *  @return A newly allocated string
+ */
+static char*
+index_path(char const * const source) {
+    size_t const length = strlen(source);
+    char* const path = malloc(length + sizeof(ROWINDEX_EXTENSION));
+    memcpy( path, source, length );
+    memcpy( path + length, ROWINDEX_EXTENSION, sizeof(ROWINDEX_EXTENSION) );
+    return path;
+}
+
+static void
+set_shape(rowIndex * const idx, GLuint width, GLuint height,
+          GLfloat resolution, GLuint stride) {
+    idx->width = width;
+    idx->height = height;
+    idx->resolution = resolution;
+    idx->stride = stride;
+    idx->per_row = (width + stride - 1) / stride;
+}
+
+/**
+ *  Map the index of a source file if it exists and is still valid
+ *  @param[out] idx  The mapped index
+ *  @param[in] source  The path of the text elevation file
+ *  @return 1 if a valid index was mapped, 0 otherwise
+ */
+int
+rowindex_open(rowIndex * const idx, char const * const source) {
+    struct stat st;
+    if(stat(source, &st) != 0) {
+        return 0;
+    }
+
+    char* const path = index_path(source);
+    int const fd = open(path, O_RDONLY);
+    free( path );
+    if(fd < 0) {
+        return 0;
+    }
+    int const mapped = (map_file( &idx->file, fd ) == 0);
+    close( fd );
+    if(!mapped) {
+        return 0;
+    }
+    idx->built = NULL;
+
+    rowIndexHeader const * const h = (rowIndexHeader const *) idx->file.data;
+    if(idx->file.size < sizeof(*h)
+       || memcmp(h->magic, index_magic, sizeof(index_magic)) != 0
+       || h->version != ROWINDEX_VERSION
+       || h->sourceSize != (uint64_t) st.st_size
+       || h->sourceMtimeSec != (int64_t) st.st_mtim.tv_sec
+       || h->sourceMtimeNsec != (int64_t) st.st_mtim.tv_nsec
+       || h->stride == 0) {
+        rowindex_close( idx );
+        return 0;
+    }
+    set_shape( idx, h->mapWidth, h->mapHeight, h->resolution, h->stride );
+    uint64_t const count = (uint64_t) idx->per_row * idx->height;
+    if(h->offsetsOffset + count * sizeof(uint64_t) > idx->file.size) {
+        rowindex_close( idx );
+        return 0;
+    }
+    idx->offsets = (uint64_t const *) (idx->file.data + h->offsetsOffset);
+    return 1;
+}
+
+/**
+ *  Index a text elevation file with one pass over all of it
+ *  @param[out] idx  The index, held in memory
+ *  @param[in] data  The whole file
+ *  @param[in] size  Its size
+ *  @param[in] pool  The workers to scan with
+ *  @return 0 if the file is malformed, with a message
+ */
+int
+rowindex_build(rowIndex * const idx, char const * const data, size_t size,
+               threadPool * const pool) {
+    TRACE_SPAN("rowindex_build");
+    char const * s = data;
+    char const * const end = data + size;
+    GLuint width, height;
+    GLfloat resolution;
+    if(!parse_uint( &s, end, &width ) || !parse_uint( &s, end, &height )
+       || parse_float( &s, end, &resolution ) != 1) {
+        fprintf(stderr, "Invalid elevation file header\n");
+        return 0;
+    }
+    if(width < 2 || height < 2) {
+        fprintf(stderr, "Elevation data must be at least 2 x 2 samples\n");
+        return 0;
+    }
+
+    set_shape( idx, width, height, resolution, ROWINDEX_STRIDE );
+    idx->built = malloc((size_t) idx->per_row * height * sizeof(uint64_t));
+    if(idx->built == NULL) {
+        fprintf(stderr, "Unable to allocate the row index\n");
+        exit(1);
+    }
+    idx->file.data = NULL;
+    idx->file.size = 0;
+    idx->file.mapped = 0;
+    idx->offsets = idx->built;
+
+    size_t const samples = (size_t) width * height;
+    size_t const found = index_tokens(idx->built, data, s, end, width, height,
+                                      idx->stride, pool);
+    if(found < samples) {
+        fprintf(stderr, "Expected %zu elevation values, found %zu\n",
+                samples, found);
+        rowindex_close( idx );
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ *  Write the index for a source file, through a temporary file renamed
+ *  into place like the .tvc cache
+ *  @return 1 if the index was written, 0 otherwise
+ */
+int
+rowindex_write(rowIndex const * const idx, char const * const source) {
+    struct stat st;
+    if(stat(source, &st) != 0) {
+        return 0;
+    }
+    rowIndexHeader h;
+    memset( &h, 0, sizeof(h) );
+    memcpy( h.magic, index_magic, sizeof(index_magic) );
+    h.version = ROWINDEX_VERSION;
+    h.mapWidth = idx->width;
+    h.mapHeight = idx->height;
+    h.resolution = idx->resolution;
+    h.stride = idx->stride;
+    h.sourceSize = st.st_size;
+    h.sourceMtimeSec = st.st_mtim.tv_sec;
+    h.sourceMtimeNsec = st.st_mtim.tv_nsec;
+    h.offsetsOffset = sizeof(h);
+
+    char* const path = index_path(source);
+    char* const temp = malloc(strlen(path) + 32);
+    sprintf( temp, "%s.%ld", path, (long) getpid() );
+
+    size_t const count = (size_t) idx->per_row * idx->height;
+    FILE* const f = fopen(temp, "wb");
+    int ok = (f != NULL);
+    if(ok) {
+        ok = fwrite(&h, sizeof(h), 1, f) == 1
+             && fwrite(idx->offsets, sizeof(uint64_t), count, f) == count;
+        ok = (fclose( f ) == 0) && ok;
+    }
+    if(ok) {
+        ok = (rename( temp, path ) == 0);
+    }
+    if(!ok) {
+        unlink( temp );
+    }
+
+    free( temp );
+    free( path );
+    return ok;
+}
+
+void
+rowindex_close(rowIndex * const idx) {
+    if(idx->built != NULL) {
+        free( idx->built );
+        idx->built = NULL;
+    }else {
+        unmap_file( &idx->file );
+    }
+    idx->offsets = NULL;
+}
+
+/**
+ *  Parse a band of rows of the window, seeking to the nearest recorded
+ *  offset before the first column of each
+ */
+static void
+parse_band(void * const arg, unsigned int band) {
+    windowParse const * const w = arg;
+    rowIndex const * const idx = w->idx;
+    GLuint const width = w->grid->width;
+    GLfloat* const row = malloc(width * sizeof(*row));
+    if(row == NULL) {
+        fprintf(stderr, "Unable to allocate a row of the window\n");
+        exit(1);
+    }
+
+    parseResult r;
+    r.count = 0;
+    r.error = NULL;
+    r.minElevation = 0.0f;
+    r.maxElevation = 0.0f;
+
+    GLuint const first = band * ROWINDEX_BAND_ROWS;
+    GLuint const last = first + ROWINDEX_BAND_ROWS < w->grid->height
+                        ? first + ROWINDEX_BAND_ROWS : w->grid->height;
+    GLuint z, x;
+    for(z = first; z < last && r.error == NULL; z++) {
+        size_t const checkpoint = (size_t) (w->z0 + z) * idx->per_row
+                                  + w->x0 / idx->stride;
+        char const * s = w->data + idx->offsets[checkpoint];
+        skip_tokens( &s, w->end, w->x0 % idx->stride );
+        for(x = 0; x < width; x++) {
+            if(parse_float( &s, w->end, &row[x] ) != 1) {
+                r.error = s;
+                break;
+            }
+
+            // Clamped and ranged like parse_elevations()
+            GLfloat const v = row[x] < 0.0f ? 0.0f : row[x];
+            row[x] = v;
+            r.maxElevation = v > r.maxElevation ? v : r.maxElevation;
+            if(v > 0.0f && (r.minElevation == 0.0f || v < r.minElevation)) {
+                r.minElevation = v;
+            }
+        }
+        if(r.error == NULL) {
+            grid_write_row( w->grid, z, 0, width, row );
+            r.count += width;
+        }
+    }
+    w->bands[band] = r;
+    free( row );
+}
+
+/**
+ *  Parse a window of a text elevation file through its index, each task
+ *  reading a band of rows
+ *  @param[out] r  The number of samples parsed and their min/max
+ *  @param[out] grid  The window, its size giving the number of samples
+ *  @param[in] idx  The index of the file
+ *  @param[in] data  The whole file
+ *  @param[in] size  Its size
+ *  @param[in] x0  The first column of the window, within the file
+ *  @param[in] z0  The first row
+ *  @param[in] pool  The workers to parse with
+ */
+void
+rowindex_parse(parseResult * const r, elevationGrid * const grid,
+               rowIndex const * const idx, char const * const data,
+               size_t size, GLuint x0, GLuint z0, threadPool * const pool) {
+    TRACE_SPAN("rowindex_parse");
+    unsigned int const bands = (grid->height + ROWINDEX_BAND_ROWS - 1)
+                               / ROWINDEX_BAND_ROWS;
+    windowParse w;
+    w.grid = grid;
+    w.idx = idx;
+    w.data = data;
+    w.end = data + size;
+    w.x0 = x0;
+    w.z0 = z0;
+    w.bands = malloc(bands * sizeof(*w.bands));
+    if(w.bands == NULL) {
+        fprintf(stderr, "Unable to allocate the window\n");
+        exit(1);
+    }
+
+    pool_run( pool, bands, parse_band, &w );
+
+    // Merge in band order so the first error reported is the earliest
+    r->count = 0;
+    r->error = NULL;
+    r->minElevation = 0.0f;
+    r->maxElevation = 0.0f;
+    unsigned int i;
+    for(i = 0; i < bands; i++) {
+        parseResult const * const b = &w.bands[i];
+        r->count += b->count;
+        if(b->error != NULL && r->error == NULL) {
+            r->error = b->error;
+        }
+        r->maxElevation = b->maxElevation > r->maxElevation
+                          ? b->maxElevation : r->maxElevation;
+        GLfloat const m = b->minElevation;
+        if(m > 0.0f && (r->minElevation == 0.0f || m < r->minElevation)) {
+            r->minElevation = m;
+        }
+    }
+    free( w.bands );
+}
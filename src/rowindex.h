@@ -0,0 +1,60 @@
+/**
+ * rowindex.h
+ */
+#ifndef ROWINDEX_H
+#define ROWINDEX_H
+#include <stdint.h>
+#include "terrain.h"
+#include "grid.h"
+#include "mapfile.h"
+#include "parse.h"
+#include "pool.h"
+
+#define ROWINDEX_EXTENSION ".tvi"
+#define ROWINDEX_VERSION   1
+
+// Samples between recorded offsets within a row
+#define ROWINDEX_STRIDE    1024
+
+// Rows of a window parsed by one task
+#define ROWINDEX_BAND_ROWS 16
+
+/**
+ *  On-disk header of a .tvi file, stored in native byte order. The offsets
+ *  follow, ceil(mapWidth / stride) per row: where sample x * stride of the
+ *  row starts in the source file.
+ */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t mapWidth;
+    uint32_t mapHeight;
+    float resolution;
+    uint32_t stride;
+    uint64_t sourceSize;
+    int64_t sourceMtimeSec;
+    int64_t sourceMtimeNsec;
+    uint64_t offsetsOffset;
+} rowIndexHeader;
+
+typedef struct {
+    GLuint width;           // Samples of the whole file
+    GLuint height;
+    GLfloat resolution;
+    GLuint stride;
+    GLuint per_row;         // Offsets per row
+    uint64_t const * offsets;
+    mappedFile file;        // The sidecar the offsets were read from
+    uint64_t* built;        // Or the offsets found by rowindex_build()
+} rowIndex;
+
+int rowindex_open(rowIndex * const idx, char const * const source);
+int rowindex_build(rowIndex * const idx, char const * const data,
+                   size_t size, threadPool * const pool);
+int rowindex_write(rowIndex const * const idx, char const * const source);
+void rowindex_close(rowIndex * const idx);
+void rowindex_parse(parseResult * const r, elevationGrid * const grid,
+                    rowIndex const * const idx, char const * const data,
+                    size_t size, GLuint x0, GLuint z0,
+                    threadPool * const pool);
+#endif
@@ -0,0 +1,509 @@
+/**
+ * rtin.c
+ *
+ * Adaptive triangulation of a map as a right-triangulated irregular network
+ * (RTIN). Every triangle is split at the midpoint of its hypotenuse until
+ * the midpoint's height is within the allowed error of the hypotenuse.
+ *
+ * The error of a midpoint is precomputed bottom-up: midpoints of edges of
+ * length s, then centers of squares of size s, for s = 2, 4, ... Each one
+ * also takes the largest error of the midpoints its triangles split into,
+ * so a midpoint is only inserted when both triangles sharing it get split,
+ * which keeps the mesh free of cracks. Unlike Martini, which only looks at
+ * the distance of a midpoint from its hypotenuse, the error of a midpoint
+ * is the furthest any sample inside either of its triangles lies from the
+ * triangle's plane. A triangle is only kept when none of its samples is
+ * further than the limit, so the limit holds for the whole map, which
+ * rtin_build() measures again.
+ *
+ * Maps of any size are padded up to whole tiles. Triangles crossing the
+ * edge of the map are always split and triangles outside of it dropped.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "rtin.h"
+#include "trace.h"
+
+typedef struct {
+    mapData const * mData;
+    GLfloat* error;         // Of every point of the padded lattice
+    GLuint width;           // Padded to whole tiles
+    GLuint height;
+    GLuint tile;
+    GLuint tiles_x;
+    GLuint tiles_z;
+    GLuint size;            // Level being measured
+    GLfloat max_error;
+    size_t* tile_start;     // First triangle of each tile, then the total
+    GLuint* indices;
+    double* tile_sum;       // Error of the samples each tile owns
+    GLfloat* tile_max;
+} rtinBuild;
+
+static GLfloat
+error_at(rtinBuild const * const b, int x, int z) {
+    if(x < 0 || z < 0 || x >= (int) b->width || z >= (int) b->height) {
+        return 0.0f;
+    }
+    return b->error[(size_t) z * b->width + x];
+}
+
+/**
+ *  Whether a box crosses the last row or column of the map
+ */
+static int
+straddles(rtinBuild const * const b, int x0, int z0, int x1, int z1) {
+    int const w = b->mData->mapWidth - 1;
+    int const h = b->mData->mapHeight - 1;
+    return (x0 < w && w < x1) || (z0 < h && h < z1);
+}
+
+/**
+ *  The height of a triangle's plane over a sample, from the edge functions
+ *  of the sample, which measure_tile() shares so both agree to the bit
+ *  @param[in] inverse_area  1 / the area of the triangle
+ */
+static GLfloat
+plane_height(int ea, int eb, int ec, double inverse_area, GLfloat ha,
+             GLfloat hb, GLfloat hc) {
+    return ((double) ea * ha + (double) eb * hb + (double) ec * hc)
+           * inverse_area;
+}
+
+/**
+ *  Narrow a span of a row to the samples where an edge function, e0 + k x
+ *  times the sign of the triangle's area, isn't negative
+ */
+static void
+clip_span(int * const lo, int * const hi, int e0, int k) {
+    if(k > 0) {
+        // x >= -e0 / k, rounded up
+        int const x = e0 <= 0 ? (-e0 + k - 1) / k : -(e0 / k);
+        *lo = x > *lo ? x : *lo;
+    }else if(k < 0) {
+        // x <= e0 / -k, rounded down
+        int const x = e0 >= 0 ? e0 / -k : -((-e0 - k - 1) / -k);
+        *hi = x < *hi ? x : *hi;
+    }else if(e0 < 0) {
+        *hi = *lo - 1;
+    }
+}
+
+/**
+ *  The furthest any sample inside a triangle lies from its plane, or 0 if
+ *  the triangle isn't entirely on the map. Only whether it is over the
+ *  limit matters, so the first sample over it is returned.
+ *  @param[in] ax, az, bx, bz  The hypotenuse
+ *  @param[in] cx, cz  The right angle
+ */
+static GLfloat
+triangle_error(rtinBuild const * const b, int ax, int az, int bx, int bz,
+               int cx, int cz) {
+    int const w = b->mData->mapWidth;
+    int const h = b->mData->mapHeight;
+    if(ax < 0 || bx < 0 || cx < 0 || az < 0 || bz < 0 || cz < 0
+       || ax >= w || bx >= w || cx >= w || az >= h || bz >= h || cz >= h) {
+        return 0.0f;
+    }
+    elevationGrid const * const g = &b->mData->elevation;
+    GLfloat const ha = grid_get(g, ax, az);
+    GLfloat const hb = grid_get(g, bx, bz);
+    GLfloat const hc = grid_get(g, cx, cz);
+    int const area = (bx - ax) * (cz - az) - (bz - az) * (cx - ax);
+    int const sign = area > 0 ? 1 : -1;
+    double const inverse_area = 1.0 / area;
+    int const min_x = cx < ax ? (cx < bx ? cx : bx) : (ax < bx ? ax : bx);
+    int const max_x = cx > ax ? (cx > bx ? cx : bx) : (ax > bx ? ax : bx);
+    int const min_z = cz < az ? (cz < bz ? cz : bz) : (az < bz ? az : bz);
+    int const max_z = cz > az ? (cz > bz ? cz : bz) : (az > bz ? az : bz);
+
+    GLfloat row[RTIN_TILE_SIZE + 1];
+    GLfloat e = 0.0f;
+    int x, z;
+    for(z = min_z; z <= max_z; z++) {
+        // The edge functions along the row are linear in x, so the samples
+        // inside are the span where none is of the wrong sign
+        int const ea0 = bx * (cz - z) - (bz - z) * cx;
+        int const eb0 = cx * (az - z) - (cz - z) * ax;
+        int lo = min_x, hi = max_x;
+        clip_span( &lo, &hi, sign * ea0, sign * (bz - cz) );
+        clip_span( &lo, &hi, sign * eb0, sign * (cz - az) );
+        clip_span( &lo, &hi, sign * (area - ea0 - eb0), sign * (az - bz) );
+        if(lo > hi) {
+            continue;
+        }
+        grid_read_row( g, z, lo, hi - lo + 1, row );
+        for(x = lo; x <= hi; x++) {
+            int const ea = ea0 + x * (bz - cz);
+            int const eb = eb0 + x * (cz - az);
+            int const ec = area - ea - eb;
+            GLfloat const d = fabsf(row[x - lo]
+                                    - plane_height(ea, eb, ec, inverse_area,
+                                                   ha, hb, hc));
+            if(d > b->max_error) {
+                return d;
+            }
+            e = d > e ? d : e;
+        }
+    }
+    return e;
+}
+
+/**
+ *  Store the error of a midpoint
+ *  @param[in] x, z  The midpoint
+ *  @param[in] ax, az, bx, bz  The ends of the hypotenuse it splits
+ *  @param[in] straddle  Whether one of its triangles crosses the map edge
+ *  @param[in] children  The largest error of the midpoints below it
+ */
+static void
+set_error(rtinBuild * const b, int x, int z, int ax, int az, int bx, int bz,
+          int straddle, GLfloat children) {
+    elevationGrid const * const g = &b->mData->elevation;
+    GLfloat e;
+    if(straddle) {
+        e = INFINITY;
+    }else if(x >= (int) b->mData->mapWidth || z >= (int) b->mData->mapHeight) {
+        e = 0.0f;
+    }else if(children > b->max_error) {
+        // Split anyway, whatever the samples of its own triangles
+        e = children;
+    }else {
+        // The midpoint is a sample of both triangles, so its distance from
+        // the hypotenuse is as far as they are off at least. Their samples
+        // lie on their children, which are off by at most their error from
+        // planes that stray from the hypotenuse by the midpoint's, so only
+        // triangles between the two bounds need their samples looked at.
+        GLfloat const mid = fabsf(grid_get(g, x, z)
+                                  - 0.5f * (grid_get(g, ax, az)
+                                            + grid_get(g, bx, bz)));
+        if(mid > b->max_error || children + mid <= b->max_error) {
+            e = children + mid;
+        }else {
+            // The right angles of the triangles on either side of the
+            // hypotenuse, half of it away from the midpoint
+            int const dx = (az - bz) / 2;
+            int const dz = (bx - ax) / 2;
+            e = fmaxf(triangle_error(b, ax, az, bx, bz, x + dx, z + dz),
+                      triangle_error(b, ax, az, bx, bz, x - dx, z - dz));
+            e = children > e ? children : e;
+        }
+    }
+    b->error[(size_t) z * b->width + x] = e;
+}
+
+/**
+ *  Measure the midpoints of the edges of length b->size on one row of
+ *  the lattice, rows being b->size / 2 apart
+ */
+static void
+measure_edges(void * const arg, unsigned int row) {
+    rtinBuild * const b = arg;
+    int const s = b->size;
+    int const half = s / 2;
+    int const quarter = half / 2;
+    int const z = row * half;
+    int const w = b->width;
+    int const h = b->height;
+
+    int x;
+    if(z % s == 0) {
+        // Horizontal edges, with a triangle above and one below
+        for(x = half; x < w; x += s) {
+            int const straddle = (z >= half
+                                  && straddles(b, x - half, z - half,
+                                               x + half, z))
+                                 || (z + half < h
+                                     && straddles(b, x - half, z,
+                                                  x + half, z + half));
+            GLfloat children = 0.0f;
+            if(quarter > 0) {
+                children = fmaxf(fmaxf(error_at(b, x - quarter, z - quarter),
+                                       error_at(b, x + quarter, z - quarter)),
+                                 fmaxf(error_at(b, x - quarter, z + quarter),
+                                       error_at(b, x + quarter, z + quarter)));
+            }
+            set_error(b, x, z, x - half, z, x + half, z, straddle, children);
+        }
+    }else {
+        // Vertical edges, with a triangle on the left and one on the right
+        for(x = 0; x < w; x += s) {
+            int const straddle = (x >= half
+                                  && straddles(b, x - half, z - half,
+                                               x, z + half))
+                                 || (x + half < w
+                                     && straddles(b, x, z - half,
+                                                  x + half, z + half));
+            GLfloat children = 0.0f;
+            if(quarter > 0) {
+                children = fmaxf(fmaxf(error_at(b, x - quarter, z - quarter),
+                                       error_at(b, x + quarter, z - quarter)),
+                                 fmaxf(error_at(b, x - quarter, z + quarter),
+                                       error_at(b, x + quarter, z + quarter)));
+            }
+            set_error(b, x, z, x, z - half, x, z + half, straddle, children);
+        }
+    }
+}
+
+/**
+ *  Measure the centers of one row of squares of size b->size. Squares
+ *  alternate diagonals like a checkerboard, so that the diagonal of every
+ *  square runs from a corner of its parent to the parent's center.
+ */
+static void
+measure_centers(void * const arg, unsigned int row) {
+    rtinBuild * const b = arg;
+    int const s = b->size;
+    int const half = s / 2;
+    int const z = half + row * s;
+
+    int x;
+    for(x = half; x < (int) b->width; x += s) {
+        int const main_diagonal = ((x / s) + (z / s)) % 2 == 0;
+        int const straddle = straddles(b, x - half, z - half,
+                                       x + half, z + half);
+        GLfloat const children = fmaxf(fmaxf(error_at(b, x - half, z),
+                                             error_at(b, x + half, z)),
+                                       fmaxf(error_at(b, x, z - half),
+                                             error_at(b, x, z + half)));
+        if(main_diagonal) {
+            set_error(b, x, z, x - half, z - half, x + half, z + half,
+                      straddle, children);
+        }else {
+            set_error(b, x, z, x + half, z - half, x - half, z + half,
+                      straddle, children);
+        }
+    }
+}
+
+/**
+ *  Split a triangle as long as its error is too large, then count it or
+ *  write it out if it lies on the map
+ *  @param[in] ax, az, bx, bz  The hypotenuse
+ *  @param[in] cx, cz  The right angle
+ *  @param[in,out] out  Where to write the next triangle, NULL to count
+ *  @return The number of triangles
+ */
+static size_t
+emit_triangle(rtinBuild const * const b, int ax, int az, int bx, int bz,
+              int cx, int cz, GLuint** out) {
+    int const leaf = (ax + bx) % 2 != 0 || (az + bz) % 2 != 0;
+    if(!leaf) {
+        int const mx = (ax + bx) / 2;
+        int const mz = (az + bz) / 2;
+        if(b->error[(size_t) mz * b->width + mx] > b->max_error) {
+            return emit_triangle(b, cx, cz, ax, az, mx, mz, out)
+                   + emit_triangle(b, bx, bz, cx, cz, mx, mz, out);
+        }
+    }
+
+    GLuint const w = b->mData->mapWidth;
+    if((GLuint) ax >= w || (GLuint) bx >= w || (GLuint) cx >= w
+       || (GLuint) az >= b->mData->mapHeight
+       || (GLuint) bz >= b->mData->mapHeight
+       || (GLuint) cz >= b->mData->mapHeight) {
+        return 0;
+    }
+    if(out != NULL) {
+        GLuint* const t = *out;
+        t[0] = az * w + ax;
+        t[1] = bz * w + bx;
+        t[2] = cz * w + cx;
+        *out += 3;
+    }
+    return 1;
+}
+
+/**
+ *  Walk the two root triangles of a tile
+ */
+static size_t
+emit_tile(rtinBuild const * const b, unsigned int tile, GLuint** out) {
+    int const tx = tile % b->tiles_x;
+    int const tz = tile / b->tiles_x;
+    int const t = b->tile;
+    int const x0 = tx * t;
+    int const z0 = tz * t;
+    if((tx + tz) % 2 == 0) {
+        return emit_triangle(b, x0, z0, x0 + t, z0 + t, x0 + t, z0, out)
+               + emit_triangle(b, x0 + t, z0 + t, x0, z0, x0, z0 + t, out);
+    }
+    return emit_triangle(b, x0 + t, z0, x0, z0 + t, x0, z0, out)
+           + emit_triangle(b, x0, z0 + t, x0 + t, z0, x0 + t, z0 + t, out);
+}
+
+static void
+count_tile(void * const arg, unsigned int tile) {
+    rtinBuild * const b = arg;
+    b->tile_start[tile + 1] = emit_tile(b, tile, NULL);
+}
+
+static void
+write_tile(void * const arg, unsigned int tile) {
+    rtinBuild * const b = arg;
+    GLuint* out = b->indices + 3 * b->tile_start[tile];
+    emit_tile(b, tile, &out);
+}
+
+/**
+ *  Compare the triangles of a tile with the samples under them. Each tile
+ *  owns the samples of its cells up to, but not including, its last row
+ *  and column, unless they are the map's, so every sample is counted once.
+ *  The error lattice is no longer needed and holds the sample errors.
+ */
+static void
+measure_tile(void * const arg, unsigned int tile) {
+    rtinBuild * const b = arg;
+    GLuint const w = b->mData->mapWidth;
+    GLuint const h = b->mData->mapHeight;
+    int const x0 = (tile % b->tiles_x) * b->tile;
+    int const z0 = (tile / b->tiles_x) * b->tile;
+    int const x_end = x0 + b->tile >= (int) w - 1 ? (int) w : x0 + (int) b->tile;
+    int const z_end = z0 + b->tile >= (int) h - 1 ? (int) h : z0 + (int) b->tile;
+
+    size_t i;
+    for(i = b->tile_start[tile]; i < b->tile_start[tile + 1]; i++) {
+        GLuint const * const t = b->indices + 3 * i;
+        int const ax = t[0] % w, az = t[0] / w;
+        int const bx = t[1] % w, bz = t[1] / w;
+        int const cx = t[2] % w, cz = t[2] / w;
+        GLfloat const ha = grid_get(&b->mData->elevation, ax, az);
+        GLfloat const hb = grid_get(&b->mData->elevation, bx, bz);
+        GLfloat const hc = grid_get(&b->mData->elevation, cx, cz);
+        int const area = (bx - ax) * (cz - az) - (bz - az) * (cx - ax);
+
+        int min_x = ax < bx ? ax : bx;
+        int max_x = ax > bx ? ax : bx;
+        int min_z = az < bz ? az : bz;
+        int max_z = az > bz ? az : bz;
+        min_x = cx < min_x ? cx : min_x;
+        max_x = cx > max_x ? cx : max_x;
+        min_z = cz < min_z ? cz : min_z;
+        max_z = cz > max_z ? cz : max_z;
+        min_x = min_x > x0 ? min_x : x0;
+        min_z = min_z > z0 ? min_z : z0;
+        max_x = max_x < x_end - 1 ? max_x : x_end - 1;
+        max_z = max_z < z_end - 1 ? max_z : z_end - 1;
+
+        int x, z;
+        for(z = min_z; z <= max_z; z++) {
+            for(x = min_x; x <= max_x; x++) {
+                // Edge functions, all of the sign of the area when inside
+                int const ea = (bx - x) * (cz - z) - (bz - z) * (cx - x);
+                int const eb = (cx - x) * (az - z) - (cz - z) * (ax - x);
+                int const ec = area - ea - eb;
+                if((area > 0 && (ea < 0 || eb < 0 || ec < 0))
+                   || (area < 0 && (ea > 0 || eb > 0 || ec > 0))) {
+                    continue;
+                }
+                GLfloat const surface = plane_height(ea, eb, ec,
+                                                     1.0 / area, ha, hb, hc);
+                b->error[(size_t) z * b->width + x]
+                    = fabsf(grid_get(&b->mData->elevation, x, z) - surface);
+            }
+        }
+    }
+
+    double sum = 0.0;
+    GLfloat max = 0.0f;
+    int x, z;
+    for(z = z0; z < z_end; z++) {
+        for(x = x0; x < x_end; x++) {
+            GLfloat const e = b->error[(size_t) z * b->width + x];
+            sum += e;
+            max = e > max ? e : max;
+        }
+    }
+    b->tile_sum[tile] = sum;
+    b->tile_max[tile] = max;
+}
+
+/**
+ *  Triangulate a map with as few triangles as keep every sample within
+ *  max_error of the surface
+ *  @param[out] mesh  The triangles, with their measured error
+ *  @param[in] mData  The map
+ *  @param[in] max_error  The largest vertical error, elevation units
+ *  @param[in] pool  The workers to build with
+ */
+void
+rtin_build(rtinMesh * const mesh, mapData const * const mData,
+           GLfloat max_error, threadPool * const pool) {
+    TRACE_SPAN("rtin");
+    rtinBuild b;
+    b.mData = mData;
+    b.max_error = max_error;
+
+    // Tiles as large as the map needs, up to RTIN_TILE_SIZE
+    GLuint const cells = mData->mapWidth > mData->mapHeight
+                         ? mData->mapWidth - 1 : mData->mapHeight - 1;
+    b.tile = 1;
+    while(b.tile < cells && b.tile < RTIN_TILE_SIZE) {
+        b.tile *= 2;
+    }
+    b.tiles_x = (mData->mapWidth - 1 + b.tile - 1) / b.tile;
+    b.tiles_z = (mData->mapHeight - 1 + b.tile - 1) / b.tile;
+    b.tiles_x = b.tiles_x > 0 ? b.tiles_x : 1;
+    b.tiles_z = b.tiles_z > 0 ? b.tiles_z : 1;
+    b.width = b.tiles_x * b.tile + 1;
+    b.height = b.tiles_z * b.tile + 1;
+
+    b.error = calloc((size_t) b.width * b.height, sizeof(*b.error));
+    if(b.error == NULL) {
+        fprintf(stderr, "Unable to allocate the RTIN error of %u x %u samples\n",
+                b.width, b.height);
+        exit(1);
+    }
+
+    for(b.size = 2; b.size <= b.tile; b.size *= 2) {
+        pool_run( pool, (b.height - 1) / (b.size / 2) + 1, measure_edges, &b );
+        pool_run( pool, (b.height - 1) / b.size, measure_centers, &b );
+    }
+
+    // Count the triangles of every tile, then write them where they belong
+    unsigned int const tiles = b.tiles_x * b.tiles_z;
+    b.tile_start = malloc((tiles + 1) * sizeof(*b.tile_start));
+    b.tile_start[0] = 0;
+    pool_run( pool, tiles, count_tile, &b );
+    unsigned int i;
+    for(i = 0; i < tiles; i++) {
+        b.tile_start[i + 1] += b.tile_start[i];
+    }
+
+    mesh->triangles = b.tile_start[tiles];
+    mesh->indices = malloc(3 * mesh->triangles * sizeof(*mesh->indices));
+    if(mesh->indices == NULL) {
+        fprintf(stderr, "Unable to allocate %zu RTIN triangles\n",
+                mesh->triangles);
+        exit(1);
+    }
+    b.indices = mesh->indices;
+    pool_run( pool, tiles, write_tile, &b );
+
+    b.tile_sum = malloc(tiles * sizeof(*b.tile_sum));
+    b.tile_max = malloc(tiles * sizeof(*b.tile_max));
+    pool_run( pool, tiles, measure_tile, &b );
+
+    double sum = 0.0;
+    mesh->max_error = 0.0f;
+    for(i = 0; i < tiles; i++) {
+        sum += b.tile_sum[i];
+        mesh->max_error = b.tile_max[i] > mesh->max_error
+                          ? b.tile_max[i] : mesh->max_error;
+    }
+    mesh->mean_error = sum / ((double) mData->mapWidth * mData->mapHeight);
+
+    free( b.tile_max );
+    free( b.tile_sum );
+    free( b.tile_start );
+    free( b.error );
+}
+
+void
+rtin_free(rtinMesh * const mesh) {
+    free( mesh->indices );
+    mesh->indices = NULL;
+    mesh->triangles = 0;
+}
@@ -0,0 +1,28 @@
+/**
+ * rtin.h
+ */
+#ifndef RTIN_H
+#define RTIN_H
+#include <stddef.h>
+#include "terrain.h"
+#include "pool.h"
+
+// The map is covered by square tiles of at most this many cells, each the
+// root of a right-triangulated irregular network
+#define RTIN_TILE_SIZE  1024
+
+/**
+ *  An adaptive triangle list over the samples of a map. Indices refer to
+ *  one vertex per sample, row-major, like MESH_TRIANGLES.
+ */
+typedef struct {
+    GLuint* indices;
+    size_t triangles;
+    GLfloat max_error;      // Measured against the full grid, elevation
+    GLfloat mean_error;     // units, over every sample of the map
+} rtinMesh;
+
+void rtin_build(rtinMesh * const mesh, mapData const * const mData,
+                GLfloat max_error, threadPool * const pool);
+void rtin_free(rtinMesh * const mesh);
+#endif
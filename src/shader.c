@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include "terrain.h"
 #include "shader.h"
+#include "trace.h"
 
 // Create a NULL-terminated string by reading the provided file
 static char*
@@ -29,6 +30,7 @@ read_shader_source(const char* shaderFile)
 GLuint
 init_shader(const char* vShaderFile, const char* fShaderFile)
 {
+    TRACE_SPAN("init_shader");
     struct Shader {
         const char*  filename;
         GLenum       type;
@@ -0,0 +1,540 @@
+/**
+ * stream.c
+ *
+ * Draws a tile pyramid too large to load. Every frame the pyramid is walked
+ * as a quadtree from its coarsest level: a tile close to the camera is
+ * replaced by its children once all of them are at hand, otherwise it is
+ * drawn while its children are asked for. Tiles drawn are kept on the GPU
+ * in a fixed number of slots, each built like a chunk of lod.h at its
+ * finest level, skirts included. Heights come from a tileCache that reads
+ * them in the background, nearest to a point ahead of the camera first.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "stream.h"
+#include "normals.h"
+#include "trace.h"
+
+typedef struct {
+    streamView const * view;
+    vec3 ahead;                 // Where wants are prioritized from
+    int pending;                // Tiles committed to, not drawn yet
+    int available;              // Slots not drawn yet this frame
+    GLuint uploads;
+    int throttled;              // Refining waited for uploads
+} streamVisit;
+
+static size_t
+slot_hash(tileKey key) {
+    return (key.level * 0x9E3779B1u ^ key.x * 0x85EBCA77u
+            ^ key.z * 0xC2B2AE3Du) & (STREAM_SLOT_TABLE - 1);
+}
+
+static int
+same_key(tileKey a, tileKey b) {
+    return a.level == b.level && a.x == b.x && a.z == b.z;
+}
+
+/**
+ *  The slot holding a tile, or -1
+ */
+static int
+find_slot(streamTerrain const * const s, tileKey key) {
+    size_t i = slot_hash(key);
+    while(s->slot_table[i] >= 0) {
+        if(same_key(s->slots[s->slot_table[i]].key, key)) {
+            return s->slot_table[i];
+        }
+        i = (i + 1) & (STREAM_SLOT_TABLE - 1);
+    }
+    return -1;
+}
+
+static void
+insert_slot(streamTerrain * const s, int slot) {
+    size_t i = slot_hash(s->slots[slot].key);
+    while(s->slot_table[i] >= 0) {
+        i = (i + 1) & (STREAM_SLOT_TABLE - 1);
+    }
+    s->slot_table[i] = slot;
+}
+
+/**
+ *  Remove a slot from the table, shifting back the slots after it that
+ *  would no longer be found
+ */
+static void
+erase_slot(streamTerrain * const s, int slot) {
+    size_t const mask = STREAM_SLOT_TABLE - 1;
+    size_t i = slot_hash(s->slots[slot].key);
+    while(s->slot_table[i] != slot) {
+        i = (i + 1) & mask;
+    }
+    s->slot_table[i] = -1;
+
+    size_t j = (i + 1) & mask;
+    while(s->slot_table[j] >= 0) {
+        size_t const home = slot_hash(s->slots[s->slot_table[j]].key);
+        if(((j - home) & mask) >= ((j - i) & mask)) {
+            s->slot_table[i] = s->slot_table[j];
+            s->slot_table[j] = -1;
+            i = j;
+        }
+        j = (j + 1) & mask;
+    }
+}
+
+/**
+ *  The map column or row of a sample of a level. The last sample of every
+ *  level is the map's last one.
+ */
+static GLuint
+map_sample(GLuint sample, GLuint level, GLuint size) {
+    uint64_t const s = (uint64_t) sample << level;
+    return s < size ? s : size - 1;
+}
+
+static GLfloat
+tile_width(streamTerrain const * const s, GLuint level) {
+    return s->map.scale * PYRAMID_TILE_SIZE * (GLfloat) (1u << level);
+}
+
+/**
+ *  How far the skirts of a tile hang below its lowest sample: its range,
+ *  which covers the error of a neighbour one level coarser, plus a little
+ *  to hide rounding at T-junctions
+ */
+static GLfloat
+tile_skirt(streamTerrain const * const s, GLuint level,
+           GLfloat low, GLfloat high) {
+    return high - low
+           + PYRAMID_TILE_SIZE * (GLfloat) (1u << level) * s->map.resolution
+             * 0.01f;
+}
+
+/**
+ *  The world space box around a tile, using the whole map's elevation
+ *  range until the tile has been seen
+ */
+static void
+tile_bounds(streamTerrain const * const s, tileKey key,
+            GLfloat min[3], GLfloat max[3]) {
+    pyramidLevel const * const l = &s->file.header.level[key.level];
+    GLuint const x0 = key.x * PYRAMID_TILE_SIZE;
+    GLuint const z0 = key.z * PYRAMID_TILE_SIZE;
+    GLuint const x1 = x0 + PYRAMID_TILE_SIZE;
+    GLuint const z1 = z0 + PYRAMID_TILE_SIZE;
+
+    GLfloat low = s->map.minElevation;
+    GLfloat high = s->map.maxElevation;
+    GLfloat skirt = high - low;
+    int const slot = find_slot(s, key);
+    if(slot >= 0) {
+        low = s->slots[slot].low;
+        high = s->slots[slot].high;
+        skirt = tile_skirt(s, key.level, low, high);
+    }
+
+    min[0] = s->map.scale * map_sample(x0, key.level, s->map.mapWidth)
+             - s->map.xOffset;
+    min[1] = s->map.yScale * (low - skirt - s->map.minElevation);
+    min[2] = s->map.scale * map_sample(z0, key.level, s->map.mapHeight)
+             - s->map.zOffset;
+    max[0] = s->map.scale * map_sample(x1 < l->width ? x1 : l->width - 1,
+                                       key.level, s->map.mapWidth)
+             - s->map.xOffset;
+    max[1] = s->map.yScale * (high - s->map.minElevation);
+    max[2] = s->map.scale * map_sample(z1 < l->height ? z1 : l->height - 1,
+                                       key.level, s->map.mapHeight)
+             - s->map.zOffset;
+}
+
+/**
+ *  The tiles of the next finer level covering a tile
+ *  @return The number of children, 0 for a tile of level 0
+ */
+static unsigned int
+tile_children(streamTerrain const * const s, tileKey key,
+              tileKey children[4]) {
+    if(key.level == 0) {
+        return 0;
+    }
+    pyramidLevel const * const l = &s->file.header.level[key.level - 1];
+    unsigned int n = 0;
+    GLuint dx, dz;
+    for(dz = 0; dz < 2; dz++) {
+        for(dx = 0; dx < 2; dx++) {
+            GLuint const x = 2 * key.x + dx;
+            GLuint const z = 2 * key.z + dz;
+            if(x < l->tilesX && z < l->tilesZ) {
+                children[n].level = key.level - 1;
+                children[n].x = x;
+                children[n].z = z;
+                n++;
+            }
+        }
+    }
+    return n;
+}
+
+/**
+ *  Ask for a tile, more urgently the closer it is to the point ahead of
+ *  the camera
+ *  @param[in] bias  Added to the priority, in tile widths
+ */
+static void
+want_tile(streamTerrain * const s, streamVisit const * const v, tileKey key,
+          GLfloat bias) {
+    if(s->want_count == STREAM_MAX_WANTS) {
+        return;
+    }
+    size_t i;
+    for(i = 0; i < s->want_count; i++) {
+        if(same_key(s->wants[i].key, key)) {
+            return;
+        }
+    }
+
+    GLfloat min[3], max[3];
+    tile_bounds(s, key, min, max);
+    streamWant* const w = &s->wants[s->want_count++];
+    w->key = key;
+    w->priority = lod_box_distance(min, max, &v->ahead)
+                  / tile_width(s, key.level) + bias;
+}
+
+static int
+compare_wants(void const * a, void const * b) {
+    GLfloat const pa = ((streamWant const *) a)->priority;
+    GLfloat const pb = ((streamWant const *) b)->priority;
+    return (pa > pb) - (pa < pb);
+}
+
+/**
+ *  Build the vertices and normals of a tile into a free slot
+ *  @return The slot, or -1 if every slot is drawn this frame
+ */
+static int
+upload_tile(streamTerrain * const s, tileKey key,
+            GLfloat const * const heights) {
+    TRACE_SPAN("upload tile");
+    // An empty slot, or the one drawn longest ago
+    int slot = -1;
+    int i;
+    for(i = 0; i < STREAM_GPU_TILES; i++) {
+        streamSlot const * const c = &s->slots[i];
+        if(c->last_used == s->frame) {
+            continue;
+        }
+        if(!c->used) {
+            slot = i;
+            break;
+        }
+        if(slot < 0 || c->last_used < s->slots[slot].last_used) {
+            slot = i;
+        }
+    }
+    if(slot < 0) {
+        return -1;
+    }
+    if(s->slots[slot].used) {
+        erase_slot( s, slot );
+    }
+
+    GLfloat low = heights[0], high = heights[0];
+    GLuint x, z, v;
+    for(z = 0; z < PYRAMID_TILE_SAMPLES; z++) {
+        GLfloat const * const row = heights + z * PYRAMID_TILE_SAMPLES;
+        grid_write_row( &s->tile, z, 0, PYRAMID_TILE_SAMPLES, row );
+        for(x = 0; x < PYRAMID_TILE_SAMPLES; x++) {
+            low = row[x] < low ? row[x] : low;
+            high = row[x] > high ? row[x] : high;
+        }
+    }
+
+    // The tile as a map of its own, for its normals
+    mapData tile_map = s->map;
+    tile_map.mapWidth = PYRAMID_TILE_SAMPLES;
+    tile_map.mapHeight = PYRAMID_TILE_SAMPLES;
+    tile_map.elevation = s->tile;
+    tile_map.scale = s->map.scale * (GLfloat) (1u << key.level);
+    compute_normal_rows( s->sample_normals, &tile_map, s->normal_mode,
+                         0, PYRAMID_TILE_SAMPLES );
+
+    // Samples past the edge of the level collapse onto its last ones
+    pyramidLevel const * const l = &s->file.header.level[key.level];
+    GLuint const x0 = key.x * PYRAMID_TILE_SIZE;
+    GLuint const z0 = key.z * PYRAMID_TILE_SIZE;
+    GLfloat const skirt = tile_skirt(s, key.level, low, high);
+    for(v = 0; v < LOD_CHUNK_VERTICES; v++) {
+        GLuint lx, lz;
+        int is_skirt = 0;
+        if(v < LOD_SKIRT_START) {
+            lx = v % LOD_CHUNK_SAMPLES;
+            lz = v / LOD_CHUNK_SAMPLES;
+        }else {
+            GLuint const edge = (v - LOD_SKIRT_START) / LOD_CHUNK_SAMPLES;
+            GLuint const e = (v - LOD_SKIRT_START) % LOD_CHUNK_SAMPLES;
+            lx = (edge < 2) ? e : (edge == 2 ? 0 : LOD_CHUNK_SIZE);
+            lz = (edge >= 2) ? e : (edge == 0 ? 0 : LOD_CHUNK_SIZE);
+            is_skirt = 1;
+        }
+        GLuint const sx = x0 + lx < l->width ? x0 + lx : l->width - 1;
+        GLuint const sz = z0 + lz < l->height ? z0 + lz : l->height - 1;
+        GLfloat const h = heights[lz * PYRAMID_TILE_SAMPLES + lx]
+                          - (is_skirt ? skirt : 0.0f);
+
+        vec4* const out = &s->vertices[v];
+        out->x = s->map.scale * map_sample(sx, key.level, s->map.mapWidth)
+                 - s->map.xOffset;
+        out->y = s->map.yScale * (h - s->map.minElevation);
+        out->z = s->map.scale * map_sample(sz, key.level, s->map.mapHeight)
+                 - s->map.zOffset;
+        out->w = 1.0f;
+        s->normals[v] = s->sample_normals[lz * PYRAMID_TILE_SAMPLES + lx];
+    }
+
+    size_t const positions = (size_t) STREAM_GPU_TILES * LOD_CHUNK_VERTICES
+                             * sizeof(vec4);
+    TRACE_TALLY(TRACE_UPLOAD_BYTES,
+                LOD_CHUNK_VERTICES * (sizeof(vec4) + sizeof(vec3)));
+    glBindBuffer( GL_ARRAY_BUFFER, s->vertex_buffer );
+    glBufferSubData( GL_ARRAY_BUFFER,
+                     (size_t) slot * LOD_CHUNK_VERTICES * sizeof(vec4),
+                     LOD_CHUNK_VERTICES * sizeof(vec4), s->vertices );
+    glBufferSubData( GL_ARRAY_BUFFER,
+                     positions
+                     + (size_t) slot * LOD_CHUNK_VERTICES * sizeof(vec3),
+                     LOD_CHUNK_VERTICES * sizeof(vec3), s->normals );
+
+    streamSlot* const c = &s->slots[slot];
+    c->key = key;
+    c->used = 1;
+    c->low = low;
+    c->high = high;
+    insert_slot( s, slot );
+    return slot;
+}
+
+/**
+ *  Draw a tile from its slot, uploading it first if it has none
+ */
+static void
+draw_tile(streamTerrain * const s, streamVisit * const v, tileKey key) {
+    v->pending--;
+    int slot = find_slot(s, key);
+    if(slot < 0) {
+        GLfloat const * const heights = tile_cache_peek(s->cache, key);
+        if(heights == NULL) {
+            want_tile( s, v, key, 0.0f );
+            return;
+        }
+        slot = upload_tile(s, key, heights);
+        if(slot < 0) {
+            return;
+        }
+        v->uploads++;
+    }
+    if(s->slots[slot].last_used != s->frame) {
+        s->slots[slot].last_used = s->frame;
+        v->available--;
+    }
+
+    lodDrawList* const d = &s->draws;
+    d->counts[d->draws] = s->index_count;
+    d->offsets[d->draws] = BUFFER_OFFSET(0);
+    d->base_vertices[d->draws] = slot * LOD_CHUNK_VERTICES;
+    d->draws++;
+
+    streamStats* const stats = &s->stats;
+    stats->finest_level = stats->tiles == 0 || key.level < stats->finest_level
+                          ? key.level : stats->finest_level;
+    stats->coarsest_level = key.level > stats->coarsest_level
+                            ? key.level : stats->coarsest_level;
+    stats->tiles++;
+    stats->triangles += s->index_count / 3;
+}
+
+/**
+ *  Draw a tile, or its children when it is close enough and all of them
+ *  can be drawn this frame
+ */
+static void
+visit_tile(streamTerrain * const s, streamVisit * const v, tileKey key) {
+    GLfloat min[3], max[3];
+    tile_bounds(s, key, min, max);
+    if(v->view->frustum != NULL
+       && !frustum_test_box(v->view->frustum, min, max)) {
+        v->pending--;
+        s->stats.culled_tiles++;
+        return;
+    }
+
+    tileKey children[4];
+    unsigned int const n = tile_children(s, key, children);
+    if(n > 0 && lod_box_distance(min, max, &v->view->eye)
+                < STREAM_REFINE * tile_width(s, key.level)) {
+        GLuint uploads = 0, missing = 0;
+        unsigned int i;
+        for(i = 0; i < n; i++) {
+            if(find_slot(s, children[i]) >= 0) {
+                continue;
+            }
+            if(tile_cache_get(s->cache, children[i]) != NULL) {
+                uploads++;
+            }else {
+                want_tile( s, v, children[i], 0.0f );
+                missing++;
+            }
+        }
+
+        // Every tile committed to must still find a slot
+        if(missing == 0 && v->available >= v->pending + (int) n - 1) {
+            if(v->uploads + uploads <= STREAM_UPLOADS_PER_FRAME) {
+                v->pending += n - 1;
+                for(i = 0; i < n; i++) {
+                    visit_tile( s, v, children[i] );
+                }
+                return;
+            }
+            v->throttled = 1;
+        }
+    }
+    draw_tile( s, v, key );
+}
+
+/**
+ *  Ask for the tiles the camera would draw from the point ahead of it
+ */
+static void
+prefetch_tile(streamTerrain * const s, streamVisit const * const v,
+              tileKey key) {
+    GLfloat min[3], max[3];
+    tile_bounds(s, key, min, max);
+
+    tileKey children[4];
+    unsigned int const n = tile_children(s, key, children);
+    if(n > 0 && lod_box_distance(min, max, &v->ahead)
+                < STREAM_REFINE * tile_width(s, key.level)) {
+        unsigned int i;
+        for(i = 0; i < n; i++) {
+            prefetch_tile( s, v, children[i] );
+        }
+    }else if(find_slot(s, key) < 0 && tile_cache_peek(s->cache, key) == NULL) {
+        want_tile( s, v, key, 1.0f );
+    }
+}
+
+/**
+ *  Set up streaming from an open pyramid. The caller creates
+ *  s->vertex_buffer and the index buffer from s->indices.
+ *  @param[in] file  The pyramid, owned by the stream from now on
+ *  @param[in] mData  The placement of the map, without elevations
+ *  @param[in] budget  Bytes of heights to keep in memory
+ *  @param[in] normals  How vertex normals are computed
+ *  @return The stream, for the lifetime of the program
+ */
+streamTerrain*
+stream_create(pyramid const * const file, mapData const * const mData,
+              size_t budget, normalMode normals) {
+    streamTerrain* const s = calloc(1, sizeof(*s));
+    s->file = *file;
+    s->cache = tile_cache_create(&s->file, budget);
+    s->map = *mData;
+    s->normal_mode = normals;
+
+    size_t i;
+    for(i = 0; i < STREAM_SLOT_TABLE; i++) {
+        s->slot_table[i] = -1;
+    }
+
+    if(!grid_init( &s->tile, PYRAMID_TILE_SAMPLES, PYRAMID_TILE_SAMPLES,
+                   GRID_ROW_MAJOR )) {
+        fprintf(stderr, "Unable to allocate a tile\n");
+        exit(1);
+    }
+    s->sample_normals = malloc(PYRAMID_TILE_SAMPLES * PYRAMID_TILE_SAMPLES
+                               * sizeof(*s->sample_normals));
+    s->vertices = malloc(LOD_CHUNK_VERTICES * sizeof(*s->vertices));
+    s->normals = malloc(LOD_CHUNK_VERTICES * sizeof(*s->normals));
+
+    s->index_count = 6 * (LOD_CHUNK_SIZE * LOD_CHUNK_SIZE
+                          + 4 * LOD_CHUNK_SIZE);
+    s->indices = malloc(s->index_count * sizeof(*s->indices));
+    lod_build_pattern( s->indices, 0 );
+
+    s->draws.counts = malloc(STREAM_GPU_TILES * sizeof(*s->draws.counts));
+    s->draws.offsets = malloc(STREAM_GPU_TILES * sizeof(*s->draws.offsets));
+    s->draws.base_vertices = malloc(STREAM_GPU_TILES
+                                    * sizeof(*s->draws.base_vertices));
+    s->draws.draws = 0;
+
+    s->wants = malloc(STREAM_MAX_WANTS * sizeof(*s->wants));
+    s->want_keys = malloc(STREAM_MAX_WANTS * sizeof(*s->want_keys));
+    return s;
+}
+
+/**
+ *  Pick, upload and list the tiles to draw for a camera, then queue the
+ *  tiles still missing
+ *  @param[in] s  The stream
+ *  @param[in] view  The camera
+ */
+void
+stream_update(streamTerrain * const s, streamView const * const view) {
+    TRACE_SPAN("stream update");
+    tile_cache_update( s->cache );
+    s->frame++;
+    s->draws.draws = 0;
+    s->want_count = 0;
+    s->stats.tiles = 0;
+    s->stats.culled_tiles = 0;
+    s->stats.finest_level = 0;
+    s->stats.coarsest_level = 0;
+    s->stats.triangles = 0;
+
+    streamVisit v;
+    v.view = view;
+    vec3_init( &v.ahead, view->eye.x + view->lookahead * view->heading.x,
+               view->eye.y + view->lookahead * view->heading.y,
+               view->eye.z + view->lookahead * view->heading.z );
+    v.available = STREAM_GPU_TILES;
+    v.uploads = 0;
+    v.throttled = 0;
+
+    // The coarsest level is the root of the quadtree
+    pyramidHeader const * const h = &s->file.header;
+    pyramidLevel const * const top = &h->level[h->levels - 1];
+    v.pending = top->tilesX * top->tilesZ;
+    tileKey key;
+    key.level = h->levels - 1;
+    for(key.z = 0; key.z < top->tilesZ; key.z++) {
+        for(key.x = 0; key.x < top->tilesX; key.x++) {
+            visit_tile( s, &v, key );
+        }
+    }
+    for(key.z = 0; key.z < top->tilesZ; key.z++) {
+        for(key.x = 0; key.x < top->tilesX; key.x++) {
+            prefetch_tile( s, &v, key );
+        }
+    }
+
+    qsort( s->wants, s->want_count, sizeof(*s->wants), compare_wants );
+    size_t i;
+    for(i = 0; i < s->want_count; i++) {
+        s->want_keys[i] = s->wants[i].key;
+    }
+    tile_cache_want( s->cache, s->want_keys, s->want_count );
+
+    s->stats.uploads = v.uploads;
+    tile_cache_stats( s->cache, &s->stats.cache );
+    s->settled = s->want_count == 0 && !v.throttled;
+}
+
+/**
+ *  Whether the last update had everything it wanted
+ */
+int
+stream_settled(streamTerrain const * const s) {
+    return s->settled;
+}
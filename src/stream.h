@@ -0,0 +1,96 @@
+/**
+ * stream.h
+ */
+#ifndef STREAM_H
+#define STREAM_H
+#include "terrain.h"
+#include "pyramid.h"
+#include "tilecache.h"
+#include "frustum.h"
+#include "lod.h"
+
+// Tiles that fit on the GPU at once, and how many may be uploaded per frame
+#define STREAM_GPU_TILES            512
+#define STREAM_UPLOADS_PER_FRAME    16
+
+// Tiles closer than this many of their widths are split into their children
+#define STREAM_REFINE               2.0f
+
+// How far ahead of the camera to prefetch, in cube sizes (five w/s steps)
+#define STREAM_LOOKAHEAD            0.05f
+
+#define STREAM_MAX_WANTS            1024
+#define STREAM_SLOT_TABLE           (4 * STREAM_GPU_TILES)
+
+// Milliseconds between redraws while tiles are still arriving
+#define STREAM_POLL_MS              50
+
+// What the selector needs to know about the camera
+typedef struct {
+    vec3 eye;                   // Camera position, world coordinates
+    vec3 heading;               // Unit vector the camera moves along
+    GLfloat lookahead;          // Distance to prefetch along the heading
+    frustum const * frustum;    // World space, NULL to draw every tile
+} streamView;
+
+typedef struct {
+    GLuint tiles;               // Drawn this frame
+    GLuint culled_tiles;
+    GLuint finest_level;        // Of the tiles drawn
+    GLuint coarsest_level;
+    GLuint uploads;
+    size_t triangles;
+    tileCacheStats cache;
+} streamStats;
+
+typedef struct {
+    tileKey key;
+    GLfloat priority;           // Lower is loaded first
+} streamWant;
+
+typedef struct {
+    tileKey key;
+    GLuint last_used;           // Frame the slot was last drawn in
+    int used;                   // Holds a tile
+    GLfloat low;                // Elevation range of the tile
+    GLfloat high;
+} streamSlot;
+
+// Everything the display needs to draw a streamed pyramid
+struct streamTerrain {
+    pyramid file;
+    tileCache* cache;
+    mapData map;                // Placement of level 0, without elevations
+    normalMode normal_mode;
+    GLuint vertex_buffer;       // STREAM_GPU_TILES tiles of positions, then
+                                // as many of normals
+
+    // Tiles on the GPU, found through an open addressing table of slots
+    streamSlot slots[STREAM_GPU_TILES];
+    GLshort slot_table[STREAM_SLOT_TABLE];
+    GLuint frame;
+
+    // Scratch space to build one tile
+    elevationGrid tile;
+    vec3* sample_normals;
+    vec4* vertices;
+    vec3* normals;
+
+    // Level 0 index pattern of lod.h, shared by every tile
+    GLushort* indices;
+    GLuint index_count;
+
+    lodDrawList draws;
+    streamWant* wants;
+    tileKey* want_keys;
+    size_t want_count;
+    int settled;                // Nothing was left to load or upload
+    streamStats stats;          // Of the last update
+};
+
+streamTerrain* stream_create(pyramid const * const file,
+                             mapData const * const mData, size_t budget,
+                             normalMode normals);
+void stream_update(streamTerrain * const s, streamView const * const view);
+int stream_settled(streamTerrain const * const s);
+#endif
@@ -1,69 +1,170 @@
-#ifndef TERRAIN_H
-#define TERRAIN_H
-
-#ifndef M_PI
-#  define M_PI  3.14159265358979323846
-#endif
-
-#ifdef __APPLE__  // include Mac OS X verions of headers
-#  include <OpenGL/OpenGL.h>
-#  include <GLUT/glut.h>
-#else // non-Mac OS X operating systems
-#  include <GL/glew.h>
-#  include <GL/glut.h>
-// # include <GL/glut_ext.h>
-#endif  // __APPLE__
-
-#define BUFFER_OFFSET( offset )   ((GLvoid*) (offset))
-
-#include "vec.h"
-
-typedef struct {
-    vec4 position;
-    vec4 ambient;
-    vec4 diffuse;
-    vec4 specular;
-} lightData;
-
-typedef struct {
-    vec4 ambient;
-    vec4 diffuse;
-    vec4 specular;
-    GLfloat shininess;
-} materialData;
-
-typedef struct {
-    GLuint mapHeight;
-    GLuint mapWidth;
-    GLfloat** elevationData;
-    GLfloat minElevation;
-    GLfloat maxElevation;
-    GLfloat scale;
-    GLfloat yScale;
-    GLfloat xOffset;
-    GLfloat zOffset;
-} mapData;
-
-typedef struct {
-    GLfloat cube_size;
-    GLuint projection_pos;
-    int wireframe_mode;
-    int fill_mode;
-    GLuint wireframe_pos;
-    lightData sun_light;
-    GLfloat sun_theta;
-    GLuint light_pos;
-    materialData ground_material;
-    GLuint shininess_pos;
-    GLuint num_vertices;
-} worldData;
-
-typedef struct {
-    GLfloat viewer[3];
-    GLfloat theta[3];
-    GLuint model_view_pos;
-    int last_mouse_x;
-    int last_mouse_y;
-} cameraData;
-
-#endif
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#ifndef M_PI
+#  define M_PI  3.14159265358979323846
+#endif
+
+#ifdef __APPLE__  // include Mac OS X verions of headers
+#  include <OpenGL/OpenGL.h>
+#  include <GLUT/glut.h>
+#else // non-Mac OS X operating systems
+#  include <GL/glew.h>
+#  include <GL/glut.h>
+// # include <GL/glut_ext.h>
+#endif  // __APPLE__
+
+#define BUFFER_OFFSET( offset )   ((GLvoid*) (offset))
+
+#include "vec.h"
+#include "mat.h"
+#include "grid.h"
+#include "pool.h"
+
+typedef struct {
+    vec4 position;
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+} lightData;
+
+typedef struct {
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+    GLfloat shininess;
+} materialData;
+
+typedef struct {
+    GLuint mapHeight;
+    GLuint mapWidth;
+    elevationGrid elevation;
+    GLfloat minElevation;
+    GLfloat maxElevation;
+    GLfloat scale;
+    GLfloat yScale;
+    GLfloat resolution;
+    GLfloat xOffset;
+    GLfloat zOffset;
+} mapData;
+
+typedef enum {
+    MESH_STRIP,         // One serpentine strip with duplicated vertices
+    MESH_INDEXED,       // One vertex per sample, strips with restart
+    MESH_TRIANGLES,     // One vertex per sample, indexed triangle list
+    MESH_CHUNKED,       // Chunks with levels of detail, see lod.h
+    MESH_RTIN           // One vertex per sample, adaptive triangles
+} meshMode;
+
+// Chunked level of detail state, see lod.h
+typedef struct lodState lodState;
+
+// Tiles streamed from a pyramid, see stream.h
+typedef struct streamTerrain streamTerrain;
+
+// A map loading in the background, see progressive.h
+typedef struct progressiveLoader progressiveLoader;
+
+// Elevations kept for picking and ground following, see heightmap.h
+typedef struct heightMap heightMap;
+
+// Patches the vertex buffer when heights change, see update.h
+typedef struct terrainUpdater terrainUpdater;
+
+// Watches the elevation file for changes, see watch.h
+typedef struct fileWatch fileWatch;
+
+// Plays a sequence of grids, see playback.h
+typedef struct framePlayer framePlayer;
+
+// Camera paths recorded and replayed, see replay.h
+typedef struct pathRecorder pathRecorder;
+typedef struct pathReplay pathReplay;
+
+typedef struct {
+    GLfloat cube_size;
+    GLuint projection_pos;
+    int wireframe_mode;
+    int fill_mode;
+    GLuint wireframe_pos;
+    lightData sun_light;
+    GLfloat sun_theta;
+    GLuint light_pos;
+    int shadows;            // Whether the vertices carry horizons
+    GLuint sun_direction_pos;
+    materialData ground_material;
+    GLuint shininess_pos;
+    meshMode mesh;
+    GLuint num_vertices;
+    GLuint num_indices;     // 0 when drawing without an index buffer
+    size_t num_triangles;   // Drawn by each pass unless chunked or streamed
+    lodState* lod;          // NULL unless the mesh is chunked
+    streamTerrain* stream;  // NULL unless the map is a tile pyramid
+    progressiveLoader* loader;  // NULL unless loading in the background
+    pathRecorder* recorder; // NULL unless recording the camera
+    pathReplay* replay;     // NULL unless replaying a camera path
+    heightMap* heights;     // NULL when streaming or loading in the
+                            // background
+    terrainUpdater* updater;    // NULL unless heights can be updated
+    fileWatch* watch;       // NULL unless watching the elevation file
+    framePlayer* player;    // NULL unless playing a sequence of grids
+    int follow_ground;      // Keep the camera at eye height over the map
+    char cursor[64];        // What is under the mouse, empty if nothing
+    GLfloat fovy;           // Vertical field of view, degrees
+    int viewport_width;     // Pixels
+    int viewport_height;
+    mat4 projection;        // Set by reshape()
+    int cull;               // Skip chunks outside the view frustum
+    threadPool* pool;
+} worldData;
+
+typedef struct {
+    GLfloat viewer[3];
+    GLfloat theta[3];
+    GLuint model_view_pos;
+    int last_mouse_x;
+    int last_mouse_y;
+} cameraData;
+
+typedef enum {
+    NORMALS_EXACT,      // Average of the four corner face normals
+    NORMALS_FAST        // Central differences
+} normalMode;
+
+typedef struct {
+    char const * path;      // Elevation file, NULL when reading stdin
+    char const * mosaic;    // List of tiles stitched into one map, or NULL
+    char * const * tiles;   // Tiles placed by their georeference
+    unsigned int num_tiles; // 0 unless stitching them
+    int crop;               // Load only a window of a text file
+    GLuint crop_x;          // Its first sample
+    GLuint crop_z;
+    GLuint crop_width;
+    GLuint crop_height;
+    GLfloat quantize;       // Largest error of 16 bit heights, < 0 for off
+    int watch;              // Update the map when the file changes
+    char const * play;      // Directory or file of grids to play, or NULL
+    GLfloat play_fps;       // Frames played per second, 0 for as fast as
+                            // they are decoded
+    int use_cache;          // Read/write the .tvc cache next to the file
+    int cache_mesh;         // Also store the finished mesh in the cache
+    gridLayout layout;      // Memory layout of the elevation grid
+    normalMode normals;     // How vertex normals are computed
+    meshMode mesh;          // Vertex and index layout of the terrain
+    int compact;            // Use 8 byte vertices (indexed layouts only)
+    GLfloat lod_threshold;  // Largest error of chunked meshes, pixels
+    GLfloat max_error;      // Largest error of RTIN meshes, elevation units
+    size_t cache_budget;    // Bytes of tiles kept when streaming a pyramid
+    int progressive;        // Draw coarse previews while the map loads
+    int shadows;            // Shade with precomputed horizons
+    char const * out;       // Image to render without a window, or NULL
+    unsigned int out_width; // Pixels of the image
+    unsigned int out_height;
+    char const * record;    // Camera path to record, or NULL
+    char const * replay;    // Camera path to replay, or NULL
+    char const * stats;     // CSV the replay summary is appended to
+    char const * frame_times;   // CSV of every replayed frame
+    unsigned int threads;   // Worker threads, 0 for one per CPU
+} optionsData;
+
+#endif
@@ -0,0 +1,387 @@
+/**
+ * tilecache.c
+ *
+ * A least recently used cache of pyramid tiles with a fixed memory budget.
+ * A background thread reads the tiles asked for by tile_cache_want(), in
+ * order. Everything else, including eviction, happens on the caller's
+ * thread in tile_cache_update(), so the data returned by tile_cache_get()
+ * stays valid until the next update.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tilecache.h"
+#include "trace.h"
+
+typedef struct tileEntry {
+    uint64_t key;
+    GLfloat* data;
+    struct tileEntry* prev;     // Toward the most recently used
+    struct tileEntry* next;
+} tileEntry;
+
+struct tileCache {
+    pyramid const * file;
+    size_t tile_bytes;
+    size_t budget;
+    size_t max_tiles;
+
+    // Resident tiles, only touched by the caller's thread
+    tileEntry** table;          // Open addressing, linear probing
+    size_t table_mask;
+    tileEntry* newest;
+    tileEntry* oldest;
+    size_t resident;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+
+    // Shared with the I/O thread
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+    uint64_t* wanted;
+    size_t wanted_count;
+    size_t wanted_next;
+    size_t wanted_capacity;
+    tileEntry* loaded;          // Read but not resident yet
+    size_t loaded_count;
+    uint64_t loading;
+    int busy;
+    int shutdown;
+    size_t loads;
+    size_t failures;
+    pthread_t thread;
+};
+
+static uint64_t
+pack_key(tileKey key) {
+    return ((uint64_t) key.level << 58) | ((uint64_t) key.x << 29) | key.z;
+}
+
+static size_t
+hash_key(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static tileEntry*
+find(tileCache const * const c, uint64_t key) {
+    size_t i = hash_key(key) & c->table_mask;
+    while(c->table[i] != NULL) {
+        if(c->table[i]->key == key) {
+            return c->table[i];
+        }
+        i = (i + 1) & c->table_mask;
+    }
+    return NULL;
+}
+
+static void
+insert(tileCache * const c, tileEntry * const e) {
+    size_t i = hash_key(e->key) & c->table_mask;
+    while(c->table[i] != NULL) {
+        i = (i + 1) & c->table_mask;
+    }
+    c->table[i] = e;
+}
+
+/**
+ *  Remove an entry from the table, shifting back the entries after it that
+ *  would no longer be found
+ */
+static void
+erase(tileCache * const c, uint64_t key) {
+    size_t i = hash_key(key) & c->table_mask;
+    while(c->table[i]->key != key) {
+        i = (i + 1) & c->table_mask;
+    }
+    c->table[i] = NULL;
+
+    size_t j = (i + 1) & c->table_mask;
+    while(c->table[j] != NULL) {
+        size_t const home = hash_key(c->table[j]->key) & c->table_mask;
+        // Move the entry into the hole unless its home lies between them
+        if(((j - home) & c->table_mask) >= ((j - i) & c->table_mask)) {
+            c->table[i] = c->table[j];
+            c->table[j] = NULL;
+            i = j;
+        }
+        j = (j + 1) & c->table_mask;
+    }
+}
+
+static void
+unlink_entry(tileCache * const c, tileEntry * const e) {
+    if(e->prev != NULL) {
+        e->prev->next = e->next;
+    }else {
+        c->newest = e->next;
+    }
+    if(e->next != NULL) {
+        e->next->prev = e->prev;
+    }else {
+        c->oldest = e->prev;
+    }
+}
+
+static void
+push_newest(tileCache * const c, tileEntry * const e) {
+    e->prev = NULL;
+    e->next = c->newest;
+    if(c->newest != NULL) {
+        c->newest->prev = e;
+    }
+    c->newest = e;
+    if(c->oldest == NULL) {
+        c->oldest = e;
+    }
+}
+
+/**
+ *  Read the wanted tiles in order, pausing while a budget's worth of
+ *  tiles waits for tile_cache_update()
+ */
+static void*
+io_thread(void * const arg) {
+    tileCache* const c = arg;
+    pthread_mutex_lock( &c->lock );
+    for(;;) {
+        while(!c->shutdown && (c->wanted_next == c->wanted_count
+                               || c->loaded_count >= c->max_tiles)) {
+            pthread_cond_wait( &c->wake, &c->lock );
+        }
+        if(c->shutdown) {
+            break;
+        }
+
+        uint64_t const key = c->wanted[c->wanted_next++];
+        c->loading = key;
+        c->busy = 1;
+        pthread_mutex_unlock( &c->lock );
+
+        TRACE_SPAN("read tile");
+        tileEntry* e = malloc(sizeof(*e));
+        e->key = key;
+        e->data = malloc(c->tile_bytes);
+        if(!pyramid_read_tile( c->file, key >> 58, (key >> 29) & 0x1FFFFFFF,
+                               key & 0x1FFFFFFF, e->data )) {
+            free( e->data );
+            free( e );
+            e = NULL;
+        }
+
+        pthread_mutex_lock( &c->lock );
+        if(e != NULL) {
+            e->next = c->loaded;
+            c->loaded = e;
+            c->loaded_count++;
+            c->loads++;
+        }else {
+            c->failures++;
+        }
+        c->busy = 0;
+        pthread_cond_broadcast( &c->idle );
+    }
+    pthread_mutex_unlock( &c->lock );
+    return NULL;
+}
+
+/**
+ *  Create a cache and start its I/O thread
+ *  @param[in] file  The pyramid to read, open for the life of the cache
+ *  @param[in] budget  Bytes of tile data to keep, at least one tile
+ *  @return The cache
+ */
+tileCache*
+tile_cache_create(pyramid const * const file, size_t budget) {
+    tileCache* const c = calloc(1, sizeof(*c));
+    c->file = file;
+    c->tile_bytes = pyramid_tile_bytes(file);
+    c->max_tiles = budget / c->tile_bytes;
+    c->max_tiles = c->max_tiles > 0 ? c->max_tiles : 1;
+    c->budget = c->max_tiles * c->tile_bytes;
+
+    // Up to twice the budget is briefly resident while loaded tiles merge
+    size_t size = 16;
+    while(size < 4 * c->max_tiles) {
+        size *= 2;
+    }
+    c->table = calloc(size, sizeof(*c->table));
+    c->table_mask = size - 1;
+
+    pthread_mutex_init( &c->lock, NULL );
+    pthread_cond_init( &c->wake, NULL );
+    pthread_cond_init( &c->idle, NULL );
+    pthread_create( &c->thread, NULL, io_thread, c );
+    return c;
+}
+
+void
+tile_cache_destroy(tileCache * const c) {
+    pthread_mutex_lock( &c->lock );
+    c->shutdown = 1;
+    pthread_cond_broadcast( &c->wake );
+    pthread_mutex_unlock( &c->lock );
+    pthread_join( c->thread, NULL );
+
+    tileEntry* e = c->newest;
+    while(e != NULL) {
+        tileEntry* const next = e->next;
+        free( e->data );
+        free( e );
+        e = next;
+    }
+    e = c->loaded;
+    while(e != NULL) {
+        tileEntry* const next = e->next;
+        free( e->data );
+        free( e );
+        e = next;
+    }
+
+    pthread_cond_destroy( &c->idle );
+    pthread_cond_destroy( &c->wake );
+    pthread_mutex_destroy( &c->lock );
+    free( c->wanted );
+    free( c->table );
+    free( c );
+}
+
+/**
+ *  Look up a tile, counting a hit or a miss
+ *  @return The tile's heights, valid until the next tile_cache_update(),
+ *          or NULL if the tile isn't resident
+ */
+GLfloat const *
+tile_cache_get(tileCache * const c, tileKey key) {
+    tileEntry* const e = find(c, pack_key(key));
+    if(e == NULL) {
+        c->misses++;
+        return NULL;
+    }
+    c->hits++;
+    unlink_entry( c, e );
+    push_newest( c, e );
+    return e->data;
+}
+
+/**
+ *  Look up a tile without counting or promoting it
+ *  @return The tile's heights, or NULL if the tile isn't resident
+ */
+GLfloat const *
+tile_cache_peek(tileCache const * const c, tileKey key) {
+    tileEntry const * const e = find(c, pack_key(key));
+    return e != NULL ? e->data : NULL;
+}
+
+/**
+ *  Replace the tiles the I/O thread reads next. Tiles already resident or
+ *  read are skipped.
+ *  @param[in] c  The cache
+ *  @param[in] keys  The tiles, most urgent first
+ *  @param[in] count  The number of tiles
+ */
+void
+tile_cache_want(tileCache * const c, tileKey const * const keys,
+                size_t count) {
+    pthread_mutex_lock( &c->lock );
+    if(count > c->wanted_capacity) {
+        c->wanted_capacity = count;
+        c->wanted = realloc(c->wanted, count * sizeof(*c->wanted));
+    }
+
+    c->wanted_count = 0;
+    c->wanted_next = 0;
+    size_t i;
+    for(i = 0; i < count; i++) {
+        uint64_t const key = pack_key(keys[i]);
+        if(find(c, key) != NULL || (c->busy && c->loading == key)) {
+            continue;
+        }
+        tileEntry const * e = c->loaded;
+        while(e != NULL && e->key != key) {
+            e = e->next;
+        }
+        if(e == NULL) {
+            c->wanted[c->wanted_count++] = key;
+        }
+    }
+    pthread_cond_signal( &c->wake );
+    pthread_mutex_unlock( &c->lock );
+}
+
+/**
+ *  Make the tiles read since the last update resident, then evict the
+ *  least recently used tiles beyond the budget
+ *  @return The number of tiles that became resident
+ */
+unsigned int
+tile_cache_update(tileCache * const c) {
+    pthread_mutex_lock( &c->lock );
+    tileEntry* e = c->loaded;
+    c->loaded = NULL;
+    c->loaded_count = 0;
+    pthread_cond_signal( &c->wake );
+    pthread_mutex_unlock( &c->lock );
+
+    unsigned int added = 0;
+    while(e != NULL) {
+        tileEntry* const next = e->next;
+        if(find(c, e->key) != NULL) {
+            free( e->data );
+            free( e );
+        }else {
+            insert( c, e );
+            push_newest( c, e );
+            c->resident++;
+            added++;
+        }
+        e = next;
+    }
+
+    while(c->resident > c->max_tiles) {
+        tileEntry* const old = c->oldest;
+        unlink_entry( c, old );
+        erase( c, old->key );
+        free( old->data );
+        free( old );
+        c->resident--;
+        c->evictions++;
+    }
+    return added;
+}
+
+/**
+ *  Wait until the I/O thread has read every wanted tile, or as many as it
+ *  reads before an update
+ */
+void
+tile_cache_wait(tileCache * const c) {
+    pthread_mutex_lock( &c->lock );
+    while((c->wanted_next < c->wanted_count || c->busy)
+          && c->loaded_count < c->max_tiles) {
+        pthread_cond_wait( &c->idle, &c->lock );
+    }
+    pthread_mutex_unlock( &c->lock );
+}
+
+void
+tile_cache_stats(tileCache * const c, tileCacheStats * const s) {
+    s->hits = c->hits;
+    s->misses = c->misses;
+    s->evictions = c->evictions;
+    s->resident_tiles = c->resident;
+    s->resident_bytes = c->resident * c->tile_bytes;
+    s->budget_bytes = c->budget;
+
+    pthread_mutex_lock( &c->lock );
+    s->loads = c->loads;
+    s->failures = c->failures;
+    s->queued = c->wanted_count - c->wanted_next + c->busy;
+    pthread_mutex_unlock( &c->lock );
+}
@@ -0,0 +1,38 @@
+/**
+ * tilecache.h
+ */
+#ifndef TILECACHE_H
+#define TILECACHE_H
+#include <stddef.h>
+#include "pyramid.h"
+
+typedef struct {
+    GLuint level;
+    GLuint x;
+    GLuint z;
+} tileKey;
+
+typedef struct {
+    size_t hits;                // Lookups that found their tile
+    size_t misses;
+    size_t loads;               // Tiles read by the I/O thread
+    size_t failures;            // Tiles that could not be read
+    size_t evictions;
+    size_t resident_tiles;
+    size_t resident_bytes;
+    size_t budget_bytes;
+    size_t queued;              // Wanted tiles not read yet
+} tileCacheStats;
+
+typedef struct tileCache tileCache;
+
+tileCache* tile_cache_create(pyramid const * const file, size_t budget);
+void tile_cache_destroy(tileCache * const c);
+GLfloat const * tile_cache_get(tileCache * const c, tileKey key);
+GLfloat const * tile_cache_peek(tileCache const * const c, tileKey key);
+void tile_cache_want(tileCache * const c, tileKey const * const keys,
+                     size_t count);
+unsigned int tile_cache_update(tileCache * const c);
+void tile_cache_wait(tileCache * const c);
+void tile_cache_stats(tileCache * const c, tileCacheStats * const s);
+#endif
@@ -0,0 +1,206 @@
+/**
+ * trace.c
+ *
+ * Each thread records its events into its own ring, allocated on its
+ * first event, so recording takes no lock. Spans are stored as one
+ * complete event when they end, so a ring that wrapped never holds half a
+ * span. The rings are written out by an atexit() handler; threads still
+ * running then are expected to be idle.
+ */
+#ifdef TRACE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "trace.h"
+
+typedef struct {
+    char const * name;
+    uint64_t time;              // Nanoseconds since trace_init()
+    uint64_t duration;          // Of spans
+    double value;               // Of counters
+    char phase;                 // 'X' for a span, 'C' for a counter
+} traceEvent;
+
+typedef struct traceRing {
+    traceEvent events[TRACE_RING_EVENTS];
+    uint64_t written;           // Events ever recorded, wraps the ring
+    unsigned int thread;
+    struct traceRing* next;
+} traceRing;
+
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static traceRing* rings = NULL;
+static unsigned int thread_count = 0;
+static uint64_t origin = 0;
+static __thread traceRing* own_ring = NULL;
+
+static size_t tallies[TRACE_TALLIES];
+static char const * const tally_names[TRACE_TALLIES] = {
+    "draw calls", "vertices", "upload bytes"
+};
+
+static uint64_t
+now() {
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return (uint64_t) t.tv_sec * 1000000000u + t.tv_nsec - origin;
+}
+
+/**
+ *  The next event of the calling thread's ring
+ *  @return NULL if the ring can't be allocated
+ */
+static traceEvent*
+next_event() {
+    traceRing* r = own_ring;
+    if(r == NULL) {
+        r = calloc(1, sizeof(*r));
+        if(r == NULL) {
+            return NULL;
+        }
+        pthread_mutex_lock( &rings_lock );
+        r->thread = thread_count++;
+        r->next = rings;
+        rings = r;
+        pthread_mutex_unlock( &rings_lock );
+        own_ring = r;
+    }
+    return &r->events[r->written % TRACE_RING_EVENTS];
+}
+
+/**
+ *  Publish the event returned by next_event()
+ */
+static void
+commit_event() {
+    __atomic_store_n( &own_ring->written, own_ring->written + 1,
+                      __ATOMIC_RELEASE );
+}
+
+static void
+write_event(FILE * const out, traceEvent const * const e,
+            unsigned int thread, int first) {
+    fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+                 "\"pid\":1,\"tid\":%u", first ? "" : ",", e->name, e->phase,
+            e->time / 1e3, thread);
+    if(e->phase == 'X') {
+        fprintf(out, ",\"dur\":%.3f}", e->duration / 1e3);
+    }else {
+        fprintf(out, ",\"args\":{\"value\":%.17g}}", e->value);
+    }
+}
+
+/**
+ *  Write every ring as trace_event JSON
+ */
+static void
+trace_write() {
+    char const * const path = getenv("TERRAIN_TRACE") != NULL
+                              ? getenv("TERRAIN_TRACE") : TRACE_DEFAULT_FILE;
+    FILE* const out = fopen(path, "w");
+    if(out == NULL) {
+        fprintf(stderr, "Unable to write trace: %s\n", path);
+        return;
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    pthread_mutex_lock( &rings_lock );
+    size_t events = 0;
+    int first = 1;
+    traceRing const * r;
+    for(r = rings; r != NULL; r = r->next) {
+        fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                     "\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}",
+                first ? "" : ",", r->thread,
+                r->thread == 0 ? "main" : "thread", r->thread);
+        first = 0;
+
+        uint64_t const written = __atomic_load_n( &r->written,
+                                                  __ATOMIC_ACQUIRE );
+        uint64_t const oldest = written > TRACE_RING_EVENTS
+                                ? written - TRACE_RING_EVENTS : 0;
+        uint64_t i;
+        for(i = oldest; i < written; i++) {
+            write_event( out, &r->events[i % TRACE_RING_EVENTS], r->thread,
+                         0 );
+        }
+        events += written - oldest;
+    }
+    pthread_mutex_unlock( &rings_lock );
+    fprintf(out, "\n]}\n");
+    if(fclose(out) == 0) {
+        printf("Wrote %zu trace events to %s\n", events, path);
+    }
+}
+
+/**
+ *  Start the clock and write the trace on exit. Called from the main
+ *  thread before any other event, so it gets thread 0.
+ */
+void
+trace_init() {
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    origin = (uint64_t) t.tv_sec * 1000000000u + t.tv_nsec;
+    if(next_event() != NULL) {
+        atexit( trace_write );
+    }
+}
+
+traceSpan
+trace_span_begin(char const * const name) {
+    traceSpan span;
+    span.name = name;
+    span.start = now();
+    return span;
+}
+
+void
+trace_span_end(traceSpan const * const span) {
+    uint64_t const end = now();
+    traceEvent* const e = next_event();
+    if(e == NULL) {
+        return;
+    }
+    e->name = span->name;
+    e->time = span->start;
+    e->duration = end - span->start;
+    e->phase = 'X';
+    commit_event();
+}
+
+void
+trace_counter(char const * const name, double value) {
+    traceEvent* const e = next_event();
+    if(e == NULL) {
+        return;
+    }
+    e->name = name;
+    e->time = now();
+    e->value = value;
+    e->phase = 'C';
+    commit_event();
+}
+
+/**
+ *  Add to a counter of the current frame, from any thread
+ */
+void
+trace_tally(traceTally tally, size_t amount) {
+    __atomic_fetch_add( &tallies[tally], amount, __ATOMIC_RELAXED );
+}
+
+/**
+ *  Emit the counters of the frame that just ended and reset them
+ */
+void
+trace_frame_counters() {
+    unsigned int i;
+    for(i = 0; i < TRACE_TALLIES; i++) {
+        size_t const value = __atomic_exchange_n( &tallies[i], 0,
+                                                  __ATOMIC_RELAXED );
+        trace_counter( tally_names[i], value );
+    }
+}
+#endif
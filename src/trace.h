@@ -0,0 +1,59 @@
+/**
+ * trace.h
+ *
+ * Spans and counters written as Chrome trace_event JSON on exit, for
+ * chrome://tracing or Perfetto. Only compiled in with "make TRACE=1";
+ * otherwise every macro expands to nothing.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+#include <stddef.h>
+#include <stdint.h>
+
+// Events each thread keeps, the oldest are overwritten past this
+#define TRACE_RING_EVENTS   65536
+
+// Where the trace is written unless TERRAIN_TRACE names a file
+#define TRACE_DEFAULT_FILE  "trace.json"
+
+// Counted over a frame and emitted by TRACE_FRAME_COUNTERS()
+typedef enum {
+    TRACE_DRAW_CALLS,
+    TRACE_VERTICES,             // Vertices or indices sent to draw calls
+    TRACE_UPLOAD_BYTES,         // Given to glBufferData/glBufferSubData
+    TRACE_TALLIES
+} traceTally;
+
+// A span open on the stack
+typedef struct {
+    char const * name;          // A string literal
+    uint64_t start;             // Nanoseconds
+} traceSpan;
+
+#ifdef TRACE
+void trace_init();
+traceSpan trace_span_begin(char const * const name);
+void trace_span_end(traceSpan const * const span);
+void trace_counter(char const * const name, double value);
+void trace_tally(traceTally tally, size_t amount);
+void trace_frame_counters();
+
+// Spans end with the block they're declared in
+#  define TRACE_CONCAT_(a, b)   a ## b
+#  define TRACE_CONCAT(a, b)    TRACE_CONCAT_(a, b)
+#  define TRACE_SPAN(name) \
+       traceSpan const TRACE_CONCAT(trace_span_, __LINE__) \
+           __attribute__ ((cleanup (trace_span_end))) \
+           = trace_span_begin(name)
+#  define TRACE_INIT()                  trace_init()
+#  define TRACE_COUNTER(name, value)    trace_counter(name, value)
+#  define TRACE_TALLY(tally, amount)    trace_tally(tally, amount)
+#  define TRACE_FRAME_COUNTERS()        trace_frame_counters()
+#else
+#  define TRACE_SPAN(name)
+#  define TRACE_INIT()
+#  define TRACE_COUNTER(name, value)
+#  define TRACE_TALLY(tally, amount)
+#  define TRACE_FRAME_COUNTERS()
+#endif
+#endif
@@ -0,0 +1,92 @@
+/**
+ * update.c
+ *
+ * Changes a rectangle of the map's heights in place. The heights go into
+ * the grid kept for picking, the height pyramid is refreshed over them,
+ * and only the vertices made from the rectangle and its neighbours, whose
+ * normals it changes, are rebuilt and uploaded with glBufferSubData().
+ * The work grows with the size of the rectangle, not of the map.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "update.h"
+#include "heightmap.h"
+#include "mesh.h"
+#include "trace.h"
+
+/**
+ *  Start patching the vertex buffer of a strip, indexed or triangle mesh
+ *  @param[in] vertex_buffer  The buffer, positions followed by normals
+ *  @param[in] normal_offset  Bytes of positions
+ *  @param[in] program  The shader program drawing the mesh
+ *  @param[in] normals  How the normals were computed
+ *  @return The updater, for the lifetime of the program
+ */
+terrainUpdater*
+update_create(GLuint vertex_buffer, size_t normal_offset, GLuint program,
+              normalMode normals) {
+    terrainUpdater* const u = malloc(sizeof(*u));
+    if(u == NULL) {
+        fprintf(stderr, "Unable to allocate the updater\n");
+        exit(1);
+    }
+    u->vertex_buffer = vertex_buffer;
+    u->normal_offset = normal_offset;
+    u->max_elevation_pos = glGetUniformLocation( program, "max_elevation" );
+    u->normals = normals;
+    return u;
+}
+
+/**
+ *  Replace a rectangle of heights and patch the vertices they change. The
+ *  lowest elevation stays where it was, so the rest of the vertices keep
+ *  their place; a new highest one recolours the gradient.
+ *  @param[out] s  What was written and uploaded
+ *  @param[in] u  The updater
+ *  @param[in,out] w  The world, whose heights are changed
+ *  @param[in] rect  The samples to replace, inside the map
+ *  @param[in] heights  Their new heights, row-major
+ */
+void
+update_heights(updateStats * const s, terrainUpdater const * const u,
+               worldData * const w, gridRect const * const rect,
+               GLfloat const * const heights) {
+    TRACE_SPAN("update heights");
+    mapData* const mData = &w->heights->map;
+    GLuint const width = rect->x1 - rect->x0;
+    GLuint x, z;
+    for(z = rect->z0; z < rect->z1; z++) {
+        GLfloat const * const row = heights + (size_t) (z - rect->z0) * width;
+        grid_write_row( &mData->elevation, z, rect->x0, width, row );
+        for(x = 0; x < width; x++) {
+            if(row[x] > mData->maxElevation) {
+                mData->maxElevation = row[x];
+                glUniform1f( u->max_elevation_pos, mData->yScale
+                             * (mData->maxElevation - mData->minElevation) );
+            }
+        }
+    }
+    heightmap_update( w->heights, rect->x0, rect->z0, rect->x1, rect->z1 );
+
+    meshPatch p;
+    mesh_build_patch( &p, mData, w->mesh, u->normals, rect );
+
+    glBindBuffer( GL_ARRAY_BUFFER, u->vertex_buffer );
+    size_t i, offset = 0;
+    for(i = 0; i < p.num_ranges; i++) {
+        meshRange const * const r = &p.ranges[i];
+        glBufferSubData( GL_ARRAY_BUFFER, r->first * sizeof(vec4),
+                         r->count * sizeof(vec4), p.vertices + offset );
+        glBufferSubData( GL_ARRAY_BUFFER,
+                         u->normal_offset + r->first * sizeof(vec3),
+                         r->count * sizeof(vec3), p.normals + offset );
+        offset += r->count;
+    }
+
+    s->samples = (size_t) width * (rect->z1 - rect->z0);
+    s->vertices = p.num_vertices;
+    s->ranges = p.num_ranges;
+    s->bytes = p.num_vertices * (sizeof(vec4) + sizeof(vec3));
+    TRACE_TALLY(TRACE_UPLOAD_BYTES, s->bytes);
+    mesh_patch_free( &p );
+}
@@ -0,0 +1,29 @@
+/**
+ * update.h
+ */
+#ifndef UPDATE_H
+#define UPDATE_H
+#include "terrain.h"
+
+// Where the vertices of the map are on the GPU, so a rectangle of new
+// heights can be patched in without rebuilding the rest
+struct terrainUpdater {
+    GLuint vertex_buffer;
+    size_t normal_offset;       // Bytes of positions before the normals
+    GLint max_elevation_pos;
+    normalMode normals;
+};
+
+typedef struct {
+    size_t samples;             // Heights written
+    size_t vertices;            // Vertices and normals uploaded
+    size_t ranges;              // glBufferSubData() calls for each
+    size_t bytes;
+} updateStats;
+
+terrainUpdater* update_create(GLuint vertex_buffer, size_t normal_offset,
+                              GLuint program, normalMode normals);
+void update_heights(updateStats * const s, terrainUpdater const * const u,
+                    worldData * const w, gridRect const * const rect,
+                    GLfloat const * const heights);
+#endif
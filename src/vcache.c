@@ -0,0 +1,186 @@
+/**
+ * vcache.c
+ *
+ * Orders the indices of the indexed layouts for the GPU's post-transform
+ * vertex cache, and simulates that cache so any order can be measured
+ * without a GPU. Walking whole rows of a wide map, the vertices a row
+ * shares with the next have been evicted long before they are used again,
+ * so every vertex is transformed twice. Cutting the map into stripes a
+ * few quads across, walked top to bottom one after another, keeps the
+ * shared row in the cache and transforms most vertices once.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vcache.h"
+
+// Marks vertices the simulation hasn't seen
+#define VCACHE_UNSEEN SIZE_MAX
+
+/**
+ *  Quads across a stripe, the whole row if stripe is 0
+ */
+static GLuint
+stripe_quads(GLuint width, GLuint stripe) {
+    return (stripe == 0 || stripe > width - 1) ? width - 1 : stripe;
+}
+
+/**
+ *  Number of indices in an indexed layout
+ *  @param[in] mode  MESH_INDEXED or MESH_TRIANGLES
+ *  @param[in] width  The number of samples in a row
+ *  @param[in] height  The number of rows
+ *  @param[in] stripe  Quads across each stripe, 0 for whole rows
+ */
+size_t
+vcache_index_count(meshMode mode, GLuint width, GLuint height,
+                   GLuint stripe) {
+    if(mode == MESH_INDEXED) {
+        // One strip per row of each stripe, separated by restart indices
+        GLuint const quads = stripe_quads(width, stripe);
+        GLuint const stripes = (width - 1 + quads - 1) / quads;
+        return (size_t) (height - 1) * (2 * (width - 1) + 3 * stripes) - 1;
+    }else if(mode == MESH_TRIANGLES) {
+        return (size_t) (height - 1) * (width - 1) * 6;
+    }
+    return 0;
+}
+
+/**
+ *  Index rows z_begin to z_end of quads of every stripe. Each row of a
+ *  stripe is either a strip followed by a restart index, or two triangles
+ *  per quad. Like the serpentine strip, odd rows run right to left so the
+ *  quads are split along the same diagonals whatever the layout and
+ *  stripe width.
+ *  @param[out] indices  All the indices, vcache_index_count() long
+ *  @param[in] mode  MESH_INDEXED or MESH_TRIANGLES
+ *  @param[in] width  The number of samples in a row
+ *  @param[in] height  The number of rows
+ *  @param[in] stripe  Quads across each stripe, 0 for whole rows
+ *  @param[in] z_begin  The first row of quads to index
+ *  @param[in] z_end  One past the last
+ */
+void
+vcache_index_rows(GLuint * const indices, meshMode mode,
+                  GLuint width, GLuint height, GLuint stripe,
+                  GLuint z_begin, GLuint z_end) {
+    GLuint const quads = stripe_quads(width, stripe);
+    GLuint const rows = height - 1;
+
+    GLuint x0, x, z;
+    for(x0 = 0; x0 < width - 1; x0 += quads) {
+        GLuint const x1 = (x0 + quads < width - 1) ? x0 + quads : width - 1;
+        GLuint const n = x1 - x0;
+        int const last_stripe = (x1 == width - 1);
+
+        for(z = z_begin; z < z_end; z++) {
+            GLuint const top = z * width;
+            GLuint const bottom = top + width;
+
+            if(mode == MESH_INDEXED) {
+                size_t const before = (size_t) rows
+                                      * (2 * x0 + 3 * (x0 / quads));
+                GLuint* out = indices + before + (size_t) z * (2 * n + 3);
+                for(x = 0; x <= n; x++) {
+                    GLuint const column = (z % 2 == 0) ? x0 + x : x1 - x;
+                    *out++ = top + column;
+                    *out++ = bottom + column;
+                }
+                if(!last_stripe || z + 1 < rows) {
+                    *out = VCACHE_RESTART_INDEX;
+                }
+            }else {
+                size_t const before = (size_t) rows * x0 * 6;
+                GLuint* out = indices + before + (size_t) z * n * 6;
+                for(x = 0; x < n; x++) {
+                    // The quad between columns c0 and c1, in strip order
+                    GLuint const c0 = (z % 2 == 0) ? x0 + x : x1 - x;
+                    GLuint const c1 = (z % 2 == 0) ? c0 + 1 : c0 - 1;
+                    *out++ = top + c0;
+                    *out++ = bottom + c0;
+                    *out++ = top + c1;
+                    *out++ = top + c1;
+                    *out++ = bottom + c0;
+                    *out++ = bottom + c1;
+                }
+            }
+        }
+    }
+}
+
+/**
+ *  Run indices through a simulated post-transform cache, counting the
+ *  vertices it would have to transform
+ *  @param[out] s  The references, misses and their ratios
+ *  @param[in] indices  The indices
+ *  @param[in] count  Their number
+ *  @param[in] mode  MESH_INDEXED for strips separated by restart indices,
+ *                   anything else for a list of triangles
+ *  @param[in] num_vertices  One more than the largest index
+ *  @param[in] size  Entries in the cache
+ *  @param[in] policy  Which entry a miss evicts
+ */
+void
+vcache_simulate(vcacheStats * const s, GLuint const * const indices,
+                size_t count, meshMode mode, size_t num_vertices,
+                unsigned int size, vcachePolicy policy) {
+    // The miss each vertex was last loaded on, for the FIFO
+    size_t* const loaded = malloc(num_vertices * sizeof(*loaded));
+    GLuint* const lru = malloc(size * sizeof(*lru));
+    if(loaded == NULL || lru == NULL) {
+        fprintf(stderr, "Unable to allocate the cache simulation\n");
+        exit(1);
+    }
+    size_t i;
+    for(i = 0; i < num_vertices; i++) {
+        loaded[i] = VCACHE_UNSEEN;
+    }
+    unsigned int used = 0;
+
+    memset( s, 0, sizeof(*s) );
+    size_t strip_length = 0;
+    for(i = 0; i < count; i++) {
+        GLuint const v = indices[i];
+        if(mode == MESH_INDEXED && v == VCACHE_RESTART_INDEX) {
+            strip_length = 0;
+            continue;
+        }
+        s->references++;
+        strip_length++;
+        if(mode == MESH_INDEXED ? strip_length >= 3 : strip_length % 3 == 0) {
+            s->triangles++;
+        }
+
+        if(loaded[v] == VCACHE_UNSEEN) {
+            s->vertices++;
+        }
+        if(policy == VCACHE_FIFO) {
+            if(loaded[v] == VCACHE_UNSEEN || s->misses - loaded[v] > size) {
+                loaded[v] = s->misses++;
+            }
+            continue;
+        }
+
+        // Move to the front, evicting the back on a miss
+        unsigned int j = 0;
+        while(j < used && lru[j] != v) {
+            j++;
+        }
+        if(j == used) {
+            s->misses++;
+            loaded[v] = 0;
+            if(used < size) {
+                used++;
+            }
+            j = used - 1;
+        }
+        memmove( lru + 1, lru, j * sizeof(*lru) );
+        lru[0] = v;
+    }
+
+    s->acmr = s->triangles > 0 ? (double) s->misses / s->triangles : 0.0;
+    s->atvr = s->vertices > 0 ? (double) s->misses / s->vertices : 0.0;
+    free( lru );
+    free( loaded );
+}
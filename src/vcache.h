@@ -0,0 +1,43 @@
+/**
+ * vcache.h
+ */
+#ifndef VCACHE_H
+#define VCACHE_H
+#include <stddef.h>
+#include "terrain.h"
+
+// Separates the strips of MESH_INDEXED
+#define VCACHE_RESTART_INDEX 0xFFFFFFFFu
+
+// Entries of the post-transform cache the index order is tuned for
+#define VCACHE_SIZE          32
+
+// Quads across each stripe of the indexed layouts, so the vertices shared
+// with the next row of the stripe are still cached when it reaches them.
+// A row of n quads loads n + 1 vertices; a FIFO keeps them for two rows,
+// an LRU cache, which hits also refresh, needs room for about three.
+#define VCACHE_STRIPE_QUADS  ((VCACHE_SIZE - 1) / 3)
+
+typedef enum {
+    VCACHE_FIFO,        // Hits leave the order alone, as in most GPUs
+    VCACHE_LRU          // Hits move a vertex to the front
+} vcachePolicy;
+
+typedef struct {
+    size_t references;      // Indices, not counting restarts
+    size_t misses;          // Vertices transformed
+    size_t triangles;
+    size_t vertices;        // Distinct vertices referenced
+    double acmr;            // Misses per triangle, 0.5 at best on a grid
+    double atvr;            // Misses per distinct vertex, 1 at best
+} vcacheStats;
+
+size_t vcache_index_count(meshMode mode, GLuint width, GLuint height,
+                          GLuint stripe);
+void vcache_index_rows(GLuint * const indices, meshMode mode,
+                       GLuint width, GLuint height, GLuint stripe,
+                       GLuint z_begin, GLuint z_end);
+void vcache_simulate(vcacheStats * const s, GLuint const * const indices,
+                     size_t count, meshMode mode, size_t num_vertices,
+                     unsigned int size, vcachePolicy policy);
+#endif
@@ -0,0 +1,267 @@
+/**
+ * watch.c
+ *
+ * Follows the elevation file as it is rewritten. inotify reports writes
+ * to the file, and renames over it, through a watch on its directory;
+ * once the file has been left alone for WATCH_SETTLE_MS it is read again
+ * on the watcher's thread and compared with the version before, band of
+ * rows by band of rows. The heights of the bands that changed are queued
+ * for the display, which patches them in with update_heights(), so the
+ * GPU only sees work in proportion to the edit.
+ */
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "watch.h"
+#include "init.h"
+#include "update.h"
+#include "trace.h"
+
+static double
+seconds_since(struct timespec const * const start) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ *  Wait for events on the directory until one is about the file
+ */
+static void
+wait_for_file(fileWatch const * const f) {
+    char buffer[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    for(;;) {
+        ssize_t const length = read(f->fd, buffer, sizeof(buffer));
+        if(length <= 0) {
+            perror( "Unable to watch the elevation file" );
+            exit(1);
+        }
+        char const * p = buffer;
+        while(p < buffer + length) {
+            struct inotify_event const * const e
+                = (struct inotify_event const *) p;
+            if(e->len > 0 && strcmp(e->name, f->name) == 0) {
+                return;
+            }
+            p += sizeof(*e) + e->len;
+        }
+    }
+}
+
+/**
+ *  Drop events until the directory has been quiet for WATCH_SETTLE_MS
+ */
+static void
+settle(fileWatch const * const f) {
+    char buffer[4096]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd p;
+    p.fd = f->fd;
+    p.events = POLLIN;
+    while(poll(&p, 1, WATCH_SETTLE_MS) > 0) {
+        if(read(f->fd, buffer, sizeof(buffer)) <= 0) {
+            return;
+        }
+    }
+}
+
+/**
+ *  Queue a change for the display
+ */
+static void
+push(fileWatch * const f, watchChange * const c) {
+    c->next = __atomic_load_n(&f->ready, __ATOMIC_ACQUIRE);
+    while(!__atomic_compare_exchange_n(&f->ready, &c->next, c, 0,
+                                       __ATOMIC_ACQ_REL,
+                                       __ATOMIC_ACQUIRE)) {
+    }
+}
+
+/**
+ *  Read the file again and queue the heights that differ from the last
+ *  version. A file that changed size can't be patched and is skipped.
+ */
+static void
+reload(fileWatch * const f) {
+    TRACE_SPAN("reload");
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    FILE* const file = fopen(f->opts.path, "r");
+    if(file == NULL) {
+        fprintf(stderr, "Unable to open file: %s\n", f->opts.path);
+        return;
+    }
+    mapData m;
+    load_file( &m, file, f->world, &f->opts );
+    if(m.mapWidth != f->last.mapWidth || m.mapHeight != f->last.mapHeight) {
+        fprintf(stderr, "%s is now %u x %u samples, restart to view it\n",
+                f->opts.path, m.mapWidth, m.mapHeight);
+        grid_free( &m.elevation );
+        return;
+    }
+
+    watchChange* const c = calloc(1, sizeof(*c));
+    c->load_seconds = seconds_since( &start );
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    c->rects = malloc((m.mapHeight + WATCH_BAND_ROWS - 1) / WATCH_BAND_ROWS
+                      * sizeof(*c->rects));
+    if(c->rects == NULL) {
+        fprintf(stderr, "Unable to allocate the changes\n");
+        exit(1);
+    }
+    c->count = grid_diff(c->rects, &f->last.elevation, &m.elevation,
+                         WATCH_BAND_ROWS);
+
+    size_t samples = 0, i;
+    for(i = 0; i < c->count; i++) {
+        samples += (size_t) (c->rects[i].x1 - c->rects[i].x0)
+                   * (c->rects[i].z1 - c->rects[i].z0);
+    }
+    c->heights = malloc(samples * sizeof(*c->heights) + 1);
+    if(c->heights == NULL) {
+        fprintf(stderr, "Unable to allocate %zu changed heights\n", samples);
+        exit(1);
+    }
+    GLfloat* out = c->heights;
+    for(i = 0; i < c->count; i++) {
+        gridRect const * const r = &c->rects[i];
+        GLuint z;
+        for(z = r->z0; z < r->z1; z++) {
+            grid_read_row( &m.elevation, z, r->x0, r->x1 - r->x0, out );
+            out += r->x1 - r->x0;
+        }
+    }
+    c->diff_seconds = seconds_since( &start );
+
+    grid_free( &f->last.elevation );
+    f->last.elevation = m.elevation;
+    push( f, c );
+}
+
+static void*
+watch_thread(void * const arg) {
+    fileWatch* const f = arg;
+    for(;;) {
+        wait_for_file( f );
+        settle( f );
+        reload( f );
+    }
+    return NULL;
+}
+
+/**
+ *  Start watching the elevation file for changes
+ *  @param[in] mData  The map as loaded, copied to compare the next version
+ *                    with
+ *  @param[in] w  The world, whose pool the watcher shares
+ *  @param[in] opts  The command line options, naming the file
+ *  @return The watcher, for the lifetime of the program
+ */
+fileWatch*
+watch_start(mapData const * const mData, worldData const * const w,
+            optionsData const * const opts) {
+    fileWatch* const f = calloc(1, sizeof(*f));
+    f->opts = *opts;
+    f->opts.use_cache = 0;
+    f->world = w;
+
+    // Editors often write a new file and rename it over the old one, so
+    // the directory is watched rather than the file
+    char const * const slash = strrchr(opts->path, '/');
+    if(slash != NULL) {
+        f->directory = strndup(opts->path, slash - opts->path + 1);
+        f->name = slash + 1;
+    }else {
+        f->directory = strdup(".");
+        f->name = opts->path;
+    }
+    f->fd = inotify_init1(IN_CLOEXEC);
+    if(f->fd < 0 || inotify_add_watch(f->fd, f->directory,
+                                      IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        perror( "Unable to watch the elevation file" );
+        exit(1);
+    }
+
+    f->last = *mData;
+    if(!grid_init( &f->last.elevation, mData->mapWidth, mData->mapHeight,
+                   mData->elevation.layout )) {
+        fprintf(stderr, "Unable to allocate %u x %u elevation samples\n",
+                mData->mapWidth, mData->mapHeight);
+        exit(1);
+    }
+    GLfloat* const row = malloc(mData->mapWidth * sizeof(*row));
+    GLuint z;
+    for(z = 0; z < mData->mapHeight; z++) {
+        grid_read_row( &mData->elevation, z, 0, mData->mapWidth, row );
+        grid_write_row( &f->last.elevation, z, 0, mData->mapWidth, row );
+    }
+    free( row );
+
+    if(pthread_create( &f->thread, NULL, watch_thread, f ) != 0) {
+        fprintf(stderr, "Unable to start the watcher thread\n");
+        exit(1);
+    }
+    pthread_detach( f->thread );
+    printf("Watching %s for changes\n", opts->path);
+    return f;
+}
+
+/**
+ *  Take every change queued, without waiting
+ *  @return The oldest change, the rest following through next, or NULL
+ */
+watchChange*
+watch_take(fileWatch * const f) {
+    watchChange* c = __atomic_exchange_n(&f->ready, NULL, __ATOMIC_ACQ_REL);
+
+    // Queued newest first
+    watchChange* oldest = NULL;
+    while(c != NULL) {
+        watchChange* const next = c->next;
+        c->next = oldest;
+        oldest = c;
+        c = next;
+    }
+    return oldest;
+}
+
+/**
+ *  Patch the heights of a change into the map drawn, and report the cost
+ *  @param[in] c  The change
+ *  @param[in,out] w  The world
+ */
+void
+watch_apply(watchChange const * const c, worldData * const w) {
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    updateStats total;
+    memset( &total, 0, sizeof(total) );
+    GLfloat const * heights = c->heights;
+    size_t i;
+    for(i = 0; i < c->count; i++) {
+        updateStats s;
+        update_heights( &s, w->updater, w, &c->rects[i], heights );
+        heights += s.samples;
+        total.samples += s.samples;
+        total.vertices += s.vertices;
+        total.ranges += s.ranges;
+        total.bytes += s.bytes;
+    }
+    printf("Updated %zu samples in %zu rectangles: read in %.3f s, compared "
+           "in %.3f s, %zu vertices (%.1f KB in %zu ranges) patched in "
+           "%.3f s\n", total.samples, c->count, c->load_seconds,
+           c->diff_seconds, total.vertices, total.bytes / 1e3, total.ranges,
+           seconds_since( &start ));
+}
+
+void
+watch_change_free(watchChange * const c) {
+    free( c->heights );
+    free( c->rects );
+    free( c );
+}
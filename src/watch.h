@@ -0,0 +1,51 @@
+/**
+ * watch.h
+ */
+#ifndef WATCH_H
+#define WATCH_H
+#include <pthread.h>
+#include "terrain.h"
+
+// Milliseconds between the display's checks for changes
+#define WATCH_POLL_MS       100
+
+// Milliseconds the file has to be left alone before it is read again, so
+// a writer's bursts of writes are read once
+#define WATCH_SETTLE_MS     200
+
+// Rows of the map compared as one band; each band with changes is updated
+// as one rectangle
+#define WATCH_BAND_ROWS     64
+
+// Heights that changed since the file was last read
+typedef struct watchChange {
+    gridRect* rects;
+    size_t count;
+    GLfloat* heights;           // Of every rectangle, one after another
+    double load_seconds;        // Reading the file again
+    double diff_seconds;        // Comparing it with the last version
+    struct watchChange* next;   // An older change, while queued
+} watchChange;
+
+// Reads the elevation file again whenever it is written, on a thread of
+// its own, and queues the heights that changed for the display
+struct fileWatch {
+    optionsData opts;
+    worldData const * world;    // Only its cube size and pool are used
+    int fd;                     // inotify, watching the file's directory
+    char* directory;
+    char const * name;          // Of the file in the directory
+    mapData last;               // The file as last read
+    pthread_t thread;
+
+    // Pushed by the watcher and taken all at once by the display
+    watchChange* ready;
+};
+
+fileWatch* watch_start(mapData const * const mData,
+                       worldData const * const w,
+                       optionsData const * const opts);
+watchChange* watch_take(fileWatch * const f);
+void watch_apply(watchChange const * const c, worldData * const w);
+void watch_change_free(watchChange * const c);
+#endif
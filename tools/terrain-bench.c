@@ -0,0 +1,1788 @@
+/**
+ * terrain-bench.c
+ *
+ * Microbenchmarks for the data structures behind the viewer. Run with the
+ * names of the benchmarks to run, or none to run them all. Benchmarks also
+ * check their results, and the run exits with status 1 if any check failed.
+ */
+#include <float.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "grid.h"
+#include "compact.h"
+#include "lod.h"
+#include "camera.h"
+#include "frustum.h"
+#include "rtin.h"
+#include "pyramid.h"
+#include "tilecache.h"
+#include "horizon.h"
+#include "heightmap.h"
+#include "vcache.h"
+#include "mesh.h"
+#include "normals.h"
+#include "parse.h"
+
+typedef struct {
+    GLuint size;        // Width and height of the benchmark grid
+} benchOptions;
+
+typedef struct {
+    char const * name;
+    void (*run)(benchOptions const * const opts);
+} benchmark;
+
+// Checks that failed so far
+static unsigned int failures;
+
+/**
+ *  Count a check and say so if it failed
+ *  @param[in] passed  Whether the check passed
+ *  @param[in] format  What failed, printf style
+ */
+static void
+check(int passed, char const * const format, ...) {
+    if(passed) {
+        return;
+    }
+    va_list args;
+    va_start( args, format );
+    fprintf(stderr, "FAILED: ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end( args );
+    failures++;
+}
+
+static double
+now() {
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/**
+ *  Fill a grid with smooth synthetic terrain, one row at a time
+ */
+static void
+fill_grid(elevationGrid * const g) {
+    GLfloat* const row = malloc(g->width * sizeof(*row));
+    GLuint x, z;
+    for(z = 0; z < g->height; z++) {
+        for(x = 0; x < g->width; x++) {
+            row[x] = (GLfloat) ((x * 7 + z * 13) % 1024) + (x ^ z) % 17;
+        }
+        grid_write_row( g, z, 0, g->width, row );
+    }
+    free( row );
+}
+
+/**
+ *  Sum the 3x3 neighbourhood of every interior sample, in row order
+ */
+static double
+sweep_stencil(elevationGrid const * const g) {
+    double sum = 0.0;
+    GLuint x, z;
+    for(z = 1; z < g->height - 1; z++) {
+        for(x = 1; x < g->width - 1; x++) {
+            sum += grid_get(g, x-1, z-1) + grid_get(g, x, z-1)
+                   + grid_get(g, x+1, z-1) + grid_get(g, x-1, z)
+                   + grid_get(g, x, z) + grid_get(g, x+1, z)
+                   + grid_get(g, x-1, z+1) + grid_get(g, x, z+1)
+                   + grid_get(g, x+1, z+1);
+        }
+    }
+    return sum;
+}
+
+/**
+ *  Visit samples in the order the serpentine strip does, looking at the
+ *  4-neighbourhood of each one like the per-vertex normal code
+ */
+static double
+sweep_strip(elevationGrid const * const g) {
+    double sum = 0.0;
+    GLuint x, z;
+    for(z = 1; z < g->height - 2; z++) {
+        for(x = 1; x < g->width - 1; x++) {
+            GLuint const sx = (z % 2 == 0) ? x : g->width - 1 - x;
+            GLuint k;
+            for(k = 0; k < 2; k++) {
+                GLuint const sz = z + k;
+                sum += grid_get(g, sx, sz) + grid_get(g, sx-1, sz)
+                       + grid_get(g, sx+1, sz) + grid_get(g, sx, sz-1)
+                       + grid_get(g, sx, sz+1);
+            }
+        }
+    }
+    return sum;
+}
+
+/**
+ *  Compare the row-major and tiled grid layouts
+ */
+static void
+bench_grid(benchOptions const * const opts) {
+    static struct {
+        char const * name;
+        gridLayout layout;
+    } const layouts[] = {
+        { "row",   GRID_ROW_MAJOR },
+        { "tiled", GRID_TILED }
+    };
+
+    double const samples = (double) opts->size * opts->size;
+    unsigned int i;
+    for(i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        elevationGrid g;
+        if(!grid_init( &g, opts->size, opts->size, layouts[i].layout )) {
+            fprintf(stderr, "Unable to allocate a %u x %u grid\n",
+                    opts->size, opts->size);
+            exit(1);
+        }
+        fill_grid( &g );
+
+        double start = now();
+        double const stencil = sweep_stencil(&g);
+        double const stencil_time = now() - start;
+
+        start = now();
+        double const strip = sweep_strip(&g);
+        double const strip_time = now() - start;
+
+        printf("grid %-6s %ux%u  stencil %7.3f s (%5.2f ns/sample)"
+               "  strip %7.3f s (%5.2f ns/sample)  [%g %g]\n",
+               layouts[i].name, opts->size, opts->size,
+               stencil_time, stencil_time * 1e9 / samples,
+               strip_time, strip_time * 1e9 / samples, stencil, strip);
+        grid_free( &g );
+    }
+}
+
+/**
+ *  Read three rows at a time and take central differences, like the fast
+ *  normals do
+ */
+static double
+sweep_rows(elevationGrid const * const g) {
+    GLfloat* const rows = malloc(3 * g->width * sizeof(*rows));
+    GLfloat* const above = rows;
+    GLfloat* const here = rows + g->width;
+    GLfloat* const below = rows + 2 * g->width;
+    double sum = 0.0;
+    GLuint x, z;
+    for(z = 1; z < g->height - 1; z++) {
+        grid_read_row( g, z - 1, 0, g->width, above );
+        grid_read_row( g, z, 0, g->width, here );
+        grid_read_row( g, z + 1, 0, g->width, below );
+        GLfloat row_sum = 0.0f;
+        for(x = 1; x < g->width - 1; x++) {
+            row_sum += (here[x + 1] - here[x - 1]) + (below[x] - above[x]);
+        }
+        sum += row_sum;
+    }
+    free( rows );
+    return sum;
+}
+
+/**
+ *  Compare float heights with 16 bit heights, on integer heights that
+ *  quantize exactly and on the same heights with a fraction added
+ */
+static void
+bench_quantize(benchOptions const * const opts) {
+    double const samples = (double) opts->size * opts->size;
+    unsigned int fractional;
+    for(fractional = 0; fractional < 2; fractional++) {
+        elevationGrid g;
+        if(!grid_init( &g, opts->size, opts->size, GRID_ROW_MAJOR )) {
+            fprintf(stderr, "Unable to allocate a %u x %u grid\n",
+                    opts->size, opts->size);
+            exit(1);
+        }
+        fill_grid( &g );
+        if(fractional) {
+            grid_set( &g, 0, 0, grid_get(&g, 0, 0) + 0.3f );
+        }
+
+        double start = now();
+        double const floats = sweep_rows(&g);
+        double const float_time = now() - start;
+        size_t const float_bytes = grid_bytes(&g);
+
+        GLfloat error;
+        start = now();
+        int const quantized = grid_quantize( &g, 0.01f, &error );
+        double const quantize_time = now() - start;
+        if(!quantized) {
+            fprintf(stderr, "Quantizing was off by %g\n", error);
+            exit(1);
+        }
+
+        start = now();
+        double const shorts = sweep_rows(&g);
+        double const short_time = now() - start;
+
+        printf("quantize %s %ux%u  step %g error %g in %.3f s  rows float "
+               "%5.2f ns/sample (%.0f MB)  16 bit %5.2f ns/sample (%.0f MB)"
+               "  [%g %g]\n", fractional ? "fraction" : "integer ",
+               opts->size, opts->size, g.qscale, error, quantize_time,
+               float_time * 1e9 / samples, float_bytes / 1e6,
+               short_time * 1e9 / samples, grid_bytes(&g) / 1e6,
+               floats, shorts);
+        if(fractional) {
+            // The central differences telescope along each row, so the
+            // sums stay far closer than the error of every sample
+            check( fabs(floats - shorts) <= error * samples,
+                   "quantize fraction sums %g and %g differ by more than "
+                   "%g x %.0f samples", floats, shorts, error, samples );
+        }else {
+            check( error == 0.0f && floats == shorts,
+                   "quantize integer error %g, sums %.9g and %.9g differ",
+                   error, floats, shorts );
+        }
+        grid_free( &g );
+    }
+}
+
+// Largest angle between a unit normal and its compact code, degrees
+#define COMPACT_NORMAL_ERROR    0.7
+
+/**
+ *  Measure the speed and the error of the compact vertex encoders on
+ *  random normals and heights, and check both stay within their bounds
+ */
+static void
+bench_compact(benchOptions const * const opts) {
+    size_t const count = (size_t) opts->size * 64;
+    vec3* const normals = malloc(count * sizeof(*normals));
+    GLubyte* const codes = malloc(2 * count * sizeof(*codes));
+
+    // Uniform directions over the sphere
+    srand( 1 );
+    size_t i;
+    for(i = 0; i < count; i++) {
+        GLfloat const y = 2.0f * rand() / RAND_MAX - 1.0f;
+        GLfloat const phi = 2.0f * M_PI * rand() / RAND_MAX;
+        GLfloat const r = sqrtf(1.0f - y * y);
+        vec3_init( &normals[i], r * cosf(phi), y, r * sinf(phi) );
+    }
+
+    double const start = now();
+    for(i = 0; i < count; i++) {
+        compact_encode_normal( &codes[2 * i], &normals[i] );
+    }
+    double const encode_time = now() - start;
+
+    double max_error = 0.0, sum_error = 0.0;
+    for(i = 0; i < count; i++) {
+        vec3 decoded;
+        compact_decode_normal( &decoded, &codes[2 * i] );
+        double d = decoded.x * normals[i].x + decoded.y * normals[i].y
+                   + decoded.z * normals[i].z;
+        d = d > 1.0 ? 1.0 : d;
+        double const error = acos(d) * 180.0 / M_PI;
+        max_error = error > max_error ? error : max_error;
+        sum_error += error;
+    }
+
+    printf("compact normals %zu  encode %5.2f ns/normal  "
+           "error max %.3f mean %.3f degrees\n",
+           count, encode_time * 1e9 / count, max_error, sum_error / count);
+    check( max_error <= COMPACT_NORMAL_ERROR, "compact normals are off by "
+           "up to %.3f degrees, more than %g", max_error,
+           COMPACT_NORMAL_ERROR );
+
+    // The axes, and zeros of either sign, are coded exactly
+    static GLfloat const axes[][3] = {
+        {  1.0f,  0.0f,  0.0f }, { -1.0f,  0.0f,  0.0f },
+        {  0.0f,  1.0f,  0.0f }, {  0.0f, -1.0f,  0.0f },
+        {  0.0f,  0.0f,  1.0f }, {  0.0f,  0.0f, -1.0f },
+        { -0.0f,  1.0f, -0.0f }, { -0.0f, -1.0f, -0.0f },
+        {  1.0f, -0.0f, -0.0f }, { -0.0f, -0.0f, -1.0f }
+    };
+    for(i = 0; i < sizeof(axes) / sizeof(axes[0]); i++) {
+        vec3 axis, decoded;
+        GLubyte code[2];
+        vec3_init( &axis, axes[i][0], axes[i][1], axes[i][2] );
+        compact_encode_normal( code, &axis );
+        compact_decode_normal( &decoded, code );
+        check( decoded.x == axis.x && decoded.y == axis.y
+               && decoded.z == axis.z, "compact normal (%g, %g, %g) decodes "
+               "as (%g, %g, %g)", axis.x, axis.y, axis.z, decoded.x,
+               decoded.y, decoded.z );
+    }
+
+    // Heights over the range of Earth's elevations: random ones, then
+    // evenly spaced ones from the lowest to the highest
+    heightQuantizer q;
+    compact_init_quantizer( &q, -430.0f, 8848.0f );
+    double max_height_error = 0.0;
+    for(i = 0; i < 2 * count + 1; i++) {
+        GLfloat const h = i < count
+                          ? -430.0f + 9278.0f * rand() / RAND_MAX
+                          : -430.0f + 9278.0f * (i - count) / count;
+        double const error = fabs(compact_dequantize(&q, 
+                                                     compact_quantize(&q, h)) 
+                                  - h);
+        max_height_error = error > max_height_error ? error : max_height_error;
+    }
+    printf("compact heights step %.4f  error max %.4f\n",
+           q.step, max_height_error);
+    // Half a step, and the rounding of float elevations near the top
+    double const height_bound = q.step / 2.0 + 8848.0 * FLT_EPSILON;
+    check( max_height_error <= height_bound, "compact heights are off by "
+           "up to %g, more than half a step", max_height_error );
+
+    free( codes );
+    free( normals );
+}
+
+/**
+ *  Fill a grid with rolling hills, smooth enough to be decimated
+ */
+static void
+fill_hills(elevationGrid * const g) {
+    GLfloat* const row = malloc(g->width * sizeof(*row));
+    GLfloat const k = 2.0f * M_PI / 512.0f;
+    GLuint x, z;
+    for(z = 0; z < g->height; z++) {
+        for(x = 0; x < g->width; x++) {
+            row[x] = 500.0f + 300.0f * sinf(k * x) * cosf(k * 0.7f * z)
+                     + 40.0f * sinf(k * 5.3f * (x + z));
+        }
+        grid_write_row( g, z, 0, g->width, row );
+    }
+    free( row );
+}
+
+static int
+compare_floats(void const * a, void const * b) {
+    GLfloat const x = *(GLfloat const *) a, y = *(GLfloat const *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ *  Check the levels a selection picked: the error of each, projected from
+ *  the nearest point of its chunk, stays under the threshold, and the
+ *  nearer half of the chunks drawn is no coarser than the farther half
+ */
+static void
+check_lod_levels(lodTerrain const * const lod, lodView const * const view,
+                 GLubyte const * const levels, char const * const name) {
+    GLfloat const pixels = view->viewport_height
+                           / (2.0f * tanf(view->fovy * M_PI / 360.0f));
+    GLuint const count = lod_chunk_count(lod);
+    GLfloat* const distances = malloc(count * sizeof(*distances));
+    GLuint i, drawn = 0, over = 0;
+    for(i = 0; i < count; i++) {
+        if(levels[i] == LOD_CULLED) {
+            continue;
+        }
+        GLfloat min[3], max[3];
+        lod_chunk_bounds(lod, i, min, max);
+        GLfloat const distance = lod_box_distance(min, max, &view->eye);
+        GLfloat const error = lod->yScale * lod->chunks[i].error[levels[i]];
+        over += error * pixels > view->threshold * distance;
+        distances[drawn++] = distance;
+    }
+    check( over == 0, "lod %s drew %u chunks with an error of more than "
+           "%g pixels", name, over, view->threshold );
+
+    // Mean level of the chunks nearer and farther than the median
+    if(drawn >= 2) {
+        qsort( distances, drawn, sizeof(*distances), compare_floats );
+        GLfloat const median = distances[drawn / 2];
+        double near = 0.0, far = 0.0;
+        GLuint near_count = 0, far_count = 0;
+        for(i = 0; i < count; i++) {
+            if(levels[i] == LOD_CULLED) {
+                continue;
+            }
+            GLfloat min[3], max[3];
+            lod_chunk_bounds(lod, i, min, max);
+            if(lod_box_distance(min, max, &view->eye) < median) {
+                near += levels[i];
+                near_count++;
+            }else {
+                far += levels[i];
+                far_count++;
+            }
+        }
+        near = near_count > 0 ? near / near_count : 0.0;
+        far /= far_count;
+        printf("lod %-6s mean level %.2f nearer than %.3f, %.2f farther\n",
+               name, near, median, far);
+        check( near <= far, "lod %s drew nearer chunks at coarser levels "
+               "than farther ones", name );
+    }
+    free( distances );
+}
+
+/**
+ *  Check the skirts hide the cracks between chunks at any two levels: the
+ *  edges of two neighbours are each off by at most the coarsest error of
+ *  their chunk, so the skirts must reach down by both
+ */
+static void
+check_lod_skirts(lodTerrain const * const lod) {
+    static int const offsets[4][2] = {
+        { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 }
+    };
+    GLuint cx, cz, short_skirts = 0;
+    for(cz = 0; cz < lod->chunks_z; cz++) {
+        for(cx = 0; cx < lod->chunks_x; cx++) {
+            lodChunk const * const c = &lod->chunks[cz * lod->chunks_x + cx];
+            GLfloat const own = c->error[LOD_LEVELS - 1];
+            unsigned int k;
+            for(k = 0; k < 4; k++) {
+                int const nx = (int) cx + offsets[k][0];
+                int const nz = (int) cz + offsets[k][1];
+                if(nx < 0 || nz < 0 || nx >= (int) lod->chunks_x
+                   || nz >= (int) lod->chunks_z) {
+                    continue;
+                }
+                lodChunk const * const n = &lod->chunks[nz * lod->chunks_x
+                                                        + nx];
+                short_skirts += c->skirt < own + n->error[LOD_LEVELS - 1];
+            }
+        }
+    }
+    check( short_skirts == 0, "lod %u chunk edges have skirts shorter than "
+           "the coarsest errors on either side", short_skirts );
+}
+
+/**
+ *  Chunk a grid, then time the level of detail selection and culling from
+ *  a few camera poses and compare the triangles drawn against the full
+ *  mesh. The levels picked from each pose and the skirts are checked.
+ */
+static void
+bench_lod(benchOptions const * const opts) {
+    mapData mData;
+    mData.mapWidth = mData.mapHeight = opts->size;
+    if(!grid_init( &mData.elevation, opts->size, opts->size, 
+                   GRID_ROW_MAJOR )) {
+        fprintf(stderr, "Unable to allocate a %u x %u grid\n",
+                opts->size, opts->size);
+        exit(1);
+    }
+    fill_hills( &mData.elevation );
+
+    // Placed like init.c places a map in a cube of size 2
+    mData.minElevation = 0.0f;
+    mData.resolution = 30.0f;
+    mData.scale = 2.0f / (opts->size - 1);
+    mData.yScale = mData.scale / mData.resolution;
+    mData.xOffset = mData.zOffset = 1.0f;
+
+    threadPool* const pool = pool_create( pool_default_threads() );
+    lodTerrain lod;
+    double start = now();
+    lod_init( &lod, &mData, pool );
+    double const init_time = now() - start;
+    printf("lod chunks %u  init %7.3f s\n", lod_chunk_count(&lod), init_time);
+
+    // Eye positions and camera angles, like cameraData
+    static struct {
+        char const * name;
+        GLfloat eye[3];
+        GLfloat theta[3];
+    } const poses[] = {
+        { "ground", {  0.0f, 0.05f,  0.0f }, {  5.0f,   0.0f, 0.0f } },
+        { "corner", { -1.0f, 0.20f, -1.0f }, { 10.0f, 135.0f, 0.0f } },
+        { "above",  {  0.0f, 2.00f,  0.0f }, { 90.0f,   0.0f, 0.0f } },
+        { "far",    {  0.0f, 0.50f,  3.0f }, {  5.0f,   0.0f, 0.0f } }
+    };
+    mat4 projection;
+    mat4_perspective( projection, 45.0f, 16.0f / 9.0f, 0.01f, 4.0f );
+
+    GLubyte* const levels = malloc(lod_chunk_count(&lod) * sizeof(*levels));
+    double const full = 2.0 * (opts->size - 1) * (opts->size - 1);
+    unsigned int const frames = 100;
+    unsigned int i, f;
+    for(i = 0; i < sizeof(poses) / sizeof(poses[0]); i++) {
+        cameraData camera;
+        unsigned int k;
+        for(k = 0; k < 3; k++) {
+            camera.viewer[k] = poses[i].eye[k];
+            camera.theta[k] = poses[i].theta[k];
+        }
+        mat4 mv, pmv;
+        camera_model_view( mv, &camera );
+        mat4_mult( pmv, projection, mv );
+        frustum view_frustum;
+        frustum_extract( &view_frustum, pmv );
+
+        lodView view;
+        vec3_init( &view.eye, poses[i].eye[0], poses[i].eye[1], 
+                   poses[i].eye[2] );
+        view.fovy = 45.0f;
+        view.viewport_height = 1080.0f;
+        view.threshold = 1.0f;
+        view.frustum = &view_frustum;
+
+        lodStats stats;
+        start = now();
+        for(f = 0; f < frames; f++) {
+            lod_select( &lod, &view, levels, &stats );
+        }
+        double const select_time = (now() - start) / frames;
+
+        printf("lod %-6s select %7.3f ms  triangles %10zu (%5.2f%% of %.0f)"
+               "  culled %u chunks %zu triangles\n",
+               poses[i].name, select_time * 1e3, stats.triangles,
+               100.0 * stats.triangles / full, full, stats.culled_chunks,
+               stats.culled_triangles);
+        check_lod_levels( &lod, &view, levels, poses[i].name );
+    }
+    check_lod_skirts( &lod );
+
+    free( levels );
+    lod_free( &lod );
+    pool_destroy( pool );
+    grid_free( &mData.elevation );
+}
+
+/**
+ *  Check the planes a frustum was given against the expected ones
+ */
+static void
+check_planes(frustum const * const f, GLfloat const expected[][4],
+             char const * const name) {
+    static char const * const names[FRUSTUM_PLANES] = {
+        "left", "right", "bottom", "top", "near", "far"
+    };
+    unsigned int i;
+    for(i = 0; i < FRUSTUM_PLANES; i++) {
+        vec4 const * const p = &f->planes[i];
+        GLfloat const * const e = expected[i];
+        check( fabsf(p->x - e[0]) < 1e-5f && fabsf(p->y - e[1]) < 1e-5f
+               && fabsf(p->z - e[2]) < 1e-5f && fabsf(p->w - e[3]) < 1e-5f,
+               "frustum %s %s plane is (%g, %g, %g, %g), expected (%g, %g, "
+               "%g, %g)", name, names[i], p->x, p->y, p->z, p->w, e[0], e[1],
+               e[2], e[3] );
+    }
+}
+
+/**
+ *  Check the planes of known matrices and boxes on either side of them,
+ *  then time testing boxes scattered around a frustum
+ */
+static void
+bench_frustum(benchOptions const * const opts) {
+    (void) opts;
+
+    // The identity keeps the clip cube, -1 to 1 on every axis
+    mat4 identity;
+    mat4_create_i( identity );
+    frustum cube;
+    frustum_extract( &cube, identity );
+    static GLfloat const cube_planes[FRUSTUM_PLANES][4] = {
+        {  1.0f,  0.0f,  0.0f, 1.0f }, { -1.0f,  0.0f,  0.0f, 1.0f },
+        {  0.0f,  1.0f,  0.0f, 1.0f }, {  0.0f, -1.0f,  0.0f, 1.0f },
+        {  0.0f,  0.0f,  1.0f, 1.0f }, {  0.0f,  0.0f, -1.0f, 1.0f }
+    };
+    check_planes( &cube, cube_planes, "identity" );
+
+    // A square 90 degree view down -z from 1 to 10: the sides are at 45
+    // degrees and the near and far planes at z = -1 and z = -10
+    mat4 projection;
+    mat4_perspective( projection, 90.0f, 1.0f, 1.0f, 10.0f );
+    frustum view;
+    frustum_extract( &view, projection );
+    GLfloat const r = (GLfloat) M_SQRT1_2;
+    GLfloat const perspective_planes[FRUSTUM_PLANES][4] = {
+        {  r,    0.0f, -r,    0.0f }, { -r,    0.0f, -r,    0.0f },
+        {  0.0f, r,    -r,    0.0f }, {  0.0f, -r,   -r,    0.0f },
+        {  0.0f, 0.0f, -1.0f, -1.0f }, {  0.0f, 0.0f, 1.0f, 10.0f }
+    };
+    check_planes( &view, perspective_planes, "perspective" );
+
+    static struct {
+        char const * name;
+        int identity;       // Which frustum
+        GLfloat min[3];
+        GLfloat max[3];
+        int visible;
+    } const boxes[] = {
+        { "inside the cube",   1, { -0.5f, -0.5f, -0.5f },
+                                  {  0.5f,  0.5f,  0.5f }, 1 },
+        { "right of the cube", 1, {  1.5f, -0.5f, -0.5f },
+                                  {  2.0f,  0.5f,  0.5f }, 0 },
+        { "across the right",  1, {  0.5f, -0.5f, -0.5f },
+                                  {  1.5f,  0.5f,  0.5f }, 1 },
+        { "around the cube",   1, { -2.0f, -2.0f, -2.0f },
+                                  {  2.0f,  2.0f,  2.0f }, 1 },
+        { "inside the view",   0, { -0.5f, -0.5f, -5.0f },
+                                  {  0.5f,  0.5f, -4.0f }, 1 },
+        { "before near",       0, { -0.5f, -0.5f, -0.5f },
+                                  {  0.5f,  0.5f,  2.0f }, 0 },
+        { "beyond far",        0, { -0.5f, -0.5f, -20.0f },
+                                  {  0.5f,  0.5f, -12.0f }, 0 },
+        { "left of the view",  0, { -10.0f, -0.5f, -5.0f },
+                                  { -8.0f,   0.5f, -4.0f }, 0 },
+        { "above the view",    0, { -0.5f,  6.0f, -5.0f },
+                                  {  0.5f,  7.0f, -4.0f }, 0 },
+        { "across the left",   0, { -6.0f, -0.5f, -5.0f },
+                                  { -4.0f,  0.5f, -4.0f }, 1 },
+        { "across near",       0, { -0.5f, -0.5f, -2.0f },
+                                  {  0.5f,  0.5f,  0.0f }, 1 },
+        { "across far",        0, { -0.5f, -0.5f, -11.0f },
+                                  {  0.5f,  0.5f, -9.0f }, 1 },
+        { "around the view",   0, { -100.0f, -100.0f, -100.0f },
+                                  {  100.0f,  100.0f,  100.0f }, 1 }
+    };
+    unsigned int const count = sizeof(boxes) / sizeof(boxes[0]);
+    unsigned int i;
+    for(i = 0; i < count; i++) {
+        int const visible = frustum_test_box(boxes[i].identity ? &cube : &view,
+                                             boxes[i].min, boxes[i].max);
+        check( visible == boxes[i].visible, "frustum box %s is %s",
+               boxes[i].name, visible ? "visible" : "culled" );
+    }
+    printf("frustum checked 2 matrices and %u boxes\n", count);
+
+    // Unit boxes scattered over a cube around the view
+    unsigned int const tests = 4 << 20;
+    GLfloat (* const corners)[3] = malloc(1024 * sizeof(*corners));
+    srand( 1 );
+    for(i = 0; i < 1024; i++) {
+        corners[i][0] = 24.0f * rand() / RAND_MAX - 12.0f;
+        corners[i][1] = 24.0f * rand() / RAND_MAX - 12.0f;
+        corners[i][2] = -24.0f * rand() / RAND_MAX + 2.0f;
+    }
+    unsigned int visible = 0;
+    double const start = now();
+    for(i = 0; i < tests; i++) {
+        GLfloat const * const min = corners[i % 1024];
+        GLfloat const max[3] = { min[0] + 1.0f, min[1] + 1.0f, min[2] + 1.0f };
+        visible += frustum_test_box(&view, min, max);
+    }
+    double const test_time = now() - start;
+    printf("frustum %u boxes  %6.2f ns/box  %5.2f%% visible\n", tests,
+           test_time * 1e9 / tests, 100.0 * visible / tests);
+    free( corners );
+}
+
+/**
+ *  Time the RTIN mesher at a few error limits and compare its triangles
+ *  and measured error against the full grid
+ */
+static void
+bench_rtin(benchOptions const * const opts) {
+    mapData mData;
+    mData.mapWidth = mData.mapHeight = opts->size;
+    if(!grid_init( &mData.elevation, opts->size, opts->size, 
+                   GRID_ROW_MAJOR )) {
+        fprintf(stderr, "Unable to allocate a %u x %u grid\n",
+                opts->size, opts->size);
+        exit(1);
+    }
+    fill_hills( &mData.elevation );
+
+    threadPool* const pool = pool_create( pool_default_threads() );
+    static GLfloat const limits[] = { 0.0f, 0.5f, 2.0f, 10.0f };
+    double const full = 2.0 * (opts->size - 1) * (opts->size - 1);
+    unsigned int i;
+    for(i = 0; i < sizeof(limits) / sizeof(limits[0]); i++) {
+        rtinMesh rtin;
+        double const start = now();
+        rtin_build( &rtin, &mData, limits[i], pool );
+        double const build_time = now() - start;
+
+        printf("rtin limit %5.1f  build %7.3f s  triangles %10zu (%6.2f%%)"
+               "  error max %.3f mean %.4f\n",
+               limits[i], build_time, rtin.triangles,
+               100.0 * rtin.triangles / full, rtin.max_error, 
+               rtin.mean_error);
+        check( rtin.max_error <= limits[i], "rtin error %g over the limit "
+               "%g", rtin.max_error, limits[i] );
+        rtin_free( &rtin );
+    }
+
+    pool_destroy( pool );
+    grid_free( &mData.elevation );
+}
+
+// Largest map the cache simulation indexes, larger -n are clamped
+#define VCACHE_BENCH_SIZE 4097
+
+/**
+ *  Print the misses of one index order in FIFO caches of a few sizes and
+ *  in an LRU cache the size the order is tuned for
+ *  @param[out] tuned  The ACMR of the FIFO and the LRU cache of the size
+ *                     the order is tuned for
+ */
+static void
+report_vcache(double tuned[2], char const * const name,
+              GLuint const * const indices, size_t count, meshMode mode,
+              size_t num_vertices) {
+    static unsigned int const sizes[] = { 16, VCACHE_SIZE, 64 };
+    printf("vcache %-22s", name);
+    vcacheStats s;
+    unsigned int i;
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        vcache_simulate( &s, indices, count, mode, num_vertices, sizes[i],
+                         VCACHE_FIFO );
+        printf("  fifo %2u acmr %.3f atvr %.2f", sizes[i], s.acmr, s.atvr);
+        if(sizes[i] == VCACHE_SIZE) {
+            tuned[0] = s.acmr;
+        }
+    }
+    vcache_simulate( &s, indices, count, mode, num_vertices, VCACHE_SIZE,
+                     VCACHE_LRU );
+    printf("  lru %u acmr %.3f\n", VCACHE_SIZE, s.acmr);
+    tuned[1] = s.acmr;
+}
+
+/**
+ *  Check the simulated misses of a two strip list and a cache of three
+ *  vertices against counts worked out by hand. A FIFO misses 0 1 2, hits
+ *  0, misses 3, evicting 0, then after the restart hits 2 and misses 0
+ *  and 4. The LRU hit on 0 keeps it past 3, which evicts 1 instead, so
+ *  only 4 misses after the restart.
+ */
+static void
+check_vcache_counts() {
+    static GLuint const indices[] = {
+        0, 1, 2, 0, 3, VCACHE_RESTART_INDEX, 2, 0, 4
+    };
+    static vcachePolicy const policies[] = { VCACHE_FIFO, VCACHE_LRU };
+    static size_t const misses[] = { 6, 5 };
+    size_t const count = sizeof(indices) / sizeof(*indices);
+    unsigned int i;
+    for(i = 0; i < 2; i++) {
+        vcacheStats s;
+        vcache_simulate( &s, indices, count, MESH_INDEXED, 5, 3,
+                         policies[i] );
+        check( s.misses == misses[i] && s.triangles == 4
+               && s.references == 8 && s.vertices == 5,
+               "vcache %s of 3 counted %zu misses, %zu triangles, "
+               "%zu references and %zu vertices, expected %zu, 4, 8 and 5",
+               i == 0 ? "fifo" : "lru", s.misses, s.triangles,
+               s.references, s.vertices, misses[i] );
+    }
+}
+
+/**
+ *  Simulate the post-transform cache on the indexed layouts walking whole
+ *  rows and stripes of several widths, and on an RTIN mesh
+ */
+static void
+bench_vcache(benchOptions const * const opts) {
+    GLuint const size = opts->size < VCACHE_BENCH_SIZE
+                        ? opts->size : VCACHE_BENCH_SIZE;
+    size_t const num_vertices = (size_t) size * size;
+    static GLuint const stripes[] = { 0, 7, VCACHE_STRIPE_QUADS, 15 };
+    static meshMode const modes[] = { MESH_INDEXED, MESH_TRIANGLES };
+    static char const * const policies[] = { "fifo", "lru" };
+    check_vcache_counts();
+
+    unsigned int i, j, k;
+    for(i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        double rows[2] = { 0.0, 0.0 };
+        for(j = 0; j < sizeof(stripes) / sizeof(stripes[0]); j++) {
+            size_t const count = vcache_index_count(modes[i], size, size,
+                                                    stripes[j]);
+            GLuint* const indices = malloc(count * sizeof(*indices));
+            if(indices == NULL) {
+                fprintf(stderr, "Unable to allocate %zu indices\n", count);
+                exit(1);
+            }
+            double const start = now();
+            vcache_index_rows( indices, modes[i], size, size, stripes[j],
+                               0, size - 1 );
+            double const build_time = now() - start;
+
+            char name[64];
+            if(stripes[j] == 0) {
+                snprintf( name, sizeof(name), "%s rows",
+                          modes[i] == MESH_INDEXED ? "strips" : "triangles" );
+            }else {
+                snprintf( name, sizeof(name), "%s stripe %u",
+                          modes[i] == MESH_INDEXED ? "strips" : "triangles",
+                          stripes[j] );
+            }
+            double tuned[2];
+            report_vcache( tuned, name, indices, count, modes[i],
+                           num_vertices );
+            printf("vcache %-22s  %ux%u indexed in %.3f s\n", name,
+                   size, size, build_time);
+            free( indices );
+
+            // Stripes only pay off once rows outgrow the cache
+            for(k = 0; k < 2; k++) {
+                if(stripes[j] == 0) {
+                    rows[k] = tuned[k];
+                }else if(stripes[j] == VCACHE_STRIPE_QUADS
+                         && size > 2 * VCACHE_SIZE) {
+                    check( tuned[k] < rows[k], "vcache %s %s %u acmr %.3f, "
+                           "no better than rows at %.3f", name,
+                           policies[k], VCACHE_SIZE, tuned[k], rows[k] );
+                }
+            }
+        }
+    }
+
+    mapData mData;
+    mData.mapWidth = mData.mapHeight = size;
+    if(!grid_init( &mData.elevation, size, size, GRID_ROW_MAJOR )) {
+        fprintf(stderr, "Unable to allocate a %u x %u grid\n", size, size);
+        exit(1);
+    }
+    fill_hills( &mData.elevation );
+    threadPool* const pool = pool_create( pool_default_threads() );
+    rtinMesh rtin;
+    rtin_build( &rtin, &mData, 0.5f, pool );
+    double tuned[2];
+    report_vcache( tuned, "rtin limit 0.5", rtin.indices,
+                   rtin.triangles * 3, MESH_RTIN, num_vertices );
+    rtin_free( &rtin );
+    pool_destroy( pool );
+    grid_free( &mData.elevation );
+}
+
+// Largest map the update benchmark patches, rebuilding it whole to check
+#define UPDATE_BENCH_SIZE 1025
+
+// Rectangles of heights changed for each layout and normal mode
+#define UPDATE_EDITS 16
+
+/**
+ *  The rectangle changed by an edit: a corner, an edge, a whole row, a
+ *  single sample, then rectangles of pseudo-random places and sizes
+ */
+static void
+update_rect(gridRect * const r, unsigned int edit, GLuint size,
+            unsigned int * const seed) {
+    switch(edit) {
+        case 0:
+            r->x0 = 0; r->z0 = 0; r->x1 = 5; r->z1 = 3;
+            return;
+        case 1:
+            r->x0 = size - 7; r->z0 = size - 4; r->x1 = size; r->z1 = size;
+            return;
+        case 2:
+            r->x0 = 0; r->z0 = size / 3; r->x1 = size; r->z1 = size / 3 + 1;
+            return;
+        case 3:
+            r->x0 = size / 2; r->z0 = size / 2 + 1;
+            r->x1 = r->x0 + 1; r->z1 = r->z0 + 1;
+            return;
+    }
+    GLuint v[4];
+    unsigned int k;
+    for(k = 0; k < 4; k++) {
+        *seed = *seed * 1103515245u + 12345u;
+        v[k] = (*seed >> 8) % size;
+    }
+    GLuint const w = 1 + v[2] % (size / 8);
+    GLuint const h = 1 + v[3] % (size / 8);
+    r->x0 = v[0] < size - w ? v[0] : size - w;
+    r->z0 = v[1] < size - h ? v[1] : size - h;
+    r->x1 = r->x0 + w;
+    r->z1 = r->z0 + h;
+}
+
+/**
+ *  Build a whole layout the way init.c does
+ */
+static void
+update_build_full(vec4 * const vertices, vec3 * const normals,
+                  vec3 * const sample_normals, mapData const * const mData,
+                  meshMode mode, normalMode nm, threadPool * const pool) {
+    compute_normals( sample_normals, mData, nm, pool );
+    if(mode == MESH_STRIP) {
+        mesh_build_strip( vertices, normals, sample_normals, mData, pool );
+    }else {
+        mesh_build_vertices( vertices, mData, pool );
+        memcpy( normals, sample_normals, (size_t) mData->mapWidth
+                * mData->mapHeight * sizeof(*normals) );
+    }
+}
+
+/**
+ *  Check the ranges of a patch are sorted, apart and inside the layout,
+ *  and take in every vertex made from a dirty sample
+ *  @return The number of vertices missed
+ */
+static size_t
+update_check_ranges(meshPatch const * const p, meshMode mode,
+                    GLuint size, size_t count, unsigned char * const covered) {
+    memset( covered, 0, count );
+    size_t i, v, missed = 0;
+    for(i = 0; i < p->num_ranges; i++) {
+        meshRange const * const r = &p->ranges[i];
+        if(r->first + r->count > count || (i > 0 && r->first
+           <= p->ranges[i - 1].first + p->ranges[i - 1].count)) {
+            missed++;
+        }
+        for(v = r->first; v < r->first + r->count && v < count; v++) {
+            covered[v] = 1;
+        }
+    }
+    for(v = 0; v < count; v++) {
+        GLuint x, z;
+        if(mode == MESH_STRIP) {
+            mesh_strip_sample( &x, &z, v, size, size );
+        }else {
+            x = v % size;
+            z = v / size;
+        }
+        missed += !covered[v] && x >= p->dirty.x0 && x < p->dirty.x1
+                  && z >= p->dirty.z0 && z < p->dirty.z1;
+    }
+    return missed;
+}
+
+/**
+ *  Change rectangles of heights, patch the vertices they change into a
+ *  copy of each layout and check it bit for bit against rebuilding the
+ *  layout, timing both, then time finding the changes with grid_diff
+ */
+static void
+bench_update(benchOptions const * const opts) {
+    GLuint const size = opts->size < UPDATE_BENCH_SIZE
+                        ? opts->size : UPDATE_BENCH_SIZE;
+    mapData mData;
+    mData.mapWidth = mData.mapHeight = size;
+    if(!grid_init( &mData.elevation, size, size, GRID_ROW_MAJOR )) {
+        fprintf(stderr, "Unable to allocate a %u x %u grid\n", size, size);
+        exit(1);
+    }
+    fill_hills( &mData.elevation );
+
+    // Placed like init.c places a map in a cube of size 2
+    mData.minElevation = 0.0f;
+    mData.maxElevation = 1000.0f;
+    mData.resolution = 30.0f;
+    mData.scale = 2.0f / (size - 1);
+    mData.yScale = mData.scale / mData.resolution;
+    mData.xOffset = mData.zOffset = 1.0f;
+
+    threadPool* const pool = pool_create( pool_default_threads() );
+    heightMap* const m = heightmap_create( &mData, pool );
+    mapData* const map = &m->map;
+
+    size_t const most = mesh_vertex_count(MESH_STRIP, size, size);
+    vec4* const vertices = malloc(most * sizeof(*vertices));
+    vec3* const normals = malloc(most * sizeof(*normals));
+    vec4* const full_vertices = malloc(most * sizeof(*full_vertices));
+    vec3* const full_normals = malloc(most * sizeof(*full_normals));
+    vec3* const sample_normals = malloc((size_t) size * size
+                                        * sizeof(*sample_normals));
+    unsigned char* const covered = malloc(most);
+    GLfloat* const row = malloc(size * sizeof(*row));
+    if(vertices == NULL || normals == NULL || full_vertices == NULL
+       || full_normals == NULL || sample_normals == NULL || covered == NULL
+       || row == NULL) {
+        fprintf(stderr, "Unable to allocate %zu vertices\n", most);
+        exit(1);
+    }
+
+    static meshMode const modes[] = { MESH_STRIP, MESH_INDEXED,
+                                      MESH_TRIANGLES };
+    static normalMode const normal_modes[] = { NORMALS_EXACT, NORMALS_FAST };
+    unsigned int i, j, e;
+    for(i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        for(j = 0; j < sizeof(normal_modes) / sizeof(normal_modes[0]); j++) {
+            // The same edits for every layout
+            unsigned int seed = 1;
+            meshMode const mode = modes[i];
+            normalMode const nm = normal_modes[j];
+            size_t const count = mesh_vertex_count(mode, size, size);
+            update_build_full( vertices, normals, sample_normals, map, mode,
+                               nm, pool );
+
+            double patch_time = 0.0, full_time = 0.0;
+            size_t patched = 0, differ = 0, missed = 0;
+            for(e = 0; e < UPDATE_EDITS; e++) {
+                gridRect r;
+                update_rect( &r, e, size, &seed );
+                GLuint x, z;
+                for(z = r.z0; z < r.z1; z++) {
+                    grid_read_row( &map->elevation, z, r.x0, r.x1 - r.x0,
+                                   row );
+                    for(x = 0; x < r.x1 - r.x0; x++) {
+                        row[x] += 25.0f + (x * 31 + z * 17) % 50;
+                    }
+                    grid_write_row( &map->elevation, z, r.x0, r.x1 - r.x0,
+                                    row );
+                }
+
+                double start = now();
+                heightmap_update( m, r.x0, r.z0, r.x1, r.z1 );
+                meshPatch p;
+                mesh_build_patch( &p, map, mode, nm, &r );
+                size_t k, offset = 0;
+                for(k = 0; k < p.num_ranges; k++) {
+                    meshRange const * const range = &p.ranges[k];
+                    memcpy( vertices + range->first, p.vertices + offset,
+                            range->count * sizeof(*vertices) );
+                    memcpy( normals + range->first, p.normals + offset,
+                            range->count * sizeof(*normals) );
+                    offset += range->count;
+                }
+                patch_time += now() - start;
+                patched += p.num_vertices;
+                missed += update_check_ranges(&p, mode, size, count,
+                                              covered);
+                mesh_patch_free( &p );
+
+                start = now();
+                update_build_full( full_vertices, full_normals,
+                                   sample_normals, map, mode, nm, pool );
+                full_time += now() - start;
+                differ += memcmp(vertices, full_vertices,
+                                 count * sizeof(*vertices)) != 0
+                          || memcmp(normals, full_normals,
+                                    count * sizeof(*normals)) != 0;
+            }
+            printf("update %-9s %-5s %ux%u  patch %8.3f ms  rebuild "
+                   "%8.3f ms  %8.0f vertices/edit  %u of %u differ  "
+                   "%zu missed\n", mesh_mode_name(mode),
+                   nm == NORMALS_EXACT ? "exact" : "fast", size, size,
+                   1e3 * patch_time / UPDATE_EDITS,
+                   1e3 * full_time / UPDATE_EDITS,
+                   (double) patched / UPDATE_EDITS, (unsigned int) differ,
+                   UPDATE_EDITS, missed);
+            check( differ == 0 && missed == 0, "update %s %s patched %u "
+                   "edits differently from a rebuild, missing %zu vertices",
+                   mesh_mode_name(mode), nm == NORMALS_EXACT ? "exact"
+                   : "fast", (unsigned int) differ, missed );
+        }
+    }
+
+    // The pyramid patched edit by edit against one built from scratch
+    mapData copy = *map;
+    if(!grid_init( &copy.elevation, size, size, GRID_ROW_MAJOR )) {
+        fprintf(stderr, "Unable to allocate a %u x %u grid\n", size, size);
+        exit(1);
+    }
+    GLuint z;
+    for(z = 0; z < size; z++) {
+        grid_read_row( &map->elevation, z, 0, size, row );
+        grid_write_row( &copy.elevation, z, 0, size, row );
+    }
+    heightMap* const rebuilt = heightmap_create( &copy, pool );
+    unsigned int l, levels_differ = 0;
+    for(l = 1; l < m->levels; l++) {
+        levels_differ += memcmp(m->level[l].ranges, rebuilt->level[l].ranges,
+                                (size_t) m->level[l].width
+                                * m->level[l].height
+                                * sizeof(heightRange)) != 0;
+    }
+    printf("update pyramid %u of %u levels differ\n", levels_differ,
+           m->levels - 1);
+    check( levels_differ == 0, "update pyramid differs from a rebuild" );
+
+    // Finding the edits again, as the watcher does after a reload
+    fill_hills( &copy.elevation );
+    double const start = now();
+    gridRect* const rects = malloc((size + 63) / 64 * sizeof(*rects));
+    size_t const found = grid_diff(rects, &copy.elevation, &map->elevation,
+                                   64);
+    double const diff_time = now() - start;
+    size_t samples = 0, k;
+    for(k = 0; k < found; k++) {
+        samples += (size_t) (rects[k].x1 - rects[k].x0)
+                   * (rects[k].z1 - rects[k].z0);
+    }
+    printf("update diff %ux%u in %.3f ms (%.0f MB/s)  %zu rectangles of "
+           "%zu samples\n", size, size, 1e3 * diff_time,
+           2.0 * size * size * sizeof(GLfloat) / 1e6 / diff_time, found,
+           samples);
+
+    free( rects );
+    heightmap_free( rebuilt );
+    free( row );
+    free( covered );
+    free( sample_normals );
+    free( full_normals );
+    free( full_vertices );
+    free( normals );
+    free( vertices );
+    heightmap_free( m );
+    pool_destroy( pool );
+}
+
+// Samples the horizon benchmark checks by brute force
+#define HORIZON_CHECKS 4096
+
+/**
+ *  Time the horizon sweep on one thread and on all of them, check it
+ *  against looking along every line from sampled points, and count the
+ *  samples in shadow as the sun sets
+ */
+static void
+bench_horizon(benchOptions const * const opts) {
+    mapData mData;
+    mData.mapWidth = mData.mapHeight = opts->size;
+    if(!grid_init( &mData.elevation, opts->size, opts->size, 
+                   GRID_ROW_MAJOR )) {
+        fprintf(stderr, "Unable to allocate a %u x %u grid\n",
+                opts->size, opts->size);
+        exit(1);
+    }
+    fill_hills( &mData.elevation );
+    mData.resolution = 30.0f;
+
+    size_t const samples = (size_t) opts->size * opts->size;
+    GLubyte* const horizons = malloc(samples * HORIZON_AZIMUTHS);
+    if(horizons == NULL) {
+        fprintf(stderr, "Unable to allocate %zu horizons\n", samples);
+        exit(1);
+    }
+
+    unsigned int const threads[] = { 1, pool_default_threads() };
+    unsigned int i;
+    for(i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+        threadPool* const pool = pool_create( threads[i] );
+        double const start = now();
+        compute_horizons( horizons, &mData, pool );
+        double const sweep_time = now() - start;
+        printf("horizon sweep %2u threads %7.3f s  %7.1f Msamples/s\n",
+               threads[i], sweep_time, samples / sweep_time / 1e6);
+        pool_destroy( pool );
+    }
+
+    // The same pseudo-random samples every run
+    unsigned int seed = 1;
+    unsigned int worst = 0;
+    size_t mismatched = 0;
+    double const start = now();
+    for(i = 0; i < HORIZON_CHECKS; i++) {
+        seed = seed * 1103515245u + 12345u;
+        GLuint const x = (seed >> 8) % opts->size;
+        seed = seed * 1103515245u + 12345u;
+        GLuint const z = (seed >> 8) % opts->size;
+        unsigned int a;
+        for(a = 0; a < HORIZON_AZIMUTHS; a++) {
+            int const expected = horizon_brute_force(&mData, x, z, a);
+            int const found = horizons[((size_t) z * opts->size + x)
+                                       * HORIZON_AZIMUTHS + a];
+            unsigned int const difference = abs(expected - found);
+            worst = difference > worst ? difference : worst;
+            mismatched += (difference != 0);
+        }
+    }
+    double const brute_time = (now() - start) / HORIZON_CHECKS * samples;
+    printf("horizon brute force ~%.1f s for the grid  %zu of %u angles "
+           "differ, at most %u/255\n", brute_time, mismatched,
+           HORIZON_CHECKS * HORIZON_AZIMUTHS, worst);
+    check( mismatched == 0, "horizon sweep differs from looking along "
+           "every line" );
+
+    static GLfloat const elevations[] = { 45.0f, 20.0f, 10.0f, 5.0f };
+    for(i = 0; i < sizeof(elevations) / sizeof(elevations[0]); i++) {
+        GLfloat const e = elevations[i] * M_PI / 180.0f;
+        vec3 sun;
+        vec3_init( &sun, 0.0f, sinf(e), cosf(e) );
+        double lit = 0.0;
+        size_t s;
+        for(s = 0; s < samples; s++) {
+            lit += horizon_sunlight(&horizons[s * HORIZON_AZIMUTHS], &sun);
+        }
+        printf("horizon sun %4.0f degrees  %5.1f%% in shadow\n",
+               elevations[i], 100.0 * (1.0 - lit / samples));
+    }
+
+    free( horizons );
+    grid_free( &mData.elevation );
+}
+
+// Rays and heights queried by the heightmap benchmark
+#define HEIGHTMAP_QUERIES 200000
+
+/**
+ *  Time picking rays through the height pyramid against walking them cell
+ *  by cell, which must find the same hits, and bilinear height queries
+ */
+static void
+bench_heightmap(benchOptions const * const opts) {
+    mapData mData;
+    mData.mapWidth = mData.mapHeight = opts->size;
+    if(!grid_init( &mData.elevation, opts->size, opts->size, 
+                   GRID_ROW_MAJOR )) {
+        fprintf(stderr, "Unable to allocate a %u x %u grid\n",
+                opts->size, opts->size);
+        exit(1);
+    }
+    fill_hills( &mData.elevation );
+
+    // Placed like init.c places a map in a cube of size 2
+    mData.minElevation = 0.0f;
+    mData.maxElevation = 1000.0f;
+    mData.resolution = 30.0f;
+    mData.scale = 2.0f / (opts->size - 1);
+    mData.yScale = mData.scale / mData.resolution;
+    mData.xOffset = mData.zOffset = 1.0f;
+
+    threadPool* const pool = pool_create( pool_default_threads() );
+    heightMap* const m = heightmap_create( &mData, pool );
+
+    // The same pyramid without its levels walks every cell
+    heightMap linear = *m;
+    linear.levels = 1;
+
+    // Rays from above the map looking down at up to 45 degrees
+    vec3* const origins = malloc(HEIGHTMAP_QUERIES * sizeof(*origins));
+    vec3* const directions = malloc(HEIGHTMAP_QUERIES
+                                    * sizeof(*directions));
+    unsigned int seed = 1;
+    unsigned int i;
+    for(i = 0; i < HEIGHTMAP_QUERIES; i++) {
+        GLfloat r[5];
+        unsigned int k;
+        for(k = 0; k < 5; k++) {
+            seed = seed * 1103515245u + 12345u;
+            r[k] = (seed >> 8) / 16777216.0f;
+        }
+        vec3_init( &origins[i], 2.0f * r[0] - 1.0f, 0.2f + 0.3f * r[1],
+                   2.0f * r[2] - 1.0f );
+        GLfloat const yaw = 2.0f * M_PI * r[3];
+        GLfloat const pitch = M_PI / 4.0f * (0.05f + 0.95f * r[4]);
+        vec3_init( &directions[i], cosf(yaw) * cosf(pitch), -sinf(pitch),
+                   sinf(yaw) * cosf(pitch) );
+    }
+
+    heightMap const * const maps[2] = { m, &linear };
+    char const * const names[2] = { "pyramid", "cells" };
+    heightHit* const hits = malloc(2 * HEIGHTMAP_QUERIES * sizeof(*hits));
+    int* const found = malloc(2 * HEIGHTMAP_QUERIES * sizeof(*found));
+    unsigned int p;
+    for(p = 0; p < 2; p++) {
+        // Walking every cell is slow, so it gets fewer rays
+        unsigned int const rays = p == 0 ? HEIGHTMAP_QUERIES
+                                         : HEIGHTMAP_QUERIES / 20;
+        double steps = 0.0;
+        size_t hit_count = 0;
+        double const start = now();
+        for(i = 0; i < rays; i++) {
+            heightHit* const h = &hits[p * HEIGHTMAP_QUERIES + i];
+            found[p * HEIGHTMAP_QUERIES + i]
+                = heightmap_pick(h, maps[p], &origins[i], &directions[i]);
+            hit_count += found[p * HEIGHTMAP_QUERIES + i];
+            steps += h->steps;
+        }
+        double const elapsed = now() - start;
+        printf("heightmap pick %-8s %10.0f rays/s  %7.1f steps/ray  "
+               "%5.1f%% hit\n", names[p], rays / elapsed, steps / rays,
+               100.0 * hit_count / rays);
+    }
+
+    size_t differ = 0;
+    for(i = 0; i < HEIGHTMAP_QUERIES / 20; i++) {
+        heightHit const * const a = &hits[i];
+        heightHit const * const b = &hits[HEIGHTMAP_QUERIES + i];
+        differ += found[i] != found[HEIGHTMAP_QUERIES + i]
+                  || (found[i] && fabsf(a->distance - b->distance) > 1e-4f);
+    }
+    printf("heightmap pick differs on %zu of %u rays\n", differ,
+           HEIGHTMAP_QUERIES / 20);
+    check( differ == 0, "heightmap pick through the pyramid differs from "
+           "visiting every cell" );
+
+    double total = 0.0;
+    double const start = now();
+    for(i = 0; i < HEIGHTMAP_QUERIES; i++) {
+        total += height_at(m, origins[i].x, origins[i].z);
+    }
+    double const elapsed = now() - start;
+    printf("heightmap height_at %10.0f queries/s  (mean %.4f)\n",
+           HEIGHTMAP_QUERIES / elapsed, total / HEIGHTMAP_QUERIES);
+
+    free( found );
+    free( hits );
+    free( directions );
+    free( origins );
+    heightmap_free( m );
+    pool_destroy( pool );
+}
+
+// Largest map written by the tiles benchmark, about 300 MB of tiles
+#define TILES_MAX_SIZE 8193
+
+/**
+ *  Walk a camera across a pyramid, once asking only for the tiles around
+ *  it and once also for the tiles ahead of it, and count how often a tile
+ *  the camera needs is already resident
+ *  @param[in] file  The pyramid
+ *  @param[in] budget  Bytes the cache may keep
+ *  @param[in] lookahead  Tiles ahead of the camera to prefetch around
+ */
+static void
+walk_tiles(pyramid const * const file, size_t budget, int lookahead) {
+    pyramidLevel const * const level = &file->header.level[0];
+    int const radius = 2;
+    int const side = 2 * radius + 1;
+    tileKey* const keys = malloc(2 * side * side * sizeof(*keys));
+    GLfloat* const priority = malloc(2 * side * side * sizeof(*priority));
+
+    tileCache* const cache = tile_cache_create(file, budget);
+    size_t max_resident = 0;
+    double const start = now();
+    int const cz = level->tilesZ / 2;
+    int cx;
+    for(cx = 0; cx < (int) level->tilesX; cx++) {
+        tile_cache_update( cache );
+
+        // What a frame draws
+        int dx, dz;
+        for(dz = -radius; dz <= radius; dz++) {
+            for(dx = -radius; dx <= radius; dx++) {
+                tileKey key;
+                key.level = 0;
+                key.x = cx + dx;
+                key.z = cz + dz;
+                if(key.x < level->tilesX && key.z < level->tilesZ) {
+                    tile_cache_get( cache, key );
+                }
+            }
+        }
+
+        // What it asks for: the tiles around it and around the point
+        // ahead, nearest to that point first
+        int const centers[2] = { cx, cx + lookahead };
+        int const passes = lookahead > 0 ? 2 : 1;
+        size_t kept = 0;
+        int pass;
+        for(pass = 0; pass < passes; pass++) {
+            for(dz = -radius; dz <= radius; dz++) {
+                for(dx = -radius; dx <= radius; dx++) {
+                    tileKey key;
+                    key.level = 0;
+                    key.x = centers[pass] + dx;
+                    key.z = cz + dz;
+                    if(key.x >= level->tilesX || key.z >= level->tilesZ) {
+                        continue;
+                    }
+                    size_t i;
+                    for(i = 0; i < kept; i++) {
+                        if(keys[i].x == key.x && keys[i].z == key.z) {
+                            break;
+                        }
+                    }
+                    if(i < kept) {
+                        continue;
+                    }
+
+                    // Insertion sort by distance to the point ahead
+                    GLfloat const p = abs((int) key.x - centers[passes - 1])
+                                      + abs(dz);
+                    for(i = kept; i > 0 && priority[i - 1] > p; i--) {
+                        keys[i] = keys[i - 1];
+                        priority[i] = priority[i - 1];
+                    }
+                    keys[i] = key;
+                    priority[i] = p;
+                    kept++;
+                }
+            }
+        }
+        tile_cache_want( cache, keys, kept );
+
+        // The I/O thread catches up between frames
+        tile_cache_wait( cache );
+        tileCacheStats stats;
+        tile_cache_stats( cache, &stats );
+        max_resident = stats.resident_bytes > max_resident
+                       ? stats.resident_bytes : max_resident;
+    }
+    double const elapsed = now() - start;
+
+    tileCacheStats stats;
+    tile_cache_stats( cache, &stats );
+    printf("tiles lookahead %d  %5.1f%% hits (%zu/%zu)  loads %zu  "
+           "evictions %zu  resident max %.2f MB of %.2f MB  %7.3f s\n",
+           lookahead, 100.0 * stats.hits / (stats.hits + stats.misses),
+           stats.hits, stats.hits + stats.misses, stats.loads,
+           stats.evictions, max_resident / 1e6, stats.budget_bytes / 1e6,
+           elapsed);
+    check( max_resident <= stats.budget_bytes,
+           "tiles lookahead %d kept %zu bytes, over the %zu byte budget",
+           lookahead, max_resident, stats.budget_bytes );
+
+    tile_cache_destroy( cache );
+    free( priority );
+    free( keys );
+}
+
+/**
+ *  Look up a tile, reading it into the cache on a miss
+ *  @param[in] cache  The cache
+ *  @param[in] key  The tile
+ */
+static void
+touch_tile(tileCache * const cache, tileKey key) {
+    if(tile_cache_get( cache, key ) == NULL) {
+        tile_cache_want( cache, &key, 1 );
+        tile_cache_wait( cache );
+        tile_cache_update( cache );
+    }
+}
+
+/**
+ *  Check that a three tile cache touched with A, B, C, A, D evicts B, the
+ *  least recently used tile
+ *  @param[in] file  The pyramid, at least four tiles wide
+ */
+static void
+check_tile_lru(pyramid const * const file) {
+    tileCache* const cache = tile_cache_create(file,
+                                               3 * pyramid_tile_bytes(file));
+    tileKey tiles[4];
+    int i;
+    for(i = 0; i < 4; i++) {
+        tiles[i].level = 0;
+        tiles[i].x = i;
+        tiles[i].z = 0;
+    }
+    int const order[] = { 0, 1, 2, 0, 3 };
+    for(i = 0; i < (int) (sizeof(order) / sizeof(*order)); i++) {
+        touch_tile( cache, tiles[order[i]] );
+    }
+
+    for(i = 0; i < 4; i++) {
+        int const resident = tile_cache_peek(cache, tiles[i]) != NULL;
+        check( resident == (i != 1),
+               "tiles LRU tile %c %s after A B C A D", 'A' + i,
+               resident ? "still resident" : "evicted" );
+    }
+    tileCacheStats stats;
+    tile_cache_stats( cache, &stats );
+    check( stats.hits == 1 && stats.misses == 4 && stats.evictions == 1,
+           "tiles LRU counted %zu hits, %zu misses and %zu evictions, "
+           "expected 1, 4 and 1", stats.hits, stats.misses,
+           stats.evictions );
+    tile_cache_destroy( cache );
+}
+
+/**
+ *  Write a pyramid to a temporary file, then page its tiles through a
+ *  cache with a small budget
+ */
+static void
+bench_tiles(benchOptions const * const opts) {
+    GLuint const size = opts->size < TILES_MAX_SIZE ? opts->size
+                                                    : TILES_MAX_SIZE;
+    GLfloat* const row = malloc(size * sizeof(*row));
+    char path[64];
+    snprintf( path, sizeof(path), "/tmp/terrain-bench-%ld%s",
+              (long) getpid(), PYRAMID_EXTENSION );
+    pyramidWriter w;
+    if(!pyramid_writer_open( &w, path, size, size, 30.0f )) {
+        fprintf(stderr, "Unable to create %s\n", path);
+        exit(1);
+    }
+
+    GLfloat const k = 2.0f * M_PI / 512.0f;
+    double const start = now();
+    GLuint x, z;
+    for(z = 0; z < size; z++) {
+        for(x = 0; x < size; x++) {
+            row[x] = 500.0f + 300.0f * sinf(k * x) * cosf(k * 0.7f * z);
+        }
+        pyramid_writer_row( &w, row );
+    }
+    if(!pyramid_writer_close( &w )) {
+        fprintf(stderr, "Unable to write %s\n", path);
+        exit(1);
+    }
+    double const write_time = now() - start;
+    free( row );
+
+    pyramid file;
+    if(!pyramid_open( &file, path )) {
+        fprintf(stderr, "Unable to open %s\n", path);
+        exit(1);
+    }
+    printf("tiles %u x %u  %u levels  write %7.3f s (%.1f MB/s)\n",
+           size, size, file.header.levels, write_time,
+           (double) size * size * sizeof(GLfloat) / 1e6 / write_time);
+
+    if(file.header.level[0].tilesX >= 4) {
+        check_tile_lru( &file );
+    }
+
+    // Room for about three views of 5 x 5 tiles
+    size_t const budget = 80 * pyramid_tile_bytes(&file);
+    walk_tiles( &file, budget, 0 );
+    walk_tiles( &file, budget, 3 );
+
+    pyramid_close( &file );
+    unlink( path );
+}
+
+// Longest token the parse benchmark writes, separator included
+#define PARSE_TOKEN_LENGTH 48
+
+/**
+ *  Append a token and a separator to a text buffer
+ *  @param[in,out] text  The end of the text, advanced past the token
+ *  @param[in] format  The token, printf style
+ */
+static void
+put_token(char ** const text, char const * const format, ...) {
+    va_list args;
+    va_start( args, format );
+    int const length = vsnprintf(*text, PARSE_TOKEN_LENGTH, format, args);
+    va_end( args );
+    if(length < 0 || length >= PARSE_TOKEN_LENGTH - 1) {
+        fprintf(stderr, "Parse token too long\n");
+        exit(1);
+    }
+    *text += length;
+    *(*text)++ = rand() % 8 == 0 ? '\n' : ' ';
+}
+
+/**
+ *  A random float from its bits
+ */
+static GLfloat
+random_float(unsigned int mask) {
+    unsigned int const bits = ((unsigned int) rand() << 16 ^ rand()) & mask;
+    GLfloat f;
+    memcpy( &f, &bits, sizeof(f) );
+    return f;
+}
+
+/**
+ *  Write a decimal with a 15 digit mantissa and an exponent of 22 or -22
+ *  that isn't halfway between two floats but whose nearest double is, so
+ *  rounding it through a double would round it twice
+ *  @param[in,out] text  The end of the text, advanced past the token
+ *  @param[in] negative  Whether to use the negative exponent
+ */
+static void
+put_double_rounding(char ** const text, int negative) {
+    for(;;) {
+        GLfloat const fraction = 1.0f + (GLfloat) rand() / RAND_MAX;
+        GLfloat const f = negative ? ldexpf(fraction, -24 - rand() % 3)
+                                   : ldexpf(fraction, 120 + rand() % 3);
+        double const half = ((double) f + nextafterf(f, INFINITY)) / 2.0;
+        long long const m = llround(negative ? half * 1e22 : half / 1e22);
+        double const value = negative ? m / 1e22 : m * 1e22;
+        if(value == half) {
+            put_token( text, "%llde%d", m, negative ? -22 : 22 );
+            return;
+        }
+    }
+}
+
+/**
+ *  Write the tokens parse_float() finds hardest to round like strtof():
+ *  float halfway points and values just beside them, subnormals, mantissas
+ *  longer than 19 digits, large and small exponents, and signed zeros
+ *  @param[in,out] text  The end of the text, advanced past the tokens
+ *  @param[in] count  The number of tokens of each kind
+ */
+static void
+put_hard_tokens(char ** const text, size_t count) {
+    static char const * const zeros[] = {
+        "0", "-0", "+0", "0.0", "-0.0", ".0", "-.0", "000", "-00.000",
+        "0e10", "-0E-10", "+0.0e+99", "-0.00000000000000000000000000"
+    };
+    static char const * const nudges[] = {
+        ".5", ".5000000001", ".4999999999", "5e-1", "49999999999e-11"
+    };
+    size_t i;
+    for(i = 0; i < count; i++) {
+        // Halfway between two floats a unit apart, and just either side
+        put_token( text, "%u%s", (1u << 23) + rand() % (1 << 23),
+                   nudges[rand() % (sizeof(nudges) / sizeof(*nudges))] );
+        GLfloat const f = 1.0f + rand() % 65535 + (GLfloat) rand() / RAND_MAX;
+        double const half = ((double) f + nextafterf(f, INFINITY)) / 2.0;
+        put_token( text, "%s%.24f%s", rand() % 2 ? "-" : "", half,
+                   rand() % 2 ? "01" : "" );
+        put_double_rounding( text, i % 2 );
+
+        // Subnormals, in full and rounded to a few digits
+        GLfloat const tiny = random_float(0x7FFFFF);
+        put_token( text, "%.9g", tiny );
+        put_token( text, "%.3e", tiny );
+
+        // More digits than the fast path keeps
+        double const d = (double) rand() / RAND_MAX * 1e4;
+        put_token( text, "%.25g", d );
+        put_token( text, "0.%018u%u", rand() % 1000, rand() );
+
+        // Exponents from underflow to overflow
+        int const exponent = rand() % 100 - 55;
+        put_token( text, "%d%c%s%d", rand() % 100000 - 50000,
+                   rand() % 2 ? 'e' : 'E',
+                   exponent >= 0 && rand() % 2 ? "+" : "", exponent );
+
+        put_token( text, "%s", zeros[i % (sizeof(zeros) / sizeof(*zeros))] );
+    }
+}
+
+/**
+ *  Parse a text with parse_float() or with strtof()
+ *  @return The seconds taken
+ */
+static double
+time_parse(char const * const begin, char const * const end, int use_strtof,
+           double * const sum) {
+    double const start = now();
+    double total = 0.0;
+    char const * p = begin;
+    if(use_strtof) {
+        char* next;
+        for(;;) {
+            GLfloat const value = strtof(p, &next);
+            if(next == p || next > end) {
+                break;
+            }
+            total += isfinite(value) ? value : 0.0;
+            p = next;
+        }
+    }else {
+        GLfloat value;
+        while(parse_float(&p, end, &value) == 1) {
+            total += isfinite(value) ? value : 0.0;
+        }
+    }
+    *sum = total;
+    return now() - start;
+}
+
+/**
+ *  Parse elevations and hard cases with parse_float(), check every value
+ *  is bit-identical to strtof(), and compare their speeds
+ */
+static void
+bench_parse(benchOptions const * const opts) {
+    size_t const elevations = (size_t) opts->size * 64;
+    size_t const hard = (size_t) opts->size * 8;
+    char* const text = malloc((elevations + 9 * hard) * PARSE_TOKEN_LENGTH
+                              + 1);
+    if(text == NULL) {
+        fprintf(stderr, "Unable to allocate the parse text\n");
+        exit(1);
+    }
+
+    // Elevations as a DEM writes them
+    srand( 1 );
+    char* end = text;
+    size_t i;
+    for(i = 0; i < elevations; i++) {
+        put_token( &end, "%.*f", rand() % 4,
+                   rand() % 9000 - 500 + (double) rand() / RAND_MAX );
+    }
+    char* const middle = end;
+    put_hard_tokens( &end, hard );
+    *end = '\0';
+
+    size_t tokens = 0;
+    size_t mismatches = 0;
+    char const * first = "";
+    int first_length = 0;
+    char const * p = text;
+    for(;;) {
+        char* next;
+        GLfloat const expected = strtof(p, &next);
+        if(next == p) {
+            break;
+        }
+        GLfloat value;
+        char const * parsed = p;
+        int const found = parse_float(&parsed, end, &value);
+        if(found != 1 || parsed != next
+           || memcmp(&value, &expected, sizeof(value)) != 0) {
+            if(mismatches++ == 0) {
+                first = p + strspn(p, " \n");
+                first_length = next - first;
+            }
+        }
+        tokens++;
+        p = next;
+    }
+    check( mismatches == 0, "parse %zu of %zu values differ from strtof, "
+           "first %.*s", mismatches, tokens, first_length, first );
+
+    char const * const names[] = { "elevations", "hard cases" };
+    char const * const begins[] = { text, middle };
+    char const * const ends[] = { middle, end };
+    for(i = 0; i < 2; i++) {
+        double fast_sum, slow_sum;
+        double const fast = time_parse(begins[i], ends[i], 0, &fast_sum);
+        double const slow = time_parse(begins[i], ends[i], 1, &slow_sum);
+        double const mb = (ends[i] - begins[i]) / 1e6;
+        printf("parse %-10s %6.2f MB  parse_float %7.1f MB/s  strtof "
+               "%7.1f MB/s  [%g %g]\n", names[i], mb, mb / fast, mb / slow,
+               fast_sum, slow_sum);
+    }
+    free( text );
+}
+
+static benchmark const benchmarks[] = {
+    { "grid",    bench_grid },
+    { "compact", bench_compact },
+    { "lod",     bench_lod },
+    { "frustum", bench_frustum },
+    { "rtin",    bench_rtin },
+    { "tiles",   bench_tiles },
+    { "horizon", bench_horizon },
+    { "heightmap", bench_heightmap },
+    { "quantize", bench_quantize },
+    { "vcache",  bench_vcache },
+    { "update",  bench_update },
+    { "parse",   bench_parse }
+};
+
+static void
+usage(char const * const program) {
+    fprintf(stderr, "Usage: %s [ -n SIZE ] [ BENCHMARK ... ]\n", program);
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    benchOptions opts;
+    opts.size = 16384;
+
+    int c;
+    while((c = getopt(argc, argv, "n:")) != -1) {
+        switch(c) {
+            case 'n':
+                opts.size = strtoul(optarg, NULL, 10);
+                if(opts.size < 3) {
+                    usage(argv[0]);
+                }
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    unsigned int const count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+    unsigned int i;
+    if(optind == argc) {
+        for(i = 0; i < count; i++) {
+            benchmarks[i].run( &opts );
+        }
+        return failures > 0;
+    }
+
+    int a;
+    for(a = optind; a < argc; a++) {
+        for(i = 0; i < count; i++) {
+            if(strcmp(argv[a], benchmarks[i].name) == 0) {
+                benchmarks[i].run( &opts );
+                break;
+            }
+        }
+        if(i == count) {
+            fprintf(stderr, "Unknown benchmark: %s\n", argv[a]);
+            usage(argv[0]);
+        }
+    }
+    return failures > 0;
+}
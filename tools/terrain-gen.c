@@ -0,0 +1,613 @@
+/**
+ * terrain-gen.c
+ *
+ * Writes synthetic elevation files in the formats the viewer reads, for
+ * load and scaling tests: its own text format, SRTM .hgt tiles, and .bil
+ * and .flt grids with the .hdr file describing them. Rows are generated
+ * and written in order, so memory use depends on the width of the map but
+ * not on its height.
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+// Side of the diamond-square squares and height of a band, a power of two
+#define TILE_SIZE 256
+
+// Written for samples inside NODATA regions
+#define NODATA_VALUE -9999.0
+
+// Marks voids in SRTM tiles, which have no header to name another value
+#define HGT_NODATA_VALUE -32768
+
+typedef enum {
+    GEN_TEXT,
+    GEN_HGT,            // Square, big-endian int16
+    GEN_BIL,            // Little-endian int16, with a .hdr
+    GEN_FLT             // Little-endian float32, with a .hdr
+} genFormat;
+
+typedef enum {
+    GEN_DIAMOND_SQUARE,
+    GEN_FBM
+} genAlgorithm;
+
+typedef struct {
+    unsigned long width;
+    unsigned long height;
+    double resolution;      // Distance between samples
+    uint64_t seed;
+    genAlgorithm algorithm;
+    double wavelength;      // Largest feature size, in samples, 0 for
+                            // half the longer side of the map
+    unsigned int octaves;
+    double relief;          // Elevation of the highest peaks
+    double sea_level;       // Rough fraction of the map written as
+                            // negative elevations
+    double plateau;         // Rough fraction of the map flattened into
+                            // plateaus at the top of the relief
+    double nodata;          // Rough fraction of the map covered by NODATA
+    genFormat format;
+    char const * path;      // Output file, NULL for stdout
+
+    // Raw heights matching the knobs above, set by calibrate()
+    double raw_range;
+    double raw_sea;
+    double raw_plateau;
+} genOptions;
+
+/**
+ *  Hash a lattice point to a value in [-1, 1]
+ */
+static double
+lattice(uint64_t seed, int64_t x, int64_t z, uint64_t salt) {
+    uint64_t h = seed ^ (salt * 0x9E3779B97F4A7C15ULL);
+    h ^= (uint64_t) x * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 31)) * 0x94D049BB133111EBULL;
+    h ^= (uint64_t) z * 0xD6E8FEB86659FD93ULL;
+    h = (h ^ (h >> 32)) * 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 29;
+    return (h >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
+/**
+ *  Smoothly interpolated value noise
+ */
+static double
+value_noise(uint64_t seed, double x, double z, uint64_t salt) {
+    double const fx = floor(x);
+    double const fz = floor(z);
+    int64_t const ix = (int64_t) fx;
+    int64_t const iz = (int64_t) fz;
+    double const tx = x - fx;
+    double const tz = z - fz;
+    double const sx = tx * tx * (3.0 - 2.0 * tx);
+    double const sz = tz * tz * (3.0 - 2.0 * tz);
+
+    double const a = lattice(seed, ix, iz, salt);
+    double const b = lattice(seed, ix + 1, iz, salt);
+    double const c = lattice(seed, ix, iz + 1, salt);
+    double const d = lattice(seed, ix + 1, iz + 1, salt);
+    double const top = a + (b - a) * sx;
+    double const bottom = c + (d - c) * sx;
+    return top + (bottom - top) * sz;
+}
+
+/**
+ *  Fractional Brownian motion: octaves of value noise, each at twice the
+ *  frequency and half the amplitude of the one before, stopping once the
+ *  wavelength drops below min_wavelength
+ *  @return A value in roughly [-1, 1]
+ */
+static double
+fbm(genOptions const * const opts, double x, double z,
+    double min_wavelength, uint64_t salt) {
+    double sum = 0.0;
+    double amplitude = 0.5;
+    double wavelength = opts->wavelength;
+    unsigned int i;
+    for(i = 0; i < opts->octaves && wavelength >= min_wavelength; i++) {
+        sum += amplitude * value_noise(opts->seed, x / wavelength,
+                                       z / wavelength, salt + i);
+        amplitude *= 0.5;
+        wavelength *= 0.5;
+    }
+    return sum;
+}
+
+/**
+ *  Turn a raw height into the elevation written out, applying the
+ *  plateau, sea level and NODATA knobs
+ */
+static double
+finish_sample(genOptions const * const opts, double h,
+              unsigned long x, unsigned long z) {
+    if(opts->nodata > 0.0) {
+        // Each cell of a coarse lattice is a hole with probability nodata.
+        // Looking the cell up at a jittered position makes the holes
+        // ragged instead of square.
+        double const cell = opts->wavelength / 16.0;
+        double const jx = x + 0.3 * cell * value_noise(opts->seed, x / cell * 4.0,
+                                                       z / cell * 4.0, 1001);
+        double const jz = z + 0.3 * cell * value_noise(opts->seed, x / cell * 4.0,
+                                                       z / cell * 4.0, 1002);
+        double const hole = lattice(opts->seed, (int64_t) floor(jx / cell),
+                                    (int64_t) floor(jz / cell), 1000);
+        if(hole < 2.0 * opts->nodata - 1.0) {
+            return NODATA_VALUE;
+        }
+    }
+
+    if(h > opts->raw_plateau) {
+        h = opts->raw_plateau;
+    }
+    double const elevation = (h - opts->raw_sea) / opts->raw_range 
+                             * opts->relief;
+    return (opts->sea_level == 0.0 && elevation < 0.0) ? 0.0 : elevation;
+}
+
+static int
+compare_doubles(void const * a, void const * b) {
+    double const x = *(double const *) a;
+    double const y = *(double const *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ *  Sample the fBm heights of the map to find the raw heights that cut off
+ *  the requested fractions of sea and plateau. Diamond-square continues
+ *  the same fBm, so its heights follow roughly the same distribution.
+ */
+static void
+calibrate(genOptions * const opts) {
+    size_t const count = 16384;
+    double* const samples = malloc(count * sizeof(*samples));
+    size_t i;
+    for(i = 0; i < count; i++) {
+        double const x = (lattice(opts->seed, i, 0, 2000) + 1.0) / 2.0;
+        double const z = (lattice(opts->seed, i, 1, 2000) + 1.0) / 2.0;
+        samples[i] = fbm(opts, x * (opts->width - 1), z * (opts->height - 1),
+                         1.0, 0);
+    }
+    qsort( samples, count, sizeof(*samples), compare_doubles );
+
+    double const low = samples[0];
+    double const high = samples[count - 1];
+    opts->raw_sea = samples[(size_t) (opts->sea_level * (count - 1))];
+    opts->raw_plateau = samples[(size_t) ((1.0 - opts->plateau) 
+                                          * (count - 1))];
+    opts->raw_range = high > low ? high - low : 1.0;
+    if(opts->plateau == 0.0) {
+        opts->raw_plateau = INFINITY;
+    }
+    free( samples );
+}
+
+/**
+ *  Fill one row of a map with fBm heights
+ */
+static void
+fbm_row(genOptions const * const opts, unsigned long z, double * const row) {
+    unsigned long x;
+    for(x = 0; x < opts->width; x++) {
+        row[x] = fbm(opts, x, z, 1.0, 0);
+    }
+}
+
+/**
+ *  Random displacement of a diamond-square point, seeded by its global
+ *  position so the output only depends on the seed
+ */
+static double
+displacement(genOptions const * const opts, int64_t x, int64_t z,
+             unsigned int step) {
+    return lattice(opts->seed, x, z, 500) * 0.5 * step / opts->wavelength;
+}
+
+/**
+ *  Run diamond-square over a band of TILE_SIZE + 1 rows spanning the
+ *  whole map. The corners of the TILE_SIZE squares come from fBm, and
+ *  diamond-square adds the detail. Every band after the first starts from
+ *  the last row of the band before it, so bands join without seams.
+ *  @param[in,out] band  The band, pitch values per row
+ *  @param[in] pitch  Values per row of the band
+ *  @param[in] z0  Global row of the top of the band
+ */
+static void
+diamond_square_band(genOptions const * const opts, double * const band,
+                    size_t pitch, unsigned long z0) {
+    size_t x, z;
+    int const top_known = (z0 > 0);
+    if(z0 > 0) {
+        memcpy( band, band + TILE_SIZE * pitch, pitch * sizeof(*band) );
+    }
+    for(z = top_known ? TILE_SIZE : 0; z <= TILE_SIZE; z += TILE_SIZE) {
+        for(x = 0; x < pitch; x += TILE_SIZE) {
+            band[z * pitch + x] = fbm(opts, x, z0 + z, TILE_SIZE, 0);
+        }
+    }
+
+    unsigned int step;
+    for(step = TILE_SIZE; step > 1; step /= 2) {
+        unsigned int const half = step / 2;
+
+        // Square step: the centre of every square
+        for(z = half; z < TILE_SIZE; z += step) {
+            for(x = half; x < pitch; x += step) {
+                double const sum = band[(z - half) * pitch + x - half]
+                                   + band[(z - half) * pitch + x + half]
+                                   + band[(z + half) * pitch + x - half]
+                                   + band[(z + half) * pitch + x + half];
+                band[z * pitch + x] = sum / 4.0
+                    + displacement(opts, x, z0 + z, step);
+            }
+        }
+
+        // Diamond step: the midpoint of every edge, averaging the
+        // neighbours that are inside the band
+        for(z = top_known ? half : 0; z <= TILE_SIZE; z += half) {
+            for(x = (z / half) % 2 == 0 ? half : 0; x < pitch; x += step) {
+                double sum = 0.0;
+                unsigned int n = 0;
+                if(x >= half) {
+                    sum += band[z * pitch + x - half];
+                    n++;
+                }
+                if(x + half < pitch) {
+                    sum += band[z * pitch + x + half];
+                    n++;
+                }
+                if(z >= half) {
+                    sum += band[(z - half) * pitch + x];
+                    n++;
+                }
+                if(z + half <= TILE_SIZE) {
+                    sum += band[(z + half) * pitch + x];
+                    n++;
+                }
+                band[z * pitch + x] = sum / n
+                    + displacement(opts, x, z0 + z, step);
+            }
+        }
+    }
+}
+
+/**
+ *  Append a number with two decimals to a buffer, which is much faster
+ *  than printf for billions of samples
+ *  @return The end of the number
+ */
+static char*
+format_elevation(char* p, double value) {
+    long long hundredths = llround(value * 100.0);
+    if(hundredths < 0) {
+        *p++ = '-';
+        hundredths = -hundredths;
+    }
+
+    char digits[24];
+    int n = 0;
+    long long whole = hundredths / 100;
+    do {
+        digits[n++] = '0' + whole % 10;
+        whole /= 10;
+    } while(whole > 0);
+    while(n > 0) {
+        *p++ = digits[--n];
+    }
+
+    int const fraction = hundredths % 100;
+    if(fraction != 0) {
+        *p++ = '.';
+        *p++ = '0' + fraction / 10;
+        if(fraction % 10 != 0) {
+            *p++ = '0' + fraction % 10;
+        }
+    }
+    return p;
+}
+
+/**
+ *  Round an elevation to a 16 bit sample
+ */
+static int
+int16_sample(double value) {
+    long const rounded = lround(value);
+    return rounded < -32767 ? -32767 : (rounded > 32767 ? 32767 : rounded);
+}
+
+/**
+ *  Write one row of raw heights in the output format: a line of
+ *  elevations, or binary samples
+ */
+static void
+write_row(genOptions const * const opts, FILE* const out,
+          double const * const row, unsigned long z, char * const buffer) {
+    char* p = buffer;
+    unsigned long x;
+    for(x = 0; x < opts->width; x++) {
+        double const value = finish_sample(opts, row[x], x, z);
+        if(opts->format == GEN_TEXT) {
+            if(x > 0) {
+                *p++ = ' ';
+            }
+            p = format_elevation(p, value);
+        }else if(opts->format == GEN_FLT) {
+            float const f = value;
+            uint32_t bits;
+            memcpy( &bits, &f, sizeof(bits) );
+            *p++ = bits & 0xFF;
+            *p++ = (bits >> 8) & 0xFF;
+            *p++ = (bits >> 16) & 0xFF;
+            *p++ = bits >> 24;
+        }else {
+            int const sample = value == NODATA_VALUE
+                               && opts->format == GEN_HGT
+                               ? HGT_NODATA_VALUE : int16_sample(value);
+            uint16_t const bits = (uint16_t) sample;
+            if(opts->format == GEN_HGT) {
+                *p++ = bits >> 8;
+                *p++ = bits & 0xFF;
+            }else {
+                *p++ = bits & 0xFF;
+                *p++ = bits >> 8;
+            }
+        }
+    }
+    if(opts->format == GEN_TEXT) {
+        *p++ = '\n';
+    }
+
+    size_t const length = p - buffer;
+    if(fwrite(buffer, 1, length, out) != length) {
+        perror("Unable to write elevation data");
+        exit(1);
+    }
+}
+
+/**
+ *  The extension the viewer recognizes a format by
+ */
+static char const *
+format_extension(genFormat format) {
+    static char const * const extensions[] = { NULL, ".hgt", ".bil", ".flt" };
+    return extensions[format];
+}
+
+/**
+ *  Write the .hdr file the viewer reads next to a .bil or .flt grid
+ */
+static void
+write_sidecar(genOptions const * const opts) {
+    char const * const dot = strrchr(opts->path, '.');
+    size_t const stem = dot - opts->path;
+    char* const name = malloc(stem + sizeof(".hdr"));
+    if(name == NULL) {
+        fprintf(stderr, "Unable to allocate the header path\n");
+        exit(1);
+    }
+    memcpy( name, opts->path, stem );
+    strcpy( name + stem, ".hdr" );
+    FILE* const out = fopen(name, "w");
+    if(out == NULL) {
+        fprintf(stderr, "Unable to open %s\n", name);
+        exit(1);
+    }
+    if(opts->format == GEN_BIL) {
+        fprintf(out, "BYTEORDER I\nLAYOUT BIL\nNROWS %lu\nNCOLS %lu\n"
+                     "NBANDS 1\nNBITS 16\nPIXELTYPE SIGNEDINT\nXDIM %g\n"
+                     "NODATA %g\n", opts->height, opts->width,
+                opts->resolution, NODATA_VALUE);
+    }else {
+        fprintf(out, "ncols %lu\nnrows %lu\ncellsize %g\nNODATA_value %g\n"
+                     "byteorder LSBFIRST\n", opts->width, opts->height,
+                opts->resolution, NODATA_VALUE);
+    }
+    if(fclose(out) != 0) {
+        fprintf(stderr, "Unable to write %s\n", name);
+        exit(1);
+    }
+    free( name );
+}
+
+static void
+generate(genOptions const * const opts, FILE* const out) {
+    // Room for the longest elevation and a separator per sample
+    char* const buffer = malloc(opts->width * 24 + 2);
+
+    if(opts->format == GEN_TEXT) {
+        fprintf(out, "%lu\n%lu\n%g\n", opts->width, opts->height,
+                opts->resolution);
+    }
+
+    unsigned long z;
+    if(opts->algorithm == GEN_FBM) {
+        double* const row = malloc(opts->width * sizeof(*row));
+        for(z = 0; z < opts->height; z++) {
+            fbm_row( opts, z, row );
+            write_row( opts, out, row, z, buffer );
+        }
+        free( row );
+    }else {
+        // One band at a time, TILE_SIZE + 1 rows deep
+        unsigned long const tiles = (opts->width + TILE_SIZE - 1) / TILE_SIZE;
+        size_t const pitch = tiles * TILE_SIZE + 1;
+        double* const band = malloc((TILE_SIZE + 1) * pitch * sizeof(*band));
+
+        unsigned long z0;
+        for(z0 = 0; z0 < opts->height; z0 += TILE_SIZE) {
+            diamond_square_band( opts, band, pitch, z0 );
+            for(z = z0; z < z0 + TILE_SIZE && z < opts->height; z++) {
+                write_row( opts, out, band + (z - z0) * pitch, z, buffer );
+            }
+        }
+        free( band );
+    }
+
+    free( buffer );
+}
+
+static void
+usage(char const * const program) {
+    fprintf(stderr,
+            "Usage: %s [ -n WIDTH[xHEIGHT] ] [ -r RESOLUTION ] [ -s SEED ]\n"
+            "          [ -a ds|fbm ] [ -l WAVELENGTH ] [ -O OCTAVES ]\n"
+            "          [ -m RELIEF ] [ -z SEA_LEVEL ] [ -p PLATEAU ]\n"
+            "          [ -d NODATA ] [ -f txt|hgt|bil|flt ] [ -o FILE ]\n",
+            program);
+    exit(1);
+}
+
+/**
+ *  Parse a fraction in [0, 1]
+ */
+static double
+parse_fraction(char const * const program, char const * const arg) {
+    char* end;
+    double const value = strtod(arg, &end);
+    if(*end != '\0' || value < 0.0 || value > 1.0) {
+        usage(program);
+    }
+    return value;
+}
+
+int main(int argc, char* argv[]) {
+    genOptions opts;
+    opts.width = 1024;
+    opts.height = 1024;
+    opts.resolution = 30.0;
+    opts.seed = 1;
+    opts.algorithm = GEN_DIAMOND_SQUARE;
+    opts.wavelength = 0.0;
+    opts.octaves = 16;
+    opts.relief = 2000.0;
+    opts.sea_level = 0.0;
+    opts.plateau = 0.0;
+    opts.nodata = 0.0;
+    opts.format = GEN_TEXT;
+    opts.path = NULL;
+
+    int c;
+    char* end;
+    while((c = getopt(argc, argv, "n:r:s:a:l:O:m:z:p:d:f:o:")) != -1) {
+        switch(c) {
+            case 'n':
+                opts.width = strtoul(optarg, &end, 10);
+                opts.height = opts.width;
+                if(*end == 'x') {
+                    opts.height = strtoul(end + 1, &end, 10);
+                }
+                if(*end != '\0' || opts.width < 2 || opts.height < 2) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'r':
+                opts.resolution = strtod(optarg, NULL);
+                if(opts.resolution <= 0.0) {
+                    usage(argv[0]);
+                }
+                break;
+            case 's':
+                opts.seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'a':
+                if(strcmp(optarg, "ds") == 0) {
+                    opts.algorithm = GEN_DIAMOND_SQUARE;
+                }else if(strcmp(optarg, "fbm") == 0) {
+                    opts.algorithm = GEN_FBM;
+                }else {
+                    usage(argv[0]);
+                }
+                break;
+            case 'l':
+                opts.wavelength = strtod(optarg, NULL);
+                if(opts.wavelength < 1.0) {
+                    usage(argv[0]);
+                }
+                break;
+            case 'O':
+                opts.octaves = strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                opts.relief = strtod(optarg, NULL);
+                break;
+            case 'z':
+                opts.sea_level = parse_fraction(argv[0], optarg);
+                break;
+            case 'p':
+                opts.plateau = parse_fraction(argv[0], optarg);
+                break;
+            case 'd':
+                opts.nodata = parse_fraction(argv[0], optarg);
+                break;
+            case 'f':
+                if(strcmp(optarg, "txt") == 0) {
+                    opts.format = GEN_TEXT;
+                }else if(strcmp(optarg, "hgt") == 0) {
+                    opts.format = GEN_HGT;
+                }else if(strcmp(optarg, "bil") == 0) {
+                    opts.format = GEN_BIL;
+                }else if(strcmp(optarg, "flt") == 0) {
+                    opts.format = GEN_FLT;
+                }else {
+                    usage(argv[0]);
+                }
+                break;
+            case 'o':
+                opts.path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if(optind != argc) {
+        usage(argv[0]);
+    }
+
+    // The viewer tells binary formats apart by their extension
+    if(opts.format != GEN_TEXT) {
+        char const * const extension = format_extension(opts.format);
+        char const * const dot = opts.path != NULL ? strrchr(opts.path, '.')
+                                                   : NULL;
+        if(dot == NULL || strchr(dot, '/') != NULL
+           || strcasecmp(dot, extension) != 0) {
+            fprintf(stderr, "-f %s needs -o FILE%s\n", extension + 1,
+                    extension);
+            exit(1);
+        }
+    }
+    if(opts.format == GEN_HGT && opts.width != opts.height) {
+        fprintf(stderr, "-f hgt needs a square map\n");
+        exit(1);
+    }
+    if(opts.wavelength == 0.0) {
+        unsigned long const longest = opts.width > opts.height ? opts.width 
+                                                               : opts.height;
+        opts.wavelength = longest / 2.0;
+    }
+    calibrate( &opts );
+
+    FILE* out = stdout;
+    if(opts.path != NULL) {
+        out = fopen(opts.path, opts.format == GEN_TEXT ? "w" : "wb");
+        if(out == NULL) {
+            fprintf(stderr, "Unable to open %s\n", opts.path);
+            exit(1);
+        }
+    }
+
+    generate( &opts, out );
+    if(opts.format == GEN_BIL || opts.format == GEN_FLT) {
+        write_sidecar( &opts );
+    }
+
+    if(fclose(out) != 0) {
+        perror("Unable to write elevation data");
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,163 @@
+/**
+ * terrain-tile.c
+ *
+ * Converts an elevation file into a tile pyramid (.tvp) that the viewer
+ * streams instead of loading. The input is read through a fixed buffer and
+ * the pyramid written one row at a time, so maps far larger than memory
+ * can be converted.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "parse.h"
+#include "pyramid.h"
+
+#define READ_BUFFER_SIZE (1 << 20)
+
+// Refill the buffer when fewer bytes than the longest number are left
+#define READ_MARGIN 128
+
+typedef struct {
+    FILE* in;
+    char* buffer;
+    char const * p;
+    char const * end;
+    size_t offset;          // Of the start of the buffer in the input
+    int eof;
+} inputBuffer;
+
+/**
+ *  Move what is left to the front of the buffer and read more behind it
+ */
+static void
+refill(inputBuffer * const b) {
+    size_t const left = b->end - b->p;
+    b->offset += b->p - b->buffer;
+    memmove( b->buffer, b->p, left );
+    size_t const got = fread(b->buffer + left, 1, READ_BUFFER_SIZE - left,
+                             b->in);
+    b->eof = (got == 0);
+    b->p = b->buffer;
+    b->end = b->buffer + left + got;
+}
+
+static void
+ensure_margin(inputBuffer * const b) {
+    while(!b->eof && b->end - b->p < READ_MARGIN) {
+        refill( b );
+    }
+}
+
+static void
+usage(char const * const program) {
+    fprintf(stderr, "Usage: %s [ -o PYRAMID%s ] [ FILE ]\n", program,
+            PYRAMID_EXTENSION);
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    char const * out_path = NULL;
+    int c;
+    while((c = getopt(argc, argv, "o:")) != -1) {
+        switch(c) {
+            case 'o':
+                out_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if(optind + 1 < argc || (optind == argc && out_path == NULL)) {
+        usage(argv[0]);
+    }
+
+    inputBuffer b;
+    b.in = stdin;
+    char* default_path = NULL;
+    if(optind < argc) {
+        b.in = fopen(argv[optind], "r");
+        if(b.in == NULL) {
+            fprintf(stderr, "Unable to open file: %s\n", argv[optind]);
+            exit(1);
+        }
+        if(out_path == NULL) {
+            default_path = malloc(strlen(argv[optind])
+                                  + sizeof(PYRAMID_EXTENSION));
+            sprintf( default_path, "%s%s", argv[optind], PYRAMID_EXTENSION );
+            out_path = default_path;
+        }
+    }
+    b.buffer = malloc(READ_BUFFER_SIZE);
+    b.p = b.end = b.buffer;
+    b.offset = 0;
+    b.eof = 0;
+
+    struct timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+
+    GLuint width, height;
+    GLfloat resolution;
+    ensure_margin( &b );
+    if(!parse_uint( &b.p, b.end, &width )
+       || !parse_uint( &b.p, b.end, &height )
+       || parse_float( &b.p, b.end, &resolution ) != 1) {
+        fprintf(stderr, "Invalid elevation file header\n");
+        exit(1);
+    }
+    if(width < 2 || height < 2) {
+        fprintf(stderr, "Elevation data must be at least 2 x 2 samples\n");
+        exit(1);
+    }
+
+    pyramidWriter w;
+    if(!pyramid_writer_open( &w, out_path, width, height, resolution )) {
+        fprintf(stderr, "Unable to create %s\n", out_path);
+        exit(1);
+    }
+
+    // Like the viewer, negative elevations are stored as 0
+    GLfloat* const row = malloc(width * sizeof(*row));
+    GLuint x, z;
+    for(z = 0; z < height; z++) {
+        for(x = 0; x < width; x++) {
+            ensure_margin( &b );
+            int const result = parse_float(&b.p, b.end, &row[x]);
+            if(result != 1) {
+                if(result == 0) {
+                    fprintf(stderr, "Expected %zu elevation values, "
+                            "found %zu\n", (size_t) width * height,
+                            (size_t) z * width + x);
+                }else {
+                    fprintf(stderr, "Invalid elevation value at byte %zu\n",
+                            b.offset + (size_t) (b.p - b.buffer));
+                }
+                pyramid_writer_close( &w );
+                exit(1);
+            }
+            row[x] = row[x] > 0.0f ? row[x] : 0.0f;
+        }
+        pyramid_writer_row( &w, row );
+    }
+
+    pyramidHeader const header = w.header;
+    if(!pyramid_writer_close( &w )) {
+        fprintf(stderr, "Unable to write %s\n", out_path);
+        exit(1);
+    }
+
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    printf("Wrote %s: %u x %u samples, %u levels, %.3f s\n", out_path,
+           width, height, header.levels,
+           (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9);
+
+    free( row );
+    free( b.buffer );
+    free( default_path );
+    if(b.in != stdin) {
+        fclose( b.in );
+    }
+    return 0;
+}